@@ -0,0 +1,440 @@
+#include "AsyncFileReader.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			using namespace collections;
+
+/***********************************************************************
+UringFileReader
+***********************************************************************/
+
+			/*
+			 * io_uring is used by raw syscalls, so that liburing is not required.
+			 * Submitting threads fill the submission queue under a lock,
+			 * a background thread waits for completions and calls OnCompleted.
+			 * A NOP with user_data 0 stops the background thread.
+			 * If waiting for completions fails, submitted requests are completed with the error, and no request is submitted anymore.
+			 */
+			class UringFileReader : public AsyncFileReader
+			{
+				static const vint			CompletionBatchSize = 64;
+				static const vint			MaxStopRetryCount = 1000;
+			private:
+				int							ringDescriptor = -1;
+				void*						ringAddress = MAP_FAILED;
+				vuint64_t					ringSize = 0;
+				io_uring_sqe*				sqes = (io_uring_sqe*)MAP_FAILED;
+				vuint64_t					sqesSize = 0;
+
+				unsigned*					sqTail = nullptr;
+				unsigned*					sqMask = nullptr;
+				unsigned*					sqArray = nullptr;
+				unsigned*					cqHead = nullptr;
+				unsigned*					cqTail = nullptr;
+				unsigned*					cqMask = nullptr;
+				io_uring_cqe*				cqes = nullptr;
+
+				CriticalSection				submitLock;
+				ConditionVariable			submitCondition;
+				vint						capacity = 0;
+				volatile vint				inflight = 0;
+				SortedList<AsyncReadRequest*>	submittedRequests;
+				bool						failed = false;
+				EventObject					stoppedEvent;
+
+				bool SubmitUnsafe(vuint8_t opcode, AsyncReadRequest* request)
+				{
+					while (inflight >= capacity && !failed)
+					{
+						submitCondition.SleepWith(submitLock);
+					}
+					if (failed) return false;
+
+					unsigned tail = *sqTail;
+					unsigned index = tail & *sqMask;
+					auto sqe = &sqes[index];
+					memset(sqe, 0, sizeof(*sqe));
+					sqe->opcode = opcode;
+					if (request)
+					{
+						sqe->fd = request->fileDescriptor;
+						sqe->addr = (vuint64_t)request->buffer + request->readSize;
+						sqe->len = (vuint32_t)(request->size - request->readSize);
+						sqe->off = request->offset + request->readSize;
+					}
+					sqe->user_data = (vuint64_t)request;
+					sqArray[index] = index;
+					__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+					int submitted = 0;
+					do
+					{
+						submitted = (int)syscall(__NR_io_uring_enter, ringDescriptor, 1, 0, 0, nullptr, 0);
+					} while (submitted == -1 && errno == EINTR);
+
+					if (submitted != 1)
+					{
+						// the entry is still in the queue, take it back
+						__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+						return false;
+					}
+					inflight++;
+					if (request)
+					{
+						submittedRequests.Add(request);
+					}
+					return true;
+				}
+
+				void FailSubmittedRequests(int error)
+				{
+					List<AsyncReadRequest*> requests;
+					CS_LOCK(submitLock)
+					{
+						failed = true;
+						CopyFrom(requests, submittedRequests);
+						submittedRequests.Clear();
+						inflight = 0;
+						submitCondition.WakeAllPendings();
+					}
+
+					FOREACH(AsyncReadRequest*, request, requests)
+					{
+						request->result = -error;
+						request->OnCompleted();
+					}
+				}
+
+				void RunCompletion()
+				{
+					bool stopping = false;
+					while (!stopping || inflight > 0)
+					{
+						int waited = (int)syscall(__NR_io_uring_enter, ringDescriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+						if (waited == -1 && errno != EINTR)
+						{
+							FailSubmittedRequests(errno);
+							break;
+						}
+
+						AsyncReadRequest* requests[CompletionBatchSize];
+						AsyncReadRequest* continuingRequests[CompletionBatchSize];
+						vint count = 0;
+						vint continuingCount = 0;
+						vint completed = 0;
+						unsigned head = *cqHead;
+						unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+						while (head != tail && count + continuingCount < CompletionBatchSize)
+						{
+							auto cqe = &cqes[head & *cqMask];
+							auto request = (AsyncReadRequest*)cqe->user_data;
+							if (request)
+							{
+								if (cqe->res > 0 && request->readSize + cqe->res < request->size)
+								{
+									// a short read before the end of the file continues with the rest
+									request->readSize += cqe->res;
+									continuingRequests[continuingCount++] = request;
+								}
+								else
+								{
+									request->result = cqe->res < 0 ? cqe->res : (vint64_t)request->readSize + cqe->res;
+									requests[count++] = request;
+								}
+							}
+							else
+							{
+								stopping = true;
+							}
+							completed++;
+							head++;
+						}
+						__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+						// completed entries leave the queue before callbacks, so that callbacks could submit new requests
+						CS_LOCK(submitLock)
+						{
+							inflight -= completed;
+							for (vint i = 0; i < count; i++)
+							{
+								submittedRequests.Remove(requests[i]);
+							}
+
+							// slots of completed entries are still free because the lock is not released
+							for (vint i = 0; i < continuingCount; i++)
+							{
+								auto request = continuingRequests[i];
+								submittedRequests.Remove(request);
+								if (!SubmitUnsafe(IORING_OP_READ, request))
+								{
+									request->result = -EIO;
+									requests[count++] = request;
+								}
+							}
+							submitCondition.WakeAllPendings();
+						}
+
+						for (vint i = 0; i < count; i++)
+						{
+							requests[i]->OnCompleted();
+						}
+					}
+				}
+			public:
+				UringFileReader()
+				{
+					stoppedEvent.CreateManualUnsignal(false);
+				}
+
+				~UringFileReader()
+				{
+					if (capacity > 0)
+					{
+						// the background thread stops by itself only when waiting for completions fails
+						for (vint i = 0; ; i++)
+						{
+							bool stopping = false;
+							CS_LOCK(submitLock)
+							{
+								stopping = SubmitUnsafe(IORING_OP_NOP, nullptr) || failed;
+							}
+							if (stopping) break;
+							CHECK_ERROR(i < MaxStopRetryCount, L"vl::database::buffer_internal::UringFileReader::~UringFileReader()#Internal error: Failed to stop the completion thread.");
+							Thread::Sleep(1);
+						}
+						stoppedEvent.Wait();
+					}
+					if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+					if (ringAddress != MAP_FAILED) munmap(ringAddress, ringSize);
+					if (ringDescriptor != -1) close(ringDescriptor);
+				}
+
+				bool Initialize(vint queueDepth)
+				{
+					io_uring_params params;
+					memset(&params, 0, sizeof(params));
+					ringDescriptor = (int)syscall(__NR_io_uring_setup, (unsigned)queueDepth, &params);
+					if (ringDescriptor == -1)
+					{
+						return false;
+					}
+
+					// IORING_OP_READ requires Linux 5.6, IORING_FEAT_FAST_POLL comes with 5.7
+					if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_FAST_POLL))
+					{
+						return false;
+					}
+
+					vuint64_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+					vuint64_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+					ringSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+					ringAddress = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQ_RING);
+					if (ringAddress == MAP_FAILED)
+					{
+						return false;
+					}
+
+					sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+					sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQES);
+					if (sqes == MAP_FAILED)
+					{
+						return false;
+					}
+
+					auto ring = (char*)ringAddress;
+					sqTail = (unsigned*)(ring + params.sq_off.tail);
+					sqMask = (unsigned*)(ring + params.sq_off.ring_mask);
+					sqArray = (unsigned*)(ring + params.sq_off.array);
+					cqHead = (unsigned*)(ring + params.cq_off.head);
+					cqTail = (unsigned*)(ring + params.cq_off.tail);
+					cqMask = (unsigned*)(ring + params.cq_off.ring_mask);
+					cqes = (io_uring_cqe*)(ring + params.cq_off.cqes);
+
+					// at most sq_entries requests are in flight, so the completion queue never overflows
+					capacity = params.sq_entries;
+
+					// a thread still touches itself after Wait() returns, so it deletes itself and reports stopping by an event
+					Thread::CreateAndStart([this]()
+					{
+						RunCompletion();
+						stoppedEvent.Signal();
+					}, true);
+					return true;
+				}
+
+				bool Submit(AsyncReadRequest* request)override
+				{
+					bool submitted = false;
+					request->readSize = 0;
+					CS_LOCK(submitLock)
+					{
+						submitted = SubmitUnsafe(IORING_OP_READ, request);
+					}
+					return submitted;
+				}
+
+				bool IsKernelQueue()override
+				{
+					return true;
+				}
+			};
+
+/***********************************************************************
+ThreadPoolFileReader
+***********************************************************************/
+
+			/*
+			 * Each thread takes the first queued request and performs it by pread.
+			 */
+			class ThreadPoolFileReader : public AsyncFileReader
+			{
+			private:
+				CriticalSection				lock;
+				ConditionVariable			condition;
+				AsyncReadRequest*			firstRequest = nullptr;
+				AsyncReadRequest*			lastRequest = nullptr;
+				vint						runningThreads = 0;
+				bool						stopping = false;
+				EventObject					stoppedEvent;
+
+				void RunWorker()
+				{
+					lock.Enter();
+					while (true)
+					{
+						while (!firstRequest && !stopping)
+						{
+							condition.SleepWith(lock);
+						}
+						if (!firstRequest)
+						{
+							break;
+						}
+
+						auto request = firstRequest;
+						firstRequest = request->nextRequest;
+						if (!firstRequest) lastRequest = nullptr;
+						request->nextRequest = nullptr;
+						lock.Leave();
+
+						request->result = ReadFileFully(request->fileDescriptor, request->buffer, request->size, request->offset);
+						request->OnCompleted();
+
+						lock.Enter();
+					}
+
+					bool last = --runningThreads == 0;
+					lock.Leave();
+					if (last)
+					{
+						stoppedEvent.Signal();
+					}
+				}
+			public:
+				ThreadPoolFileReader(vint threadCount)
+				{
+					stoppedEvent.CreateManualUnsignal(false);
+					runningThreads = threadCount;
+					for (vint i = 0; i < threadCount; i++)
+					{
+						Thread::CreateAndStart([this]()
+						{
+							RunWorker();
+						}, true);
+					}
+				}
+
+				~ThreadPoolFileReader()
+				{
+					// queued requests are still performed before threads stop
+					CS_LOCK(lock)
+					{
+						stopping = true;
+						condition.WakeAllPendings();
+					}
+					stoppedEvent.Wait();
+				}
+
+				bool Submit(AsyncReadRequest* request)override
+				{
+					CS_LOCK(lock)
+					{
+						if (stopping) return false;
+						if (lastRequest)
+						{
+							lastRequest->nextRequest = request;
+						}
+						else
+						{
+							firstRequest = request;
+						}
+						lastRequest = request;
+						condition.WakeOnePending();
+					}
+					return true;
+				}
+
+				bool IsKernelQueue()override
+				{
+					return false;
+				}
+			};
+
+/***********************************************************************
+Functions
+***********************************************************************/
+
+			vint64_t ReadFileFully(int fileDescriptor, void* buffer, vuint64_t size, vuint64_t offset)
+			{
+				vuint64_t readSize = 0;
+				while (readSize < size)
+				{
+					auto read = pread(fileDescriptor, (char*)buffer + readSize, size - readSize, offset + readSize);
+					if (read == -1)
+					{
+						if (errno == EINTR) continue;
+						return -errno;
+					}
+					if (read == 0) break;
+					readSize += read;
+				}
+				return readSize;
+			}
+
+			AsyncFileReader* CreateUringFileReader(vint queueDepth)
+			{
+				auto reader = new UringFileReader;
+				if (!reader->Initialize(queueDepth))
+				{
+					delete reader;
+					return nullptr;
+				}
+				return reader;
+			}
+
+			AsyncFileReader* CreateThreadPoolFileReader(vint threadCount)
+			{
+				return new ThreadPoolFileReader(threadCount);
+			}
+
+			AsyncFileReader* CreateAsyncFileReader(vint queueDepth)
+			{
+				if (auto reader = CreateUringFileReader(queueDepth))
+				{
+					return reader;
+				}
+				return CreateThreadPoolFileReader(queueDepth);
+			}
+		}
+	}
+}
@@ -0,0 +1,71 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_ASYNCFILEREADER
+#define VCZH_DATABASE_UTILITY_ASYNCFILEREADER
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * A read submitted to an AsyncFileReader.
+			 * OnCompleted is called in a background thread of the reader,
+			 * result is the number of bytes read, or a negative errno when the read fails.
+			 * A read shorter than size is continued by the reader, so result is less than size only at the end of the file.
+			 * OnCompleted is allowed to submit new requests, and to delete the request.
+			 */
+			class AsyncReadRequest
+			{
+				friend class UringFileReader;
+				friend class ThreadPoolFileReader;
+			private:
+				AsyncReadRequest*			nextRequest = nullptr;
+				vuint64_t					readSize = 0;
+			public:
+				int							fileDescriptor = -1;
+				void*						buffer = nullptr;
+				vuint64_t					size = 0;
+				vuint64_t					offset = 0;
+				vint64_t					result = 0;
+
+				virtual ~AsyncReadRequest() = default;
+				virtual void				OnCompleted() = 0;
+			};
+
+			/*
+			 * Keeps many reads in flight for threads that do not want to block on each of them.
+			 * Destroying a reader waits until all submitted requests are completed.
+			 */
+			class AsyncFileReader : public Object, public NotCopyable
+			{
+			public:
+				// Returns false if the request is not submitted, OnCompleted will not be called in this case
+				virtual bool				Submit(AsyncReadRequest* request) = 0;
+
+				// Returns true if reads are queued in the kernel by io_uring, instead of being performed by threads calling pread
+				virtual bool				IsKernelQueue() = 0;
+			};
+
+			// Calls pread until size bytes are read or the end of the file is reached, returns the number of bytes read or a negative errno
+			extern vint64_t					ReadFileFully(int fileDescriptor, void* buffer, vuint64_t size, vuint64_t offset);
+
+			// Returns nullptr if io_uring is not supported by the kernel or is disabled
+			extern AsyncFileReader*			CreateUringFileReader(vint queueDepth);
+			extern AsyncFileReader*			CreateThreadPoolFileReader(vint threadCount);
+
+			// Creates an io_uring reader, or a thread pool of the same concurrency when io_uring is unavailable
+			extern AsyncFileReader*			CreateAsyncFileReader(vint queueDepth);
+		}
+	}
+}
+
+#endif
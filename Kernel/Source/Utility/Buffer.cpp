@@ -1,6 +1,12 @@
 #include "Buffer.h"
 #include "FileBuffer.h"
 #include "InMemoryBuffer.h"
+#include "ReplacementPolicy.h"
+#include "FramePool.h"
+#include "BufferMetrics.h"
+#include "AsyncFileReader.h"
+#include "PageChecksum.h"
+#include "DirtyPageTable.h"
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
@@ -10,6 +16,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
+#include <sched.h>
 
 namespace vl
 {
@@ -17,156 +24,1124 @@ namespace vl
 	{
 		using namespace collections;
 
+		vuint64_t GetBufferAccessTime()
+		{
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (vuint64_t)ts.tv_sec * 1000000000 + (vuint64_t)ts.tv_nsec;
+		}
+
+		static volatile vuint64_t bufferLsn = 0;
+
+		vuint64_t NextBufferLsn()
+		{
+			return __sync_add_and_fetch(&bufferLsn, 1);
+		}
+
+		vuint64_t GetBufferLsn()
+		{
+			return __atomic_load_n(&bufferLsn, __ATOMIC_ACQUIRE);
+		}
+
+		void AdvanceBufferLsn(vuint64_t lsn)
+		{
+			vuint64_t current = GetBufferLsn();
+			while (current < lsn && !__atomic_compare_exchange_n(&bufferLsn, &current, lsn, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		}
+
+/***********************************************************************
+BufferManager::SourceReader
+***********************************************************************/
+
+		BufferManager::SourceReader::SourceReader(BufferManager* bm, BufferSource _source)
+			:slot(&bm->readerSlots[buffer_internal::GetBufferThreadIndex() % ReaderSlotCount])
+			,source(nullptr)
+		{
+			INCRC(&slot->readers);
+			source = bm->GetSourceUnsafe(_source);
+		}
+
+		BufferManager::SourceReader::~SourceReader()
+		{
+			DECRC(&slot->readers);
+		}
+
+/***********************************************************************
+PageHandle
+***********************************************************************/
+
+		void PageHandle::MoveFrom(PageHandle& handle)
+		{
+			bm = handle.bm;
+			source = handle.source;
+			page = handle.page;
+			pageDesc = handle.pageDesc;
+			pageSize = handle.pageSize;
+			latch = handle.latch;
+			persistanceType = handle.persistanceType;
+
+			handle.bm = nullptr;
+			handle.source = nullptr;
+			handle.page = BufferPage::Invalid();
+			handle.pageDesc = nullptr;
+		}
+
+		PageHandle::PageHandle()
+		{
+		}
+
+		PageHandle::PageHandle(PageHandle&& handle)
+		{
+			MoveFrom(handle);
+		}
+
+		PageHandle::~PageHandle()
+		{
+			Release();
+		}
+
+		PageHandle& PageHandle::operator=(PageHandle&& handle)
+		{
+			if (this != &handle)
+			{
+				Release();
+				MoveFrom(handle);
+			}
+			return *this;
+		}
+
+		bool PageHandle::IsValid()const
+		{
+			return pageDesc != nullptr;
+		}
+
+		BufferPage PageHandle::GetPage()const
+		{
+			return page;
+		}
+
+		PageLatch PageHandle::GetLatch()const
+		{
+			return latch;
+		}
+
+		void* PageHandle::GetAddress()const
+		{
+			return pageDesc ? pageDesc->address : nullptr;
+		}
+
+		bool PageHandle::SetPersistanceType(PersistanceType type)
+		{
+			if (!pageDesc) return false;
+			if (latch == PageLatch::Shared && type != PersistanceType::NoChanging) return false;
+			persistanceType = type;
+			return true;
+		}
+
+		PersistanceType PageHandle::GetPersistanceType()const
+		{
+			return persistanceType;
+		}
+
+		bool PageHandle::Release()
+		{
+			if (!pageDesc) return false;
+			return bm->ReleasePageHandle(*this);
+		}
+
+/***********************************************************************
+BufferCompletion
+***********************************************************************/
+
+		BufferCompletion::BufferCompletion(volatile vint* _readers)
+			:readers(_readers)
+		{
+			event.CreateManualUnsignal(false);
+		}
+
+		void BufferCompletion::Complete(void* _address)
+		{
+			address = _address;
+			completed = true;
+			event.Signal();
+
+			// the source could be unloaded after the completion stops reading it
+			DECRC(readers);
+		}
+
+		bool BufferCompletion::IsCompleted()
+		{
+			return completed;
+		}
+
+		void* BufferCompletion::Wait()
+		{
+			if (!completed)
+			{
+				event.Wait();
+			}
+			return address;
+		}
+
+/***********************************************************************
+BufferAccessStrategy
+***********************************************************************/
+
+		BufferAccessStrategy::BufferAccessStrategy(vint ringSize)
+			:ring(ringSize > 0 ? ringSize : 1)
+		{
+		}
+
+		vint BufferAccessStrategy::GetRingSize()
+		{
+			return ring.Count();
+		}
+
+		vuint64_t BufferAccessStrategy::GetRecycledPageCount()
+		{
+			return recycledPageCount;
+		}
+
 /***********************************************************************
 BufferManager
 ***********************************************************************/
 
-		void BufferManager::SwapCacheIfNecessary()
+		IBufferSource* BufferManager::GetSourceUnsafe(BufferSource source)
+		{
+			if (source.index < 0 || source.index >= SourceChunkSize * SourceChunkCount)
+			{
+				return nullptr;
+			}
+
+			auto chunk = __atomic_load_n(&sourceChunks[source.index / SourceChunkSize], __ATOMIC_ACQUIRE);
+			if (!chunk)
+			{
+				return nullptr;
+			}
+			return __atomic_load_n(&(*chunk)[source.index % SourceChunkSize], __ATOMIC_ACQUIRE);
+		}
+
+		bool BufferManager::RegisterSource(BufferSource source, IBufferSource* bs)
+		{
+			if (source.index < 0 || source.index >= SourceChunkSize * SourceChunkCount)
+			{
+				return false;
+			}
+
+			SPIN_LOCK(lock)
+			{
+				auto& chunk = sourceChunks[source.index / SourceChunkSize];
+				if (!chunk)
+				{
+					auto newChunk = new SourceChunk;
+					memset(newChunk, 0, sizeof(SourceChunk));
+					__atomic_store_n(&chunk, newChunk, __ATOMIC_RELEASE);
+				}
+				__atomic_store_n(&(*chunk)[source.index % SourceChunkSize], bs, __ATOMIC_RELEASE);
+				loadedSources.Add(bs);
+			}
+			return true;
+		}
+
+		void BufferManager::WaitForReaders()
+		{
+			__sync_synchronize();
+			for (vint i = 0; i < ReaderSlotCount; i++)
+			{
+				while (readerSlots[i].readers != 0)
+				{
+					sched_yield();
+				}
+			}
+		}
+
+		void BufferManager::WaitForHandles(IBufferSource* bs)
+		{
+			__sync_synchronize();
+			while (bs->GetHandleCount() != 0)
+			{
+				sched_yield();
+			}
+		}
+
+		vuint64_t BufferManager::EvictSourcePagesUnsafe(SourceList& sources, vuint64_t expectCount, bool foreground)
+		{
+			bool cleanOnly = foreground && cleanerRunning;
+			vuint64_t evicted = 0;
+			SourceList candidates;
+			List<vuint64_t> budgets;
+
+			// victims are selected again when some of them are skipped to keep minimum quotas
+			while (evicted < expectCount)
+			{
+				candidates.Clear();
+				budgets.Clear();
+				FOREACH(IBufferSource*, source, sources)
+				{
+					SOURCE_LOCK(source)
+					{
+						vuint64_t count = source->GetCachedPageCount();
+						vuint64_t minPageCount = source->GetQuota().minPageCount;
+						if (count > minPageCount)
+						{
+							candidates.Add(source);
+							budgets.Add(count - minPageCount);
+						}
+					}
+				}
+				if (candidates.Count() == 0) break;
+
+				IBufferReplacementPolicy::VictimList victims;
+				replacementPolicy->SelectVictims(candidates, expectCount - evicted, cleanOnly, victims);
+
+				vuint64_t roundEvicted = 0;
+				FOREACH(IBufferReplacementPolicy::VictimTuple, victim, victims)
+				{
+					vint index = candidates.IndexOf(victim.f0);
+					if (budgets[index] == 0) continue;
+
+					SOURCE_LOCK(victim.f0)
+					{
+						// the page could be locked or changed again after victims are selected
+						bool writtenBack = false;
+						if (victim.f0->EvictPage(victim.f1, !cleanOnly, writtenBack))
+						{
+							roundEvicted++;
+							budgets[index]--;
+							victim.f0->GetCounters().Increase(BufferCounter::EvictedPages);
+						}
+						if (writtenBack && foreground)
+						{
+							INCRC(&totalForegroundStalls);
+						}
+					}
+				}
+
+				if (roundEvicted == 0) break;
+				evicted += roundEvicted;
+			}
+
+			__sync_add_and_fetch(&totalEvictedPages, evicted);
+			return evicted;
+		}
+
+		vuint64_t BufferManager::EvictPagesUnsafe(vuint64_t expectCount, bool foreground)
+		{
+			vuint64_t evicted = 0;
+			SourceList sources;
+
+			// a source above its maximum quota evicts its own pages first
+			FOREACH(IBufferSource*, source, loadedSources)
+			{
+				vuint64_t overflow = 0;
+				SOURCE_LOCK(source)
+				{
+					vuint64_t count = source->GetCachedPageCount();
+					vuint64_t maxPageCount = source->GetQuota().maxPageCount;
+					if (count > maxPageCount)
+					{
+						overflow = count - maxPageCount / 4 * 3;
+					}
+				}
+
+				if (overflow > 0)
+				{
+					sources.Clear();
+					sources.Add(source);
+					evicted += EvictSourcePagesUnsafe(sources, overflow, foreground);
+				}
+			}
+
+			// pages in lower priority classes are evicted first
+			for (vint priority = (vint)BufferPriority::Scan; priority >= (vint)BufferPriority::System && evicted < expectCount; priority--)
+			{
+				sources.Clear();
+				FOREACH(IBufferSource*, source, loadedSources)
+				{
+					if (source->GetQuota().priority == (BufferPriority)priority)
+					{
+						sources.Add(source);
+					}
+				}
+				if (sources.Count() > 0)
+				{
+					evicted += EvictSourcePagesUnsafe(sources, expectCount - evicted, foreground);
+				}
+			}
+
+			if (evicted > 0)
+			{
+				counters->Increase(BufferCounter::EvictionBatches);
+			}
+			return evicted;
+		}
+
+		vuint64_t BufferManager::CleanPages(vuint64_t expectCount)
+		{
+			// dirty pages are collected while holding the lock of the buffer manager, and written back after the lock is released,
+			// sources are pinned like page handles so that they are not unloaded, and pages are checked again by FlushPage
+			SourceList sources;
+			List<vint> pageCounts;
+			List<BufferPage> dirtyPages;
+			SPIN_LOCK(lock)
+			{
+				FOREACH(IBufferSource*, source, loadedSources)
+				{
+					if ((vuint64_t)dirtyPages.Count() >= expectCount) break;
+
+					vint collected = dirtyPages.Count();
+					SOURCE_LOCK(source)
+					{
+						vint slotCount = source->GetPageSlotCount();
+						for (vint slot = 0; slot < slotCount && (vuint64_t)dirtyPages.Count() < expectCount; slot++)
+						{
+							BufferPage page;
+							auto pageDesc = source->GetPageSlot(slot, page);
+							if (pageDesc && pageDesc->dirty && !pageDesc->IsExclusivelyLatched())
+							{
+								dirtyPages.Add(page);
+							}
+						}
+					}
+
+					if (dirtyPages.Count() > collected)
+					{
+						INCRC(&source->GetHandleCount());
+						sources.Add(source);
+						pageCounts.Add(dirtyPages.Count() - collected);
+					}
+				}
+			}
+
+			// write back pages one by one, so that foreground calls are not blocked for long
+			vuint64_t cleaned = 0;
+			vint pageIndex = 0;
+			for (vint i = 0; i < sources.Count(); i++)
+			{
+				auto source = sources[i];
+				for (vint j = 0; j < pageCounts[i]; j++)
+				{
+					auto page = dirtyPages[pageIndex++];
+					SOURCE_LOCK(source)
+					{
+						if (source->FlushPage(page))
+						{
+							cleaned++;
+						}
+					}
+				}
+				DECRC(&source->GetHandleCount());
+			}
+
+			__sync_add_and_fetch(&totalCleanedPages, cleaned);
+			return cleaned;
+		}
+
+		void BufferManager::RunCleaner()
+		{
+			while (!cleanerStopping)
+			{
+				SPIN_LOCK(lock)
+				{
+					// sources above their maximum quotas are checked even when the cache is not full
+					EvictPagesUnsafe(totalCachedPages > cleanerHighWatermark ? totalCachedPages - cleanerLowWatermark : 0, false);
+				}
+				CleanPages(cleanerBatchSize);
+
+				for (vint i = 0; i < cleanerInterval && !cleanerStopping && !cleanerRequested; i++)
+				{
+					Thread::Sleep(1);
+				}
+				cleanerRequested = false;
+			}
+		}
+
+		void BufferManager::SwapCacheIfNecessary(IBufferSource* bs)
+		{
+			// the quota is checked again while holding the lock of the source before evicting
+			bool overQuota = bs && bs->GetCachedPageCount() > bs->GetQuota().maxPageCount;
+			if (totalCachedPages > cachePageCount || overQuota)
+			{
+				if (cleanerRunning)
+				{
+					// let the cleaner do the heavy job if it is already evicting pages
+					cleanerRequested = true;
+					if (lock.TryEnter())
+					{
+						EvictPagesUnsafe(totalCachedPages > cachePageCount ? totalCachedPages - cachePageCount / 4 * 3 : 0, true);
+						lock.Leave();
+					}
+				}
+				else
+				{
+					SPIN_LOCK(lock)
+					{
+						EvictPagesUnsafe(totalCachedPages > cachePageCount ? totalCachedPages - cachePageCount / 4 * 3 : 0, true);
+					}
+				}
+			}
+		}
+
+		void BufferManager::RecycleRingEntry(BufferAccessStrategy* strategy)
+		{
+			auto& entry = strategy->ring[strategy->nextEntry];
+			SourceReader bsReader(this, entry.source);
+			if (auto bs = bsReader.source)
+			{
+				SOURCE_LOCK(bs)
+				{
+					// a page accessed by others since it was read through the ring stays in the shared cache
+					auto pageDesc = bs->GetCachedPageDesc(entry.page);
+					if (pageDesc && pageDesc->lastAccessTime == entry.accessTime && !pageDesc->IsPinned())
+					{
+						bool writtenBack = false;
+						if (bs->EvictPage(entry.page, true, writtenBack))
+						{
+							bs->GetCounters().Increase(BufferCounter::RecycledPages);
+							strategy->recycledPageCount++;
+						}
+					}
+				}
+			}
+			strategy->usedEntryCount--;
+		}
+
+		bool BufferManager::ReleasePageHandle(PageHandle& handle)
+		{
+			auto bs = handle.source;
+			bool successful = false;
+			BufferTicket ticket;
+			SOURCE_LOCK(bs)
+			{
+				successful = bs->UnlockPageDesc(handle.pageDesc, handle.persistanceType);
+				if (successful && handle.persistanceType == PersistanceType::ChangedAndPersist)
+				{
+					ticket = bs->RequestPersistance();
+				}
+			}
+			SwapCacheIfNecessary(bs);
+			if (successful && ticket.IsValid())
+			{
+				successful = bs->WaitForPersistance(ticket);
+			}
+
+			// the source could be unloaded after the handle stops pinning it
+			DECRC(&bs->GetHandleCount());
+			handle.bm = nullptr;
+			handle.source = nullptr;
+			handle.page = BufferPage::Invalid();
+			handle.pageDesc = nullptr;
+			return successful;
+		}
+
+		BufferManager::BufferManager(vuint64_t _pageSize, vuint64_t _cachePageCount, BufferReplacement _replacement, const BufferPoolOptions& _poolOptions)
+			:pageSize(_pageSize)
+			,cachePageCount(_cachePageCount)
+			,pageSizeBits(0)
+			,pageDataSize(0)
+			,pageChecksums(_poolOptions.pageChecksums)
+			,spillDirectory(_poolOptions.spillDirectory)
+			,totalCachedPages(0)
+			,totalEvictedPages(0)
+			,totalForegroundStalls(0)
+			,totalCleanedPages(0)
+			,usedSourceIndex(0)
+			,cleanerStarted(false)
+			,cleanerRunning(false)
+			,cleanerStopping(false)
+			,cleanerRequested(false)
+			,cleanerLowWatermark(_cachePageCount / 4 * 3)
+			,cleanerHighWatermark(_cachePageCount / 8 * 7)
+			,cleanerInterval(10)
+			,cleanerBatchSize(64)
+			,metricsDumpStarted(false)
+			,metricsDumpStopping(false)
+			,checkpointFile(_poolOptions.checkpointFile)
+			,checkpointerStarted(false)
+			,checkpointerStopping(false)
+		{
+			cleanerStoppedEvent.CreateManualUnsignal(false);
+			metricsDumpStoppedEvent.CreateManualUnsignal(false);
+			checkpointerStoppedEvent.CreateManualUnsignal(false);
+			counters = new buffer_internal::BufferCounters;
+			replacementPolicy = CreateReplacementPolicy(_replacement);
+			CHECK_ERROR(replacementPolicy, L"vl::database::BufferManager::BufferManager(vuint64_t, vuint64_t, BufferReplacement, const BufferPoolOptions&)#Unknown replacement policy.");
+			memset(sourceChunks, 0, sizeof(sourceChunks));
+			readerSlots = (ReaderSlot*)IntUpperBound((vuint64_t)readerSlotBuffer, (vuint64_t)CacheLineSize);
+			memset(readerSlots, 0, ReaderSlotCount * sizeof(ReaderSlot));
+			vuint64_t systemPageSize = sysconf(_SC_PAGE_SIZE);
+			pageSize = IntUpperBound(pageSize, systemPageSize);
+			// offsets in a page should fit in pageSizeBits even if the page size is not a power of 2
+			while (((vuint64_t)1 << pageSizeBits) < pageSize)
+			{
+				pageSizeBits++;
+			}
+			pageDataSize = pageChecksums ? pageSize - buffer_internal::PageChecksumSize : pageSize;
+			framePool = new buffer_internal::FramePool(pageSize, cachePageCount, _poolOptions.hugePages, _poolOptions.nodeLocal);
+
+			// pages are stamped with LSNs after the last checkpoint, even if the process is restarted
+			if (checkpointFile != L"" && ReadCheckpointFile(checkpointFile, lastCheckpoint))
+			{
+				AdvanceBufferLsn(lastCheckpoint.endLsn);
+			}
+		}
+
+		BufferManager::~BufferManager()
+		{
+			StopBackgroundCleaner();
+			StopMetricsDump();
+			StopCheckpointer();
+			WaitForReaders();
+			FOREACH(IBufferSource*, source, loadedSources)
+			{
+				source->Unload();
+				delete source;
+			}
+			for (vint i = 0; i < SourceChunkCount; i++)
+			{
+				delete sourceChunks[i];
+			}
+		}
+
+		vuint64_t BufferManager::GetPageSize()
+		{
+			return pageSize;
+		}
+
+		vuint64_t BufferManager::GetPageDataSize()
+		{
+			return pageDataSize;
+		}
+
+		vuint64_t BufferManager::GetCachePageCount()
+		{
+			return cachePageCount;
+		}
+
+		vuint64_t BufferManager::GetCacheSize()
+		{
+			return pageSize * cachePageCount;
+		}
+
+		vuint64_t BufferManager::GetCurrentlyCachedPageCount()
+		{
+			return totalCachedPages;
+		}
+
+		vuint64_t BufferManager::GetEvictedPageCount()
+		{
+			return totalEvictedPages;
+		}
+
+		vuint64_t BufferManager::GetForegroundStallCount()
+		{
+			return totalForegroundStalls;
+		}
+
+		vuint64_t BufferManager::GetCleanedPageCount()
+		{
+			return totalCleanedPages;
+		}
+
+		bool BufferManager::StartBackgroundCleaner()
+		{
+			SPIN_LOCK(lock)
+			{
+				if (cleanerStarted) return false;
+				cleanerStarted = true;
+				cleanerStopping = false;
+				cleanerRequested = false;
+				cleanerRunning = true;
+				cleanerStoppedEvent.Unsignal();
+
+				// a thread still touches itself after Wait() returns, so it deletes itself and reports stopping by an event
+				Thread::CreateAndStart([this]()
+				{
+					RunCleaner();
+					cleanerStoppedEvent.Signal();
+				}, true);
+			}
+			return true;
+		}
+
+		bool BufferManager::StopBackgroundCleaner()
+		{
+			SPIN_LOCK(lock)
+			{
+				if (!cleanerStarted) return false;
+				cleanerStarted = false;
+				cleanerStopping = true;
+			}
+
+			cleanerStoppedEvent.Wait();
+			cleanerRunning = false;
+			return true;
+		}
+
+		bool BufferManager::IsBackgroundCleanerRunning()
+		{
+			return cleanerRunning;
+		}
+
+		bool BufferManager::SetCleanerWatermarks(vuint64_t lowWatermark, vuint64_t highWatermark)
+		{
+			if (lowWatermark > highWatermark || highWatermark > cachePageCount) return false;
+			SPIN_LOCK(lock)
+			{
+				cleanerLowWatermark = lowWatermark;
+				cleanerHighWatermark = highWatermark;
+			}
+			return true;
+		}
+
+		void BufferManager::SetCleanerInterval(vint milliseconds)
+		{
+			cleanerInterval = milliseconds < 1 ? 1 : milliseconds;
+		}
+
+		void BufferManager::SetCleanerBatchSize(vint pageCount)
+		{
+			cleanerBatchSize = pageCount < 1 ? 1 : pageCount;
+		}
+
+		void BufferManager::RunMetricsDump(vint milliseconds, Func<void(const WString&)> callback)
+		{
+			while (!metricsDumpStopping)
+			{
+				for (vint i = 0; i < milliseconds && !metricsDumpStopping; i++)
+				{
+					Thread::Sleep(1);
+				}
+
+				if (!metricsDumpStopping)
+				{
+					BufferMetrics metrics;
+					GetMetrics(metrics);
+					callback(metrics.ToString());
+				}
+			}
+		}
+
+		void BufferManager::GetMetrics(BufferMetrics& metrics)
+		{
+			metrics = BufferMetrics();
+			SPIN_LOCK(lock)
+			{
+				counters->Collect(metrics);
+				metrics.Add(unloadedSourceMetrics);
+				FOREACH(IBufferSource*, source, loadedSources)
+				{
+					source->GetCounters().Collect(metrics);
+				}
+			}
+		}
+
+		bool BufferManager::StartMetricsDump(vint milliseconds, const Func<void(const WString&)>& callback)
+		{
+			if (milliseconds < 1 || !callback) return false;
+			SPIN_LOCK(lock)
+			{
+				if (metricsDumpStarted) return false;
+				metricsDumpStarted = true;
+				metricsDumpStopping = false;
+				metricsDumpStoppedEvent.Unsignal();
+
+				Thread::CreateAndStart([=]()
+				{
+					RunMetricsDump(milliseconds, callback);
+					metricsDumpStoppedEvent.Signal();
+				}, true);
+			}
+			return true;
+		}
+
+		bool BufferManager::StopMetricsDump()
+		{
+			SPIN_LOCK(lock)
+			{
+				if (!metricsDumpStarted) return false;
+				metricsDumpStarted = false;
+				metricsDumpStopping = true;
+			}
+
+			metricsDumpStoppedEvent.Wait();
+			return true;
+		}
+
+		BufferPageDesc* BufferManager::GetOldestDirtyPageUnsafe(IBufferSource* source)
+		{
+			// dirty pages of memory sources are only waiting to be spilled, nothing is recovered from them
+			if (source->GetSourceKind() != BufferSourceKind::File) return nullptr;
+			return source->GetDirtyPageTable().GetOldestPage();
+		}
+
+		bool BufferManager::WriteCheckpointFile(const BufferCheckpoint& checkpoint)
+		{
+			// the record is written to a new file and then renamed, so that the file always contains a complete record
+			vuint64_t record[CheckpointRecordSize] =
+			{
+				CheckpointMagic,
+				checkpoint.sequence,
+				checkpoint.beginTime,
+				checkpoint.endTime,
+				checkpoint.recoveryTime,
+				checkpoint.beginLsn,
+				checkpoint.endLsn,
+				checkpoint.recoveryLsn,
+				checkpoint.writtenPageCount,
+				checkpoint.skippedPageCount,
+				0,
+			};
+			record[CheckpointRecordSize - 1] = buffer_internal::ComputeCrc32c(record, sizeof(record) - sizeof(vuint64_t));
+
+			auto tempFileName = wtoa(checkpointFile + L".writing");
+			auto mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+			int fileDescriptor = open(tempFileName.Buffer(), O_CREAT | O_TRUNC | O_WRONLY, mode);
+			if (fileDescriptor == -1) return false;
+
+			bool succeeded =
+				pwrite(fileDescriptor, record, sizeof(record), 0) == (ssize_t)sizeof(record) &&
+				fdatasync(fileDescriptor) != -1;
+			close(fileDescriptor);
+			succeeded = succeeded && rename(tempFileName.Buffer(), wtoa(checkpointFile).Buffer()) != -1;
+			if (!succeeded)
+			{
+				unlink(tempFileName.Buffer());
+			}
+			return succeeded;
+		}
+
+		void BufferManager::RunCheckpointer(vint milliseconds, Func<void(const BufferCheckpoint&)> callback)
+		{
+			while (!checkpointerStopping)
+			{
+				for (vint i = 0; i < milliseconds && !checkpointerStopping; i++)
+				{
+					Thread::Sleep(1);
+				}
+
+				if (!checkpointerStopping)
+				{
+					BufferCheckpoint checkpoint;
+					Checkpoint(checkpoint);
+					if (callback)
+					{
+						callback(checkpoint);
+					}
+				}
+			}
+		}
+
+		vuint64_t BufferManager::GetOldestDirtyTime()
+		{
+			vuint64_t oldestDirtyTime = ~(vuint64_t)0;
+			SPIN_LOCK(lock)
+			{
+				FOREACH(IBufferSource*, source, loadedSources)
+				{
+					SOURCE_LOCK(source)
+					{
+						auto pageDesc = GetOldestDirtyPageUnsafe(source);
+						if (pageDesc && oldestDirtyTime > pageDesc->firstDirtyTime)
+						{
+							oldestDirtyTime = pageDesc->firstDirtyTime;
+						}
+					}
+				}
+			}
+			return oldestDirtyTime;
+		}
+
+		bool BufferManager::Checkpoint(BufferCheckpoint& checkpoint)
 		{
-			if (totalCachedPages > cachePageCount)
+			CS_LOCK(checkpointLock)
 			{
+				checkpoint = BufferCheckpoint();
+				checkpoint.sequence = lastCheckpoint.sequence + 1;
+				checkpoint.beginTime = GetBufferAccessTime();
+				checkpoint.beginLsn = GetBufferLsn();
+				checkpoint.recoveryTime = checkpoint.beginTime;
+				checkpoint.recoveryLsn = checkpoint.beginLsn + 1;
+
+				List<BufferSource> sources;
 				SPIN_LOCK(lock)
 				{
-					vuint64_t remainPage = cachePageCount / 4 * 3;
-					vuint64_t expectPage = totalCachedPages - remainPage;
-					List<IBufferSource::BufferPageTimeTuple> pages;
-					FOREACH(Ptr<IBufferSource>, source, sources.Values())
+					FOREACH(IBufferSource*, source, loadedSources)
+					{
+						sources.Add(source->GetBufferSource());
+					}
+				}
+
+				List<BufferPage> dirtyPages;
+				FOREACH(BufferSource, source, sources)
+				{
+					// like a page handle, the source is pinned instead of keeping the reader slot during writing back,
+					// a source unloaded in the middle has written back all its pages
+					IBufferSource* bs = nullptr;
 					{
-						source->FillUnmapPageCandidates(pages, expectPage);
+						SourceReader reader(this, source);
+						bs = reader.source;
+						if (bs)
+						{
+							INCRC(&bs->GetHandleCount());
+						}
 					}
+					if (!bs) continue;
 
-					if (pages.Count() > 0)
+					dirtyPages.Clear();
+					SOURCE_LOCK(bs)
+					{
+						// pages dirty before the checkpoint began are a prefix of the dirty page table
+						auto pageDesc = GetOldestDirtyPageUnsafe(bs);
+						while (pageDesc && pageDesc->firstDirtyLsn <= checkpoint.beginLsn)
+						{
+							dirtyPages.Add(BufferPage{pageDesc->offset / pageSize});
+							pageDesc = bs->GetDirtyPageTable().GetNextPage(pageDesc);
+						}
+					}
+					if (dirtyPages.Count() > 0)
 					{
-						SortLambda(&pages[0], pages.Count(), [](const IBufferSource::BufferPageTimeTuple& t1, const IBufferSource::BufferPageTimeTuple& t2)
+						// pages are written back in the order of their offsets in the file
+						SortLambda(&dirtyPages[0], dirtyPages.Count(), [](BufferPage a, BufferPage b)
 						{
-							if (t1.f2 < t2.f2) return -1;
-							else if (t1.f2 > t2.f2) return 1;
-							else return 0;
+							return a.index < b.index ? -1 : a.index > b.index ? 1 : 0;
 						});
+					}
 
-						vint count = pages.Count() < expectPage ? pages.Count() : expectPage;
-						for (vint i = 0; i < count; i++)
+					vuint64_t written = 0;
+					for (vint i = 0; i < dirtyPages.Count(); i += CheckpointBatchSize)
+					{
+						SOURCE_LOCK(bs)
 						{
-							auto tuple = pages[i];
-							auto source = sources[tuple.f0];
-							SPIN_LOCK(source->GetLock())
+							for (vint j = i; j < i + CheckpointBatchSize && j < dirtyPages.Count(); j++)
 							{
-								CHECK_ERROR(source->UnmapPage(tuple.f1), L"vl::database::BufferManager::SwapCacheIfNecessary()#Internal error: Failed to unmap page.");
+								auto page = dirtyPages[j];
+								if (bs->FlushPage(page))
+								{
+									written++;
+								}
+								else if (auto pageDesc = bs->GetCachedPageDesc(page))
+								{
+									// pages written back or evicted by others since the collection are not counted
+									if (pageDesc->dirty && pageDesc->firstDirtyLsn <= checkpoint.beginLsn)
+									{
+										checkpoint.skippedPageCount++;
+									}
+								}
 							}
 						}
+					}
+
+					if (written > 0)
+					{
+						bs->SyncFile();
+						checkpoint.writtenPageCount += written;
+					}
 
-						CHECK_ERROR(totalCachedPages <= cachePageCount, L"vl::database::BufferManager::SwapCacheIfNecessary()#Internal error: Failed to maintain totalCachedPages.");
+					SOURCE_LOCK(bs)
+					{
+						auto pageDesc = GetOldestDirtyPageUnsafe(bs);
+						if (pageDesc && checkpoint.recoveryLsn > pageDesc->firstDirtyLsn)
+						{
+							checkpoint.recoveryLsn = pageDesc->firstDirtyLsn;
+							checkpoint.recoveryTime = pageDesc->firstDirtyTime;
+						}
 					}
+					DECRC(&bs->GetHandleCount());
 				}
-			}
-		}
 
-		BufferManager::BufferManager(vuint64_t _pageSize, vuint64_t _cachePageCount)
-			:pageSize(_pageSize)
-			,cachePageCount(_cachePageCount)
-			,pageSizeBits(0)
-			,totalCachedPages(0)
-			,usedSourceIndex(0)
-		{
-			vuint64_t systemPageSize = sysconf(_SC_PAGE_SIZE);
-			pageSize = IntUpperBound(pageSize, systemPageSize);
-			if (pageSize > 0)
-			{
-				pageSizeBits = sizeof(pageSize) * 8;
-				while ((pageSize & (((vuint64_t)2) << (pageSizeBits - 1))) == 0)
+				checkpoint.endTime = GetBufferAccessTime();
+				checkpoint.endLsn = GetBufferLsn();
+				lastCheckpoint = checkpoint;
+				if (checkpointFile != L"")
 				{
-					pageSizeBits--;
+					return WriteCheckpointFile(checkpoint);
 				}
 			}
+			return true;
 		}
 
-		BufferManager::~BufferManager()
+		bool BufferManager::GetLastCheckpoint(BufferCheckpoint& checkpoint)
 		{
-			FOREACH(Ptr<IBufferSource>, source, sources.Values())
+			CS_LOCK(checkpointLock)
 			{
-				source->Unload();
+				if (lastCheckpoint.sequence == 0) return false;
+				checkpoint = lastCheckpoint;
 			}
+			return true;
 		}
 
-		vuint64_t BufferManager::GetPageSize()
+		bool BufferManager::ReadCheckpointFile(const WString& fileName, BufferCheckpoint& checkpoint)
 		{
-			return pageSize;
+			int fileDescriptor = open(wtoa(fileName).Buffer(), O_RDONLY);
+			if (fileDescriptor == -1) return false;
+
+			vuint64_t record[CheckpointRecordSize];
+			bool succeeded = pread(fileDescriptor, record, sizeof(record), 0) == (ssize_t)sizeof(record);
+			close(fileDescriptor);
+			if (!succeeded) return false;
+			if (record[0] != CheckpointMagic) return false;
+			if (record[CheckpointRecordSize - 1] != buffer_internal::ComputeCrc32c(record, sizeof(record) - sizeof(vuint64_t))) return false;
+
+			checkpoint.sequence = record[1];
+			checkpoint.beginTime = record[2];
+			checkpoint.endTime = record[3];
+			checkpoint.recoveryTime = record[4];
+			checkpoint.beginLsn = record[5];
+			checkpoint.endLsn = record[6];
+			checkpoint.recoveryLsn = record[7];
+			checkpoint.writtenPageCount = record[8];
+			checkpoint.skippedPageCount = record[9];
+			return true;
 		}
 
-		vuint64_t BufferManager::GetCachePageCount()
+		bool BufferManager::StartCheckpointer(vint milliseconds, const Func<void(const BufferCheckpoint&)>& callback)
 		{
-			return cachePageCount;
+			if (milliseconds < 1) return false;
+			SPIN_LOCK(lock)
+			{
+				if (checkpointerStarted) return false;
+				checkpointerStarted = true;
+				checkpointerStopping = false;
+				checkpointerStoppedEvent.Unsignal();
+
+				Thread::CreateAndStart([=]()
+				{
+					RunCheckpointer(milliseconds, callback);
+					checkpointerStoppedEvent.Signal();
+				}, true);
+			}
+			return true;
 		}
 
-		vuint64_t BufferManager::GetCacheSize()
+		bool BufferManager::StopCheckpointer()
 		{
-			return pageSize * cachePageCount;
+			SPIN_LOCK(lock)
+			{
+				if (!checkpointerStarted) return false;
+				checkpointerStarted = false;
+				checkpointerStopping = true;
+			}
+
+			checkpointerStoppedEvent.Wait();
+			return true;
 		}
 
-		vuint64_t BufferManager::GetCurrentlyCachedPageCount()
+		BufferSource BufferManager::LoadMemorySource()
 		{
-			return totalCachedPages;
+			BufferSource source{(BufferSource::IndexType)INCRC(&usedSourceIndex) - 1};
+			IBufferSource* bs = CreateMemorySource(source, &totalCachedPages, pageSize, framePool.Obj(), spillDirectory);
+			if (!bs)
+			{
+				return BufferSource::Invalid();
+			}
+
+			if (!RegisterSource(source, bs))
+			{
+				bs->Unload();
+				delete bs;
+				return BufferSource::Invalid();
+			}
+			SwapCacheIfNecessary(nullptr);
+			return source;
 		}
 
-		BufferSource BufferManager::LoadMemorySource()
+		BufferSource BufferManager::RestoreMemorySource(const WString& fileName)
 		{
 			BufferSource source{(BufferSource::IndexType)INCRC(&usedSourceIndex) - 1};
-			Ptr<IBufferSource> bs = CreateMemorySource(source, &totalCachedPages, pageSize);
+			IBufferSource* bs = CreateMemorySourceFromSnapshot(source, &totalCachedPages, pageSize, framePool.Obj(), spillDirectory, fileName);
 			if (!bs)
 			{
 				return BufferSource::Invalid();
 			}
 
-			SPIN_LOCK(lock)
+			if (!RegisterSource(source, bs))
 			{
-				sources.Add(source, bs);
+				bs->Unload();
+				delete bs;
+				return BufferSource::Invalid();
 			}
-			SwapCacheIfNecessary();
 			return source;
 		}
 
-		BufferSource BufferManager::LoadFileSource(const WString& fileName, bool createNew)
+		BufferSource BufferManager::LoadFileSource(const WString& fileName, bool createNew, FileSourceMode mode)
 		{
 			BufferSource source{(BufferSource::IndexType)INCRC(&usedSourceIndex) - 1};
-			Ptr<IBufferSource> bs = CreateFileSource(source, &totalCachedPages, pageSize, fileName, createNew);
+			auto sourceFramePool = mode == FileSourceMode::MemoryMapped ? nullptr : framePool.Obj();
+			buffer_internal::AsyncFileReader* sourceAsyncReader = nullptr;
+			if (mode == FileSourceMode::AsyncFrames)
+			{
+				SPIN_LOCK(lock)
+				{
+					if (!asyncReader)
+					{
+						asyncReader = buffer_internal::CreateAsyncFileReader(AsyncQueueDepth);
+					}
+					sourceAsyncReader = asyncReader.Obj();
+				}
+			}
+			IBufferSource* bs = CreateFileSource(source, &totalCachedPages, pageSize, fileName, createNew, sourceFramePool, sourceAsyncReader, mode == FileSourceMode::CompressedFrames, pageChecksums);
 			if (!bs)
 			{
 				return BufferSource::Invalid();
 			}
 
-			SPIN_LOCK(lock)
+			if (!RegisterSource(source, bs))
 			{
-				sources.Add(source, bs);
+				bs->Unload();
+				delete bs;
+				return BufferSource::Invalid();
 			}
-			SwapCacheIfNecessary();
+			SwapCacheIfNecessary(nullptr);
 			return source;
 		}
 
 #define TRY_GET_BUFFER_SOURCE(BS, SOURCE, FAILVALUE)					\
-			Ptr<IBufferSource> BS;										\
-			SPIN_LOCK(lock)												\
-			{															\
-				vint index = sources.Keys().IndexOf(SOURCE);			\
-				if (index == -1) return FAILVALUE;						\
-				BS = sources.Values()[index];							\
-			}															\
+			SourceReader BS##Reader(this, SOURCE);						\
+			IBufferSource* BS = BS##Reader.source;						\
+			if (!BS) return FAILVALUE;									\
 
 
+		bool BufferManager::DumpMemorySource(BufferSource source, const WString& fileName)
+		{
+			// like a page handle, the source is pinned instead of keeping the reader slot during dumping
+			IBufferSource* bs = nullptr;
+			{
+				SourceReader bsReader(this, source);
+				bs = bsReader.source;
+				if (!bs) return false;
+				INCRC(&bs->GetHandleCount());
+			}
+			bool succeeded = vl::database::DumpMemorySource(bs, fileName);
+			DECRC(&bs->GetHandleCount());
+			return succeeded;
+		}
+
 		bool BufferManager::UnloadSource(BufferSource source)
 		{
-			Ptr<IBufferSource> bs;
+			IBufferSource* bs = nullptr;
 			SPIN_LOCK(lock)
 			{
-				vint index = sources.Keys().IndexOf(source);
-				if (index == -1) return false;
-				bs = sources.Values()[index];
-				sources.Remove(source);
+				bs = GetSourceUnsafe(source);
+				if (!bs) return false;
+				auto chunk = sourceChunks[source.index / SourceChunkSize];
+				__atomic_store_n(&(*chunk)[source.index % SourceChunkSize], (IBufferSource*)nullptr, __ATOMIC_RELEASE);
+				loadedSources.Remove(bs);
+				replacementPolicy->UnloadSource(source);
 			}
 
-			SPIN_LOCK(bs->GetLock())
+			// no handle pins the source after readers leave, because a handle is created by a reader
+			WaitForReaders();
+			WaitForHandles(bs);
+			SOURCE_LOCK(bs)
 			{
 				bs->Unload();
 			}
+			SPIN_LOCK(lock)
+			{
+				bs->GetCounters().Collect(unloadedSourceMetrics);
+			}
+			delete bs;
 			return true;
 		}
 
@@ -176,42 +1151,302 @@ BufferManager
 			return bs->GetFileName();
 		}
 
-		void* BufferManager::LockPage(BufferSource source, BufferPage page)
+		bool BufferManager::SetSourcePriority(BufferSource source, BufferPriority priority)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+			SPIN_LOCK(lock)
+			{
+				bs->GetQuota().priority = priority;
+			}
+			return true;
+		}
+
+		bool BufferManager::SetSourceQuota(BufferSource source, vuint64_t minPageCount, vuint64_t maxPageCount)
+		{
+			if (minPageCount > maxPageCount || minPageCount > cachePageCount) return false;
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+			SPIN_LOCK(lock)
+			{
+				bs->GetQuota().minPageCount = minPageCount;
+				bs->GetQuota().maxPageCount = maxPageCount;
+			}
+			SwapCacheIfNecessary(bs);
+			return true;
+		}
+
+		bool BufferManager::GetSourceQuota(BufferSource source, BufferSourceQuota& quota)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+			SPIN_LOCK(lock)
+			{
+				quota = bs->GetQuota();
+			}
+			return true;
+		}
+
+		vuint64_t BufferManager::GetSourceCachedPageCount(BufferSource source)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, 0);
+			vuint64_t count = 0;
+			SOURCE_LOCK(bs)
+			{
+				count = bs->GetCachedPageCount();
+			}
+			return count;
+		}
+
+		bool BufferManager::GetSourceMetrics(BufferSource source, BufferMetrics& metrics)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+			metrics = BufferMetrics();
+			bs->GetCounters().Collect(metrics);
+			return true;
+		}
+
+		void* BufferManager::LockPage(BufferSource source, BufferPage page, PageLatch latch)
 		{
 			TRY_GET_BUFFER_SOURCE(bs, source, nullptr);
 
+			bool sampling = buffer_internal::SampleLockPageLatency();
+			auto start = sampling ? GetBufferAccessTime() : 0;
 			void* address = nullptr;
-			SPIN_LOCK(bs->GetLock())
+			SOURCE_LOCK(bs)
 			{
-				address = bs->LockPage(page);
+				address = bs->LockPage(page, latch);
+			}
+			SwapCacheIfNecessary(bs);
+			if (sampling)
+			{
+				bs->GetCounters().RecordLockPageLatency(GetBufferAccessTime() - start);
 			}
-			SwapCacheIfNecessary();
 			return address;
 		}
 
+		PageHandle BufferManager::LockPageHandle(BufferSource source, BufferPage page, PageLatch latch)
+		{
+			// the reader slot is only kept during the lookup, the handle pins the source until it is released
+			PageHandle handle;
+			IBufferSource* bs = nullptr;
+			{
+				SourceReader bsReader(this, source);
+				bs = bsReader.source;
+				if (!bs) return handle;
+				INCRC(&bs->GetHandleCount());
+			}
+
+			bool sampling = buffer_internal::SampleLockPageLatency();
+			auto start = sampling ? GetBufferAccessTime() : 0;
+			BufferPageDesc* pageDesc = nullptr;
+			SOURCE_LOCK(bs)
+			{
+				pageDesc = bs->LockPageDesc(page, latch);
+			}
+			SwapCacheIfNecessary(bs);
+			if (sampling)
+			{
+				bs->GetCounters().RecordLockPageLatency(GetBufferAccessTime() - start);
+			}
+
+			if (!pageDesc)
+			{
+				DECRC(&bs->GetHandleCount());
+				return handle;
+			}
+
+			handle.bm = this;
+			handle.source = bs;
+			handle.page = page;
+			handle.pageDesc = pageDesc;
+			handle.pageSize = pageDataSize;
+			handle.latch = latch;
+			return handle;
+		}
+
+		Ptr<BufferCompletion> BufferManager::LockPageAsync(BufferSource source, BufferPage page, PageLatch latch)
+		{
+			// the completion keeps another reader slot until it is completed, which could happen before this function returns
+			auto slot = &readerSlots[buffer_internal::GetBufferThreadIndex() % ReaderSlotCount];
+			INCRC(&slot->readers);
+			auto completion = MakePtr<BufferCompletion>(&slot->readers);
+			SourceReader bsReader(this, source);
+			auto bs = bsReader.source;
+			if (!bs)
+			{
+				completion->Complete(nullptr);
+				return completion;
+			}
+
+			bs->LockPageAsync(page, latch, completion);
+			SwapCacheIfNecessary(bs);
+			return completion;
+		}
+
+		void* BufferManager::LockPage(BufferSource source, BufferPage page, PageLatch latch, BufferAccessStrategy* strategy)
+		{
+			if (!strategy) return LockPage(source, page, latch);
+			TRY_GET_BUFFER_SOURCE(bs, source, nullptr);
+
+			bool cached = false;
+			SOURCE_LOCK(bs)
+			{
+				cached = bs->GetCachedPageDesc(page) != nullptr;
+			}
+
+			auto& ring = strategy->ring;
+			if (!cached && strategy->usedEntryCount == ring.Count())
+			{
+				RecycleRingEntry(strategy);
+			}
+
+			BufferPageDesc* pageDesc = nullptr;
+			SOURCE_LOCK(bs)
+			{
+				pageDesc = bs->LockPageDesc(page, latch);
+				if (pageDesc)
+				{
+					if (!cached)
+					{
+						auto& entry = ring[strategy->nextEntry];
+						entry.source = source;
+						entry.page = page;
+						entry.accessTime = pageDesc->lastAccessTime;
+						strategy->nextEntry = (strategy->nextEntry + 1) % ring.Count();
+						strategy->usedEntryCount++;
+					}
+					else
+					{
+						// the ring accessing its own page again does not prevent recycling it, the latest entry is checked first
+						for (vint i = 1; i <= strategy->usedEntryCount; i++)
+						{
+							auto& entry = ring[(strategy->nextEntry + ring.Count() - i) % ring.Count()];
+							if (entry.source == source && entry.page == page)
+							{
+								entry.accessTime = pageDesc->lastAccessTime;
+								break;
+							}
+						}
+					}
+				}
+			}
+			SwapCacheIfNecessary(bs);
+			return pageDesc ? pageDesc->address : nullptr;
+		}
+
+		void* BufferManager::LockPageShared(BufferSource source, BufferPage page)
+		{
+			return LockPage(source, page, PageLatch::Shared);
+		}
+
+		void* BufferManager::LockPageExclusive(BufferSource source, BufferPage page)
+		{
+			return LockPage(source, page, PageLatch::Exclusive);
+		}
+
 		bool BufferManager::UnlockPage(BufferSource source, BufferPage page, void* buffer, PersistanceType persistanceType)
+		{
+			BufferTicket ticket;
+			if (!UnlockPage(source, page, buffer, persistanceType, ticket)) return false;
+			return WaitForPersistance(source, ticket);
+		}
+
+		bool BufferManager::UnlockPage(BufferSource source, BufferPage page, void* buffer, PersistanceType persistanceType, BufferTicket& ticket)
 		{
 			TRY_GET_BUFFER_SOURCE(bs, source, false);
 
 			bool successful = false;
-			SPIN_LOCK(bs->GetLock())
+			SOURCE_LOCK(bs)
 			{
 				successful = bs->UnlockPage(page, buffer, persistanceType);
+				if (successful && persistanceType == PersistanceType::ChangedAndPersist)
+				{
+					auto requested = bs->RequestPersistance();
+					if (requested.IsValid())
+					{
+						ticket = requested;
+					}
+				}
+			}
+			SwapCacheIfNecessary(bs);
+			return successful;
+		}
+
+		bool BufferManager::WaitForPersistance(BufferSource source, BufferTicket ticket)
+		{
+			if (!ticket.IsValid()) return true;
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+			return bs->WaitForPersistance(ticket);
+		}
+
+		bool BufferManager::LockPages(BufferSource source, const BufferPage* pages, vint count, void** buffers, PageLatch latch)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+
+			// reading ahead makes system calls, so it happens before taking the lock of the source
+			bs->PrefetchPages(pages, count);
+
+			bool successful = true;
+			SOURCE_LOCK(bs)
+			{
+				for (vint i = 0; i < count; i++)
+				{
+					buffers[i] = bs->LockPage(pages[i], latch);
+					if (!buffers[i])
+					{
+						for (vint j = 0; j < i; j++)
+						{
+							bs->UnlockPage(pages[j], buffers[j], PersistanceType::NoChanging);
+							buffers[j] = nullptr;
+						}
+						successful = false;
+						break;
+					}
+				}
 			}
-			SwapCacheIfNecessary();
+			SwapCacheIfNecessary(bs);
 			return successful;
 		}
 
+		bool BufferManager::UnlockPages(BufferSource source, const BufferPage* pages, vint count, void** buffers, PersistanceType persistanceType)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+
+			bool successful = true;
+			BufferTicket ticket;
+			SOURCE_LOCK(bs)
+			{
+				for (vint i = 0; i < count; i++)
+				{
+					if (!bs->UnlockPage(pages[i], buffers[i], persistanceType))
+					{
+						successful = false;
+					}
+				}
+				if (persistanceType == PersistanceType::ChangedAndPersist)
+				{
+					ticket = bs->RequestPersistance();
+				}
+			}
+			SwapCacheIfNecessary(bs);
+			return bs->WaitForPersistance(ticket) && successful;
+		}
+
+		vint BufferManager::PrefetchPages(BufferSource source, const BufferPage* pages, vint count)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, 0);
+
+			return bs->PrefetchPages(pages, count);
+		}
+
 		BufferPage BufferManager::GetIndexPage(BufferSource source)
 		{
 			TRY_GET_BUFFER_SOURCE(bs, source, BufferPage::Invalid());
 
 			BufferPage page;
-			SPIN_LOCK(bs->GetLock())
+			SOURCE_LOCK(bs)
 			{
 				page = bs->GetIndexPage();
 			}
-			SwapCacheIfNecessary();
+			SwapCacheIfNecessary(bs);
 			return page;
 		}
 
@@ -220,11 +1455,14 @@ BufferManager
 			TRY_GET_BUFFER_SOURCE(bs, source, BufferPage::Invalid());
 
 			BufferPage page;
-			SPIN_LOCK(bs->GetLock())
+			BufferTicket ticket;
+			SOURCE_LOCK(bs)
 			{
 				page = bs->AllocatePage();
+				ticket = bs->RequestPersistance();
 			}
-			SwapCacheIfNecessary();
+			SwapCacheIfNecessary(bs);
+			bs->WaitForPersistance(ticket);
 			return page;
 		}
 
@@ -233,11 +1471,53 @@ BufferManager
 			TRY_GET_BUFFER_SOURCE(bs, source, false);
 			
 			bool successful = false;
-			SPIN_LOCK(bs->GetLock())
+			BufferTicket ticket;
+			SOURCE_LOCK(bs)
 			{
 				successful = bs->FreePage(page);
+				ticket = bs->RequestPersistance();
+			}
+			SwapCacheIfNecessary(bs);
+			bs->WaitForPersistance(ticket);
+			return successful;
+		}
+
+		bool BufferManager::AllocatePages(BufferSource source, vint count, bool contiguous, BufferPage* pages)
+		{
+			if (count <= 0) return count == 0;
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+
+			bool successful = false;
+			BufferTicket ticket;
+			SOURCE_LOCK(bs)
+			{
+				successful = bs->AllocatePages(count, contiguous, pages);
+				ticket = bs->RequestPersistance();
+			}
+			SwapCacheIfNecessary(bs);
+			bs->WaitForPersistance(ticket);
+			return successful;
+		}
+
+		bool BufferManager::FreePages(BufferSource source, const BufferPage* pages, vint count)
+		{
+			TRY_GET_BUFFER_SOURCE(bs, source, false);
+
+			bool successful = true;
+			BufferTicket ticket;
+			SOURCE_LOCK(bs)
+			{
+				for (vint i = 0; i < count; i++)
+				{
+					if (!bs->FreePage(pages[i]))
+					{
+						successful = false;
+					}
+				}
+				ticket = bs->RequestPersistance();
 			}
-			SwapCacheIfNecessary();
+			SwapCacheIfNecessary(bs);
+			bs->WaitForPersistance(ticket);
 			return successful;
 		}
 		
@@ -245,7 +1525,7 @@ BufferManager
 
 		bool BufferManager::EncodePointer(BufferPointer& pointer, BufferPage page, vuint64_t offset)
 		{
-			if (offset >= pageSize) return false;
+			if (offset >= pageDataSize) return false;
 			pointer.index = (page.index << pageSizeBits) | offset;
 			return true;
 		}
@@ -253,7 +1533,7 @@ BufferManager
 		bool BufferManager::DecodePointer(BufferPointer pointer, BufferPage& page, vuint64_t& offset)
 		{
 			page.index = pointer.index >> pageSizeBits;
-			offset = pointer.index % (1 << pageSizeBits);
+			offset = pointer.index & (((vuint64_t)1 << pageSizeBits) - 1);
 			return true;
 		}
 	}
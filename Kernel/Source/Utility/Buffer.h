@@ -21,66 +21,608 @@ namespace vl
 			ChangedAndPersist,
 		};
 
-		class IBufferSource : public virtual Interface
+		enum class PageLatch
+		{
+			Shared,
+			Exclusive,
+		};
+
+		enum class BufferReplacement
+		{
+			LeastRecentlyUsed,
+			LeastRecentlyUsed2,
+			Clock,
+		};
+
+		// Transparent aligns frame regions to 2MB and advises the kernel to back them by huge pages.
+		// Explicit maps frame regions with MAP_HUGETLB, and falls back to Transparent when no huge page is reserved in the system.
+		enum class BufferHugePages
+		{
+			None,
+			Transparent,
+			Explicit,
+		};
+
+		// Frames are only used by PooledFrames file sources and memory sources,
+		// pages of MemoryMapped file sources belong to the page cache and are not affected.
+		// When nodeLocal is true, frames are partitioned by NUMA node, a thread gets frames from the node it is running on.
+		// When pageChecksums is true, every page ends with a CRC32C trailer, which is written when a frame is written back and verified when a frame is read,
+		// callers only use the first GetPageDataSize() bytes of a page. Pages of MemoryMapped file sources are written back by the kernel and are not verified.
+		// Memory sources spill evicted pages to unlinked temporary files in spillDirectory, or in the temporary directory of the system when it is empty.
+		struct BufferPoolOptions
+		{
+			BufferHugePages			hugePages = BufferHugePages::None;
+			bool					nodeLocal = false;
+			bool					pageChecksums = false;
+			WString					spillDirectory;
+			// When it is not empty, every checkpoint record is written to this file durably,
+			// and the record in the file is loaded as the last checkpoint when the buffer manager is created
+			WString					checkpointFile;
+		};
+
+		enum class BufferSourceKind
+		{
+			Memory,
+			File,
+		};
+
+		// MemoryMapped maps pages into memory by mmap, in segments of 64MB.
+		// PooledFrames copies pages into frames owned by the buffer manager by pread, and writes them back by pwrite,
+		// modifications in a page are written back only when it is unlocked with Changed or ChangedAndPersist.
+		// AsyncFrames works like PooledFrames, but the file is opened with O_DIRECT,
+		// and pages locked by LockPageAsync are read by io_uring, or by a pool of threads calling pread when io_uring is unavailable.
+		// CompressedFrames works like PooledFrames, but pages are stored compressed as variable sized extents,
+		// with a page-to-extent map in the file named by appending ".pagemap" to the file name.
+		enum class FileSourceMode
+		{
+			MemoryMapped,
+			PooledFrames,
+			AsyncFrames,
+			CompressedFrames,
+		};
+
+		// When the cache is full, pages of Scan sources are evicted first, and pages of System sources are evicted last.
+		enum class BufferPriority
+		{
+			System,
+			Log,
+			Data,
+			Scan,
+		};
+
+		// A source never gives up pages when it holds no more than minPageCount pages,
+		// a source holding more than maxPageCount pages evicts its own pages even when the cache is not full.
+		struct BufferSourceQuota
+		{
+			BufferPriority			priority = BufferPriority::Data;
+			vuint64_t				minPageCount = 0;
+			vuint64_t				maxPageCount = ~(vuint64_t)0;
+		};
+
+		enum class BufferCounter
+		{
+			PageHits,				// a page is already in memory when it is accessed
+			PageMisses,				// a page is mapped by mmap or read by pread
+			PageUnmaps,				// a page is unmapped or its frame is returned to the pool
+			SegmentMaps,			// a segment of pages is mapped by mmap
+			PageWriteBacks,			// a page is written back by msync or pwrite
+			WrittenBytes,
+			FileSyncs,				// fdatasync calls
+			EvictionBatches,
+			EvictedPages,
+			RecycledPages,			// pages evicted by access strategies to reuse their frames
+			ChecksumFailures,		// pages failing checksum verification when they are read
+			LockContentions,		// the lock of a source is not acquired immediately
+			LockSpins,				// failed attempts before acquiring the lock of a source
+			Count,
+		};
+
+		// A snapshot of counters, lockPageLatency[i] counts LockPage calls taking [2^(i-1), 2^i) nanoseconds,
+		// the last bucket also counts slower calls.
+		// Only one of every LatencySampleInterval LockPage calls in each thread is timed.
+		struct BufferMetrics
+		{
+			static const vint		CounterCount = (vint)BufferCounter::Count;
+			static const vint		LatencyBucketCount = 32;
+			static const vint		LatencySampleInterval = 16;
+
+			vuint64_t				counters[CounterCount];
+			vuint64_t				lockPageLatency[LatencyBucketCount];
+
+			BufferMetrics();
+
+			vuint64_t				Get(BufferCounter counter)const;
+			vuint64_t				GetSampledLockPageCount()const;
+			void					Add(const BufferMetrics& metrics);
+			WString					ToString()const;
+		};
+
+		extern vuint64_t			GetBufferAccessTime();
+
+		// Log sequence numbers stamped on pages when they become dirty, which increase in the process,
+		// AdvanceBufferLsn makes numbers issued later greater than a number restored from a checkpoint record
+		extern vuint64_t			NextBufferLsn();
+		extern vuint64_t			GetBufferLsn();
+		extern void					AdvanceBufferLsn(vuint64_t lsn);
+
+		namespace buffer_internal
+		{
+			class FramePool;
+			class BufferCounters;
+			class AsyncFileReader;
+			class DirtyPageTable;
+		}
+
+		class BufferPageDesc
 		{
 		public:
-			typedef Tuple<BufferSource, BufferPage, vuint64_t>		BufferPageTimeTuple;
+			void*					address = nullptr;
+			vuint64_t				offset = 0;
+			vint					pinCount = 0;		// a pinned page cannot be evicted
+			vint					latchCount = 0;		// number of shared holders, or -1 for the exclusive holder
+			bool					dirty = false;
+			bool					persisting = false;	// waiting for the next group commit
+			bool					referenced = false;
+			bool					loading = false;	// being read asynchronously, exclusively latched by the reader until the read completes
+			vuint64_t				lastAccessTime = 0;
+			vuint64_t				previousAccessTime = 0;
+			vuint64_t				firstDirtyTime = 0;	// when the page became dirty after it was last written back
+			vuint64_t				firstDirtyLsn = 0;
+			BufferPageDesc*			previousDirtyPage = nullptr;	// links in the dirty page table of the source
+			BufferPageDesc*			nextDirtyPage = nullptr;
+
+			void Access()
+			{
+				referenced = true;
+				previousAccessTime = lastAccessTime;
+				lastAccessTime = GetBufferAccessTime();
+			}
+
+			void MarkDirty()
+			{
+				if (!dirty)
+				{
+					dirty = true;
+					firstDirtyTime = GetBufferAccessTime();
+					firstDirtyLsn = NextBufferLsn();
+				}
+			}
+
+			bool IsPinned()
+			{
+				return pinCount > 0;
+			}
+
+			bool IsExclusivelyLatched()
+			{
+				return latchCount < 0;
+			}
+
+			bool AcquireLatch(PageLatch latch)
+			{
+				if (latch == PageLatch::Shared)
+				{
+					if (latchCount < 0) return false;
+					latchCount++;
+				}
+				else
+				{
+					if (latchCount != 0) return false;
+					latchCount = -1;
+				}
+				pinCount++;
+				return true;
+			}
 
+			bool ReleaseLatch(PersistanceType persistanceType)
+			{
+				if (latchCount == 0) return false;
+				if (latchCount > 0)
+				{
+					// shared holders are not allowed to change the page
+					if (persistanceType != PersistanceType::NoChanging) return false;
+					latchCount--;
+				}
+				else
+				{
+					latchCount = 0;
+				}
+				pinCount--;
+				return true;
+			}
+		};
+
+		/*
+		 * Returned by LockPageAsync, Wait returns the address of the locked page, or nullptr if the page cannot be locked.
+		 * The page is unlocked by UnlockPage like a page locked by LockPage.
+		 */
+		class BufferCompletion : public Object, public NotCopyable
+		{
+		private:
+			EventObject				event;
+			void* volatile			address = nullptr;
+			volatile bool			completed = false;
+			volatile vint*			readers = nullptr;
+		public:
+			// The reader slot keeps the source loaded until the completion is signaled
+			BufferCompletion(volatile vint* _readers);
+
+			void					Complete(void* _address);
+			bool					IsCompleted();
+			void*					Wait();
+		};
+
+		class IBufferSource : public virtual Interface
+		{
+		public:
 			virtual void			Unload() = 0;
 			virtual BufferSource	GetBufferSource() = 0;
 			virtual SpinLock&		GetLock() = 0;
 			virtual WString			GetFileName() = 0;
+			virtual BufferSourceKind	GetSourceKind() = 0;
 			virtual bool			UnmapPage(BufferPage page) = 0;
 			virtual BufferPage		GetIndexPage() = 0;
 			virtual BufferPage		AllocatePage() = 0;
+			// Allocates count pages or none of them, pages are adjacent when contiguous is true
+			virtual bool			AllocatePages(vint count, bool contiguous, BufferPage* pages) = 0;
 			virtual bool			FreePage(BufferPage page) = 0;
-			virtual void*			LockPage(BufferPage page) = 0;
+			virtual void*			LockPage(BufferPage page, PageLatch latch) = 0;
 			virtual bool			UnlockPage(BufferPage page, void* address, PersistanceType persistanceType) = 0;
-			virtual void			FillUnmapPageCandidates(collections::List<BufferPageTimeTuple>& pages, vint expectCount) = 0;
+
+			// A locked page desc stays valid until it is unlocked, so it could be unlocked without searching for the page again
+			virtual BufferPageDesc*	LockPageDesc(BufferPage page, PageLatch latch) = 0;
+			virtual bool			UnlockPageDesc(BufferPageDesc* pageDesc, PersistanceType persistanceType) = 0;
+			virtual bool			FlushPage(BufferPage page) = 0;
+			virtual bool			EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack) = 0;
+
+			// Group commit, pages unlocked with ChangedAndPersist are written back together with one file sync
+			// RequestPersistance returns an invalid ticket when nothing is waiting for persisting
+			// WaitForPersistance is called without holding the lock of the source
+			virtual BufferTicket	RequestPersistance() = 0;
+			virtual bool			WaitForPersistance(BufferTicket ticket) = 0;
+
+			// Makes pages written back by FlushPage durable, called without holding the lock of the source
+			virtual void			SyncFile() = 0;
+
+			// Hints that pages will be locked soon, returns the number of pages that are not in memory yet
+			// Called without holding the lock of the source, pages are read ahead after the source releases its lock
+			virtual vint			PrefetchPages(const BufferPage* pages, vint count) = 0;
+
+			// Called without holding the lock of the source, the completion is completed before or after the function returns
+			virtual void			LockPageAsync(BufferPage page, PageLatch latch, Ptr<BufferCompletion> completion) = 0;
+
+			virtual buffer_internal::BufferCounters&	GetCounters() = 0;
+
+			// The quota is maintained by the buffer manager while holding its lock
+			virtual BufferSourceQuota&	GetQuota() = 0;
+			// Page handles and dumps pinning the source, which is maintained by the buffer manager without holding any lock
+			virtual volatile vint&	GetHandleCount() = 0;
+			virtual vuint64_t		GetCachedPageCount() = 0;
+
+			// Returns nullptr if the page is not in memory, the page is not accessed
+			virtual BufferPageDesc*	GetCachedPageDesc(BufferPage page) = 0;
+
+			// Evictable pages are exposed as slots, a slot could be empty (returns nullptr)
+			virtual vint			GetPageSlotCount() = 0;
+			virtual BufferPageDesc*	GetPageSlot(vint slot, BufferPage& page) = 0;
+
+			// Dirty pages waiting to be written back to the file, it is always empty for memory sources, because nothing is recovered from them
+			virtual buffer_internal::DirtyPageTable&	GetDirtyPageTable() = 0;
 		};
 
-		class BufferPageDesc
+		class IBufferReplacementPolicy : public virtual Interface
 		{
 		public:
-			void*					address = nullptr;
-			vuint64_t				offset = 0;
-			bool					locked = false;
-			vuint64_t				lastAccessTime = 0;
-			bool					dirty = false;
+			typedef collections::List<IBufferSource*>						SourceList;
+			typedef Tuple<IBufferSource*, BufferPage>						VictimTuple;
+			typedef collections::List<VictimTuple>							VictimList;
+
+			virtual void			UnloadSource(BufferSource source) = 0;
+			virtual void			SelectVictims(SourceList& sources, vuint64_t expectCount, bool cleanOnly, VictimList& victims) = 0;
+		};
+
+		class BufferManager;
+
+		/*
+		 * A locked page, which is unlocked when the handle is released or destroyed.
+		 * The handle keeps the source loaded, UnloadSource waits until all handles of the source are released.
+		 */
+		class PageHandle : public Object, public NotCopyable
+		{
+			friend class BufferManager;
+		private:
+			BufferManager*			bm = nullptr;
+			IBufferSource*			source = nullptr;
+			BufferPage				page;
+			BufferPageDesc*			pageDesc = nullptr;
+			vuint64_t				pageSize = 0;
+			PageLatch				latch = PageLatch::Shared;
+			PersistanceType			persistanceType = PersistanceType::NoChanging;
+
+			void					MoveFrom(PageHandle& handle);
+		public:
+			PageHandle();
+			PageHandle(PageHandle&& handle);
+			~PageHandle();
+
+			PageHandle&				operator=(PageHandle&& handle);
+
+			bool					IsValid()const;
+			BufferPage				GetPage()const;
+			PageLatch				GetLatch()const;
+			void*					GetAddress()const;
+
+			// Returns nullptr if the handle is invalid or the object does not fit in the page
+			template<typename T>
+			T* GetView(vuint64_t offset = 0)const
+			{
+				if (!pageDesc || offset + sizeof(T) > pageSize) return nullptr;
+				return (T*)((char*)pageDesc->address + offset);
+			}
+
+			template<typename T>
+			T* GetArray(vuint64_t& count)const
+			{
+				count = pageDesc ? pageSize / sizeof(T) : 0;
+				return pageDesc ? (T*)pageDesc->address : nullptr;
+			}
+
+			// Sets how the page is unlocked on destruction, a shared handle could only use NoChanging
+			bool					SetPersistanceType(PersistanceType type);
+			PersistanceType			GetPersistanceType()const;
+
+			// Unlocks the page immediately with the chosen persistance type
+			bool					Release();
+		};
+
+		/*
+		 * A private ring of pages for sequential scans and bulk loads.
+		 * When the ring is full, a page brought into memory through the ring evicts the oldest page in the ring,
+		 * instead of evicting pages of other callers from the shared cache.
+		 * A page accessed by others after it enters the ring is left to the replacement policy.
+		 * A strategy is not shared between threads.
+		 */
+		class BufferAccessStrategy : public Object, public NotCopyable
+		{
+			friend class BufferManager;
+
+			struct RingEntry
+			{
+				BufferSource		source;
+				BufferPage			page;
+				vuint64_t			accessTime = 0;
+			};
+
+			typedef collections::Array<RingEntry>		RingArray;
+		private:
+			RingArray				ring;
+			vint					nextEntry = 0;
+			vint					usedEntryCount = 0;
+			vuint64_t				recycledPageCount = 0;
+		public:
+			BufferAccessStrategy(vint ringSize);
+
+			vint					GetRingSize();
+			vuint64_t				GetRecycledPageCount();
+		};
+
+		/*
+		 * A checkpoint record, pages with a first dirty LSN no greater than beginLsn have been written back and synced,
+		 * except skippedPageCount pages that were exclusively latched at the time.
+		 * recoveryLsn is the redo low-water mark, changes to pages stamped with smaller LSNs are durable,
+		 * it is the first dirty LSN of the oldest page still dirty, or beginLsn + 1.
+		 * recoveryTime is the first dirty time of the same page, or beginTime.
+		 */
+		struct BufferCheckpoint
+		{
+			vuint64_t				sequence = 0;
+			vuint64_t				beginTime = 0;
+			vuint64_t				endTime = 0;
+			vuint64_t				recoveryTime = 0;
+			vuint64_t				beginLsn = 0;
+			vuint64_t				endLsn = 0;
+			vuint64_t				recoveryLsn = 0;
+			vuint64_t				writtenPageCount = 0;
+			vuint64_t				skippedPageCount = 0;
 		};
 
 		class BufferManager
 		{
-			typedef collections::Dictionary<BufferSource, Ptr<IBufferSource>>				SourceMap;
+			friend class PageHandle;
+
+			typedef collections::List<IBufferSource*>										SourceList;
+
+			static const vint	SourceChunkSize = 1024;
+			static const vint	SourceChunkCount = 1024;
+			static const vint	ReaderSlotCount = 64;
+			static const vint	CacheLineSize = 64;
+			static const vint	AsyncQueueDepth = 64;
+			static const vint	CheckpointBatchSize = 16;
+			static const vint	CheckpointRecordSize = 11;							// uint64 items of a checkpoint record, ending with a CRC32C of other items
+			static const vuint64_t	CheckpointMagic = 0x544E494F504B4843ULL;		// CHKPOINT
+
+			typedef IBufferSource*	SourceChunk[SourceChunkSize];
+
+			// each slot takes a whole cache line, so that threads entering different slots do not share cache lines
+			struct ReaderSlot
+			{
+				volatile vint	readers;
+				char			padding[CacheLineSize - sizeof(vint)];
+			};
+
+			class SourceReader : public Object, public NotCopyable
+			{
+			private:
+				ReaderSlot*		slot;
+			public:
+				IBufferSource*	source;
+
+				SourceReader(BufferManager* bm, BufferSource _source);
+				~SourceReader();
+			};
 		private:
 			vuint64_t			pageSize;
 			vuint64_t			cachePageCount;
 			vuint64_t			pageSizeBits;
+			vuint64_t			pageDataSize;
+			bool				pageChecksums;
+			WString				spillDirectory;
 			volatile vuint64_t	totalCachedPages;
+			volatile vuint64_t	totalEvictedPages;
+			volatile vuint64_t	totalForegroundStalls;
+			volatile vuint64_t	totalCleanedPages;
 			SpinLock			lock;
 			volatile vint		usedSourceIndex;
-			SourceMap			sources;
+			SourceList			loadedSources;
+			SourceChunk*		sourceChunks[SourceChunkCount];
+			char				readerSlotBuffer[(ReaderSlotCount + 1) * CacheLineSize];
+			ReaderSlot*			readerSlots;			// aligned in readerSlotBuffer, because new does not align objects to cache lines before C++17
+			Ptr<IBufferReplacementPolicy>	replacementPolicy;
+			Ptr<buffer_internal::FramePool>	framePool;
+			Ptr<buffer_internal::AsyncFileReader>	asyncReader;
+			Ptr<buffer_internal::BufferCounters>	counters;
+			BufferMetrics		unloadedSourceMetrics;
+
+			bool				cleanerStarted;
+			EventObject			cleanerStoppedEvent;
+			volatile bool		cleanerRunning;
+			volatile bool		cleanerStopping;
+			volatile bool		cleanerRequested;
+			vuint64_t			cleanerLowWatermark;
+			vuint64_t			cleanerHighWatermark;
+			vint				cleanerInterval;
+			vint				cleanerBatchSize;
+
+			bool				metricsDumpStarted;
+			EventObject			metricsDumpStoppedEvent;
+			volatile bool		metricsDumpStopping;
 
-			void				SwapCacheIfNecessary();
+			CriticalSection		checkpointLock;
+			WString				checkpointFile;
+			BufferCheckpoint	lastCheckpoint;
+			bool				checkpointerStarted;
+			EventObject			checkpointerStoppedEvent;
+			volatile bool		checkpointerStopping;
+
+			IBufferSource*		GetSourceUnsafe(BufferSource source);
+			bool				RegisterSource(BufferSource source, IBufferSource* bs);
+			void				WaitForReaders();
+			void				WaitForHandles(IBufferSource* bs);
+			vuint64_t			EvictSourcePagesUnsafe(SourceList& sources, vuint64_t expectCount, bool foreground);
+			vuint64_t			EvictPagesUnsafe(vuint64_t expectCount, bool foreground);
+			vuint64_t			CleanPages(vuint64_t expectCount);
+			void				RunCleaner();
+			void				RunMetricsDump(vint milliseconds, Func<void(const WString&)> callback);
+			BufferPageDesc*		GetOldestDirtyPageUnsafe(IBufferSource* source);
+			bool				WriteCheckpointFile(const BufferCheckpoint& checkpoint);
+			void				RunCheckpointer(vint milliseconds, Func<void(const BufferCheckpoint&)> callback);
+			void				SwapCacheIfNecessary(IBufferSource* bs);
+			void				RecycleRingEntry(BufferAccessStrategy* strategy);
+			bool				ReleasePageHandle(PageHandle& handle);
 		public:
-			BufferManager(vuint64_t _pageSize, vuint64_t _cachePageCount);
+			BufferManager(vuint64_t _pageSize, vuint64_t _cachePageCount, BufferReplacement _replacement = BufferReplacement::Clock, const BufferPoolOptions& _poolOptions = BufferPoolOptions());
 			~BufferManager();
 
 			vuint64_t			GetPageSize();
+
+			// Bytes of a page available to callers, which excludes the checksum trailer when page checksums are enabled
+			vuint64_t			GetPageDataSize();
 			vuint64_t			GetCachePageCount();
 			vuint64_t			GetCacheSize();
 			vuint64_t			GetCurrentlyCachedPageCount();
+			vuint64_t			GetEvictedPageCount();
+			vuint64_t			GetForegroundStallCount();
+			vuint64_t			GetCleanedPageCount();
+
+			// The background cleaner writes back dirty pages and keeps the cache between the watermarks,
+			// when it is running, eviction in foreground calls only unmaps clean pages
+			bool				StartBackgroundCleaner();
+			bool				StopBackgroundCleaner();
+			bool				IsBackgroundCleanerRunning();
+			bool				SetCleanerWatermarks(vuint64_t lowWatermark, vuint64_t highWatermark);
+			void				SetCleanerInterval(vint milliseconds);
+			void				SetCleanerBatchSize(vint pageCount);
+
+			// Counters of unloaded sources are kept in the global metrics
+			void				GetMetrics(BufferMetrics& metrics);
+			bool				GetSourceMetrics(BufferSource source, BufferMetrics& metrics);
+
+			// Calls the callback with the text of the global metrics periodically in a background thread
+			bool				StartMetricsDump(vint milliseconds, const Func<void(const WString&)>& callback);
+			bool				StopMetricsDump();
+
+			// The first dirty time of the oldest dirty page in all sources, or ~0 if no page is dirty
+			vuint64_t			GetOldestDirtyTime();
+
+			// Writes back pages in the dirty page table of each file source when the checkpoint begins, in the order of pages,
+			// the lock of a source is held for only a few pages at a time, so that foreground calls keep running.
+			// Only one checkpoint runs at a time. The record is written to the checkpoint file if there is one,
+			// returns false if the file cannot be written, the record is still returned and kept as the last checkpoint.
+			bool				Checkpoint(BufferCheckpoint& checkpoint);
+
+			// Returns false if no checkpoint has been taken or loaded from the checkpoint file
+			bool				GetLastCheckpoint(BufferCheckpoint& checkpoint);
+
+			// Reads the record written to a checkpoint file, returns false if the file does not exist or is not a valid record
+			static bool			ReadCheckpointFile(const WString& fileName, BufferCheckpoint& checkpoint);
+
+			// Takes a checkpoint periodically in a background thread, the callback could be empty
+			bool				StartCheckpointer(vint milliseconds, const Func<void(const BufferCheckpoint&)>& callback);
+			bool				StopCheckpointer();
 
 			BufferSource		LoadMemorySource();
-			BufferSource		LoadFileSource(const WString& fileName, bool createNew);
+
+			// Writes all pages of a memory source to a snapshot file, the source is locked until the file is written,
+			// returns false if the source is not a memory source or one of its pages is exclusively locked
+			bool				DumpMemorySource(BufferSource source, const WString& fileName);
+
+			// Creates a memory source from a snapshot file, pages are copied from the mapped file when they are locked for the first time
+			BufferSource		RestoreMemorySource(const WString& fileName);
+			BufferSource		LoadFileSource(const WString& fileName, bool createNew, FileSourceMode mode = FileSourceMode::MemoryMapped);
 			bool				UnloadSource(BufferSource source);
 			WString				GetSourceFileName(BufferSource source);
 
-			void*				LockPage(BufferSource source, BufferPage page);
+			// Sources are created in the Data class without quotas
+			bool				SetSourcePriority(BufferSource source, BufferPriority priority);
+			bool				SetSourceQuota(BufferSource source, vuint64_t minPageCount, vuint64_t maxPageCount);
+			bool				GetSourceQuota(BufferSource source, BufferSourceQuota& quota);
+			vuint64_t			GetSourceCachedPageCount(BufferSource source);
+
+			void*				LockPage(BufferSource source, BufferPage page, PageLatch latch = PageLatch::Exclusive);
+			void*				LockPageShared(BufferSource source, BufferPage page);
+			void*				LockPageExclusive(BufferSource source, BufferPage page);
 			bool				UnlockPage(BufferSource source, BufferPage page, void* buffer, PersistanceType persistanceType);
+
+			// Pages not in memory are read through the ring of the strategy, a null strategy uses the shared cache like other overloads
+			void*				LockPage(BufferSource source, BufferPage page, PageLatch latch, BufferAccessStrategy* strategy);
+
+			// The handle is invalid if the page cannot be locked
+			PageHandle			LockPageHandle(BufferSource source, BufferPage page, PageLatch latch = PageLatch::Exclusive);
+
+			// Returns immediately, a page of an AsyncFrames source that is not in memory is read in the background.
+			// While a page is being read, LockPageAsync on the same page waits for the same read,
+			// and LockPage reads it again synchronously.
+			Ptr<BufferCompletion>	LockPageAsync(BufferSource source, BufferPage page, PageLatch latch = PageLatch::Exclusive);
+
+			// Unlocking with ChangedAndPersist does not wait for the page to be persisted, the ticket is replaced to wait for it.
+			// Waiting for a ticket also waits for all earlier tickets of the same source,
+			// requests from different threads are written back together with one file sync.
+			bool				UnlockPage(BufferSource source, BufferPage page, void* buffer, PersistanceType persistanceType, BufferTicket& ticket);
+			bool				WaitForPersistance(BufferSource source, BufferTicket ticket);
+
+			// Locks all pages or none of them, pages not in memory are prefetched together before locking
+			bool				LockPages(BufferSource source, const BufferPage* pages, vint count, void** buffers, PageLatch latch);
+			bool				UnlockPages(BufferSource source, const BufferPage* pages, vint count, void** buffers, PersistanceType persistanceType);
+			vint				PrefetchPages(BufferSource source, const BufferPage* pages, vint count);
 			BufferPage			GetIndexPage(BufferSource source);
 			BufferPage			AllocatePage(BufferSource source);
 			bool				FreePage(BufferSource source, BufferPage page);
+
+			// Allocates count pages or none of them, pages are adjacent when contiguous is true.
+			// A file source takes pages from its free extents before appending pages to the file.
+			bool				AllocatePages(BufferSource source, vint count, bool contiguous, BufferPage* pages);
+			// Returns false if any page is not freed, other pages are still freed
+			bool				FreePages(BufferSource source, const BufferPage* pages, vint count);
 			bool				EncodePointer(BufferPointer& pointer, BufferPage page, vuint64_t offset);
 			bool				DecodePointer(BufferPointer pointer, BufferPage& page, vuint64_t& offset);
 		};
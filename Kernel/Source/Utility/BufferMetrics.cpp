@@ -0,0 +1,176 @@
+#include "BufferMetrics.h"
+#include <string.h>
+
+namespace vl
+{
+	namespace database
+	{
+		using namespace collections;
+
+/***********************************************************************
+BufferMetrics
+***********************************************************************/
+
+		BufferMetrics::BufferMetrics()
+		{
+			memset(counters, 0, sizeof(counters));
+			memset(lockPageLatency, 0, sizeof(lockPageLatency));
+		}
+
+		vuint64_t BufferMetrics::Get(BufferCounter counter)const
+		{
+			return counters[(vint)counter];
+		}
+
+		vuint64_t BufferMetrics::GetSampledLockPageCount()const
+		{
+			vuint64_t count = 0;
+			for (vint i = 0; i < LatencyBucketCount; i++)
+			{
+				count += lockPageLatency[i];
+			}
+			return count;
+		}
+
+		void BufferMetrics::Add(const BufferMetrics& metrics)
+		{
+			for (vint i = 0; i < CounterCount; i++)
+			{
+				counters[i] += metrics.counters[i];
+			}
+			for (vint i = 0; i < LatencyBucketCount; i++)
+			{
+				lockPageLatency[i] += metrics.lockPageLatency[i];
+			}
+		}
+
+		WString BufferMetrics::ToString()const
+		{
+			static const wchar_t* counterNames[] =
+			{
+				L"PageHits",
+				L"PageMisses",
+				L"PageUnmaps",
+				L"SegmentMaps",
+				L"PageWriteBacks",
+				L"WrittenBytes",
+				L"FileSyncs",
+				L"EvictionBatches",
+				L"EvictedPages",
+				L"RecycledPages",
+				L"ChecksumFailures",
+				L"LockContentions",
+				L"LockSpins",
+			};
+			static_assert(sizeof(counterNames) / sizeof(*counterNames) == CounterCount, "Every counter should have a name.");
+
+			WString result;
+			for (vint i = 0; i < CounterCount; i++)
+			{
+				result += WString(counterNames[i]) + L": " + u64tow(counters[i]) + L"\r\n";
+			}
+
+			result += L"Sampled LockPage: " + u64tow(GetSampledLockPageCount()) + L"\r\n";
+			for (vint i = 0; i < LatencyBucketCount; i++)
+			{
+				if (lockPageLatency[i] > 0)
+				{
+					auto bound = i == LatencyBucketCount - 1 ? WString(L">= ") + u64tow((vuint64_t)1 << (i - 1)) : WString(L"< ") + u64tow((vuint64_t)1 << i);
+					result += L"    " + bound + L" ns: " + u64tow(lockPageLatency[i]) + L"\r\n";
+				}
+			}
+			return result;
+		}
+
+		namespace buffer_internal
+		{
+			vint GetBufferThreadIndex()
+			{
+				static volatile vint usedThreadIndices = 0;
+				static thread_local vint threadIndex = -1;
+				if (threadIndex == -1)
+				{
+					threadIndex = INCRC(&usedThreadIndices) - 1;
+				}
+				return threadIndex;
+			}
+
+			bool SampleLockPageLatency()
+			{
+				// timing every call costs more than locking a page in memory
+				static thread_local vint lockPageCount = 0;
+				return lockPageCount++ % BufferMetrics::LatencySampleInterval == 0;
+			}
+
+/***********************************************************************
+BufferCounters
+***********************************************************************/
+
+			BufferCounters::Stripe& BufferCounters::GetStripe()
+			{
+				return stripes[GetBufferThreadIndex() % StripeCount];
+			}
+
+			BufferCounters::BufferCounters()
+			{
+				memset(stripes, 0, sizeof(stripes));
+			}
+
+			void BufferCounters::Increase(BufferCounter counter, vuint64_t value)
+			{
+				// threads could share a stripe when there are more threads than stripes
+				__sync_fetch_and_add(&GetStripe().counters[(vint)counter], value);
+			}
+
+			void BufferCounters::RecordLockPageLatency(vuint64_t nanoseconds)
+			{
+				vint bucket = nanoseconds == 0 ? 0 : 64 - __builtin_clzll(nanoseconds);
+				if (bucket >= BufferMetrics::LatencyBucketCount)
+				{
+					bucket = BufferMetrics::LatencyBucketCount - 1;
+				}
+				__sync_fetch_and_add(&GetStripe().lockPageLatency[bucket], 1);
+			}
+
+			void BufferCounters::Collect(BufferMetrics& metrics)
+			{
+				for (vint i = 0; i < StripeCount; i++)
+				{
+					auto& stripe = stripes[i];
+					for (vint j = 0; j < BufferMetrics::CounterCount; j++)
+					{
+						metrics.counters[j] += stripe.counters[j];
+					}
+					for (vint j = 0; j < BufferMetrics::LatencyBucketCount; j++)
+					{
+						metrics.lockPageLatency[j] += stripe.lockPageLatency[j];
+					}
+				}
+			}
+
+/***********************************************************************
+CountedSpinLockScope
+***********************************************************************/
+
+			CountedSpinLockScope::CountedSpinLockScope(SpinLock& _spinLock, BufferCounters& counters)
+				:spinLock(&_spinLock)
+			{
+				if (!spinLock->TryEnter())
+				{
+					vuint64_t spins = 1;
+					while (!spinLock->TryEnter())
+					{
+						spins++;
+					}
+					counters.Increase(BufferCounter::LockContentions);
+					counters.Increase(BufferCounter::LockSpins, spins);
+				}
+			}
+
+			CountedSpinLockScope::~CountedSpinLockScope()
+			{
+				spinLock->Leave();
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_BUFFERMETRICS
+#define VCZH_DATABASE_UTILITY_BUFFERMETRICS
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			// A small number identifying the calling thread, for spreading threads over cache line padded slots
+			extern vint						GetBufferThreadIndex();
+
+			// Returns true for one of every BufferMetrics::LatencySampleInterval calls in each thread
+			extern bool						SampleLockPageLatency();
+
+			/*
+			 * Counters are spread over stripes in separated cache lines,
+			 * each thread updates its own stripe, and a snapshot sums up all stripes.
+			 */
+			class BufferCounters : public Object, public NotCopyable
+			{
+				static const vint			StripeCount = 16;
+				static const vint			StripeItemCount = BufferMetrics::CounterCount + BufferMetrics::LatencyBucketCount;
+
+				struct Stripe
+				{
+					volatile vuint64_t		counters[BufferMetrics::CounterCount];
+					volatile vuint64_t		lockPageLatency[BufferMetrics::LatencyBucketCount];
+					char					padding[64 - StripeItemCount * sizeof(vuint64_t) % 64];
+				};
+			private:
+				Stripe						stripes[StripeCount];
+
+				Stripe&						GetStripe();
+			public:
+				BufferCounters();
+
+				void						Increase(BufferCounter counter, vuint64_t value = 1);
+				void						RecordLockPageLatency(vuint64_t nanoseconds);
+				void						Collect(BufferMetrics& metrics);
+			};
+
+			/*
+			 * Acquires a spin lock like SpinLock::Scope, and counts contentions and spins.
+			 */
+			class CountedSpinLockScope : public Object, public NotCopyable
+			{
+			private:
+				SpinLock*					spinLock;
+			public:
+				CountedSpinLockScope(SpinLock& _spinLock, BufferCounters& counters);
+				~CountedSpinLockScope();
+			};
+		}
+	}
+}
+
+#define SOURCE_LOCK(BS) SCOPE_VARIABLE(const vl::database::buffer_internal::CountedSpinLockScope&, scope, vl::database::buffer_internal::CountedSpinLockScope((BS)->GetLock(), (BS)->GetCounters()))
+
+#endif
@@ -0,0 +1,529 @@
+#include "CompressedPageStore.h"
+#include "FileBuffer.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#define CODEC_RAW 1
+#define CODEC_LZ 2
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			using namespace collections;
+
+/***********************************************************************
+Codec
+***********************************************************************/
+
+			static const vint			MinMatchLength = 4;
+			static const vint			MaxMatchDistance = 65535;
+			static const vint			HashBits = 12;
+
+			static inline vuint32_t ReadSequence(const vuint8_t* p)
+			{
+				vuint32_t value;
+				memcpy(&value, p, sizeof(value));
+				return value;
+			}
+
+			static inline vuint32_t HashSequence(vuint32_t sequence)
+			{
+				return (sequence * 2654435761U) >> (32 - HashBits);
+			}
+
+			static inline bool WriteLength(vuint8_t*& op, vuint8_t* outputEnd, vuint64_t length)
+			{
+				while (length >= 255)
+				{
+					if (op == outputEnd) return false;
+					*op++ = 255;
+					length -= 255;
+				}
+				if (op == outputEnd) return false;
+				*op++ = (vuint8_t)length;
+				return true;
+			}
+
+			static inline bool ReadLength(const vuint8_t*& ip, const vuint8_t* inputEnd, vuint64_t& length)
+			{
+				vuint8_t byte = 0;
+				do
+				{
+					if (ip == inputEnd) return false;
+					byte = *ip++;
+					length += byte;
+				} while (byte == 255);
+				return true;
+			}
+
+			static bool WriteSequence(vuint8_t*& op, vuint8_t* outputEnd, const vuint8_t* literals, vuint64_t literalLength, vuint64_t distance, vuint64_t matchLength)
+			{
+				if (op == outputEnd) return false;
+				vuint8_t* token = op++;
+				vuint64_t matchCode = matchLength == 0 ? 0 : matchLength - MinMatchLength;
+				*token = (vuint8_t)((literalLength < 15 ? literalLength : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+
+				if (literalLength >= 15 && !WriteLength(op, outputEnd, literalLength - 15)) return false;
+				if ((vuint64_t)(outputEnd - op) < literalLength) return false;
+				memcpy(op, literals, literalLength);
+				op += literalLength;
+
+				if (matchLength > 0)
+				{
+					if (outputEnd - op < 2) return false;
+					*op++ = (vuint8_t)distance;
+					*op++ = (vuint8_t)(distance >> 8);
+					if (matchCode >= 15 && !WriteLength(op, outputEnd, matchCode - 15)) return false;
+				}
+				return true;
+			}
+
+			vuint64_t CompressPage(const void* input, vuint64_t inputSize, void* output, vuint64_t outputCapacity)
+			{
+				// positions are stored plus one, so that 0 means an empty bucket
+				vuint32_t table[1 << HashBits];
+				memset(table, 0, sizeof(table));
+
+				auto source = (const vuint8_t*)input;
+				auto inputEnd = source + inputSize;
+				auto ip = source;
+				auto anchor = source;
+				auto op = (vuint8_t*)output;
+				auto outputEnd = op + outputCapacity;
+
+				while (inputEnd - ip >= MinMatchLength)
+				{
+					auto sequence = ReadSequence(ip);
+					auto& bucket = table[HashSequence(sequence)];
+					auto candidate = bucket;
+					bucket = (vuint32_t)(ip - source) + 1;
+
+					if (candidate == 0 || (ip - source) + 1 - candidate > MaxMatchDistance || ReadSequence(source + candidate - 1) != sequence)
+					{
+						// skip faster in data that does not compress
+						ip += 1 + ((ip - anchor) >> 6);
+						continue;
+					}
+
+					auto match = source + candidate - 1;
+					vuint64_t matchLength = MinMatchLength;
+					while (ip + matchLength < inputEnd && match[matchLength] == ip[matchLength])
+					{
+						matchLength++;
+					}
+
+					if (!WriteSequence(op, outputEnd, anchor, ip - anchor, ip - match, matchLength)) return 0;
+					ip += matchLength;
+					anchor = ip;
+				}
+
+				if (anchor < inputEnd)
+				{
+					if (!WriteSequence(op, outputEnd, anchor, inputEnd - anchor, 0, 0)) return 0;
+				}
+				return op - (vuint8_t*)output;
+			}
+
+			bool DecompressPage(const void* input, vuint64_t inputSize, void* output, vuint64_t outputSize)
+			{
+				auto ip = (const vuint8_t*)input;
+				auto inputEnd = ip + inputSize;
+				auto target = (vuint8_t*)output;
+				auto op = target;
+				auto outputEnd = op + outputSize;
+
+				while (op < outputEnd)
+				{
+					if (ip == inputEnd) return false;
+					vuint8_t token = *ip++;
+
+					vuint64_t literalLength = token >> 4;
+					if (literalLength == 15 && !ReadLength(ip, inputEnd, literalLength)) return false;
+					if ((vuint64_t)(inputEnd - ip) < literalLength || (vuint64_t)(outputEnd - op) < literalLength) return false;
+					memcpy(op, ip, literalLength);
+					ip += literalLength;
+					op += literalLength;
+					if (op == outputEnd) break;
+
+					if (inputEnd - ip < 2) return false;
+					vuint64_t distance = ip[0] | ((vuint64_t)ip[1] << 8);
+					ip += 2;
+					vuint64_t matchLength = token & 15;
+					if (matchLength == 15 && !ReadLength(ip, inputEnd, matchLength)) return false;
+					matchLength += MinMatchLength;
+					if (distance == 0 || distance > (vuint64_t)(op - target) || (vuint64_t)(outputEnd - op) < matchLength) return false;
+
+					// a match could overlap the bytes it produces, so it is copied byte by byte
+					auto match = op - distance;
+					for (vuint64_t i = 0; i < matchLength; i++)
+					{
+						op[i] = match[i];
+					}
+					op += matchLength;
+				}
+				return true;
+			}
+
+/***********************************************************************
+CompressedPageStore
+***********************************************************************/
+
+			static inline vuint64_t EncodeEntry(vuint64_t codec, vuint64_t sectorCount, vuint64_t sectorOffset)
+			{
+				return codec | sectorCount << 4 | sectorOffset << 24;
+			}
+
+			static inline vuint64_t GetEntryCodec(vuint64_t entry)
+			{
+				return entry & 15;
+			}
+
+			static inline vuint64_t GetEntrySectorCount(vuint64_t entry)
+			{
+				return (entry >> 4) & 0xFFFFF;
+			}
+
+			static inline vuint64_t GetEntrySectorOffset(vuint64_t entry)
+			{
+				return entry >> 24;
+			}
+
+			vuint64_t CompressedPageStore::AllocateExtentUnsafe(vuint64_t sectorCount)
+			{
+				// a larger free extent is split when there is no free extent of the same size
+				for (vuint64_t size = sectorCount; size <= maxSectorCount; size++)
+				{
+					auto& extents = *freeExtents[(vint)size].Obj();
+					if (extents.Count() > 0)
+					{
+						auto sectorOffset = extents[extents.Count() - 1];
+						extents.RemoveAt(extents.Count() - 1);
+						if (size > sectorCount)
+						{
+							freeExtents[(vint)(size - sectorCount)]->Add(sectorOffset + sectorCount);
+						}
+						return sectorOffset;
+					}
+				}
+
+				auto sectorOffset = endSector;
+				endSector += sectorCount;
+				return sectorOffset;
+			}
+
+			void CompressedPageStore::FreeExtentUnsafe(vuint64_t sectorOffset, vuint64_t sectorCount)
+			{
+				while (sectorCount > 0)
+				{
+					auto size = sectorCount < maxSectorCount ? sectorCount : maxSectorCount;
+					freeExtents[(vint)size]->Add(sectorOffset);
+					sectorOffset += size;
+					sectorCount -= size;
+				}
+			}
+
+			void CompressedPageStore::WriteHeader(vuint64_t pageCount)
+			{
+				vuint64_t header[3] = {MapMagic, pageSize, pageCount};
+				CHECK_ERROR(pwrite(mapDescriptor, header, sizeof(header), 0) == sizeof(header), L"vl::database::buffer_internal::CompressedPageStore::WriteHeader(vuint64_t)#Internal error: Failed to call pwrite.");
+			}
+
+			CompressedPageStore::CompressedPageStore(vuint64_t _pageSize, int _fileDescriptor)
+				:pageSize(_pageSize)
+				,maxSectorCount(_pageSize / SectorSize)
+				,fileDescriptor(_fileDescriptor)
+				,freeExtents((vint)(_pageSize / SectorSize) + 1)
+				,compressBuffer((vint)_pageSize)
+			{
+				for (vint i = 0; i < freeExtents.Count(); i++)
+				{
+					freeExtents[i] = new EntryList;
+				}
+			}
+
+			CompressedPageStore::~CompressedPageStore()
+			{
+				if (mapDescriptor != -1)
+				{
+					CloseFileForFileSource(mapDescriptor);
+				}
+			}
+
+			bool CompressedPageStore::InitializeEmptySource(const WString& mapFileName)
+			{
+				mapDescriptor = CreateNewFileForFileSource(mapFileName);
+				if (mapDescriptor == -1) return false;
+				WriteHeader(0);
+				return true;
+			}
+
+			bool CompressedPageStore::InitializeExistingSource(const WString& mapFileName)
+			{
+				mapDescriptor = OpenExistingFileForFileSource(mapFileName);
+				if (mapDescriptor == -1) return false;
+
+				vuint64_t header[3] = {0};
+				if (pread(mapDescriptor, header, sizeof(header), 0) != sizeof(header)) return false;
+				if (header[0] != MapMagic || header[1] != pageSize) return false;
+
+				vuint64_t pageCount = header[2];
+				if (pageCount > 0)
+				{
+					Array<vuint64_t> buffer((vint)pageCount);
+					vuint64_t size = pageCount * sizeof(vuint64_t);
+					if (pread(mapDescriptor, &buffer[0], size, MapBlockSize) != (ssize_t)size) return false;
+					CopyFrom(entries, buffer);
+				}
+				syncedPageCount = pageCount;
+
+				// gaps between used extents are extents freed before the store was closed
+				List<vuint64_t> usedEntries;
+				FOREACH(vuint64_t, entry, entries)
+				{
+					if (entry != 0)
+					{
+						usedEntries.Add(entry);
+					}
+				}
+				if (usedEntries.Count() > 0)
+				{
+					SortLambda(&usedEntries[0], usedEntries.Count(), [](vuint64_t a, vuint64_t b)
+					{
+						auto offsetA = GetEntrySectorOffset(a);
+						auto offsetB = GetEntrySectorOffset(b);
+						return offsetA < offsetB ? -1 : offsetA > offsetB ? 1 : 0;
+					});
+				}
+				FOREACH(vuint64_t, entry, usedEntries)
+				{
+					auto sectorOffset = GetEntrySectorOffset(entry);
+					if (sectorOffset < endSector) return false;
+					FreeExtentUnsafe(endSector, sectorOffset - endSector);
+					endSector = sectorOffset + GetEntrySectorCount(entry);
+				}
+				return true;
+			}
+
+			vuint64_t CompressedPageStore::GetPageCount()
+			{
+				vuint64_t pageCount = 0;
+				SPIN_LOCK(lock)
+				{
+					pageCount = entries.Count();
+				}
+				return pageCount;
+			}
+
+			void CompressedPageStore::AppendPage()
+			{
+				SPIN_LOCK(lock)
+				{
+					vint block = entries.Count() / EntriesPerMapBlock;
+					if (!dirtyMapBlocks.Contains(block))
+					{
+						dirtyMapBlocks.Add(block);
+					}
+					entries.Add(0);
+				}
+			}
+
+			void CompressedPageStore::TrimPages(vuint64_t pageCount)
+			{
+				SPIN_LOCK(lock)
+				{
+					// the map file still refers to extents of removed pages until the header is written by Sync
+					while ((vuint64_t)entries.Count() > pageCount)
+					{
+						auto entry = entries[entries.Count() - 1];
+						if (entry != 0)
+						{
+							releasingEntries.Add(entry);
+						}
+						entries.RemoveAt(entries.Count() - 1);
+					}
+				}
+			}
+
+			vuint64_t CompressedPageStore::GetStoredSectorCount()
+			{
+				vuint64_t sectorCount = 0;
+				SPIN_LOCK(lock)
+				{
+					FOREACH(vuint64_t, entry, entries)
+					{
+						sectorCount += GetEntrySectorCount(entry);
+					}
+				}
+				return sectorCount;
+			}
+
+			bool CompressedPageStore::ReadPage(vuint64_t index, void* buffer)
+			{
+				vuint64_t entry = 0;
+				SPIN_LOCK(lock)
+				{
+					if (index >= (vuint64_t)entries.Count()) return false;
+					entry = entries[(vint)index];
+				}
+
+				if (entry == 0)
+				{
+					memset(buffer, 0, pageSize);
+					return true;
+				}
+
+				auto size = GetEntrySectorCount(entry) * SectorSize;
+				auto offset = GetEntrySectorOffset(entry) * SectorSize;
+				switch (GetEntryCodec(entry))
+				{
+				case CODEC_RAW:
+					return pread(fileDescriptor, buffer, pageSize, offset) == (ssize_t)pageSize;
+				case CODEC_LZ:
+					if (pread(fileDescriptor, &compressBuffer[0], size, offset) != (ssize_t)size) return false;
+					return DecompressPage(&compressBuffer[0], size, buffer, pageSize);
+				default:
+					return false;
+				}
+			}
+
+			vuint64_t CompressedPageStore::WritePage(vuint64_t index, const void* buffer)
+			{
+				// a page is compressed only when it saves at least one sector
+				auto codec = CODEC_LZ;
+				const void* data = &compressBuffer[0];
+				auto size = CompressPage(buffer, pageSize, &compressBuffer[0], pageSize - SectorSize);
+				if (size == 0)
+				{
+					codec = CODEC_RAW;
+					data = buffer;
+					size = pageSize;
+				}
+				auto sectorCount = (size + SectorSize - 1) / SectorSize;
+				if (codec == CODEC_LZ)
+				{
+					memset(&compressBuffer[0] + size, 0, sectorCount * SectorSize - size);
+				}
+
+				// a page needing the same number of sectors is written in place like an uncompressed page, the map does not change
+				vuint64_t sectorOffset = 0;
+				bool inPlace = false;
+				SPIN_LOCK(lock)
+				{
+					auto entry = entries[(vint)index];
+					if (entry != 0 && GetEntrySectorCount(entry) == sectorCount)
+					{
+						sectorOffset = GetEntrySectorOffset(entry);
+						inPlace = true;
+					}
+					else
+					{
+						sectorOffset = AllocateExtentUnsafe(sectorCount);
+					}
+				}
+
+				// the map is updated after the page is written, so that Sync never records an extent before its content
+				auto written = sectorCount * SectorSize;
+				CHECK_ERROR(pwrite(fileDescriptor, data, written, sectorOffset * SectorSize) == (ssize_t)written, L"vl::database::buffer_internal::CompressedPageStore::WritePage(vuint64_t, const void*)#Internal error: Failed to call pwrite.");
+				if (inPlace)
+				{
+					return written;
+				}
+
+				SPIN_LOCK(lock)
+				{
+					auto& entry = entries[(vint)index];
+					if (entry != 0)
+					{
+						releasingEntries.Add(entry);
+					}
+					entry = EncodeEntry(codec, sectorCount, sectorOffset);
+					vint block = (vint)(index / EntriesPerMapBlock);
+					if (!dirtyMapBlocks.Contains(block))
+					{
+						dirtyMapBlocks.Add(block);
+					}
+				}
+				return written;
+			}
+
+			void CompressedPageStore::PrefetchPage(vuint64_t index)
+			{
+				vuint64_t entry = 0;
+				SPIN_LOCK(lock)
+				{
+					if (index < (vuint64_t)entries.Count())
+					{
+						entry = entries[(vint)index];
+					}
+				}
+				if (entry != 0)
+				{
+					posix_fadvise(fileDescriptor, GetEntrySectorOffset(entry) * SectorSize, GetEntrySectorCount(entry) * SectorSize, POSIX_FADV_WILLNEED);
+				}
+			}
+
+			void CompressedPageStore::Sync()
+			{
+				CS_LOCK(syncLock)
+				{
+					// map blocks are copied first, so that they only refer to pages written before the data file is synced
+					vuint64_t pageCount = 0;
+					List<vint> blocks;
+					Array<vuint64_t> blockEntries;
+					List<vuint64_t> releasedEntries;
+					SPIN_LOCK(lock)
+					{
+						pageCount = entries.Count();
+						CopyFrom(blocks, dirtyMapBlocks);
+						dirtyMapBlocks.Clear();
+						CopyFrom(releasedEntries, releasingEntries);
+						releasingEntries.Clear();
+
+						blockEntries.Resize(blocks.Count() * EntriesPerMapBlock);
+						for (vint i = 0; i < blocks.Count(); i++)
+						{
+							for (vint j = 0; j < EntriesPerMapBlock; j++)
+							{
+								vint index = blocks[i] * EntriesPerMapBlock + j;
+								blockEntries[i * EntriesPerMapBlock + j] = index < entries.Count() ? entries[index] : 0;
+							}
+						}
+					}
+
+					CHECK_ERROR(fdatasync(fileDescriptor) != -1, L"vl::database::buffer_internal::CompressedPageStore::Sync()#Internal error: Failed to call fdatasync.");
+					if (blocks.Count() == 0 && pageCount == syncedPageCount)
+					{
+						return;
+					}
+
+					for (vint i = 0; i < blocks.Count(); i++)
+					{
+						CHECK_ERROR(pwrite(mapDescriptor, &blockEntries[i * EntriesPerMapBlock], MapBlockSize, MapBlockSize * (blocks[i] + 1)) == (ssize_t)MapBlockSize, L"vl::database::buffer_internal::CompressedPageStore::Sync()#Internal error: Failed to call pwrite.");
+					}
+					if (pageCount != syncedPageCount)
+					{
+						WriteHeader(pageCount);
+						syncedPageCount = pageCount;
+					}
+					CHECK_ERROR(fdatasync(mapDescriptor) != -1, L"vl::database::buffer_internal::CompressedPageStore::Sync()#Internal error: Failed to call fdatasync.");
+
+					// old extents are no longer referred to by the map file
+					SPIN_LOCK(lock)
+					{
+						FOREACH(vuint64_t, entry, releasedEntries)
+						{
+							FreeExtentUnsafe(GetEntrySectorOffset(entry), GetEntrySectorCount(entry));
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+#undef CODEC_RAW
+#undef CODEC_LZ
@@ -0,0 +1,108 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_COMPRESSEDPAGESTORE
+#define VCZH_DATABASE_UTILITY_COMPRESSEDPAGESTORE
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * An LZ77 codec in the style of LZ4 for pages, matches are found by a hash table of 4 byte sequences.
+			 * A sequence is [token][literals][uint16 distance] where the token holds 4 bits of the literal length and 4 bits of the match length,
+			 * longer lengths continue in extra bytes of 255.
+			 * Decompressing stops when the output is full, so bytes padded after the compressed data are ignored.
+			 */
+
+			// Returns the size of the compressed data, or 0 if it does not fit in the output
+			extern vuint64_t				CompressPage(const void* input, vuint64_t inputSize, void* output, vuint64_t outputCapacity);
+
+			// Returns false if the compressed data is corrupted or does not fill the output exactly
+			extern bool						DecompressPage(const void* input, vuint64_t inputSize, void* output, vuint64_t outputSize);
+
+			/*
+			 * Pages of a file stored as variable sized extents of sectors.
+			 * A page is compressed when it saves at least one sector, otherwise it is stored as it is.
+			 * The page-to-extent map is kept in memory and in a map file next to the data file,
+			 * a page never written has no extent and reads as zeros.
+			 *
+			 * A page needing the same number of sectors is written over its old extent.
+			 * Otherwise it moves to a new extent, and the old extent is freed after the next Sync,
+			 * so that the map file never refers to an extent reused by another page.
+			 * Free extents are kept in lists by their sizes, and rebuilt from gaps between used extents when the store is opened.
+			 *
+			 * Map File
+			 *		Header Block	: [uint64 Magic][uint64 PageSize][uint64 PageCount]
+			 *		Map Block		: {[uint64 Entry] ...}
+			 *			Entry		: [bit 0-3 Codec][bit 4-23 SectorCount][bit 24-63 SectorOffset], 0 for pages never written
+			 */
+			class CompressedPageStore : public Object, public NotCopyable
+			{
+				typedef collections::List<vuint64_t>							EntryList;
+				typedef collections::Array<Ptr<EntryList>>						ExtentListArray;
+				typedef collections::SortedList<vint>							BlockList;
+
+				static const vuint64_t		MapMagic = 0x50414D4547415048ULL;	// HPAGEMAP
+			public:
+				static const vuint64_t		SectorSize = 512;
+				static const vuint64_t		MapBlockSize = 4096;
+				static const vint			EntriesPerMapBlock = (vint)(MapBlockSize / sizeof(vuint64_t));
+			private:
+				vuint64_t					pageSize;
+				vuint64_t					maxSectorCount;
+				int							fileDescriptor;
+				int							mapDescriptor = -1;
+
+				SpinLock					lock;
+				EntryList					entries;
+				BlockList					dirtyMapBlocks;
+				ExtentListArray				freeExtents;		// offsets of free extents, indexed by sector counts
+				EntryList					releasingEntries;	// extents replaced since the last Sync
+				vuint64_t					endSector = 0;
+				vuint64_t					syncedPageCount = 0;
+
+				CriticalSection				syncLock;
+				collections::Array<char>	compressBuffer;
+
+				vuint64_t					AllocateExtentUnsafe(vuint64_t sectorCount);
+				void						FreeExtentUnsafe(vuint64_t sectorOffset, vuint64_t sectorCount);
+				void						WriteHeader(vuint64_t pageCount);
+			public:
+				// The data file is owned by the caller, the map file is owned by the store
+				CompressedPageStore(vuint64_t _pageSize, int _fileDescriptor);
+				~CompressedPageStore();
+
+				// Returns false if the map file cannot be created or opened, does not match the page size, or is corrupted
+				bool						InitializeEmptySource(const WString& mapFileName);
+				bool						InitializeExistingSource(const WString& mapFileName);
+
+				vuint64_t					GetPageCount();
+				void						AppendPage();
+				// Removes pages from the end, their extents are freed after the next Sync
+				void						TrimPages(vuint64_t pageCount);
+
+				// Sectors used by pages in the data file, not counting free extents
+				vuint64_t					GetStoredSectorCount();
+
+				// ReadPage and WritePage are called while holding the lock of the source, WritePage returns the number of bytes written
+				bool						ReadPage(vuint64_t index, void* buffer);
+				vuint64_t					WritePage(vuint64_t index, const void* buffer);
+				void						PrefetchPage(vuint64_t index);
+
+				// Makes written pages durable and then updates the map file, called without holding the lock of the source
+				void						Sync();
+			};
+		}
+	}
+}
+
+#endif
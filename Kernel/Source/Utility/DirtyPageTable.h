@@ -0,0 +1,99 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_DIRTYPAGETABLE
+#define VCZH_DATABASE_UTILITY_DIRTYPAGETABLE
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * The dirty page table of a source, maintained while holding the lock of the source.
+			 * Dirty pages are linked through their descs in the order that they became dirty,
+			 * so the oldest page has the smallest first dirty LSN, and pages dirty before an LSN are a prefix of the list.
+			 * A desc should be marked clean before it is removed from the source.
+			 */
+			class DirtyPageTable : public Object, public NotCopyable
+			{
+			private:
+				BufferPageDesc*					oldestPage = nullptr;
+				BufferPageDesc*					newestPage = nullptr;
+				vint							pageCount = 0;
+
+			public:
+				vint Count()
+				{
+					return pageCount;
+				}
+
+				BufferPageDesc* GetOldestPage()
+				{
+					return oldestPage;
+				}
+
+				BufferPageDesc* GetNextPage(BufferPageDesc* pageDesc)
+				{
+					return pageDesc->nextDirtyPage;
+				}
+
+				// Returns false if the page is already dirty
+				bool MarkDirty(BufferPageDesc* pageDesc)
+				{
+					if (pageDesc->dirty) return false;
+					pageDesc->MarkDirty();
+					pageDesc->previousDirtyPage = newestPage;
+					pageDesc->nextDirtyPage = nullptr;
+					if (newestPage)
+					{
+						newestPage->nextDirtyPage = pageDesc;
+					}
+					else
+					{
+						oldestPage = pageDesc;
+					}
+					newestPage = pageDesc;
+					pageCount++;
+					return true;
+				}
+
+				// Returns false if the page is not dirty
+				bool MarkClean(BufferPageDesc* pageDesc)
+				{
+					if (!pageDesc->dirty) return false;
+					pageDesc->dirty = false;
+					if (pageDesc->previousDirtyPage)
+					{
+						pageDesc->previousDirtyPage->nextDirtyPage = pageDesc->nextDirtyPage;
+					}
+					else
+					{
+						oldestPage = pageDesc->nextDirtyPage;
+					}
+					if (pageDesc->nextDirtyPage)
+					{
+						pageDesc->nextDirtyPage->previousDirtyPage = pageDesc->previousDirtyPage;
+					}
+					else
+					{
+						newestPage = pageDesc->previousDirtyPage;
+					}
+					pageDesc->previousDirtyPage = nullptr;
+					pageDesc->nextDirtyPage = nullptr;
+					pageCount--;
+					return true;
+				}
+			};
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include "ExtentTree.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+
+/***********************************************************************
+ExtentTree
+***********************************************************************/
+
+			void ExtentTree::Update(Node* node)
+			{
+				node->maxCount = node->count;
+				if (node->left && node->maxCount < node->left->maxCount)
+				{
+					node->maxCount = node->left->maxCount;
+				}
+				if (node->right && node->maxCount < node->right->maxCount)
+				{
+					node->maxCount = node->right->maxCount;
+				}
+			}
+
+			void ExtentTree::Split(Node* node, vuint64_t first, Node*& left, Node*& right)
+			{
+				// extents beginning before first go to left, others go to right
+				if (!node)
+				{
+					left = nullptr;
+					right = nullptr;
+				}
+				else if (node->first < first)
+				{
+					Split(node->right, first, node->right, right);
+					Update(node);
+					left = node;
+				}
+				else
+				{
+					Split(node->left, first, left, node->left);
+					Update(node);
+					right = node;
+				}
+			}
+
+			ExtentTree::Node* ExtentTree::Merge(Node* left, Node* right)
+			{
+				// all extents in left begin before extents in right
+				if (!left) return right;
+				if (!right) return left;
+				if (left->priority > right->priority)
+				{
+					left->right = Merge(left->right, right);
+					Update(left);
+					return left;
+				}
+				else
+				{
+					right->left = Merge(left, right->left);
+					Update(right);
+					return right;
+				}
+			}
+
+			void ExtentTree::Destroy(Node* node)
+			{
+				if (node)
+				{
+					Destroy(node->left);
+					Destroy(node->right);
+					delete node;
+				}
+			}
+
+			ExtentTree::ExtentTree()
+			{
+			}
+
+			ExtentTree::~ExtentTree()
+			{
+				Destroy(root);
+			}
+
+			vint ExtentTree::Count()
+			{
+				return nodeCount;
+			}
+
+			void ExtentTree::Clear()
+			{
+				Destroy(root);
+				root = nullptr;
+				nodeCount = 0;
+			}
+
+			bool ExtentTree::GetFirst(vuint64_t& first, vuint64_t& count)
+			{
+				auto node = root;
+				if (!node) return false;
+				while (node->left)
+				{
+					node = node->left;
+				}
+				first = node->first;
+				count = node->count;
+				return true;
+			}
+
+			bool ExtentTree::GetLast(vuint64_t& first, vuint64_t& count)
+			{
+				auto node = root;
+				if (!node) return false;
+				while (node->right)
+				{
+					node = node->right;
+				}
+				first = node->first;
+				count = node->count;
+				return true;
+			}
+
+			bool ExtentTree::Get(vuint64_t first, vuint64_t& count)
+			{
+				auto node = root;
+				while (node)
+				{
+					if (first < node->first)
+					{
+						node = node->left;
+					}
+					else if (first > node->first)
+					{
+						node = node->right;
+					}
+					else
+					{
+						count = node->count;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			bool ExtentTree::FindBefore(vuint64_t page, vuint64_t& first, vuint64_t& count)
+			{
+				Node* found = nullptr;
+				auto node = root;
+				while (node)
+				{
+					if (node->first <= page)
+					{
+						found = node;
+						node = node->right;
+					}
+					else
+					{
+						node = node->left;
+					}
+				}
+
+				if (!found) return false;
+				first = found->first;
+				count = found->count;
+				return true;
+			}
+
+			bool ExtentTree::FindFirstFit(vuint64_t minCount, vuint64_t& first, vuint64_t& count)
+			{
+				auto node = root;
+				if (!node || node->maxCount < minCount) return false;
+				while (true)
+				{
+					if (node->left && node->left->maxCount >= minCount)
+					{
+						node = node->left;
+					}
+					else if (node->count >= minCount)
+					{
+						first = node->first;
+						count = node->count;
+						return true;
+					}
+					else
+					{
+						node = node->right;
+					}
+				}
+			}
+
+			void ExtentTree::Set(vuint64_t first, vuint64_t count)
+			{
+				Node* left = nullptr;
+				Node* middle = nullptr;
+				Node* right = nullptr;
+				Split(root, first, left, right);
+				Split(right, first + 1, middle, right);
+
+				if (!middle)
+				{
+					middle = new Node;
+					middle->first = first;
+					// a hash of the first page keeps the treap balanced even when extents are added in order
+					middle->priority = first * 0x9E3779B97F4A7C15ULL;
+					middle->priority ^= middle->priority >> 29;
+					nodeCount++;
+				}
+				middle->count = count;
+				Update(middle);
+				root = Merge(Merge(left, middle), right);
+			}
+
+			bool ExtentTree::Remove(vuint64_t first)
+			{
+				Node* left = nullptr;
+				Node* middle = nullptr;
+				Node* right = nullptr;
+				Split(root, first, left, right);
+				Split(right, first + 1, middle, right);
+				root = Merge(left, right);
+
+				if (!middle) return false;
+				delete middle;
+				nodeCount--;
+				return true;
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_EXTENTTREE
+#define VCZH_DATABASE_UTILITY_EXTENTTREE
+
+#include "Common.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * Extents ordered by their first pages in a treap, extents should not overlap.
+			 * Each node also keeps the page count of the largest extent in its subtree,
+			 * so adding, removing and searching extents, including the first extent that is large enough, take O(log n).
+			 */
+			class ExtentTree : public Object, public NotCopyable
+			{
+			protected:
+				struct Node
+				{
+					vuint64_t					first;
+					vuint64_t					count;
+					vuint64_t					maxCount;		// the largest count in the subtree
+					vuint64_t					priority;
+					Node*						left = nullptr;
+					Node*						right = nullptr;
+				};
+
+				Node*							root = nullptr;
+				vint							nodeCount = 0;
+
+				static void						Update(Node* node);
+				static void						Split(Node* node, vuint64_t first, Node*& left, Node*& right);
+				static Node*					Merge(Node* left, Node* right);
+				static void						Destroy(Node* node);
+
+			public:
+				ExtentTree();
+				~ExtentTree();
+
+				vint							Count();
+				void							Clear();
+
+				// Each function returns false if there is no such extent
+				bool							GetFirst(vuint64_t& first, vuint64_t& count);
+				bool							GetLast(vuint64_t& first, vuint64_t& count);
+				bool							Get(vuint64_t first, vuint64_t& count);
+				// The last extent beginning no later than the page
+				bool							FindBefore(vuint64_t page, vuint64_t& first, vuint64_t& count);
+				// The first extent having at least minCount pages
+				bool							FindFirstFit(vuint64_t minCount, vuint64_t& first, vuint64_t& count);
+
+				// Adds an extent or changes the page count of the extent beginning at first
+				void							Set(vuint64_t first, vuint64_t count);
+				bool							Remove(vuint64_t first);
+			};
+		}
+	}
+}
+
+#endif
@@ -12,6 +12,7 @@
 /*
  * Page Structure
  *		Initial Page	: [uint64 NextInitialPage][uint64 FreePageItems]{[uint64 FreePage] ...}
+ *			Only INDEX_PAGE_FREEITEM is kept with no free pages, free pages are found by use masks
  *		Use Mask Page	: [uint64 NextUseMaskPage]{[bit FreePageMask] ...}
  *			FreePageMask 1=used, 0=free
  */
@@ -38,27 +39,226 @@ namespace vl
 		namespace buffer_internal
 		{
 
+/***********************************************************************
+PendingPageRead
+***********************************************************************/
+
+			PendingPageRead::PendingPageRead(FileBufferSource* _owner)
+				:owner(_owner)
+			{
+			}
+
+			void PendingPageRead::OnCompleted()
+			{
+				owner->CompleteRead(this);
+			}
+
 /***********************************************************************
 FileMapping
 ***********************************************************************/
 
-			FileMapping::FileMapping(vuint64_t _pageSize, int _fileDescriptor, volatile vuint64_t* _totalUsedPages)
+			void FileMapping::WriteFrame(BufferPageDesc* pageDesc, void* frame)
+			{
+				if (!frame)
+				{
+					frame = pageDesc->address;
+				}
+
+				vuint64_t written = pageSize;
+				if (checksums)
+				{
+					SealPage(frame, pageSize);
+				}
+				if (compressedStore)
+				{
+					written = compressedStore->WritePage(pageDesc->offset / pageSize, frame);
+				}
+				else
+				{
+					CHECK_ERROR(pwrite(fileDescriptor, frame, pageSize, pageDesc->offset) == (ssize_t)pageSize, L"vl::database::buffer_internal::FileMapping::WriteFrame(BufferPageDesc*)#Internal error: Failed to call pwrite.");
+				}
+				counters.Increase(BufferCounter::PageWriteBacks);
+				counters.Increase(BufferCounter::WrittenBytes, written);
+			}
+
+			void FileMapping::WriteBackPage(BufferPageDesc* pageDesc)
+			{
+				if (framePool)
+				{
+					WriteFrame(pageDesc);
+				}
+				else
+				{
+					CHECK_ERROR(msync(pageDesc->address, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileMapping::WriteBackPage(BufferPageDesc*)#Internal error: Failed to call msync.");
+					counters.Increase(BufferCounter::PageWriteBacks);
+					counters.Increase(BufferCounter::WrittenBytes, pageSize);
+				}
+				dirtyPages.MarkClean(pageDesc);
+			}
+
+			void FileMapping::ReleasePage(BufferPageDesc* pageDesc)
+			{
+				if (framePool)
+				{
+					if (pageDesc->dirty)
+					{
+						WriteBackPage(pageDesc);
+					}
+					framePool->FreeFrame(pageDesc->address);
+				}
+				else
+				{
+					// changes in a shared mapping are written back by munmap
+					dirtyPages.MarkClean(pageDesc);
+					UnmapSegmentPage(pageDesc->offset / pageSize);
+				}
+				DECRC(totalUsedPages);
+				counters.Increase(BufferCounter::PageUnmaps);
+			}
+
+			void* FileMapping::ReadFrame(vuint64_t offset)
+			{
+				void* address = framePool->AllocateFrame();
+				if (!address)
+				{
+					return nullptr;
+				}
+
+				if (compressedStore)
+				{
+					if (!compressedStore->ReadPage(offset / pageSize, address))
+					{
+						framePool->FreeFrame(address);
+						return nullptr;
+					}
+				}
+				else
+				{
+					auto read = ReadFileFully(fileDescriptor, address, pageSize, offset);
+					if (read < 0)
+					{
+						framePool->FreeFrame(address);
+						return nullptr;
+					}
+					if (read < (vint64_t)pageSize)
+					{
+						memset((char*)address + read, 0, pageSize - read);
+					}
+				}
+
+				if (checksums && !VerifyPage(address, pageSize))
+				{
+					counters.Increase(BufferCounter::ChecksumFailures);
+					framePool->FreeFrame(address);
+					return nullptr;
+				}
+				return address;
+			}
+
+			bool FileMapping::GrowFile(vuint64_t pageCount)
+			{
+				vuint64_t extentSize = allocatedPageCount * pageSize;
+				if (extentSize < MinExtentSize) extentSize = MinExtentSize;
+				if (extentSize > MaxExtentSize) extentSize = MaxExtentSize;
+
+				vuint64_t newPageCount = allocatedPageCount + IntUpperBound(extentSize, pageSize) / pageSize;
+				if (newPageCount < pageCount) newPageCount = pageCount;
+				if (fallocate(fileDescriptor, 0, allocatedPageCount * pageSize, (newPageCount - allocatedPageCount) * pageSize) == -1)
+				{
+					// file systems without fallocate only change the size
+					if (ftruncate(fileDescriptor, newPageCount * pageSize) == -1) return false;
+				}
+				allocatedPageCount = newPageCount;
+				return true;
+			}
+
+			void* FileMapping::MapSegmentPage(vuint64_t index)
+			{
+				vint segmentIndex = (vint)(index / pagesPerSegment);
+				while (segments.Count() <= segmentIndex)
+				{
+					segments.Add(Segment());
+				}
+
+				auto& segment = segments[segmentIndex];
+				if (!segment.address)
+				{
+					vuint64_t segmentBytes = pagesPerSegment * pageSize;
+					void* address = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, segmentIndex * segmentBytes);
+					if (address == MAP_FAILED)
+					{
+						return nullptr;
+					}
+					segment.address = (char*)address;
+					counters.Increase(BufferCounter::SegmentMaps);
+				}
+				else if (segment.mappedPageCount == 0)
+				{
+					idleSegmentCount--;
+				}
+				segment.mappedPageCount++;
+				return segment.address + (index % pagesPerSegment) * pageSize;
+			}
+
+			void FileMapping::UnmapSegmentPage(vuint64_t index)
+			{
+				auto& segment = segments[(vint)(index / pagesPerSegment)];
+				if (--segment.mappedPageCount == 0 && ++idleSegmentCount > MaxIdleSegmentCount)
+				{
+					UnmapIdleSegments();
+				}
+			}
+
+			void FileMapping::UnmapIdleSegments()
+			{
+				for (vint i = 0; i < segments.Count(); i++)
+				{
+					auto& segment = segments[i];
+					if (segment.address && segment.mappedPageCount == 0)
+					{
+						CHECK_ERROR(munmap(segment.address, pagesPerSegment * pageSize) != -1, L"vl::database::buffer_internal::FileMapping::UnmapIdleSegments()#Internal error: Failed to call munmap.");
+						segment.address = nullptr;
+					}
+				}
+				idleSegmentCount = 0;
+			}
+
+			FileMapping::FileMapping(vuint64_t _pageSize, int _fileDescriptor, volatile vuint64_t* _totalUsedPages, FramePool* _framePool, bool _checksums)
 				:pageSize(_pageSize)
 				,fileDescriptor(_fileDescriptor)
 				,totalUsedPages(_totalUsedPages)
+				,framePool(_framePool)
+				,checksums(_checksums && _framePool)
+				,pagesPerSegment(_pageSize < SegmentSize ? SegmentSize / _pageSize : 1)
 			{
 			}
 
 			void FileMapping::InitializeEmptySource()
 			{
+				if (!compressedStore)
+				{
+					CHECK_ERROR(GrowFile(3), L"vl::database::buffer_internal::FileMapping::InitializeEmptySource()#Internal error: Failed to allocate the file.");
+				}
 				totalPageCount = 3;
 			}
 
 			void FileMapping::InitializeExistingSource()
 			{
+				if (compressedStore)
+				{
+					totalPageCount = compressedStore->GetPageCount();
+					return;
+				}
+
 				struct stat fileState;
 				CHECK_ERROR(fstat(fileDescriptor, &fileState) != -1, L"vl::database::buffer_internal::FileMapping::InitializeExistingSource()#Internal error: Failed to call fstat.");
 				totalPageCount = fileState.st_size / pageSize;
+				allocatedPageCount = totalPageCount;
+			}
+
+			void FileMapping::SetCompressedStore(CompressedPageStore* _compressedStore)
+			{
+				compressedStore = _compressedStore;
 			}
 
 			vuint64_t FileMapping::GetTotalPageCount()
@@ -66,39 +266,100 @@ FileMapping
 				return totalPageCount;
 			}
 
-			Ptr<BufferPageDesc> FileMapping::MapPage(BufferPage page)
+			void FileMapping::TrimTotalPageCount(vuint64_t pageCount)
+			{
+				if (pageCount < totalPageCount)
+				{
+					if (compressedStore)
+					{
+						compressedStore->TrimPages(pageCount);
+					}
+					totalPageCount = pageCount;
+				}
+			}
+
+			void FileMapping::TruncateFile()
+			{
+				if (!compressedStore && allocatedPageCount > totalPageCount)
+				{
+					CHECK_ERROR(ftruncate(fileDescriptor, totalPageCount * pageSize) != -1, L"vl::database::buffer_internal::FileMapping::TruncateFile()#Internal error: Failed to call ftruncate.");
+					allocatedPageCount = totalPageCount;
+				}
+			}
+
+			BufferPageDesc* FileMapping::MapPage(BufferPage page)
 			{
-				vint index = mappedPages.Keys().IndexOf(page.index);
-				if (index == -1)
+				auto pageDesc = mappedPages.Get(page);
+				if (!pageDesc)
 				{
 					vuint64_t offset = page.index * pageSize;
-					struct stat fileState;	
-					CHECK_ERROR(fstat(fileDescriptor, &fileState) != -1, L"vl::database::buffer_internal::FileMapping::InitializeExistingSource()#Internal error: Failed to call fstat.");
-					if (fileState.st_size < offset + pageSize)
+					if (compressedStore)
+					{
+						vuint64_t pageCount = compressedStore->GetPageCount();
+						if (page.index >= pageCount)
+						{
+							CHECK_ERROR(page.index == pageCount, L"vl::database::buffer_internal::FileMapping::MapPage(BufferPage)#Internal error: The file is corrupted.");
+							compressedStore->AppendPage();
+							totalPageCount = pageCount + 1;
+						}
+					}
+					else if (page.index >= totalPageCount)
 					{
-						CHECK_ERROR(fileState.st_size == offset, L"vl::database::buffer_internal::FileMapping::InitializeExistingSource()#Internal error: The file is corrupted.");
-						ftruncate(fileDescriptor, offset + pageSize);
-						totalPageCount = offset / pageSize + 1;
+						CHECK_ERROR(page.index == totalPageCount, L"vl::database::buffer_internal::FileMapping::MapPage(BufferPage)#Internal error: The file is corrupted.");
+						if (page.index >= allocatedPageCount && !GrowFile(page.index + 1))
+						{
+							return nullptr;
+						}
+						totalPageCount = page.index + 1;
 					}
 
-					void* address = mmap(nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, offset);
-					if (address == MAP_FAILED)
+					void* address = nullptr;
+					if (framePool)
 					{
-						return nullptr;
+						address = ReadFrame(offset);
+						if (!address)
+						{
+							return nullptr;
+						}
+					}
+					else
+					{
+						address = MapSegmentPage(page.index);
+						if (!address)
+						{
+							return nullptr;
+						}
 					}
 					
-					auto pageDesc = MakePtr<BufferPageDesc>();
+					pageDesc = mappedPages.Add(page);
 					pageDesc->address = address;
 					pageDesc->offset = offset;
-					pageDesc->lastAccessTime = (vuint64_t)time(nullptr);
-					mappedPages.Add(page.index, pageDesc);
+					pageDesc->Access();
 					INCRC(totalUsedPages);
+					counters.Increase(BufferCounter::PageMisses);
 					return pageDesc;
 				}
 				else
 				{
-					auto pageDesc = mappedPages.Values()[index];
-					pageDesc->lastAccessTime = (vuint64_t)time(nullptr);
+					if (pageDesc->loading)
+					{
+						// the page is needed now, so it is read again into another frame instead of waiting for the asynchronous read
+						auto address = ReadFrame(pageDesc->offset);
+						if (!address)
+						{
+							return nullptr;
+						}
+
+						auto read = pendingReads[page.index];
+						pendingReads.Remove(page.index);
+						read->abandoned = true;
+						pageDesc->address = address;
+						pageDesc->loading = false;
+						pageDesc->latchCount = 0;
+						pageDesc->pinCount--;
+					}
+					pageDesc->Access();
+					counters.Increase(BufferCounter::PageHits);
 					return pageDesc;
 				}
 			}
@@ -114,36 +375,319 @@ FileMapping
 				return result;
 			}
 
+			BufferPage FileMapping::AppendPages(vuint64_t count)
+			{
+				BufferPage first{totalPageCount};
+				if (compressedStore)
+				{
+					for (vuint64_t i = 0; i < count; i++)
+					{
+						compressedStore->AppendPage();
+					}
+				}
+				else if (totalPageCount + count > allocatedPageCount && !GrowFile(totalPageCount + count))
+				{
+					return BufferPage::Invalid();
+				}
+				totalPageCount += count;
+				return first;
+			}
+
+			void FileMapping::MarkDirty(BufferPageDesc* pageDesc)
+			{
+				dirtyPages.MarkDirty(pageDesc);
+			}
+
+			void FileMapping::PersistPage(BufferPageDesc* pageDesc)
+			{
+				dirtyPages.MarkDirty(pageDesc);
+				if (!pageDesc->persisting)
+				{
+					pageDesc->persisting = true;
+					persistingPages.Add(pageDesc->offset / pageSize);
+				}
+			}
+
+			bool FileMapping::HasPersistingPages()
+			{
+				return persistingPages.Count() > 0;
+			}
+
+			void FileMapping::WritePersistingPages()
+			{
+				TakenPages taken;
+				TakePersistingPages(taken);
+				WriteTakenPages(taken);
+				ReleaseTakenPages(taken);
+			}
+
+			void FileMapping::TakePersistingPages(TakenPages& taken)
+			{
+				FOREACH(vuint64_t, index, persistingPages)
+				{
+					// evicted pages have been written back
+					auto pageDesc = mappedPages.Get(BufferPage{index});
+					if (pageDesc && pageDesc->persisting)
+					{
+						pageDesc->persisting = false;
+						if (framePool)
+						{
+							if (compressedStore)
+							{
+								WriteFrame(pageDesc);
+							}
+							else
+							{
+								pageDesc->pinCount++;
+								taken.pages.Add(pageDesc);
+							}
+						}
+
+						// a page changed again while being written is dirty again when it is unlocked
+						if (!pageDesc->IsExclusivelyLatched())
+						{
+							dirtyPages.MarkClean(pageDesc);
+						}
+					}
+				}
+				persistingPages.Clear();
+
+				// copies are sealed and written instead of frames, so that a writer holding the exclusive latch does not change bytes covered by a checksum
+				if (taken.pages.Count() == 0) return;
+				taken.frameBytes = taken.pages.Count() * pageSize;
+				taken.frames = (char*)mmap(nullptr, taken.frameBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				CHECK_ERROR(taken.frames != MAP_FAILED, L"vl::database::buffer_internal::FileMapping::TakePersistingPages(TakenPages&)#Internal error: Failed to call mmap.");
+				for (vint i = 0; i < taken.pages.Count(); i++)
+				{
+					memcpy(taken.frames + i * pageSize, taken.pages[i]->address, pageSize);
+				}
+			}
+
+			void FileMapping::WriteTakenPages(TakenPages& taken)
+			{
+				for (vint i = 0; i < taken.pages.Count(); i++)
+				{
+					WriteFrame(taken.pages[i], taken.frames + i * pageSize);
+				}
+				if (taken.frames)
+				{
+					munmap(taken.frames, taken.frameBytes);
+					taken.frames = nullptr;
+					taken.frameBytes = 0;
+				}
+			}
+
+			void FileMapping::ReleaseTakenPages(TakenPages& taken)
+			{
+				FOREACH(BufferPageDesc*, pageDesc, taken.pages)
+				{
+					pageDesc->pinCount--;
+				}
+				taken.pages.Clear();
+			}
+
+			void FileMapping::SyncFile()
+			{
+				if (compressedStore)
+				{
+					compressedStore->Sync();
+					counters.Increase(BufferCounter::FileSyncs);
+					return;
+				}
+
+				// dirty pages in shared mappings are also written back by fdatasync
+				CHECK_ERROR(fdatasync(fileDescriptor) != -1, L"vl::database::buffer_internal::FileMapping::SyncFile()#Internal error: Failed to call fdatasync.");
+				counters.Increase(BufferCounter::FileSyncs);
+			}
+
+			bool FileMapping::FlushPage(BufferPage page)
+			{
+				auto pageDesc = mappedPages.Get(page);
+				if (!pageDesc) return false;
+				if (pageDesc->IsExclusivelyLatched() || !pageDesc->dirty) return false;
+
+				WriteBackPage(pageDesc);
+				return true;
+			}
+
 			bool FileMapping::UnmapPage(BufferPage page)
 			{
-				vint index = mappedPages.Keys().IndexOf(page.index);
-				if (index != -1)
+				bool writtenBack = false;
+				return EvictPage(page, true, writtenBack);
+			}
+
+			bool FileMapping::EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack)
+			{
+				writtenBack = false;
+				if (auto pageDesc = mappedPages.Get(page))
 				{
-					auto pageDesc = mappedPages.Values()[index];
-					if (!pageDesc->locked)
+					if (!pageDesc->IsPinned())
 					{
 						if (pageDesc->dirty)
 						{
-							CHECK_ERROR(msync(pageDesc->address, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileMapping::UnmapPage(BufferPage)#Internal error: Failed to call msync.");
-							pageDesc->dirty = false;
+							if (!allowWriteBack) return false;
+							WriteBackPage(pageDesc);
+							writtenBack = true;
 						}
-						CHECK_ERROR(munmap(pageDesc->address, pageSize) != -1, L"vl::database::buffer_internal::FileMapping::UnmapPage(BufferPage)#Internal error: Failed to call munmap.");
-
-						mappedPages.Remove(page.index);
-						DECRC(totalUsedPages);
+						ReleasePage(pageDesc);
+						mappedPages.Remove(page);
 						return true;
 					}
 				}
 				return false;
 			}
 
+			vint FileMapping::PrefetchPages(const BufferPage* pages, vint count, PrefetchRanges& ranges)
+			{
+				vint prefetched = 0;
+				vuint64_t rangeBegin = 0;
+				vuint64_t rangeCount = 0;
+				for (vint i = 0; i <= count; i++)
+				{
+					BufferPageDesc* pageDesc = nullptr;
+					bool missing = false;
+					if (i < count && pages[i].index < totalPageCount)
+					{
+						pageDesc = mappedPages.Get(pages[i]);
+						missing = pageDesc == nullptr;
+					}
+
+					if (compressedStore)
+					{
+						// extents of adjacent pages are not adjacent in the file
+						if (missing)
+						{
+							ranges.Add(PrefetchRange(pages[i].index, 1));
+							prefetched++;
+						}
+						continue;
+					}
+
+					// adjacent missing pages are read ahead in one request
+					if (rangeCount > 0 && (!missing || pages[i].index != rangeBegin + rangeCount))
+					{
+						ranges.Add(PrefetchRange(rangeBegin, rangeCount));
+						prefetched += rangeCount;
+						rangeCount = 0;
+					}
+
+					if (missing)
+					{
+						if (rangeCount == 0)
+						{
+							rangeBegin = pages[i].index;
+						}
+						rangeCount++;
+					}
+					else if (pageDesc && !framePool)
+					{
+						// a mapped page may still be absent from the page cache
+						ranges.Add(PrefetchRange(pages[i].index, 1));
+					}
+				}
+				return prefetched;
+			}
+
+			void FileMapping::IssuePrefetches(const PrefetchRanges& ranges)
+			{
+				// read ahead by the file instead of mapped addresses, because segments could be unmapped after releasing the lock
+				FOREACH(PrefetchRange, range, ranges)
+				{
+					if (compressedStore)
+					{
+						compressedStore->PrefetchPage(range.f0);
+					}
+					else
+					{
+						posix_fadvise(fileDescriptor, range.f0 * pageSize, range.f1 * pageSize, POSIX_FADV_WILLNEED);
+					}
+				}
+			}
+
 			void FileMapping::UnmapAllPages()
 			{
-				FOREACH(Ptr<BufferPageDesc>, pageDesc, mappedPages.Values())
+				vint slotCount = mappedPages.GetSlotCount();
+				for (vint i = 0; i < slotCount; i++)
+				{
+					BufferPage page;
+					if (auto pageDesc = mappedPages.GetSlot(i, page))
+					{
+						ReleasePage(pageDesc);
+					}
+				}
+				mappedPages.Clear();
+				UnmapIdleSegments();
+			}
+
+			PendingPageRead* FileMapping::GetPendingRead(BufferPage page)
+			{
+				vint index = pendingReads.Keys().IndexOf(page.index);
+				return index == -1 ? nullptr : pendingReads.Values()[index];
+			}
+
+			bool FileMapping::StartReadingPage(BufferPage page, PendingPageRead* read)
+			{
+				void* address = framePool->AllocateFrame();
+				if (!address)
+				{
+					return false;
+				}
+
+				auto pageDesc = mappedPages.Add(page);
+				pageDesc->address = address;
+				pageDesc->offset = page.index * pageSize;
+				pageDesc->loading = true;
+				pageDesc->latchCount = -1;
+				pageDesc->pinCount = 1;
+				pageDesc->Access();
+				INCRC(totalUsedPages);
+				counters.Increase(BufferCounter::PageMisses);
+
+				read->page = page;
+				read->fileDescriptor = fileDescriptor;
+				read->buffer = address;
+				read->size = pageSize;
+				read->offset = pageDesc->offset;
+				pendingReads.Add(page.index, read);
+				return true;
+			}
+
+			BufferPageDesc* FileMapping::FinishReadingPage(PendingPageRead* read)
+			{
+				if (read->abandoned)
+				{
+					framePool->FreeFrame(read->buffer);
+					return mappedPages.Get(read->page);
+				}
+
+				pendingReads.Remove(read->page.index);
+				auto pageDesc = mappedPages.Get(read->page);
+				pageDesc->loading = false;
+				pageDesc->latchCount = 0;
+				pageDesc->pinCount--;
+
+				// readers continue short reads, so a page is partially read only at the end of the file
+				if (read->result >= 0 && read->result < (vint64_t)pageSize)
 				{
-					DECRC(totalUsedPages);
-					CHECK_ERROR(munmap(pageDesc->address, pageSize) != -1, L"vl::database::buffer_internal::FileMapping::UnmapAllPages(BufferPage)#Internal error: Failed to call munmap.");
+					memset((char*)pageDesc->address + read->result, 0, pageSize - read->result);
 				}
+				bool corrupted = read->result >= 0 && checksums && !VerifyPage(pageDesc->address, pageSize);
+				if (corrupted)
+				{
+					counters.Increase(BufferCounter::ChecksumFailures);
+				}
+				if (read->result < 0 || corrupted)
+				{
+					ReleasePage(pageDesc);
+					mappedPages.Remove(read->page);
+					return nullptr;
+				}
+				return pageDesc;
+			}
+
+			BufferCounters& FileMapping::GetCounters()
+			{
+				return counters;
 			}
 
 			vint FileMapping::GetMappedPageCount()
@@ -151,35 +695,69 @@ FileMapping
 				return mappedPages.Count();
 			}
 			
-			BufferPage FileMapping::GetMappedPage(vint index)
+			vint FileMapping::GetPageSlotCount()
 			{
-				return mappedPages.Keys()[index];
+				return mappedPages.GetSlotCount();
 			}
 
-			Ptr<BufferPageDesc> FileMapping::GetMappedPageDesc(vint index)
+			BufferPageDesc* FileMapping::GetPageSlot(vint slot, BufferPage& page)
 			{
-				return mappedPages.Values()[index];
+				return mappedPages.GetSlot(slot, page);
 			}
 
-			Ptr<BufferPageDesc> FileMapping::GetMappedPageDesc(BufferPage page)
+			DirtyPageTable& FileMapping::GetDirtyPageTable()
 			{
-				vint index = mappedPages.Keys().IndexOf(page.index);
-				if (index == -1)
-				{
-					return nullptr;
-				}
-				return mappedPages.Values()[index];
+				return dirtyPages;
+			}
+
+			BufferPageDesc* FileMapping::GetMappedPageDesc(BufferPage page)
+			{
+				return mappedPages.Get(page);
 			}
 
 /***********************************************************************
 FileUseMasks
 ***********************************************************************/
 
+			void FileUseMasks::AddUseMaskPage(vuint64_t index)
+			{
+				useMaskPages.Add(index);
+				vint oldItemCount = useMaskItems.Count();
+				useMaskItems.Resize(oldItemCount + (vint)useMaskItemCount);
+				memset(&useMaskItems[oldItemCount], 0, useMaskItemCount * sizeof(vuint64_t));
+			}
+
+			void FileUseMasks::AppendUseMaskPage()
+			{
+				BufferPage lastPage{useMaskPages[useMaskPages.Count() - 1]};
+				BufferPage useMaskPage = fileMapping->AppendPage();
+				CHECK_ERROR(useMaskPage.IsValid(), L"vl::database::buffer_internal::FileUseMasks::AppendUseMaskPage()#Internal error: Failed to create a new use mask page.");
+
+				auto pageDesc = fileMapping->MapPage(useMaskPage);
+				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::AppendUseMaskPage()#Internal error: Failed to map the new use mask page.");
+				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
+				memset(numbers, 0, pageSize);
+				numbers[INDEX_USEMASK_NEXTUSEMASKPAGE] = INDEX_INVALID;
+				fileMapping->PersistPage(pageDesc);
+
+				pageDesc = fileMapping->MapPage(lastPage);
+				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::AppendUseMaskPage()#Internal error: Failed to map the last use mask page.");
+				numbers = (vuint64_t*)pageDesc->address;
+				numbers[INDEX_USEMASK_NEXTUSEMASKPAGE] = useMaskPage.index;
+				fileMapping->PersistPage(pageDesc);
+
+				// the new use mask page is added before setting its own bit, which could be in itself
+				AddUseMaskPage(useMaskPage.index);
+				SetUseMask(useMaskPage, true);
+			}
+
 			FileUseMasks::FileUseMasks(vuint64_t _pageSize, int _fileDescriptor)
-				:pageSize(_pageSize)
-				,fileDescriptor(_fileDescriptor)
-				,useMaskPageItemCount((_pageSize - INDEX_USEMASK_USEMASKBEGIN * sizeof(vuint64_t)) / sizeof(vuint64_t))
+				:fileDescriptor(_fileDescriptor)
+				,pageSize(_pageSize)
+				,useMaskLayout(UseMaskLayout::Create(_pageSize))
 			{
+				static_assert(UseMaskLayout::HeaderItemCount == INDEX_USEMASK_USEMASKBEGIN, "UseMaskLayout should skip the header of a use mask page.");
+				useMaskItemCount = useMaskLayout.GetEntryCount() / (8 * sizeof(vuint64_t));
 			}
 
 			void FileUseMasks::InitializeEmptySource(FileMapping* _fileMapping)
@@ -187,14 +765,16 @@ FileUseMasks
 				fileMapping = _fileMapping;
 
 				useMaskPages.Clear();
+				useMaskItems.Resize(0);
+				dirtyUseMaskPages.Clear();
 				BufferPage page{INDEX_PAGE_USEMASK};
 				auto pageDesc = fileMapping->MapPage(page);
 				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::InitializeEmptySource()#Internal error: Failed to map INDEX_PAGE_USEMASK.");
 				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
 				memset(numbers, 0, pageSize);
 				numbers[INDEX_USEMASK_NEXTUSEMASKPAGE] = INDEX_INVALID;
-				CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileUseMasks::InitializeEmptySource()#Internal error: Failed to call msync.");
-				useMaskPages.Add(page.index);
+				fileMapping->PersistPage(pageDesc);
+				AddUseMaskPage(page.index);
 			}
 
 			void FileUseMasks::InitializeExistingSource(FileMapping* _fileMapping)
@@ -202,243 +782,295 @@ FileUseMasks
 				fileMapping = _fileMapping;
 
 				useMaskPages.Clear();
+				useMaskItems.Resize(0);
+				dirtyUseMaskPages.Clear();
 				BufferPage page{INDEX_PAGE_USEMASK};
 				
 				while(page.index != INDEX_INVALID)
 				{
-					useMaskPages.Add(page.index);
+					AddUseMaskPage(page.index);
 					auto pageDesc = fileMapping->MapPage(page);
+					CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::InitializeExistingSource()#Internal error: Failed to map the specified use mask page.");
 					vuint64_t* numbers = (vuint64_t*)pageDesc->address;
+					memcpy(&useMaskItems[useMaskItems.Count() - (vint)useMaskItemCount], numbers + INDEX_USEMASK_USEMASKBEGIN, useMaskItemCount * sizeof(vuint64_t));
 					page.index = numbers[INDEX_USEMASK_NEXTUSEMASKPAGE];
 				}
 			}
 
 			bool FileUseMasks::GetUseMask(BufferPage page)
 			{
-				auto useMaskPageBits = 8 * sizeof(vuint64_t);
-				auto useMaskPageIndex = page.index / (useMaskPageBits * useMaskPageItemCount);
-				auto useMaskPageBitIndex = page.index % (useMaskPageBits * useMaskPageItemCount);
-				auto useMaskPageItem = INDEX_USEMASK_USEMASKBEGIN + useMaskPageBitIndex / useMaskPageBits;
-				auto useMaskPageShift = useMaskPageBitIndex % useMaskPageBits;
-
-				BufferPage useMaskPage{useMaskPages[useMaskPageIndex]};
-				auto pageDesc = fileMapping->MapPage(useMaskPage);
-				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::GetUseMask(BufferPage)#Internal error: Failed to map the specified use mask page.");
-				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
-				auto& item = numbers[useMaskPageItem];
-				bool result = ((item >> useMaskPageShift) & ((vuint64_t)1)) == 1;
-				CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileUseMasks::GetUseMask(page)#Internal error: Failed to call msync.");
-				return result;
+				const vuint64_t useMaskPageBits = 8 * sizeof(vuint64_t);
+				vuint64_t item = page.index / useMaskPageBits;
+				if (item >= (vuint64_t)useMaskItems.Count()) return false;
+				return ((useMaskItems[(vint)item] >> (page.index % useMaskPageBits)) & ((vuint64_t)1)) == 1;
 			}
 			
 			void FileUseMasks::SetUseMask(BufferPage page, bool available)
 			{
-				auto useMaskPageBits = 8 * sizeof(vuint64_t);
-				auto useMaskPageIndex = page.index / (useMaskPageBits * useMaskPageItemCount);
-				auto useMaskPageBitIndex = page.index % (useMaskPageBits * useMaskPageItemCount);
-				auto useMaskPageItem = INDEX_USEMASK_USEMASKBEGIN + useMaskPageBitIndex / useMaskPageBits;
-				auto useMaskPageShift = useMaskPageBitIndex % useMaskPageBits;
-				bool newPage = false;
-
-				BufferPage useMaskPage = BufferPage::Invalid();
+				const vuint64_t useMaskPageBits = 8 * sizeof(vuint64_t);
+				vuint64_t useMaskPageIndex = 0;
+				vuint64_t useMaskPageBitIndex = 0;
+				useMaskLayout.Locate(page.index, useMaskPageIndex, useMaskPageBitIndex);
 
-				if (useMaskPageIndex == useMaskPages.Count())
+				if (useMaskPageIndex == (vuint64_t)useMaskPages.Count())
 				{
-					newPage = true;
-					BufferPage lastPage{useMaskPages[useMaskPageIndex - 1]};
-					useMaskPage = fileMapping->AppendPage();
-					CHECK_ERROR(useMaskPage.IsValid(), L"vl::database::buffer_internal::FileUseMasks::SetUseMask(BufferPage, bool)#Internal error: Failed to create a new use mask page.");
-					SetUseMask(useMaskPage, true);
-					useMaskPages.Add(useMaskPage.index);
+					AppendUseMaskPage();
+				}
+				CHECK_ERROR(useMaskPageIndex < (vuint64_t)useMaskPages.Count(), L"vl::database::buffer_internal::FileUseMasks::SetUseMask(BufferPage, bool)#Internal error: The page is beyond the next use mask page.");
 
-					auto pageDesc = fileMapping->MapPage(lastPage);
-					CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::SetUseMask(BufferPage, bool)#Internal error: Failed to map the last use mask page.");
-					vuint64_t* numbers = (vuint64_t*)pageDesc->address;
-					numbers[INDEX_USEMASK_NEXTUSEMASKPAGE] = useMaskPage.index;
-					CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileUseMasks::SetUseMask(page, bool)#Internal error: Failed to call msync.");
+				auto& item = useMaskItems[(vint)(page.index / useMaskPageBits)];
+				vuint64_t mask = ((vuint64_t)1) << (page.index % useMaskPageBits);
+				if (available)
+				{
+					item |= mask;
 				}
 				else
 				{
-					useMaskPage.index = useMaskPages[useMaskPageIndex];
+					item &= ~mask;
+				}
+				if (!dirtyUseMaskPages.Contains((vint)useMaskPageIndex))
+				{
+					dirtyUseMaskPages.Add((vint)useMaskPageIndex);
 				}
+			}
 
-				auto pageDesc = fileMapping->MapPage(useMaskPage);
-				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::SetUseMask(BufferPage, bool)#Internal error: Failed to map the specified use mask page.");
-				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
-				if (newPage)
+			void FileUseMasks::ReserveUseMaskPages(vuint64_t count)
+			{
+				// a new use mask page is appended before pages it covers, and its own bit is in an existing use mask page or itself
+				while (useMaskPages.Count() * useMaskLayout.GetEntryCount() < fileMapping->GetTotalPageCount() + count)
 				{
-					memset(numbers, 0, pageSize);
-					numbers[INDEX_USEMASK_NEXTUSEMASKPAGE] = INDEX_INVALID;
+					AppendUseMaskPage();
 				}
+			}
 
-				auto& item = numbers[useMaskPageItem];
-				if (available)
+			bool FileUseMasks::HasDirtyPages()
+			{
+				return dirtyUseMaskPages.Count() > 0;
+			}
+
+			void FileUseMasks::WriteDirtyPages()
+			{
+				FOREACH(vint, index, dirtyUseMaskPages)
 				{
-					vuint64_t mask = ((vuint64_t)1) << useMaskPageShift;
-					item |= mask;
+					auto pageDesc = fileMapping->MapPage(BufferPage{useMaskPages[index]});
+					CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileUseMasks::WriteDirtyPages()#Internal error: Failed to map the specified use mask page.");
+					vuint64_t* numbers = (vuint64_t*)pageDesc->address;
+					memcpy(numbers + INDEX_USEMASK_USEMASKBEGIN, &useMaskItems[index * (vint)useMaskItemCount], useMaskItemCount * sizeof(vuint64_t));
+					fileMapping->PersistPage(pageDesc);
 				}
-				else
+				dirtyUseMaskPages.Clear();
+			}
+
+			vuint64_t FileUseMasks::GetUsedPageEnd()
+			{
+				const vuint64_t useMaskPageBits = 8 * sizeof(vuint64_t);
+				for (vint i = useMaskItems.Count() - 1; i >= 0; i--)
 				{
-					vuint64_t mask = ~(((vuint64_t)1) << useMaskPageShift);
-					item &= mask;
+					auto item = useMaskItems[i];
+					if (item != 0)
+					{
+						return i * useMaskPageBits + (useMaskPageBits - __builtin_clzll(item));
+					}
 				}
-				CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileUseMasks::SetUseMask(page, bool)#Internal error: Failed to call msync.");
+				return 0;
+			}
+
+			vuint64_t FileUseMasks::GetUsedPageCount()
+			{
+				return useMaskItems.Count() == 0 ? 0 : CountBits(&useMaskItems[0], useMaskItems.Count());
+			}
+
+			BufferPage FileUseMasks::FindUsedPage(BufferPage begin)
+			{
+				const vuint64_t useMaskPageBits = 8 * sizeof(vuint64_t);
+				vuint64_t end = useMaskItems.Count() * useMaskPageBits;
+				if (begin.index >= end) return BufferPage::Invalid();
+
+				vuint64_t found = FindSetBit(&useMaskItems[0], begin.index, end);
+				return found == end ? BufferPage::Invalid() : BufferPage{found};
+			}
+
+			BufferPage FileUseMasks::FindFreePages(BufferPage begin, vuint64_t count)
+			{
+				const vuint64_t useMaskPageBits = 8 * sizeof(vuint64_t);
+				vuint64_t end = fileMapping->GetTotalPageCount();
+				vuint64_t maskEnd = useMaskItems.Count() * useMaskPageBits;
+				if (end > maskEnd) end = maskEnd;
+				if (count == 0 || begin.index >= end) return BufferPage::Invalid();
+
+				vuint64_t found = FindZeroBits(&useMaskItems[0], begin.index, end, count);
+				return found == end ? BufferPage::Invalid() : BufferPage{found};
 			}
 		}
 
 /***********************************************************************
-FileFreePages
+FileFreeExtents
 ***********************************************************************/
 
-			FileFreePages::FileFreePages(vuint64_t _pageSize)
+			void FileFreeExtents::RemoveExtentPages(vuint64_t first, vuint64_t extentCount, vuint64_t count)
+			{
+				// pages are removed from the beginning of the extent
+				extents.Remove(first);
+				if (extentCount > count)
+				{
+					extents.Set(first + count, extentCount - count);
+				}
+				freePageCount -= count;
+			}
+
+			FileFreeExtents::FileFreeExtents(vuint64_t _pageSize)
 				:pageSize(_pageSize)
-				,freeItemPageItemCount((_pageSize - INDEX_FREEITEM_FREEPAGEITEMBEGIN * sizeof(vuint64_t)) / sizeof(vuint64_t))
-				,activeFreeItemPageIndex(-1)
 			{
 			}
 
-			void FileFreePages::InitializeEmptySource(FileMapping* _fileMapping, FileUseMasks* _fileUseMasks)
+			void FileFreeExtents::InitializeEmptySource(FileMapping* _fileMapping)
 			{
-				fileMapping = _fileMapping;
-				fileUseMasks = _fileUseMasks;
+				extents.Clear();
+				freePageCount = 0;
 
-				freeItemPages.Clear();
 				BufferPage page{INDEX_PAGE_FREEITEM};
-				auto pageDesc = fileMapping->MapPage(page);
-				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileFreePages::InitializeEmptySource()#Internal error: Failed to map INDEX_PAGE_FREEITEM.");
+				auto pageDesc = _fileMapping->MapPage(page);
+				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileFreeExtents::InitializeEmptySource(FileMapping*)#Internal error: Failed to map INDEX_PAGE_FREEITEM.");
 
 				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
 				memset(numbers, 0, pageSize);
 				numbers[INDEX_FREEITEM_NEXTINITIALPAGE] = INDEX_INVALID;
 				numbers[INDEX_FREEITEM_FREEPAGEITEMS] = 0;
-				CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileFreePages::InitializeEmptySource()#Internal error: Failed to call msync.");
-
-				freeItemPages.Add(page.index);
-				activeFreeItemPageIndex = 0;
+				_fileMapping->PersistPage(pageDesc);
 			}
 
-			void FileFreePages::InitializeExistingSource(FileMapping* _fileMapping, FileUseMasks* _fileUseMasks)
+			void FileFreeExtents::InitializeExistingSource(FileMapping* _fileMapping, FileUseMasks* _fileUseMasks)
 			{
-				fileMapping = _fileMapping;
-				fileUseMasks = _fileUseMasks;
+				extents.Clear();
+				freePageCount = 0;
 
-				freeItemPages.Clear();
+				// pages chained after INDEX_PAGE_FREEITEM are not used anymore, free pages listed in them have their bits cleared already
 				BufferPage page{INDEX_PAGE_FREEITEM};
-				
-				while(page.index != INDEX_INVALID)
+				auto pageDesc = _fileMapping->MapPage(page);
+				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileFreeExtents::InitializeExistingSource(FileMapping*, FileUseMasks*)#Internal error: Failed to map INDEX_PAGE_FREEITEM.");
+				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
+				if (numbers[INDEX_FREEITEM_NEXTINITIALPAGE] != INDEX_INVALID || numbers[INDEX_FREEITEM_FREEPAGEITEMS] != 0)
 				{
-					freeItemPages.Add(page.index);
-					auto pageDesc = fileMapping->MapPage(page);
-					vuint64_t* numbers = (vuint64_t*)pageDesc->address;
-					page.index = numbers[INDEX_FREEITEM_NEXTINITIALPAGE];
+					BufferPage chainedPage{numbers[INDEX_FREEITEM_NEXTINITIALPAGE]};
+					numbers[INDEX_FREEITEM_NEXTINITIALPAGE] = INDEX_INVALID;
+					numbers[INDEX_FREEITEM_FREEPAGEITEMS] = 0;
+					_fileMapping->PersistPage(pageDesc);
 
-					if (numbers[INDEX_FREEITEM_FREEPAGEITEMS] != 0)
+					while (chainedPage.index != INDEX_INVALID)
 					{
-						activeFreeItemPageIndex = freeItemPages.Count() - 1;
+						auto chainedPageDesc = _fileMapping->MapPage(chainedPage);
+						CHECK_ERROR(chainedPageDesc != nullptr, L"vl::database::buffer_internal::FileFreeExtents::InitializeExistingSource(FileMapping*, FileUseMasks*)#Internal error: Failed to map a chained free item page.");
+						_fileUseMasks->SetUseMask(chainedPage, false);
+						chainedPage.index = ((vuint64_t*)chainedPageDesc->address)[INDEX_FREEITEM_NEXTINITIALPAGE];
 					}
 				}
-				
-				if (activeFreeItemPageIndex == -1)
+
+				// pages after the last page in use are appended again instead of being free
+				vuint64_t pageEnd = _fileUseMasks->GetUsedPageEnd();
+				BufferPage first{(vuint64_t)INDEX_PAGE_INDEX + 1};
+				while (first.index < pageEnd)
 				{
-					activeFreeItemPageIndex = 0;
+					first = _fileUseMasks->FindFreePages(first, 1);
+					if (!first.IsValid() || first.index >= pageEnd) break;
+					auto used = _fileUseMasks->FindUsedPage(first);
+					vuint64_t end = used.IsValid() ? used.index : pageEnd;
+					PushFreePages(first, end - first.index);
+					first.index = end;
 				}
 			}
 
-			void FileFreePages::PushFreePage(BufferPage page)
+			vuint64_t FileFreeExtents::GetFreePageCount()
 			{
-				BufferPage initialPage{freeItemPages[activeFreeItemPageIndex]};
-				auto pageDesc = fileMapping->MapPage(initialPage);
-				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileFreePages::PushFreePage(BufferPage)#Internal error: Failed to map the last active initial page.");
-				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
-				vuint64_t& count = numbers[INDEX_FREEITEM_FREEPAGEITEMS];
-				if (count == freeItemPageItemCount)
+				return freePageCount;
+			}
+
+			vint FileFreeExtents::GetExtentCount()
+			{
+				return extents.Count();
+			}
+
+			void FileFreeExtents::PushFreePages(BufferPage first, vuint64_t count)
+			{
+				freePageCount += count;
+
+				vuint64_t extentCount = count;
+				vuint64_t afterCount = 0;
+				if (extents.Get(first.index + count, afterCount))
 				{
-					if (activeFreeItemPageIndex == freeItemPages.Count() - 1)
-					{
-						BufferPage newInitialPage{fileMapping->GetTotalPageCount()};
-						numbers[INDEX_FREEITEM_NEXTINITIALPAGE] = newInitialPage.index;
-						msync(numbers, pageSize, MS_SYNC);
-
-						auto newPageDesc = fileMapping->MapPage(newInitialPage);
-						CHECK_ERROR(newPageDesc != nullptr, L"vl::database::buffer_internal::FileFreePages::PushFreePage(BufferPage)#Internal error: Failed to create a new initial page.");
-						numbers = (vuint64_t*)newPageDesc->address;
-						memset(numbers, 0, pageSize);
-						numbers[INDEX_FREEITEM_NEXTINITIALPAGE] = INDEX_INVALID;
-						numbers[INDEX_FREEITEM_FREEPAGEITEMS] = 1;
-						numbers[INDEX_FREEITEM_FREEPAGEITEMBEGIN] = page.index;
-						CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileFreePages::PushFreePage(page)#Internal error: Failed to call msync.");
-						freeItemPages.Add(newInitialPage.index);
-						fileUseMasks->SetUseMask(newInitialPage, true);
-					}
-					else
-					{
-						BufferPage newInitialPage{freeItemPages[activeFreeItemPageIndex + 1]};
-						auto newPageDesc = fileMapping->MapPage(newInitialPage);
-						CHECK_ERROR(newPageDesc != nullptr, L"vl::database::buffer_internal::FileFreePages::PushFreePage(BufferPage)#Internal error: Failed to reuse a created initial page.");
-						numbers = (vuint64_t*)newPageDesc->address;
-						numbers[INDEX_FREEITEM_FREEPAGEITEMS] = 1;
-						numbers[INDEX_FREEITEM_FREEPAGEITEMBEGIN] = page.index;
-						CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileFreePages::PushFreePage(page)#Internal error: Failed to call msync.");
-					}
-					activeFreeItemPageIndex++;
+					extentCount += afterCount;
+					extents.Remove(first.index + count);
+				}
+
+				vuint64_t beforeFirst = 0;
+				vuint64_t beforeCount = 0;
+				if (extents.FindBefore(first.index, beforeFirst, beforeCount) && beforeFirst + beforeCount == first.index)
+				{
+					extents.Set(beforeFirst, beforeCount + extentCount);
 				}
 				else
 				{
-					numbers[INDEX_FREEITEM_FREEPAGEITEMBEGIN + count] = page.index;
-					count++;
-					CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileFreePages::PushFreePage(page)#Internal error: Failed to call msync.");
+					extents.Set(first.index, extentCount);
 				}
 			}
 
-			BufferPage FileFreePages::PopFreePage()
+			vuint64_t FileFreeExtents::PopFreePages(vuint64_t maxCount, BufferPage& first)
 			{
-				BufferPage page = BufferPage::Invalid();
-				BufferPage initialPage{freeItemPages[activeFreeItemPageIndex]};
-				auto pageDesc = fileMapping->MapPage(initialPage);
-				CHECK_ERROR(pageDesc != nullptr, L"vl::database::buffer_internal::FileFreePages::PopFreePage()#Internal error: Failed to map the last active initial page.");
-				vuint64_t* numbers = (vuint64_t*)pageDesc->address;
-				vuint64_t& count = numbers[INDEX_FREEITEM_FREEPAGEITEMS];
+				vuint64_t extentCount = 0;
+				if (maxCount == 0 || !extents.GetFirst(first.index, extentCount)) return 0;
+				vuint64_t count = extentCount > maxCount ? maxCount : extentCount;
+				RemoveExtentPages(first.index, extentCount, count);
+				return count;
+			}
 
-				if (count == 0 && initialPage.index == INDEX_PAGE_FREEITEM)
-				{
-					return page;
-				}
-				count--;
-				page.index = numbers[INDEX_FREEITEM_FREEPAGEITEMBEGIN + count];
-				CHECK_ERROR(msync(numbers, pageSize, MS_SYNC) != -1, L"vl::database::buffer_internal::FileFreePages::PopFreePage()#Internal error: Failed to call msync.");
+			BufferPage FileFreeExtents::PopContiguousPages(vuint64_t count)
+			{
+				BufferPage first;
+				vuint64_t extentCount = 0;
+				if (!extents.FindFirstFit(count, first.index, extentCount)) return BufferPage::Invalid();
+				RemoveExtentPages(first.index, extentCount, count);
+				return first;
+			}
 
-				if (count == 0)
-				{
-					activeFreeItemPageIndex--;
-					if (activeFreeItemPageIndex == -1)
-					{
-						activeFreeItemPageIndex = 0;
-					}
-				}
-				return page;
+			vuint64_t FileFreeExtents::PopTailPages(vuint64_t end, BufferPage& first)
+			{
+				vuint64_t lastFirst = 0;
+				vuint64_t count = 0;
+				if (!extents.GetLast(lastFirst, count) || lastFirst + count != end) return 0;
+				first.index = lastFirst;
+				RemoveExtentPages(lastFirst, count, count);
+				return count;
 			}
 
 /***********************************************************************
 FileBufferSource
 ***********************************************************************/
 
-		FileBufferSource::FileBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize, const WString& _fileName, int _fileDescriptor)
+		FileBufferSource::FileBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize, const WString& _fileName, int _fileDescriptor, FramePool* _framePool, AsyncFileReader* _asyncReader, bool _checksums)
 			:source(_source)
 			,pageSize(_pageSize)
 			,fileName(_fileName)
 			,fileDescriptor(_fileDescriptor)
-			,fileMapping(_pageSize, _fileDescriptor, _totalUsedPages)
-			,fileUseMasks(_pageSize, _fileDescriptor)
-			,fileFreePages(_pageSize)
+			,asyncReader(_asyncReader)
+			,fileMapping(_pageSize, _fileDescriptor, _totalUsedPages, _framePool, _checksums)
+			,fileUseMasks(_checksums ? _pageSize - PageChecksumSize : _pageSize, _fileDescriptor)
+			,fileFreeExtents(_checksums ? _pageSize - PageChecksumSize : _pageSize)
 		{
 			indexPage.index = INDEX_PAGE_INDEX;
 		}
 
+		bool FileBufferSource::InitializeCompressedStore(bool createNew)
+		{
+			compressedStore = new CompressedPageStore(pageSize, fileDescriptor);
+			fileMapping.SetCompressedStore(compressedStore.Obj());
+			auto mapFileName = fileName + L".pagemap";
+			return createNew ? compressedStore->InitializeEmptySource(mapFileName) : compressedStore->InitializeExistingSource(mapFileName);
+		}
+
 		void FileBufferSource::InitializeEmptySource()
 		{
 			fileMapping.InitializeEmptySource();
 			fileUseMasks.InitializeEmptySource(&fileMapping);
-			fileFreePages.InitializeEmptySource(&fileMapping, &fileUseMasks);
+			fileFreeExtents.InitializeEmptySource(&fileMapping);
 
 			auto pageDesc = fileMapping.MapPage(BufferPage{INDEX_PAGE_INDEX});
 			CHECK_ERROR(pageDesc != nullptr, L"vl::database::FileBufferSource::InitializeEmptySource()#Internal error: Failed to map INDEX_PAGE_INDEX.");
@@ -452,12 +1084,56 @@ FileBufferSource
 		{
 			fileMapping.InitializeExistingSource();
 			fileUseMasks.InitializeExistingSource(&fileMapping);
-			fileFreePages.InitializeExistingSource(&fileMapping, &fileUseMasks);
+			fileFreeExtents.InitializeExistingSource(&fileMapping, &fileUseMasks);
+			fileMapping.TrimTotalPageCount(fileUseMasks.GetUsedPageEnd());
+		}
+
+		void FileBufferSource::CompleteRead(PendingPageRead* read)
+		{
+			List<void*> addresses;
+			SOURCE_LOCK(this)
+			{
+				auto pageDesc = fileMapping.FinishReadingPage(read);
+				if (pageDesc && pageDesc->loading)
+				{
+					// the read is abandoned, and the page has been evicted and is being read again
+					CopyFrom(fileMapping.GetPendingRead(read->page)->waiters, read->waiters, true);
+					read->waiters.Clear();
+				}
+				else
+				{
+					FOREACH(PendingPageRead::Waiter, waiter, read->waiters)
+					{
+						addresses.Add(pageDesc && pageDesc->AcquireLatch(waiter.f0) ? pageDesc->address : nullptr);
+					}
+				}
+			}
+
+			// waiters are completed at last, because the source could be unloaded after that
+			PendingPageRead::WaiterList waiters;
+			CopyFrom(waiters, read->waiters);
+			delete read;
+			for (vint i = 0; i < waiters.Count(); i++)
+			{
+				waiters[i].f1->Complete(addresses[i]);
+			}
 		}
 
 		void FileBufferSource::Unload()
 		{
+			fileUseMasks.WriteDirtyPages();
+			if (fileMapping.HasPersistingPages())
+			{
+				fileMapping.WritePersistingPages();
+				fileMapping.SyncFile();
+			}
 			fileMapping.UnmapAllPages();
+			fileMapping.TruncateFile();
+			if (compressedStore)
+			{
+				// pages written back by unmapping are lost without the map
+				fileMapping.SyncFile();
+			}
 			CloseFileForFileSource(fileDescriptor);
 		}
 
@@ -476,6 +1152,11 @@ FileBufferSource
 			return fileName;
 		}
 
+		BufferSourceKind FileBufferSource::GetSourceKind()
+		{
+			return BufferSourceKind::File;
+		}
+
 		bool FileBufferSource::UnmapPage(BufferPage page)
 		{
 			return fileMapping.UnmapPage(page);
@@ -488,8 +1169,8 @@ FileBufferSource
 
 		BufferPage FileBufferSource::AllocatePage()
 		{
-			BufferPage page = fileFreePages.PopFreePage();
-			if (!page.IsValid())
+			BufferPage page;
+			if (fileFreeExtents.PopFreePages(1, page) == 0)
 			{
 				page = fileMapping.AppendPage();
 			}
@@ -500,6 +1181,64 @@ FileBufferSource
 			return page;
 		}
 
+		bool FileBufferSource::AllocatePages(vint count, bool contiguous, BufferPage* pages)
+		{
+			vint allocated = 0;
+			BufferPage first;
+			if (contiguous)
+			{
+				// a free extent at the end of the file continues with appended pages
+				first = fileFreeExtents.PopContiguousPages(count);
+				if (!first.IsValid())
+				{
+					// use mask pages are appended before the free tail is taken, so that they are not in the middle of pages
+					fileUseMasks.ReserveUseMaskPages(count);
+				}
+				vuint64_t popped = first.IsValid() ? count : fileFreeExtents.PopTailPages(fileMapping.GetTotalPageCount(), first);
+				for (; allocated < (vint)popped; allocated++)
+				{
+					pages[allocated].index = first.index + allocated;
+				}
+			}
+			else
+			{
+				while (allocated < count)
+				{
+					vuint64_t popped = fileFreeExtents.PopFreePages(count - allocated, first);
+					if (popped == 0) break;
+					for (vuint64_t i = 0; i < popped; i++)
+					{
+						pages[allocated++].index = first.index + i;
+					}
+				}
+			}
+
+			if (allocated < count)
+			{
+				// appended pages are not mapped until they are locked
+				fileUseMasks.ReserveUseMaskPages(count - allocated);
+				first = fileMapping.AppendPages(count - allocated);
+				if (!first.IsValid())
+				{
+					for (vint i = 0; i < allocated; i++)
+					{
+						fileFreeExtents.PushFreePages(pages[i], 1);
+					}
+					return false;
+				}
+				for (vint i = 0; allocated < count; i++)
+				{
+					pages[allocated++].index = first.index + i;
+				}
+			}
+
+			for (vint i = 0; i < count; i++)
+			{
+				fileUseMasks.SetUseMask(pages[i], true);
+			}
+			return true;
+		}
+
 		bool FileBufferSource::FreePage(BufferPage page)
 		{
 			switch(page.index)
@@ -518,12 +1257,26 @@ FileBufferSource
 					return false;
 				}
 			}
-			fileFreePages.PushFreePage(page);
+			fileFreeExtents.PushFreePages(page, 1);
 			fileUseMasks.SetUseMask(page, false);
 			return true;
 		}
 
-		void* FileBufferSource::LockPage(BufferPage page)
+		void* FileBufferSource::LockPage(BufferPage page, PageLatch latch)
+		{
+			auto pageDesc = LockPageDesc(page, latch);
+			return pageDesc ? pageDesc->address : nullptr;
+		}
+
+		bool FileBufferSource::UnlockPage(BufferPage page, void* buffer, PersistanceType persistanceType)
+		{
+			auto pageDesc = fileMapping.GetMappedPageDesc(page);
+			if (!pageDesc) return false;
+			if (pageDesc->address != buffer) return false;
+			return UnlockPageDesc(pageDesc, persistanceType);
+		}
+
+		BufferPageDesc* FileBufferSource::LockPageDesc(BufferPage page, PageLatch latch)
 		{
 			if (page.index >= fileMapping.GetTotalPageCount())
 			{
@@ -532,9 +1285,8 @@ FileBufferSource
 			if (!fileUseMasks.GetUseMask(page)) return nullptr;
 			if (auto pageDesc = fileMapping.MapPage(page))
 			{
-				if (pageDesc->locked) return nullptr;
-				pageDesc->locked = true;
-				return pageDesc->address;
+				if (!pageDesc->AcquireLatch(latch)) return nullptr;
+				return pageDesc;
 			}
 			else
 			{
@@ -542,73 +1294,220 @@ FileBufferSource
 			}
 		}
 
-		bool FileBufferSource::UnlockPage(BufferPage page, void* buffer, PersistanceType persistanceType)
+		bool FileBufferSource::UnlockPageDesc(BufferPageDesc* pageDesc, PersistanceType persistanceType)
 		{
-			auto pageDesc = fileMapping.GetMappedPageDesc(page);
-			if (!pageDesc) return false;
-			if (pageDesc->address != buffer) return false;
-			if (!pageDesc->locked) return false;
+			if (!pageDesc->ReleaseLatch(persistanceType)) return false;
 
 			switch (persistanceType)
 			{
 				case PersistanceType::NoChanging:
 					break;
 				case PersistanceType::Changed:
-					pageDesc->dirty = true;
+					fileMapping.MarkDirty(pageDesc);
 					break;
 				case PersistanceType::ChangedAndPersist:
-					msync(pageDesc->address, pageSize, MS_SYNC);
-					pageDesc->dirty = false;
+					fileMapping.PersistPage(pageDesc);
 					break;
 			}
-			pageDesc->locked = false;
 			return true;
-		}	
+		}
+
+		bool FileBufferSource::FlushPage(BufferPage page)
+		{
+			return fileMapping.FlushPage(page);
+		}
+
+		bool FileBufferSource::EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack)
+		{
+			return fileMapping.EvictPage(page, allowWriteBack, writtenBack);
+		}
+
+		BufferTicket FileBufferSource::RequestPersistance()
+		{
+			// use masks changed by AllocatePage or FreePage are persisted together with other pages
+			fileUseMasks.WriteDirtyPages();
+			if (!fileMapping.HasPersistingPages())
+			{
+				return BufferTicket::Invalid();
+			}
 
-		void FileBufferSource::FillUnmapPageCandidates(collections::List<BufferPageTimeTuple>& pages, vint expectCount)
+			BufferTicket ticket;
+			CS_LOCK(persistanceLock)
+			{
+				ticket.index = ++requestedTicket;
+			}
+			return ticket;
+		}
+
+		bool FileBufferSource::WaitForPersistance(BufferTicket ticket)
 		{
-			vint mappedCount = fileMapping.GetMappedPageCount();
-			if (mappedCount == 0) return;
+			if (!ticket.IsValid()) return true;
+
+			// the first waiter becomes the leader and persists pages for all requests so far, others wait for it
+			persistanceLock.Enter();
+			if (ticket.index > requestedTicket)
+			{
+				persistanceLock.Leave();
+				return false;
+			}
 
-			Array<BufferPageTimeTuple> tuples(mappedCount);
-			vint usedCount = 0;
-			for (vint i = 0; i < mappedCount; i++)
+			while (persistedTicket < ticket.index)
 			{
-				auto key = fileMapping.GetMappedPage(i);
-				auto value = fileMapping.GetMappedPageDesc(i);
-				if (!value->locked)
+				if (persistanceLeading)
 				{
-					BufferPage page{key};
-					tuples[usedCount++] = BufferPageTimeTuple(source, page, value->lastAccessTime);
+					persistanceCondition.SleepWith(persistanceLock);
+					continue;
 				}
+
+				persistanceLeading = true;
+				auto leadingTicket = requestedTicket;
+				persistanceLock.Leave();
+
+				// pages are written without holding the lock of the source, so that followers and other callers are not blocked
+				FileMapping::TakenPages taken;
+				SOURCE_LOCK(this)
+				{
+					fileUseMasks.WriteDirtyPages();
+					fileMapping.TakePersistingPages(taken);
+				}
+				fileMapping.WriteTakenPages(taken);
+				SOURCE_LOCK(this)
+				{
+					fileMapping.ReleaseTakenPages(taken);
+				}
+				fileMapping.SyncFile();
+
+				persistanceLock.Enter();
+				persistedTicket = leadingTicket;
+				persistanceLeading = false;
+				persistanceCondition.WakeAllPendings();
+			}
+			persistanceLock.Leave();
+			return true;
+		}
+
+		void FileBufferSource::SyncFile()
+		{
+			fileMapping.SyncFile();
+		}
+
+		vint FileBufferSource::PrefetchPages(const BufferPage* pages, vint count)
+		{
+			vint prefetched = 0;
+			FileMapping::PrefetchRanges ranges;
+			SOURCE_LOCK(this)
+			{
+				prefetched = fileMapping.PrefetchPages(pages, count, ranges);
 			}
+			fileMapping.IssuePrefetches(ranges);
+			return prefetched;
+		}
 
-			if (tuples.Count() > 0)
+		void FileBufferSource::LockPageAsync(BufferPage page, PageLatch latch, Ptr<BufferCompletion> completion)
+		{
+			void* address = nullptr;
+			PendingPageRead* submittingRead = nullptr;
+			SOURCE_LOCK(this)
 			{
-				SortLambda(&tuples[0], usedCount, [](const BufferPageTimeTuple& t1, const BufferPageTimeTuple& t2)
+				if (!asyncReader || (fileMapping.GetMappedPageDesc(page) && !fileMapping.GetPendingRead(page)))
+				{
+					address = LockPage(page, latch);
+				}
+				else if (auto read = fileMapping.GetPendingRead(page))
 				{
-					if (t1.f2 < t2.f2) return -1;
-					else if (t1.f2 > t2.f2) return 1;
-					else return 0;
-				});
+					read->waiters.Add(PendingPageRead::Waiter(latch, completion));
+					return;
+				}
+				else if (page.index < fileMapping.GetTotalPageCount() && fileUseMasks.GetUseMask(page))
+				{
+					auto read = new PendingPageRead(this);
+					if (fileMapping.StartReadingPage(page, read))
+					{
+						read->waiters.Add(PendingPageRead::Waiter(latch, completion));
+						submittingRead = read;
+					}
+					else
+					{
+						delete read;
+					}
+				}
+			}
 
-				vint copyCount = usedCount < expectCount ? usedCount : expectCount;
-				for (vint i = 0; i < copyCount; i++)
+			if (submittingRead)
+			{
+				// submitting could wait for the queue, so it happens after releasing the lock
+				if (!asyncReader->Submit(submittingRead))
 				{
-					pages.Add(tuples[i]);
+					submittingRead->result = -EIO;
+					submittingRead->OnCompleted();
 				}
 			}
+			else
+			{
+				completion->Complete(address);
+			}
+		}
+
+		BufferCounters& FileBufferSource::GetCounters()
+		{
+			return fileMapping.GetCounters();
+		}
+
+		BufferSourceQuota& FileBufferSource::GetQuota()
+		{
+			return quota;
+		}
+
+		volatile vint& FileBufferSource::GetHandleCount()
+		{
+			return handleCount;
+		}
+
+		vuint64_t FileBufferSource::GetCachedPageCount()
+		{
+			return fileMapping.GetMappedPageCount();
+		}
+
+		BufferPageDesc* FileBufferSource::GetCachedPageDesc(BufferPage page)
+		{
+			return fileMapping.GetMappedPageDesc(page);
 		}
 
-		int CreateNewFileForFileSource(const WString& fileName)
+		vint FileBufferSource::GetPageSlotCount()
+		{
+			return fileMapping.GetPageSlotCount();
+		}
+
+		BufferPageDesc* FileBufferSource::GetPageSlot(vint slot, BufferPage& page)
+		{
+			return fileMapping.GetPageSlot(slot, page);
+		}
+
+		DirtyPageTable& FileBufferSource::GetDirtyPageTable()
+		{
+			return fileMapping.GetDirtyPageTable();
+		}
+
+		int CreateNewFileForFileSource(const WString& fileName, bool directIO)
 		{
 			auto mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
-			return open(wtoa(fileName).Buffer(), O_CREAT | O_TRUNC | O_RDWR, mode);
+			int fileDescriptor = open(wtoa(fileName).Buffer(), O_CREAT | O_TRUNC | O_RDWR | (directIO ? O_DIRECT : 0), mode);
+			if (fileDescriptor == -1 && directIO && errno == EINVAL)
+			{
+				// file systems like tmpfs do not support O_DIRECT
+				fileDescriptor = open(wtoa(fileName).Buffer(), O_CREAT | O_TRUNC | O_RDWR, mode);
+			}
+			return fileDescriptor;
 		}
 
-		int OpenExistingFileForFileSource(const WString& fileName)
+		int OpenExistingFileForFileSource(const WString& fileName, bool directIO)
 		{
-			return open(wtoa(fileName).Buffer(), O_RDWR);
+			int fileDescriptor = open(wtoa(fileName).Buffer(), O_RDWR | (directIO ? O_DIRECT : 0));
+			if (fileDescriptor == -1 && directIO && errno == EINVAL)
+			{
+				fileDescriptor = open(wtoa(fileName).Buffer(), O_RDWR);
+			}
+			return fileDescriptor;
 		}
 
 		void CloseFileForFileSource(int fileDescriptor)
@@ -616,16 +1515,18 @@ FileBufferSource
 			close(fileDescriptor);
 		}
 
-		IBufferSource* CreateFileSource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, const WString& fileName, bool createNew)
+		IBufferSource* CreateFileSource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, const WString& fileName, bool createNew, FramePool* framePool, AsyncFileReader* asyncReader, bool compressed, bool checksums)
 		{
+			// frames are page aligned, so pages could bypass the page cache when they are read asynchronously
+			bool directIO = asyncReader != nullptr;
 			int fileDescriptor = 0;
 			if (createNew)
 			{
-				fileDescriptor = CreateNewFileForFileSource(fileName);
+				fileDescriptor = CreateNewFileForFileSource(fileName, directIO);
 			}
 			else
 			{
-				fileDescriptor = OpenExistingFileForFileSource(fileName);
+				fileDescriptor = OpenExistingFileForFileSource(fileName, directIO);
 			}
 
 			if (fileDescriptor == -1)
@@ -634,10 +1535,18 @@ FileBufferSource
 			}
 			else
 			{
-				auto result = new FileBufferSource(source, totalUsedPages, pageSize, fileName, fileDescriptor);
+				auto result = new FileBufferSource(source, totalUsedPages, pageSize, fileName, fileDescriptor, framePool, asyncReader, checksums);
+				if (compressed && !result->InitializeCompressedStore(createNew))
+				{
+					// the map file is closed by the store
+					CloseFileForFileSource(fileDescriptor);
+					delete result;
+					return nullptr;
+				}
 				if (createNew)
 				{
 					result->InitializeEmptySource();
+					result->WaitForPersistance(result->RequestPersistance());
 				}
 				else
 				{
@@ -8,51 +8,188 @@ Database::Utility
 #ifndef VCZH_DATABASE_UTILITY_FILEBUFFER
 #define VCZH_DATABASE_UTILITY_FILEBUFFER
 
-#include "Buffer.h"
+#include "PageTable.h"
+#include "FramePool.h"
+#include "BufferMetrics.h"
+#include "PageGeometry.h"
+#include "AsyncFileReader.h"
+#include "CompressedPageStore.h"
+#include "PageChecksum.h"
+#include "PageBitmap.h"
+#include "DirtyPageTable.h"
+#include "ExtentTree.h"
 
 namespace vl
 {
 	namespace database
 	{
+		class FileBufferSource;
+
 		namespace buffer_internal
 		{
+			/*
+			 * An asynchronous read of a page into a frame.
+			 * Callers of LockPageAsync waiting for the same page are attached to the read,
+			 * they acquire their latches in order when the read completes.
+			 */
+			class PendingPageRead : public AsyncReadRequest
+			{
+			public:
+				typedef Tuple<PageLatch, Ptr<BufferCompletion>>					Waiter;
+				typedef collections::List<Waiter>								WaiterList;
+
+				FileBufferSource*			owner;
+				BufferPage					page;
+				WaiterList					waiters;
+				bool						abandoned = false;		// the page has been read synchronously into another frame
+
+				PendingPageRead(FileBufferSource* _owner);
+
+				void						OnCompleted()override;
+			};
+
+			/*
+			 * Pages are mapped into memory by mmap in segments of SegmentSize bytes,
+			 * a segment is mapped when the first page in it is mapped.
+			 * A segment without mapped pages stays mapped in case its pages are mapped again,
+			 * until there are more than MaxIdleSegmentCount such segments.
+			 * A segment is mapped in full even when the file ends inside it, so that the file grows without moving mapped pages.
+			 * Or when a frame pool is given, they are copied into frames by pread and written back by pwrite.
+			 * When a compressed page store is also given, pages are decompressed into frames and compressed on writing back.
+			 * When checksums are enabled, frames are sealed before being written back and verified after being read.
+			 *
+			 * The file grows by extents allocated by fallocate, each extent doubles the file until it reaches MaxExtentSize,
+			 * the number of pages is tracked in memory, and the file is truncated to it when the source is unloaded.
+			 */
 			class FileMapping : public Object
 			{
-				typedef collections::Dictionary<vuint64_t, Ptr<BufferPageDesc>>	PageMap;
+				typedef collections::List<vuint64_t>							PageList;
+				typedef collections::Dictionary<vuint64_t, PendingPageRead*>	PendingReadMap;
+			public:
+				typedef collections::List<BufferPageDesc*>						PageDescList;
+				typedef Tuple<vuint64_t, vuint64_t>								PrefetchRange;		// first page and page count
+				typedef collections::List<PrefetchRange>						PrefetchRanges;
+
+				// Persisting pages taken while holding the lock of the source, frames + i * pageSize is a copy of pages[i],
+				// frames are mapped anonymously so that they are aligned for files opened by O_DIRECT
+				struct TakenPages
+				{
+					PageDescList				pages;
+					char*						frames = nullptr;
+					vuint64_t					frameBytes = 0;
+				};
+			private:
+
+				struct Segment
+				{
+					char*					address = nullptr;
+					vint					mappedPageCount = 0;
+				};
+				typedef collections::List<Segment>								SegmentList;
+
+				static const vuint64_t		MinExtentSize = 64 * 1024;
+				static const vuint64_t		MaxExtentSize = 64 * 1024 * 1024;
+				static const vuint64_t		SegmentSize = 64 * 1024 * 1024;
+				static const vint			MaxIdleSegmentCount = 16;
 			private:
 				vuint64_t					pageSize;
 				int							fileDescriptor;
 				volatile vuint64_t*			totalUsedPages;
-				PageMap						mappedPages;
+				FramePool*					framePool;
+				bool						checksums;
+				CompressedPageStore*		compressedStore = nullptr;
+				PageTable					mappedPages;
+				DirtyPageTable				dirtyPages;
+				PageList					persistingPages;
+				PendingReadMap				pendingReads;
 				vuint64_t					totalPageCount = 0;
-				
+				vuint64_t					allocatedPageCount = 0;	// pages reserved in the file, no less than totalPageCount
+				vuint64_t					pagesPerSegment;
+				SegmentList					segments;
+				vint						idleSegmentCount = 0;
+				BufferCounters				counters;
+
+				void						WriteFrame(BufferPageDesc* pageDesc, void* frame = nullptr);
+				void						WriteBackPage(BufferPageDesc* pageDesc);
+				void						ReleasePage(BufferPageDesc* pageDesc);
+				void*						ReadFrame(vuint64_t offset);
+				bool						GrowFile(vuint64_t pageCount);
+				void*						MapSegmentPage(vuint64_t index);
+				void						UnmapSegmentPage(vuint64_t index);
+				void						UnmapIdleSegments();
+
 			public:
-				FileMapping(vuint64_t _pageSize, int _fileDescriptor, volatile vuint64_t* _totalUsedPages);
+				FileMapping(vuint64_t _pageSize, int _fileDescriptor, volatile vuint64_t* _totalUsedPages, FramePool* _framePool, bool _checksums = false);
 
 				void						InitializeEmptySource();
 				void						InitializeExistingSource();
+				void						SetCompressedStore(CompressedPageStore* _compressedStore);
 
 				vuint64_t					GetTotalPageCount();
-				Ptr<BufferPageDesc>			MapPage(BufferPage page);
+
+				// Reserved pages after the last page in use are appended again, when the file was not truncated before it was closed
+				// A compressed store also removes these pages, so that their extents are reused
+				void						TrimTotalPageCount(vuint64_t pageCount);
+				void						TruncateFile();
+				BufferPageDesc*				MapPage(BufferPage page);
 				BufferPage					AppendPage();
+				// Pages are appended without being mapped, returns the first page
+				BufferPage					AppendPages(vuint64_t count);
+				// Pages of the source become dirty only by MarkDirty or PersistPage, so that they are tracked in the dirty page table
+				void						MarkDirty(BufferPageDesc* pageDesc);
+				void						PersistPage(BufferPageDesc* pageDesc);
+				bool						HasPersistingPages();
+				void						WritePersistingPages();
+				// Persisting pages are taken, pinned and copied while holding the lock of the source, and the copies are written without holding the lock,
+				// so that a writer latching a page during the write does not change bytes after they are sealed. Copies are freed after being written,
+				// and pages are released while holding the lock again.
+				// Pages of a compressed store are written when they are taken, because the store is only written while holding the lock of the source.
+				void						TakePersistingPages(TakenPages& taken);
+				void						WriteTakenPages(TakenPages& taken);
+				void						ReleaseTakenPages(TakenPages& taken);
+				void						SyncFile();
+				bool						FlushPage(BufferPage page);
 				bool						UnmapPage(BufferPage page);
+				bool						EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack);
+				// Pages to read ahead are collected while holding the lock of the source, and read ahead after releasing it
+				vint						PrefetchPages(const BufferPage* pages, vint count, PrefetchRanges& ranges);
+				void						IssuePrefetches(const PrefetchRanges& ranges);
 				void						UnmapAllPages();
 
+				// A page being read is mapped, pinned and exclusively latched, until FinishReadingPage is called
+				PendingPageRead*			GetPendingRead(BufferPage page);
+				bool						StartReadingPage(BufferPage page, PendingPageRead* read);
+				BufferPageDesc*				FinishReadingPage(PendingPageRead* read);
+
+				BufferCounters&				GetCounters();
 				vint						GetMappedPageCount();
-				BufferPage					GetMappedPage(vint index);
-				Ptr<BufferPageDesc>			GetMappedPageDesc(vint index);
-				Ptr<BufferPageDesc>			GetMappedPageDesc(BufferPage page);
+				vint						GetPageSlotCount();
+				BufferPageDesc*				GetPageSlot(vint slot, BufferPage& page);
+				DirtyPageTable&				GetDirtyPageTable();
+				BufferPageDesc*				GetMappedPageDesc(BufferPage page);
 			};
 
+			/*
+			 * Bits of all use mask pages are mirrored in memory, so reading a bit does not map its use mask page.
+			 * Changed bits are copied to use mask pages by WriteDirtyPages, before pages of the source are persisted.
+			 */
 			class FileUseMasks : public Object
 			{
 				typedef collections::List<vuint64_t>							PageList;
+				typedef collections::SortedList<vint>							DirtyPageList;
+				typedef PageLayout<1, 8 * sizeof(vuint64_t)>					UseMaskLayout;
 			private:
 				int							fileDescriptor;
 				vuint64_t					pageSize;
 				PageList					useMaskPages;
-				vuint64_t					useMaskPageItemCount;
+				UseMaskLayout				useMaskLayout;
+				vuint64_t					useMaskItemCount;		// uint64 items of bits in a use mask page
+				collections::Array<vuint64_t>	useMaskItems;		// items of all use mask pages, bit i of useMaskItems[j] is the bit of page j * 64 + i
+				DirtyPageList				dirtyUseMaskPages;		// indices in useMaskPages of pages with bits not copied from useMaskItems
 				FileMapping*				fileMapping = nullptr;
+
+				void						AddUseMaskPage(vuint64_t index);
+				void						AppendUseMaskPage();
 	
 			public:
 				FileUseMasks(vuint64_t _pageSize, int _fileDescriptor);
@@ -62,27 +199,59 @@ namespace vl
 
 				bool						GetUseMask(BufferPage page);
 				void						SetUseMask(BufferPage page, bool available);
+				// Appends use mask pages until bits of the next count pages appended to the file are covered
+				void						ReserveUseMaskPages(vuint64_t count);
+
+				bool						HasDirtyPages();
+				void						WriteDirtyPages();
+
+				// One after the last page in use, or 0 if no page is in use
+				vuint64_t					GetUsedPageEnd();
+				vuint64_t					GetUsedPageCount();
+
+				// The first page of count free pages in a row no less than begin and before the end of the file, or an invalid page if there is no such pages
+				BufferPage					FindFreePages(BufferPage begin, vuint64_t count);
+				// The first page in use no less than begin, or an invalid page if there is no such page
+				BufferPage					FindUsedPage(BufferPage begin);
 			};
 
-			class FileFreePages : public Object
+			/*
+			 * Free pages are kept in memory as extents ordered by their first pages, adjacent extents are merged.
+			 * Extents are stored in an ExtentTree, so pushing and popping pages take O(log n) even when free pages are fragmented.
+			 * Extents are not stored in the file, they are rebuilt from use masks when the source is opened,
+			 * every page before the end of the file is free if its bit is cleared.
+			 *
+			 * Files used to store a stack of free pages in a chain of pages beginning with INDEX_PAGE_FREEITEM,
+			 * the page is still reserved, and other pages in the chain are freed when such a file is opened.
+			 */
+			class FileFreeExtents : public Object
 			{
-				typedef collections::List<vuint64_t>							PageList;
 			private:
 				vuint64_t					pageSize;
-				PageList					freeItemPages;
-				vint						activeFreeItemPageIndex;
-				vuint64_t					freeItemPageItemCount;
-				FileMapping*				fileMapping = nullptr;
-				FileUseMasks*				fileUseMasks = nullptr;
+				ExtentTree					extents;
+				vuint64_t					freePageCount = 0;
+
+				void						RemoveExtentPages(vuint64_t first, vuint64_t extentCount, vuint64_t count);
 
 			public:
-				FileFreePages(vuint64_t _pageSize);
+				FileFreeExtents(vuint64_t _pageSize);
 
-				void						InitializeEmptySource(FileMapping* _fileMapping, FileUseMasks* _fileUseMasks);
+				void						InitializeEmptySource(FileMapping* _fileMapping);
 				void						InitializeExistingSource(FileMapping* _fileMapping, FileUseMasks* _fileUseMasks);
 
-				void						PushFreePage(BufferPage page);
-				BufferPage					PopFreePage();
+				vuint64_t					GetFreePageCount();
+				vint						GetExtentCount();
+
+				void						PushFreePages(BufferPage first, vuint64_t count);
+
+				// Pops no more than maxCount pages from the first extent, returns the number of pages
+				vuint64_t					PopFreePages(vuint64_t maxCount, BufferPage& first);
+
+				// Pops count pages from the first extent that is large enough, or returns an invalid page
+				BufferPage					PopContiguousPages(vuint64_t count);
+
+				// Pops the last extent if it ends at the given page, returns the number of pages
+				vuint64_t					PopTailPages(vuint64_t end, BufferPage& first);
 			};
 		}
 
@@ -95,35 +264,69 @@ namespace vl
 			WString							fileName;
 			int								fileDescriptor;
 			BufferPage						indexPage;
+			BufferSourceQuota				quota;
+			volatile vint					handleCount = 0;
+			buffer_internal::AsyncFileReader*	asyncReader;
+			Ptr<buffer_internal::CompressedPageStore>	compressedStore;
 
 			buffer_internal::FileMapping	fileMapping;
 			buffer_internal::FileUseMasks	fileUseMasks;
-			buffer_internal::FileFreePages	fileFreePages;
+			buffer_internal::FileFreeExtents	fileFreeExtents;
+
+			CriticalSection					persistanceLock;
+			ConditionVariable				persistanceCondition;
+			vuint64_t						requestedTicket = 0;
+			vuint64_t						persistedTicket = 0;
+			bool							persistanceLeading = false;
 
 		public:
 
-			FileBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize, const WString& _fileName, int _fileDescriptor);
+			// Use masks only use the first pageDataSize bytes of pages when checksums are enabled
+			FileBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize, const WString& _fileName, int _fileDescriptor, buffer_internal::FramePool* _framePool, buffer_internal::AsyncFileReader* _asyncReader, bool _checksums);
 
+			// The page-to-extent map of a compressed source is stored in a file next to the data file
+			bool							InitializeCompressedStore(bool createNew);
 			void							InitializeEmptySource();
 			void							InitializeExistingSource();
+			void							CompleteRead(buffer_internal::PendingPageRead* read);
 
 			void							Unload()override;
 			BufferSource					GetBufferSource()override;
 			SpinLock&						GetLock()override;
 			WString							GetFileName()override;
+			BufferSourceKind				GetSourceKind()override;
 			bool							UnmapPage(BufferPage page)override;
 			BufferPage						GetIndexPage()override;
 			BufferPage						AllocatePage()override;
+			bool							AllocatePages(vint count, bool contiguous, BufferPage* pages)override;
 			bool							FreePage(BufferPage page)override;
-			void*							LockPage(BufferPage page)override;
+			void*							LockPage(BufferPage page, PageLatch latch)override;
 			bool							UnlockPage(BufferPage page, void* buffer, PersistanceType persistanceType)override;
-			void							FillUnmapPageCandidates(collections::List<BufferPageTimeTuple>& pages, vint expectCount)override;
+			BufferPageDesc*					LockPageDesc(BufferPage page, PageLatch latch)override;
+			bool							UnlockPageDesc(BufferPageDesc* pageDesc, PersistanceType persistanceType)override;
+			bool							FlushPage(BufferPage page)override;
+			bool							EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack)override;
+			BufferTicket					RequestPersistance()override;
+			bool							WaitForPersistance(BufferTicket ticket)override;
+			void							SyncFile()override;
+			vint							PrefetchPages(const BufferPage* pages, vint count)override;
+			void							LockPageAsync(BufferPage page, PageLatch latch, Ptr<BufferCompletion> completion)override;
+			buffer_internal::BufferCounters&	GetCounters()override;
+			BufferSourceQuota&				GetQuota()override;
+			volatile vint&					GetHandleCount()override;
+			vuint64_t						GetCachedPageCount()override;
+			BufferPageDesc*					GetCachedPageDesc(BufferPage page)override;
+			vint							GetPageSlotCount()override;
+			BufferPageDesc*					GetPageSlot(vint slot, BufferPage& page)override;
+			buffer_internal::DirtyPageTable&	GetDirtyPageTable()override;
 		};
 
-		int									CreateNewFileForFileSource(const WString& fileName);
-		int									OpenExistingFileForFileSource(const WString& fileName);
+		int									CreateNewFileForFileSource(const WString& fileName, bool directIO = false);
+		int									OpenExistingFileForFileSource(const WString& fileName, bool directIO = false);
 		void								CloseFileForFileSource(int fileDescriptor);
-		extern IBufferSource*				CreateFileSource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, const WString& fileName, bool createNew);	
+
+		// Pages are read by the async reader when it is given, in which case the frame pool is also required
+		extern IBufferSource*				CreateFileSource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, const WString& fileName, bool createNew, buffer_internal::FramePool* framePool, buffer_internal::AsyncFileReader* asyncReader = nullptr, bool compressed = false, bool checksums = false);
 	}
 }
 
@@ -0,0 +1,289 @@
+#include "FramePool.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+
+// from <numaif.h>, which requires libnuma
+#define FRAMEPOOL_MPOL_PREFERRED 1
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			using namespace collections;
+
+			vint GetNumaNodeCount()
+			{
+				// the file contains ranges like "0" or "0-1"
+				vint count = 1;
+				if (FILE* file = fopen("/sys/devices/system/node/online", "r"))
+				{
+					char buffer[256] = {0};
+					if (fgets(buffer, sizeof(buffer) - 1, file))
+					{
+						vint number = 0;
+						for (char* reading = buffer; *reading; reading++)
+						{
+							if ('0' <= *reading && *reading <= '9')
+							{
+								number = number * 10 + (*reading - '0');
+								if (count < number + 1) count = number + 1;
+							}
+							else
+							{
+								number = 0;
+							}
+						}
+					}
+					fclose(file);
+				}
+				return count;
+			}
+
+/***********************************************************************
+FramePool
+***********************************************************************/
+
+			bool FramePool::AllocateRegion(vint node, vuint64_t frameCount)
+			{
+				auto& frames = *nodes[node].Obj();
+				vuint64_t size = frameSize * frameCount;
+				void* address = MAP_FAILED;
+				bool huge = false;
+
+				if (hugePages != BufferHugePages::None)
+				{
+					size = IntUpperBound(size, HugePageSize);
+				}
+
+				if (hugePages == BufferHugePages::Explicit)
+				{
+					// without MAP_NORESERVE, this fails when not enough huge pages are reserved in the system, instead of raising SIGBUS on first touch
+					address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+					huge = address != MAP_FAILED;
+				}
+
+				if (address == MAP_FAILED && hugePages != BufferHugePages::None)
+				{
+					// align the region to huge pages, so that the kernel could back it by huge pages
+					char* reserved = (char*)mmap(nullptr, size + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+					if (reserved != MAP_FAILED)
+					{
+						char* aligned = (char*)IntUpperBound((vuint64_t)reserved, HugePageSize);
+						if (aligned > reserved)
+						{
+							munmap(reserved, aligned - reserved);
+						}
+						munmap(aligned + size, reserved + HugePageSize - aligned);
+						address = aligned;
+						huge = madvise(address, size, MADV_HUGEPAGE) == 0;
+					}
+				}
+
+				if (address == MAP_FAILED)
+				{
+					// anonymous memory is not committed until touched, so reserving the whole cache is cheap
+					address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+					if (address == MAP_FAILED)
+					{
+						return false;
+					}
+				}
+
+				if (nodeLocal)
+				{
+					// memory is allocated on the preferred node when it is touched, and falls back to other nodes if it is full
+					unsigned long nodeMask = 1UL << node;
+					syscall(SYS_mbind, address, size, FRAMEPOOL_MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, 0);
+				}
+
+				if (huge)
+				{
+					INCRC(&hugeRegionCount);
+				}
+
+				Region region;
+				region.address = (char*)address;
+				region.frameCount = size / frameSize;
+				region.mappedSize = size;
+				region.node = node;
+				frames.regions.Add(region);
+
+				if (nodes.Count() > 1)
+				{
+					SPIN_LOCK(regionLock)
+					{
+						vint index = sortedRegions.Count();
+						while (index > 0 && sortedRegions[index - 1].address > region.address)
+						{
+							index--;
+						}
+						sortedRegions.Insert(index, region);
+					}
+				}
+				frames.unusedFrameIndex = 0;
+				frames.totalFrameCount += region.frameCount;
+				return true;
+			}
+
+			vint FramePool::GetCurrentNode()
+			{
+				if (nodes.Count() == 1) return 0;
+				unsigned cpu = 0;
+				unsigned node = 0;
+				if (syscall(SYS_getcpu, &cpu, &node, nullptr) == -1)
+				{
+					return 0;
+				}
+				return (vint)node % nodes.Count();
+			}
+
+			vint FramePool::GetFrameNode(void* frame)
+			{
+				if (nodes.Count() == 1) return 0;
+				SPIN_LOCK(regionLock)
+				{
+					// the last region beginning no later than the frame
+					vint start = 0;
+					vint end = sortedRegions.Count();
+					while (start < end)
+					{
+						vint middle = start + (end - start) / 2;
+						if (sortedRegions[middle].address <= (char*)frame)
+						{
+							start = middle + 1;
+						}
+						else
+						{
+							end = middle;
+						}
+					}
+
+					if (start > 0)
+					{
+						const auto& region = sortedRegions[start - 1];
+						if ((char*)frame < region.address + region.mappedSize)
+						{
+							return region.node;
+						}
+					}
+				}
+				CHECK_FAIL(L"vl::database::buffer_internal::FramePool::GetFrameNode(void*)#Internal error: The frame does not belong to this pool.");
+			}
+
+			FramePool::FramePool(vuint64_t _frameSize, vuint64_t _reservedFrameCount, BufferHugePages _hugePages, bool _nodeLocal)
+				:frameSize(_frameSize)
+				,hugePages(_hugePages)
+				,nodeLocal(_nodeLocal)
+			{
+				nodes.Resize(nodeLocal ? GetNumaNodeCount() : 1);
+				for (vint i = 0; i < nodes.Count(); i++)
+				{
+					nodes[i] = new NodeFrames;
+					vuint64_t reservedFrameCount = IntUpperBound(_reservedFrameCount, (vuint64_t)nodes.Count()) / nodes.Count();
+					if (reservedFrameCount > 0)
+					{
+						AllocateRegion(i, reservedFrameCount);
+					}
+				}
+			}
+
+			FramePool::~FramePool()
+			{
+				for (vint i = 0; i < nodes.Count(); i++)
+				{
+					FOREACH(Region, region, nodes[i]->regions)
+					{
+						munmap(region.address, region.mappedSize);
+					}
+				}
+			}
+
+			vuint64_t FramePool::GetFrameSize()
+			{
+				return frameSize;
+			}
+
+			vuint64_t FramePool::GetUsedFrameCount()
+			{
+				vuint64_t count = 0;
+				for (vint i = 0; i < nodes.Count(); i++)
+				{
+					count += nodes[i]->usedFrameCount;
+				}
+				return count;
+			}
+
+			vuint64_t FramePool::GetTotalFrameCount()
+			{
+				vuint64_t count = 0;
+				for (vint i = 0; i < nodes.Count(); i++)
+				{
+					count += nodes[i]->totalFrameCount;
+				}
+				return count;
+			}
+
+			vint FramePool::GetNodeCount()
+			{
+				return nodes.Count();
+			}
+
+			vuint64_t FramePool::GetNodeUsedFrameCount(vint node)
+			{
+				return nodes[node]->usedFrameCount;
+			}
+
+			vuint64_t FramePool::GetHugeRegionCount()
+			{
+				return hugeRegionCount;
+			}
+
+			void* FramePool::AllocateFrame()
+			{
+				vint node = GetCurrentNode();
+				auto& frames = *nodes[node].Obj();
+				SPIN_LOCK(frames.lock)
+				{
+					if (frames.freeFrames)
+					{
+						void* frame = frames.freeFrames;
+						frames.freeFrames = *(void**)frame;
+						frames.usedFrameCount++;
+						return frame;
+					}
+
+					if (frames.regions.Count() == 0 || frames.unusedFrameIndex == frames.regions[frames.regions.Count() - 1].frameCount)
+					{
+						if (!AllocateRegion(node, GrowingFrameCount))
+						{
+							return nullptr;
+						}
+					}
+
+					const auto& region = frames.regions[frames.regions.Count() - 1];
+					void* frame = region.address + frameSize * frames.unusedFrameIndex++;
+					frames.usedFrameCount++;
+					return frame;
+				}
+				return nullptr;
+			}
+
+			void FramePool::FreeFrame(void* frame)
+			{
+				auto& frames = *nodes[GetFrameNode(frame)].Obj();
+				SPIN_LOCK(frames.lock)
+				{
+					*(void**)frame = frames.freeFrames;
+					frames.freeFrames = frame;
+					frames.usedFrameCount--;
+				}
+			}
+		}
+	}
+}
+
+#undef FRAMEPOOL_MPOL_PREFERRED
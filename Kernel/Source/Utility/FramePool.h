@@ -0,0 +1,88 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_FRAMEPOOL
+#define VCZH_DATABASE_UTILITY_FRAMEPOOL
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * Page aligned frames for sources that copy pages in and out of files instead of mapping them, and for memory sources.
+			 * Frames for the whole cache are reserved at once, the pool grows by small regions when the cache is overcommitted.
+			 * Freed frames are linked through their first bytes.
+			 *
+			 * Regions could be backed by huge pages to save TLB entries.
+			 * When frames are node local, each NUMA node reserves its share of the cache in memory bound to the node,
+			 * a thread gets frames from the node it is running on, and freed frames go back to the node owning them.
+			 */
+			class FramePool : public Object, public NotCopyable
+			{
+				struct Region
+				{
+					char*					address;
+					vuint64_t				frameCount;
+					vuint64_t				mappedSize;
+					vint					node;
+				};
+
+				typedef collections::List<Region>								RegionList;
+
+				struct NodeFrames
+				{
+					SpinLock				lock;
+					RegionList				regions;
+					vuint64_t				unusedFrameIndex = 0;
+					void*					freeFrames = nullptr;
+					vuint64_t				usedFrameCount = 0;
+					vuint64_t				totalFrameCount = 0;
+				};
+
+				typedef collections::Array<Ptr<NodeFrames>>						NodeArray;
+
+				static const vuint64_t		GrowingFrameCount = 64;
+				static const vuint64_t		HugePageSize = 2 * 1024 * 1024;
+			private:
+				vuint64_t					frameSize;
+				BufferHugePages				hugePages;
+				bool						nodeLocal;
+				NodeArray					nodes;
+				SpinLock					regionLock;
+				RegionList					sortedRegions;		// regions of all nodes ordered by addresses, only when there are multiple nodes
+				volatile vuint64_t			hugeRegionCount = 0;
+
+				bool						AllocateRegion(vint node, vuint64_t frameCount);
+				vint						GetCurrentNode();
+				vint						GetFrameNode(void* frame);
+			public:
+				FramePool(vuint64_t _frameSize, vuint64_t _reservedFrameCount, BufferHugePages _hugePages = BufferHugePages::None, bool _nodeLocal = false);
+				~FramePool();
+
+				vuint64_t					GetFrameSize();
+				vuint64_t					GetUsedFrameCount();
+				vuint64_t					GetTotalFrameCount();
+				vint						GetNodeCount();
+				vuint64_t					GetNodeUsedFrameCount(vint node);
+
+				// Number of regions that are mapped with MAP_HUGETLB or advised with MADV_HUGEPAGE
+				vuint64_t					GetHugeRegionCount();
+
+				void*						AllocateFrame();
+				void						FreeFrame(void* frame);
+			};
+
+			extern vint						GetNumaNodeCount();
+		}
+	}
+}
+
+#endif
@@ -1,67 +1,367 @@
 #include "InMemoryBuffer.h"
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
 
 namespace vl
 {
 	namespace database
 	{
 		using namespace collections;
+		using namespace buffer_internal;
 
 /***********************************************************************
 InMemoryBufferSource
 ***********************************************************************/
 
-		Ptr<BufferPageDesc> InMemoryBufferSource::MapPage(BufferPage page)
+		InMemoryBufferSource::PageEntry* InMemoryBufferSource::GetEntry(vuint64_t index)
 		{
-			CHECK_ERROR(page.index <= pages.Count(), L"vl::database::InMemoryBufferSource::MapPage(BufferPage)#Internal error: Index of page to map is out of range.");
-			if (page.index < pages.Count() && pages[page.index])
+			return &pageChunks[(vint)(index / PageChunkSize)][index % PageChunkSize];
+		}
+
+		InMemoryBufferSource::PageEntry* InMemoryBufferSource::AddEntry()
+		{
+			if (pageCount % PageChunkSize == 0)
+			{
+				pageChunks.Add(new PageEntry[PageChunkSize]);
+			}
+			return GetEntry(pageCount++);
+		}
+
+		BufferPageDesc* InMemoryBufferSource::MapPage(BufferPage page)
+		{
+			CHECK_ERROR(page.index < pageCount, L"vl::database::InMemoryBufferSource::MapPage(BufferPage)#Internal error: Index of page to map is out of range.");
+			auto entry = GetEntry(page.index);
+			auto pageDesc = &entry->desc;
+			if (pageDesc->address)
 			{
-				auto pageDesc = pages[page.index];
-				pageDesc->lastAccessTime = (vuint64_t)time(nullptr);
+				pageDesc->Access();
+				counters.Increase(BufferCounter::PageHits);
 				return pageDesc;
 			}
 			else
 			{
-				auto address = malloc(pageSize);
+				// pages are taken from the frame pool of the buffer manager, so that they share its huge pages and NUMA placement
+				auto address = framePool ? framePool->AllocateFrame() : malloc(pageSize);
 				if (!address) return nullptr;
 
-				auto pageDesc = MakePtr<BufferPageDesc>();
-				pageDesc->address = address;
-				pageDesc->offset = page.index * pageSize;
-				pageDesc->lastAccessTime = (vuint64_t)time(nullptr);
-
-				if (page.index == pages.Count())
+				if (entry->spilled)
 				{
-					pages.Add(pageDesc);
+					auto read = pread(spillFileDescriptor, address, pageSize, page.index * pageSize);
+					if (read != (ssize_t)pageSize)
+					{
+						FreeAddress(address);
+						return nullptr;
+					}
 				}
-				else
+				else if (entry->inSnapshot)
+				{
+					memcpy(address, snapshotAddress + snapshotDataOffset + page.index * pageSize, pageSize);
+				}
+
+				*pageDesc = BufferPageDesc();
+				pageDesc->address = address;
+				pageDesc->offset = page.index * pageSize;
+				pageDesc->Access();
+				if (!entry->spilled && !entry->inSnapshot)
 				{
-					pages[page.index] = pageDesc;
+					// a new page has no copy in the spill file or the snapshot
+					pageDesc->MarkDirty();
 				}
+
+				mappedPageCount++;
 				INCRC(totalUsedPages);
+				counters.Increase(BufferCounter::PageMisses);
 				return pageDesc;
 			}
 		}
 
-		InMemoryBufferSource::InMemoryBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize)
+		void InMemoryBufferSource::ReleasePage(BufferPage page)
+		{
+			auto pageDesc = &GetEntry(page.index)->desc;
+			FreeAddress(pageDesc->address);
+			pageDesc->address = nullptr;
+			mappedPageCount--;
+			DECRC(totalUsedPages);
+			counters.Increase(BufferCounter::PageUnmaps);
+		}
+
+		void InMemoryBufferSource::FreeAddress(void* address)
+		{
+			if (framePool)
+			{
+				framePool->FreeFrame(address);
+			}
+			else
+			{
+				free(address);
+			}
+		}
+
+		bool InMemoryBufferSource::WriteSpillPage(BufferPageDesc* pageDesc)
+		{
+			if (spillFileDescriptor == -1)
+			{
+				spillFileDescriptor = CreateSpillFileForMemorySource(spillDirectory);
+				if (spillFileDescriptor == -1) return false;
+			}
+
+			// a page fails to spill when the disk is full, it just stays in memory
+			if (pwrite(spillFileDescriptor, pageDesc->address, pageSize, pageDesc->offset) != (ssize_t)pageSize)
+			{
+				return false;
+			}
+			pageDesc->dirty = false;
+			GetEntry(pageDesc->offset / pageSize)->spilled = true;
+			counters.Increase(BufferCounter::PageWriteBacks);
+			counters.Increase(BufferCounter::WrittenBytes, pageSize);
+			return true;
+		}
+
+		InMemoryBufferSource::InMemoryBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize, FramePool* _framePool, const WString& _spillDirectory)
 			:source(_source)
 			,totalUsedPages(_totalUsedPages)
 			,pageSize(_pageSize)
+			,framePool(_framePool)
+			,spillDirectory(_spillDirectory)
+		{
+		}
+
+		InMemoryBufferSource::~InMemoryBufferSource()
+		{
+			FOREACH(PageEntry*, chunk, pageChunks)
+			{
+				delete[] chunk;
+			}
+		}
+
+		void InMemoryBufferSource::InitializeEmptySource()
 		{
 			indexPage = AllocatePage();
 		}
 
+		bool InMemoryBufferSource::InitializeSnapshotSource(const WString& fileName)
+		{
+			int fileDescriptor = open(wtoa(fileName).Buffer(), O_RDONLY);
+			if (fileDescriptor == -1) return false;
+
+			bool succeeded = false;
+			vuint64_t header[5];
+			struct stat fileState;
+			if (pread(fileDescriptor, header, sizeof(header), 0) == sizeof(header) && fstat(fileDescriptor, &fileState) != -1)
+			{
+				vuint64_t snapshotPageCount = header[2];
+				vuint64_t freePageCount = header[4];
+				snapshotDataOffset = pageSize + IntUpperBound<vuint64_t>(freePageCount * sizeof(vuint64_t), pageSize);
+				snapshotSize = fileState.st_size;
+				if (header[0] == SnapshotMagic && header[1] == pageSize && header[3] < snapshotPageCount && freePageCount < snapshotPageCount
+					&& snapshotSize == snapshotDataOffset + snapshotPageCount * pageSize)
+				{
+					auto address = mmap(nullptr, snapshotSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+					if (address != MAP_FAILED)
+					{
+						snapshotAddress = (char*)address;
+						succeeded = true;
+					}
+				}
+			}
+			close(fileDescriptor);
+			if (!succeeded) return false;
+
+			// pages are read ahead by the kernel while the source is being used
+			madvise(snapshotAddress + snapshotDataOffset, snapshotSize - snapshotDataOffset, MADV_WILLNEED);
+
+			vuint64_t snapshotPageCount = header[2];
+			for (vuint64_t i = 0; i < snapshotPageCount; i++)
+			{
+				auto entry = AddEntry();
+				entry->allocated = true;
+				entry->inSnapshot = true;
+			}
+
+			auto freePages = (const vuint64_t*)(snapshotAddress + pageSize);
+			for (vuint64_t i = header[4]; i > 0; i--)
+			{
+				auto index = freePages[i - 1];
+				if (index >= pageCount || index == header[3]) return false;
+				auto entry = GetEntry(index);
+				if (!entry->allocated) return false;
+				entry->allocated = false;
+				entry->inSnapshot = false;
+				entry->nextFreePage = freePageHead;
+				freePageHead = index;
+			}
+			indexPage.index = header[3];
+			return true;
+		}
+
+		bool InMemoryBufferSource::DumpSnapshot(const WString& fileName)
+		{
+			vuint64_t dumpPageCount = 0;
+			BufferPage dumpIndexPage;
+			List<vuint64_t> freePages;
+			Array<bool> storedPages;
+			SOURCE_LOCK(this)
+			{
+				for (vuint64_t i = 0; i < pageCount; i++)
+				{
+					if (GetEntry(i)->desc.IsExclusivelyLatched()) return false;
+				}
+
+				dumpPageCount = pageCount;
+				dumpIndexPage = indexPage;
+				for (auto index = freePageHead; index != InvalidPage; index = GetEntry(index)->nextFreePage)
+				{
+					freePages.Add(index);
+				}
+				storedPages.Resize((vint)pageCount);
+				for (vuint64_t i = 0; i < pageCount; i++)
+				{
+					storedPages[(vint)i] = GetEntry(i)->allocated;
+				}
+			}
+
+			// the snapshot is written to a new file and then renamed, a restored source could be still mapping the old file
+			auto tempFileName = wtoa(fileName + L".dumping");
+			auto mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+			int fileDescriptor = open(tempFileName.Buffer(), O_CREAT | O_TRUNC | O_WRONLY, mode);
+			if (fileDescriptor == -1) return false;
+
+			vuint64_t dataOffset = pageSize + IntUpperBound<vuint64_t>(freePages.Count() * sizeof(vuint64_t), pageSize);
+			Array<char> block(dataOffset);
+			memset(&block[0], 0, block.Count());
+			vuint64_t header[5] = {SnapshotMagic, pageSize, dumpPageCount, dumpIndexPage.index, (vuint64_t)freePages.Count()};
+			memcpy(&block[0], header, sizeof(header));
+			if (freePages.Count() > 0)
+			{
+				memcpy(&block[(vint)pageSize], &freePages[0], freePages.Count() * sizeof(vuint64_t));
+			}
+
+			bool succeeded =
+				pwrite(fileDescriptor, &block[0], dataOffset, 0) == (ssize_t)dataOffset &&
+				ftruncate(fileDescriptor, dataOffset + dumpPageCount * pageSize) != -1;
+
+			// pages in memory are shared latched in batches while they are written,
+			// other pages are copied to the staging buffer or read from the snapshot mapping
+			Array<char> staging(DumpBatchPageCount * pageSize);
+			BufferPageDesc* latchedPages[DumpBatchPageCount];
+			void* addresses[DumpBatchPageCount];
+			struct iovec vectors[DumpBatchPageCount];
+			for (vuint64_t batchBegin = 0; batchBegin < dumpPageCount && succeeded; batchBegin += DumpBatchPageCount)
+			{
+				vint batchCount = (vint)(dumpPageCount - batchBegin < DumpBatchPageCount ? dumpPageCount - batchBegin : DumpBatchPageCount);
+				memset(latchedPages, 0, sizeof(latchedPages));
+				SOURCE_LOCK(this)
+				{
+					for (vint i = 0; i < batchCount && succeeded; i++)
+					{
+						vuint64_t index = batchBegin + i;
+						if (!storedPages[(vint)index]) continue;
+						auto entry = GetEntry(index);
+						addresses[i] = &staging[(vint)(i * pageSize)];
+						if (!entry->allocated)
+						{
+							// the page is freed during dumping
+							memset(addresses[i], 0, pageSize);
+						}
+						else if (entry->desc.address)
+						{
+							succeeded = entry->desc.AcquireLatch(PageLatch::Shared);
+							if (succeeded)
+							{
+								latchedPages[i] = &entry->desc;
+								addresses[i] = entry->desc.address;
+							}
+						}
+						else if (entry->spilled)
+						{
+							succeeded = pread(spillFileDescriptor, addresses[i], pageSize, index * pageSize) == (ssize_t)pageSize;
+						}
+						else if (entry->inSnapshot)
+						{
+							addresses[i] = snapshotAddress + snapshotDataOffset + index * pageSize;
+						}
+						else
+						{
+							memset(addresses[i], 0, pageSize);
+						}
+					}
+				}
+
+				// runs of adjacent pages are written by one call
+				vint vectorCount = 0;
+				vint runBegin = 0;
+				for (vint i = 0; i <= batchCount && succeeded; i++)
+				{
+					bool stored = i < batchCount && storedPages[(vint)(batchBegin + i)];
+					if (vectorCount > 0 && !stored)
+					{
+						vuint64_t size = vectorCount * pageSize;
+						succeeded = pwritev(fileDescriptor, vectors, (int)vectorCount, dataOffset + (batchBegin + runBegin) * pageSize) == (ssize_t)size;
+						vectorCount = 0;
+					}
+					if (!stored) continue;
+
+					if (vectorCount == 0)
+					{
+						runBegin = i;
+					}
+					vectors[vectorCount].iov_base = addresses[i];
+					vectors[vectorCount].iov_len = pageSize;
+					vectorCount++;
+				}
+
+				SOURCE_LOCK(this)
+				{
+					for (vint i = 0; i < batchCount; i++)
+					{
+						if (latchedPages[i])
+						{
+							latchedPages[i]->ReleaseLatch(PersistanceType::NoChanging);
+						}
+					}
+				}
+			}
+
+			succeeded = succeeded && fdatasync(fileDescriptor) != -1;
+			close(fileDescriptor);
+			succeeded = succeeded && rename(tempFileName.Buffer(), wtoa(fileName).Buffer()) != -1;
+			if (!succeeded)
+			{
+				unlink(tempFileName.Buffer());
+			}
+			return succeeded;
+		}
+
 		void InMemoryBufferSource::Unload()
 		{
-			FOREACH(Ptr<BufferPageDesc>, pageDesc, pages)
+			for (vuint64_t i = 0; i < pageCount; i++)
 			{
-				if (pageDesc)
+				auto pageDesc = &GetEntry(i)->desc;
+				if (pageDesc->address)
 				{
 					DECRC(totalUsedPages);
-					free(pageDesc->address);
+					FreeAddress(pageDesc->address);
+					pageDesc->address = nullptr;
 				}
 			}
+			mappedPageCount = 0;
+			if (spillFileDescriptor != -1)
+			{
+				close(spillFileDescriptor);
+				spillFileDescriptor = -1;
+			}
+			if (snapshotAddress)
+			{
+				munmap(snapshotAddress, snapshotSize);
+				snapshotAddress = nullptr;
+			}
 		}
 
 		BufferSource InMemoryBufferSource::GetBufferSource()
@@ -79,24 +379,15 @@ InMemoryBufferSource
 			return L"";
 		}
 
-		bool InMemoryBufferSource::InMemoryBufferSource::UnmapPage(BufferPage page)
+		BufferSourceKind InMemoryBufferSource::GetSourceKind()
 		{
-			if (page.index >= pages.Count())
-			{
-				return false;
-			}
-
-			auto pageDesc = pages[page.index];
-			if (!pageDesc || pageDesc->locked)
-			{
-				return false;
-			}
+			return BufferSourceKind::Memory;
+		}
 
-			free(pageDesc->address);
-			pages[page.index] = nullptr;
-			freePages.Add(page.index);
-			DECRC(totalUsedPages);
-			return true;
+		bool InMemoryBufferSource::UnmapPage(BufferPage page)
+		{
+			bool writtenBack = false;
+			return EvictPage(page, true, writtenBack);
 		}
 
 		BufferPage InMemoryBufferSource::GetIndexPage()
@@ -104,79 +395,314 @@ InMemoryBufferSource
 			return indexPage;
 		}
 
-		BufferPage InMemoryBufferSource::AllocatePage()
+		BufferPage InMemoryBufferSource::MapNewPage(BufferPage page)
 		{
-			BufferPage page = BufferPage::Invalid();
-			if (freePages.Count() > 0)
+			auto entry = GetEntry(page.index);
+			if (MapPage(page))
 			{
-				page.index = freePages[freePages.Count() - 1];
-				freePages.RemoveAt(freePages.Count() - 1);
+				entry->allocated = true;
+				entry->nextFreePage = InvalidPage;
+				return page;
 			}
 			else
 			{
-				page.index = pages.Count();
+				entry->nextFreePage = freePageHead;
+				freePageHead = page.index;
+				return BufferPage::Invalid();
 			}
+		}
 
-			if (MapPage(page))
+		BufferPage InMemoryBufferSource::AllocatePage()
+		{
+			BufferPage page = BufferPage::Invalid();
+			if (freePageHead != InvalidPage)
 			{
-				return page;
+				page.index = freePageHead;
+				freePageHead = GetEntry(page.index)->nextFreePage;
 			}
 			else
 			{
-				return BufferPage::Invalid();
+				AddEntry();
+				page.index = pageCount - 1;
 			}
+			return MapNewPage(page);
 		}
 
-		bool InMemoryBufferSource::FreePage(BufferPage page)
+		bool InMemoryBufferSource::AllocatePages(vint count, bool contiguous, BufferPage* pages)
 		{
-			if (page.index == indexPage.index)
+			for (vint i = 0; i < count; i++)
 			{
-				return false;
+				if (contiguous)
+				{
+					// freed pages are not adjacent in general, so new pages are added
+					AddEntry();
+					pages[i] = MapNewPage(BufferPage{pageCount - 1});
+				}
+				else
+				{
+					pages[i] = AllocatePage();
+				}
+
+				if (!pages[i].IsValid())
+				{
+					for (vint j = 0; j < i; j++)
+					{
+						FreePage(pages[j]);
+					}
+					return false;
+				}
 			}
-			return UnmapPage(page);
+			return true;
 		}
 
-		void* InMemoryBufferSource::LockPage(BufferPage page)
+		bool InMemoryBufferSource::FreePage(BufferPage page)
 		{
-			if (page.index >= pages.Count())
+			if (page.index == indexPage.index || page.index >= pageCount)
 			{
-				return nullptr;
+				return false;
 			}
 
-			auto pageDesc = pages[page.index];
-			if (!pageDesc || pageDesc->locked)
+			auto entry = GetEntry(page.index);
+			if (!entry->allocated || entry->desc.IsPinned())
 			{
-				return nullptr;
+				return false;
 			}
 
-			pageDesc->locked = true;
-			return pageDesc->address;
+			if (entry->desc.address)
+			{
+				ReleasePage(page);
+			}
+			if (entry->spilled)
+			{
+				entry->spilled = false;
+				fallocate(spillFileDescriptor, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, page.index * pageSize, pageSize);
+			}
+			entry->allocated = false;
+			entry->inSnapshot = false;
+			entry->nextFreePage = freePageHead;
+			freePageHead = page.index;
+			return true;
+		}
+
+		void* InMemoryBufferSource::LockPage(BufferPage page, PageLatch latch)
+		{
+			auto pageDesc = LockPageDesc(page, latch);
+			return pageDesc ? pageDesc->address : nullptr;
 		}
 
 		bool InMemoryBufferSource::UnlockPage(BufferPage page, void* address, PersistanceType persistanceType)
 		{
-			if (page.index >= pages.Count())
+			if (page.index >= pageCount)
 			{
 				return false;
 			}
 
-			auto pageDesc = pages[page.index];
-			if (!pageDesc || !pageDesc->locked || address != pageDesc->address)
+			auto pageDesc = &GetEntry(page.index)->desc;
+			if (!pageDesc->address || address != pageDesc->address)
 			{
 				return false;
 			}
+			return UnlockPageDesc(pageDesc, persistanceType);
+		}
+
+		BufferPageDesc* InMemoryBufferSource::LockPageDesc(BufferPage page, PageLatch latch)
+		{
+			if (page.index >= pageCount || !GetEntry(page.index)->allocated)
+			{
+				return nullptr;
+			}
 
-			pageDesc->locked = false;
+			auto pageDesc = MapPage(page);
+			if (!pageDesc || !pageDesc->AcquireLatch(latch))
+			{
+				return nullptr;
+			}
+			return pageDesc;
+		}
+
+		bool InMemoryBufferSource::UnlockPageDesc(BufferPageDesc* pageDesc, PersistanceType persistanceType)
+		{
+			if (!pageDesc->ReleaseLatch(persistanceType)) return false;
+
+			// nothing is durable in a memory source, persisting only means that the page should be spilled before it is evicted
+			if (persistanceType != PersistanceType::NoChanging)
+			{
+				pageDesc->MarkDirty();
+			}
 			return true;
 		}
 
-		void InMemoryBufferSource::FillUnmapPageCandidates(collections::List<BufferPageTimeTuple>& pages, vint expectCount)
+		bool InMemoryBufferSource::FlushPage(BufferPage page)
+		{
+			if (page.index >= pageCount) return false;
+			auto pageDesc = &GetEntry(page.index)->desc;
+			if (!pageDesc->address || pageDesc->IsExclusivelyLatched() || !pageDesc->dirty) return false;
+			return WriteSpillPage(pageDesc);
+		}
+
+		bool InMemoryBufferSource::EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack)
+		{
+			writtenBack = false;
+			if (page.index >= pageCount) return false;
+			auto pageDesc = &GetEntry(page.index)->desc;
+			if (!pageDesc->address || pageDesc->IsPinned()) return false;
+
+			if (pageDesc->dirty)
+			{
+				if (!allowWriteBack || !WriteSpillPage(pageDesc)) return false;
+				writtenBack = true;
+			}
+			ReleasePage(page);
+			return true;
+		}
+
+		BufferTicket InMemoryBufferSource::RequestPersistance()
+		{
+			return BufferTicket::Invalid();
+		}
+
+		bool InMemoryBufferSource::WaitForPersistance(BufferTicket ticket)
+		{
+			return !ticket.IsValid();
+		}
+
+		void InMemoryBufferSource::SyncFile()
+		{
+		}
+
+		vint InMemoryBufferSource::PrefetchPages(const BufferPage* pages, vint count)
+		{
+			// pages are read ahead after releasing the lock, the spill file and the snapshot are kept until the source is unloaded
+			List<vuint64_t> spilledPages;
+			List<vuint64_t> snapshotPages;
+			int spillFile = -1;
+			SOURCE_LOCK(this)
+			{
+				for (vint i = 0; i < count; i++)
+				{
+					auto index = pages[i].index;
+					if (index < pageCount)
+					{
+						auto entry = GetEntry(index);
+						if (!entry->desc.address && entry->spilled)
+						{
+							spilledPages.Add(index);
+						}
+						else if (!entry->desc.address && entry->inSnapshot)
+						{
+							snapshotPages.Add(index);
+						}
+					}
+				}
+				spillFile = spillFileDescriptor;
+			}
+
+			FOREACH(vuint64_t, index, spilledPages)
+			{
+				posix_fadvise(spillFile, index * pageSize, pageSize, POSIX_FADV_WILLNEED);
+			}
+			FOREACH(vuint64_t, index, snapshotPages)
+			{
+				madvise(snapshotAddress + snapshotDataOffset + index * pageSize, pageSize, MADV_WILLNEED);
+			}
+			return spilledPages.Count() + snapshotPages.Count();
+		}
+
+		void InMemoryBufferSource::LockPageAsync(BufferPage page, PageLatch latch, Ptr<BufferCompletion> completion)
+		{
+			void* address = nullptr;
+			SOURCE_LOCK(this)
+			{
+				address = LockPage(page, latch);
+			}
+			completion->Complete(address);
+		}
+
+		BufferCounters& InMemoryBufferSource::GetCounters()
 		{
+			return counters;
+		}
+
+		BufferSourceQuota& InMemoryBufferSource::GetQuota()
+		{
+			return quota;
+		}
+
+		volatile vint& InMemoryBufferSource::GetHandleCount()
+		{
+			return handleCount;
+		}
+
+		vuint64_t InMemoryBufferSource::GetCachedPageCount()
+		{
+			return mappedPageCount;
+		}
+
+		BufferPageDesc* InMemoryBufferSource::GetCachedPageDesc(BufferPage page)
+		{
+			if (page.index >= pageCount) return nullptr;
+			auto pageDesc = &GetEntry(page.index)->desc;
+			return pageDesc->address ? pageDesc : nullptr;
+		}
+
+		vint InMemoryBufferSource::GetPageSlotCount()
+		{
+			return (vint)pageCount;
+		}
+
+		BufferPageDesc* InMemoryBufferSource::GetPageSlot(vint slot, BufferPage& page)
+		{
+			page.index = slot;
+			return GetCachedPageDesc(page);
+		}
+
+		DirtyPageTable& InMemoryBufferSource::GetDirtyPageTable()
+		{
+			return dirtyPages;
+		}
+
+		int CreateSpillFileForMemorySource(const WString& directory)
+		{
+			auto path = directory == L"" ? AString(P_tmpdir) : wtoa(directory);
+			int fileDescriptor = open(path.Buffer(), O_TMPFILE | O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+			if (fileDescriptor == -1 && (errno == EOPNOTSUPP || errno == EISDIR))
+			{
+				// file systems without O_TMPFILE get a named file which is unlinked immediately
+				auto fileName = path + "/herodb-spill-XXXXXX";
+				Array<char> buffer(fileName.Length() + 1);
+				memcpy(&buffer[0], fileName.Buffer(), buffer.Count());
+				fileDescriptor = mkstemp(&buffer[0]);
+				if (fileDescriptor != -1)
+				{
+					unlink(&buffer[0]);
+				}
+			}
+			return fileDescriptor;
+		}
+
+		IBufferSource* CreateMemorySource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, FramePool* framePool, const WString& spillDirectory)
+		{
+			auto bs = new InMemoryBufferSource(source, totalUsedPages, pageSize, framePool, spillDirectory);
+			bs->InitializeEmptySource();
+			return bs;
+		}
+
+		IBufferSource* CreateMemorySourceFromSnapshot(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, FramePool* framePool, const WString& spillDirectory, const WString& fileName)
+		{
+			auto bs = new InMemoryBufferSource(source, totalUsedPages, pageSize, framePool, spillDirectory);
+			if (!bs->InitializeSnapshotSource(fileName))
+			{
+				bs->Unload();
+				delete bs;
+				return nullptr;
+			}
+			return bs;
 		}
 
-		IBufferSource* CreateMemorySource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize)
+		bool DumpMemorySource(IBufferSource* source, const WString& fileName)
 		{
-			return new InMemoryBufferSource(source, totalUsedPages, pageSize);
+			auto bs = dynamic_cast<InMemoryBufferSource*>(source);
+			return bs && bs->DumpSnapshot(fileName);
 		}
 	}
 }
@@ -8,43 +8,128 @@ Database::Utility
 #ifndef VCZH_DATABASE_UTILITY_INMEMORYBUFFER
 #define VCZH_DATABASE_UTILITY_INMEMORYBUFFER
 
-#include "Buffer.h"
+#include "BufferMetrics.h"
+#include "FramePool.h"
+#include "DirtyPageTable.h"
 
 namespace vl
 {
 	namespace database
 	{
+		/*
+		 * Pages of a memory source are evicted like pages of a file source,
+		 * a dirty page is written to an unlinked temporary file in the spill directory when it is evicted, and read back when it is locked again.
+		 * The spill file is created when the first page is written to it, and disappears when it is closed.
+		 * A page stays at the offset of its index in the spill file, the space is given back when the page is freed.
+		 *
+		 * Entries of pages are stored in chunks indexed by page ids, so that a page is found without searching or chasing pointers,
+		 * and descriptors never move while they are locked. Freed page ids are linked through their entries.
+		 * Frames come from the frame pool of the buffer manager.
+		 *
+		 * A memory source could be dumped to a snapshot file, and restored from it by mapping the file,
+		 * a restored page is copied from the mapping into a frame when it is locked for the first time.
+		 *
+		 * Snapshot File
+		 *		Header Block	: [uint64 Magic][uint64 PageSize][uint64 PageCount][uint64 IndexPage][uint64 FreePageCount]
+		 *		Free Blocks		: {[uint64 FreePage] ...}, in the order of reusing, padded to the page size
+		 *		Page Blocks		: page i at i * PageSize after free blocks, free pages are holes
+		 */
 		class InMemoryBufferSource : public Object, public IBufferSource
 		{
-			typedef collections::List<Ptr<BufferPageDesc>>	PageList;
-			typedef collections::List<vuint64_t>			PageIdList;
+			struct PageEntry
+			{
+				BufferPageDesc		desc;						// address is nullptr when the page is not in memory
+				vuint64_t			nextFreePage = ~(vuint64_t)0;
+				bool				allocated = false;
+				bool				spilled = false;			// written to the spill file and not freed yet
+				bool				inSnapshot = false;			// restored from the snapshot and not freed yet
+			};
+
+			static const vuint64_t	PageChunkSize = 1024;
+			static const vuint64_t	InvalidPage = ~(vuint64_t)0;
+			static const vuint64_t	SnapshotMagic = 0x544F485350414E53ULL;	// SNAPSHOT
+			static const vint		DumpBatchPageCount = 256;
+
+			typedef collections::List<PageEntry*>			PageChunkList;
 		private:
 			BufferSource		source;
 			volatile vuint64_t*	totalUsedPages;
 			vuint64_t			pageSize;
 			SpinLock			lock;
-			PageList			pages;
-			PageIdList			freePages;
+			PageChunkList		pageChunks;
+			vuint64_t			pageCount = 0;
+			vuint64_t			freePageHead = InvalidPage;
+			vuint64_t			mappedPageCount = 0;
 			BufferPage			indexPage;
+			BufferSourceQuota	quota;
+			volatile vint		handleCount = 0;
+			buffer_internal::BufferCounters	counters;
+			buffer_internal::DirtyPageTable	dirtyPages;		// always empty
+			buffer_internal::FramePool*		framePool;
+			WString				spillDirectory;
+			int					spillFileDescriptor = -1;
+			char*				snapshotAddress = nullptr;
+			vuint64_t			snapshotSize = 0;
+			vuint64_t			snapshotDataOffset = 0;
 
-			Ptr<BufferPageDesc>	MapPage(BufferPage page);
+			PageEntry*			GetEntry(vuint64_t index);
+			PageEntry*			AddEntry();
+			BufferPageDesc*		MapPage(BufferPage page);
+			BufferPage			MapNewPage(BufferPage page);
+			void				ReleasePage(BufferPage page);
+			void				FreeAddress(void* address);
+			bool				WriteSpillPage(BufferPageDesc* pageDesc);
 		public:
-			InMemoryBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize);
+			InMemoryBufferSource(BufferSource _source, volatile vuint64_t* _totalUsedPages, vuint64_t _pageSize, buffer_internal::FramePool* _framePool, const WString& _spillDirectory);
+			~InMemoryBufferSource();
+
+			void				InitializeEmptySource();
+			bool				InitializeSnapshotSource(const WString& fileName);
+
+			// Writes all allocated pages to a new file replacing the snapshot file, called without holding the lock of the source,
+			// the lock is only taken to copy the free list and to latch each batch of pages, which are written and synced outside of the lock.
+			// A page changed during dumping is written as it is when its batch is latched.
+			// Returns false if any page is exclusively latched or the file cannot be written
+			bool				DumpSnapshot(const WString& fileName);
 
 			void				Unload()override;
 			BufferSource		GetBufferSource()override;
 			SpinLock&			GetLock()override;
 			WString				GetFileName()override;
+			BufferSourceKind	GetSourceKind()override;
 			bool				UnmapPage(BufferPage page)override;
 			BufferPage			GetIndexPage()override;
 			BufferPage			AllocatePage()override;
+			bool				AllocatePages(vint count, bool contiguous, BufferPage* pages)override;
 			bool				FreePage(BufferPage page)override;
-			void* 				LockPage(BufferPage page)override;
+			void* 				LockPage(BufferPage page, PageLatch latch)override;
 			bool				UnlockPage(BufferPage page, void* address, PersistanceType persistanceType)override;
-			void				FillUnmapPageCandidates(collections::List<BufferPageTimeTuple>& pages, vint expectCount)override;
+			BufferPageDesc*		LockPageDesc(BufferPage page, PageLatch latch)override;
+			bool				UnlockPageDesc(BufferPageDesc* pageDesc, PersistanceType persistanceType)override;
+			bool				FlushPage(BufferPage page)override;
+			bool				EvictPage(BufferPage page, bool allowWriteBack, bool& writtenBack)override;
+			BufferTicket		RequestPersistance()override;
+			bool				WaitForPersistance(BufferTicket ticket)override;
+			void				SyncFile()override;
+			vint				PrefetchPages(const BufferPage* pages, vint count)override;
+			void				LockPageAsync(BufferPage page, PageLatch latch, Ptr<BufferCompletion> completion)override;
+			buffer_internal::BufferCounters&	GetCounters()override;
+			BufferSourceQuota&	GetQuota()override;
+			volatile vint&		GetHandleCount()override;
+			vuint64_t			GetCachedPageCount()override;
+			BufferPageDesc*		GetCachedPageDesc(BufferPage page)override;
+			vint				GetPageSlotCount()override;
+			BufferPageDesc*		GetPageSlot(vint slot, BufferPage& page)override;
+			buffer_internal::DirtyPageTable&	GetDirtyPageTable()override;
 		};
 
-		extern IBufferSource*	CreateMemorySource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize);
+		// Returns -1 if the file cannot be created, an empty directory means the temporary directory of the system
+		extern int				CreateSpillFileForMemorySource(const WString& directory);
+		extern IBufferSource*	CreateMemorySource(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, buffer_internal::FramePool* framePool, const WString& spillDirectory);
+
+		// Returns nullptr if the snapshot file cannot be opened or does not match the page size
+		extern IBufferSource*	CreateMemorySourceFromSnapshot(BufferSource source, volatile vuint64_t* totalUsedPages, vuint64_t pageSize, buffer_internal::FramePool* framePool, const WString& spillDirectory, const WString& fileName);
+		extern bool				DumpMemorySource(IBufferSource* source, const WString& fileName);
 	}
 }
 
@@ -37,10 +37,10 @@ LogAddressItem
 				:bm(_bm)
 				,source(_source)
 				,pageSize(0)
-				,indexPageItemCount(0)
 			{
-				pageSize = bm->GetPageSize();
-				indexPageItemCount = (pageSize - INDEX_INDEXPAGE_ADDRESSITEMBEGIN * sizeof(vuint64_t)) / sizeof(vuint64_t);
+				static_assert(IndexPageLayout::HeaderItemCount == INDEX_INDEXPAGE_ADDRESSITEMBEGIN, "IndexPageLayout should skip the header of an index page.");
+				pageSize = bm->GetPageDataSize();
+				indexPageLayout = IndexPageLayout::Create(pageSize);
 			}
 
 			vuint64_t LogAddressItem::InitializeEmptyItems()
@@ -67,7 +67,7 @@ LogAddressItem
 				{
 					previousPage = page;
 					indexPages.Add(page);
-					auto numbers = (vuint64_t*)bm->LockPage(source, previousPage);
+					auto numbers = (vuint64_t*)bm->LockPageShared(source, previousPage);
 					page.index = numbers[INDEX_INDEXPAGE_NEXTINDEXPAGE];
 					usedTransactionCount += numbers[INDEX_INDEXPAGE_ADDRESSITEMS];
 					bm->UnlockPage(source, previousPage, numbers, PersistanceType::NoChanging);
@@ -78,24 +78,26 @@ LogAddressItem
 
 			BufferPointer LogAddressItem::ReadAddressItem(BufferTransaction transaction)
 			{
-				vuint64_t index = transaction.index / indexPageItemCount;
-				vuint64_t item = transaction.index % indexPageItemCount;
+				vuint64_t index = 0;
+				vuint64_t item = 0;
+				indexPageLayout.Locate(transaction.index, index, item);
 				CHECK_ERROR(index <= indexPages.Count(), L"vl::database::log_internal::LogAddressItem::ReadAddressItem(BufferTransaction)#Internal error: Transaction is out of range.");
 
 				BufferPage page = indexPages[index];
-				auto numbers = (vuint64_t*)bm->LockPage(source, page);
+				auto numbers = (vuint64_t*)bm->LockPageShared(source, page);
 				if (!numbers) return BufferPointer::Invalid();
 				auto result = numbers[item + INDEX_INDEXPAGE_ADDRESSITEMBEGIN];
-				bm->UnlockPage(source, page, numbers, PersistanceType::ChangedAndPersist);
+				bm->UnlockPage(source, page, numbers, PersistanceType::NoChanging);
 
 				BufferPointer address{result};
 				return address;
 			}
 
-			bool LogAddressItem::WriteAddressItem(BufferTransaction transaction, BufferPointer address)
+			bool LogAddressItem::WriteAddressItem(BufferTransaction transaction, BufferPointer address, BufferTicket& ticket)
 			{
-				vuint64_t index = transaction.index / indexPageItemCount;
-				vuint64_t item = transaction.index % indexPageItemCount;
+				vuint64_t index = 0;
+				vuint64_t item = 0;
+				indexPageLayout.Locate(transaction.index, index, item);
 				CHECK_ERROR(index <= indexPages.Count(), L"vl::database::log_internal::LogAddressItem::ReadAddressItem(BufferTransaction)#Internal error: Transaction is out of range.");
 
 				if (index < indexPages.Count())
@@ -109,7 +111,7 @@ LogAddressItem
 						count = item + 1;
 					}
 					numbers[item + INDEX_INDEXPAGE_ADDRESSITEMBEGIN] = address.index;
-					bm->UnlockPage(source, page, numbers, PersistanceType::ChangedAndPersist);
+					bm->UnlockPage(source, page, numbers, PersistanceType::ChangedAndPersist, ticket);
 				}
 				else
 				{
@@ -123,14 +125,14 @@ LogAddressItem
 					auto numbers = (vuint64_t*)bm->LockPage(source, lastPage);
 					if (!numbers) return false;
 					numbers[INDEX_INDEXPAGE_NEXTINDEXPAGE] = currentPage.index;
-					bm->UnlockPage(source, lastPage, numbers, PersistanceType::ChangedAndPersist);
+					bm->UnlockPage(source, lastPage, numbers, PersistanceType::ChangedAndPersist, ticket);
 
 					numbers = (vuint64_t*)bm->LockPage(source, currentPage);
 					memset(numbers, 0, pageSize);
 					numbers[INDEX_INDEXPAGE_ADDRESSITEMS] = 1;
 					numbers[INDEX_INDEXPAGE_NEXTINDEXPAGE] = INDEX_INVALID;
 					numbers[item + INDEX_INDEXPAGE_ADDRESSITEMBEGIN] = address.index;
-					bm->UnlockPage(source, currentPage, numbers, PersistanceType::ChangedAndPersist);
+					bm->UnlockPage(source, currentPage, numbers, PersistanceType::ChangedAndPersist, ticket);
 					indexPages.Add(currentPage);
 				}
 
@@ -179,12 +181,12 @@ LogTransactions
 				return activeTransactions.Values()[index];
 			}
 
-			BufferTransaction LogTransactions::OpenTransaction()
+			BufferTransaction LogTransactions::OpenTransaction(BufferTicket& ticket)
 			{
 				BufferTransaction trans;
 				trans.index = INCRC(&usedTransactionCount) - 1;
 				BufferPointer address = BufferPointer::Invalid();
-				logAddressItem->WriteAddressItem(trans, address);
+				logAddressItem->WriteAddressItem(trans, address, ticket);
 
 				auto desc = MakePtr<LogTransDesc>();
 				desc->firstItem = BufferPointer::Invalid();
@@ -227,7 +229,7 @@ LogBlocks
 				,pageSize(0)
 				,nextBlockAddress(BufferPointer::Invalid())
 			{
-				pageSize = bm->GetPageSize();
+				pageSize = bm->GetPageDataSize();
 			}
 
 			bool LogBlocks::AllocateBlock(vuint64_t minSize, vuint64_t& size, BufferPointer& address)
@@ -278,7 +280,7 @@ LogBlocks
 LogWriter
 ***********************************************************************/
 
-			LogWriter::LogWriter(SpinLock& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, LogBlocks* _logBlocks, BufferTransaction _trans)
+			LogWriter::LogWriter(CriticalSection& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, LogBlocks* _logBlocks, BufferTransaction _trans)
 				:lock(_lock)
 				,bm(_bm)
 				,source(_source)
@@ -316,7 +318,10 @@ LogWriter
 			bool LogWriter::Close()
 			{
 				if (!opening) return false;
-				SPIN_LOCK(lock)
+
+				// pages are persisted after releasing the lock, so that concurrent writers are committed together
+				BufferTicket ticket;
+				CS_LOCK(lock)
 				{
 					auto desc = logTransactions->GetTransDesc(trans);
 					vint numberCount = desc->firstItem.IsValid() ? 3 : 4;
@@ -349,12 +354,12 @@ LogWriter
 								*numbers ++ = INDEX_INVALID;
 						}
 						stream.Read(numbers, (remain < dataSize ? remain : dataSize));
-						CHECK_ERROR(bm->UnlockPage(source, page, pointer, PersistanceType::ChangedAndPersist), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to unlock page for saving logs.");
+						CHECK_ERROR(bm->UnlockPage(source, page, pointer, PersistanceType::ChangedAndPersist, ticket), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to unlock page for saving logs.");
 						
 						if (numberCount == 4)
 						{
 							desc->firstItem = address;
-							CHECK_ERROR(logAddressItem->WriteAddressItem(trans, address), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to save logs.");
+							CHECK_ERROR(logAddressItem->WriteAddressItem(trans, address, ticket), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to save logs.");
 						}
 						else if (desc->lastItem.IsValid())
 						{
@@ -364,7 +369,7 @@ LogWriter
 
 							auto pointer = bm->LockPage(source, lastItemPage);
 							*(vuint64_t*)((char*)pointer + lastItemOffset) = address.index;
-							CHECK_ERROR(bm->UnlockPage(source, lastItemPage, pointer, PersistanceType::ChangedAndPersist), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to save logs.");
+							CHECK_ERROR(bm->UnlockPage(source, lastItemPage, pointer, PersistanceType::ChangedAndPersist, ticket), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to save logs.");
 						}
 						CHECK_ERROR(bm->EncodePointer(desc->lastItem, page, offset + (numberCount - 1) * sizeof(vuint64_t)), L"vl::database::log_internal::LogWriter::Close()#Internal error: Unable to encode block address for saving logs.");
 
@@ -383,14 +388,14 @@ LogWriter
 					opening = false;
 					desc->writer = 0;
 				}
-				return true;
+				return bm->WaitForPersistance(source, ticket);
 			}
 
 /***********************************************************************
 LogReader
 ***********************************************************************/
 
-			LogReader::LogReader(SpinLock& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, BufferTransaction _trans)
+			LogReader::LogReader(CriticalSection& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, BufferTransaction _trans, BufferAccessStrategy* _strategy)
 				:lock(_lock)
 				,bm(_bm)
 				,source(_source)
@@ -398,6 +403,7 @@ LogReader
 				,logTransactions(_logTransactions)
 				,trans(_trans)
 				,item(BufferPointer::Invalid())
+				,strategy(_strategy)
 			{
 				auto desc = logTransactions->GetTransDesc(trans);
 				if (desc)
@@ -442,7 +448,7 @@ LogReader
 				BufferPage page;
 				vuint64_t offset;
 				CHECK_ERROR(bm->DecodePointer(item, page, offset), L"vl::database::log_internal::LogReader::NextItem()#Internal error: Unable to decode block pointer.");
-				auto pointer = bm->LockPage(source, page);
+				auto pointer = bm->LockPage(source, page, PageLatch::Shared, strategy);
 				auto numbers = (vuint64_t*)((char*)pointer + offset);
 				auto remain = numbers[0];
 				auto block = numbers + 1;
@@ -455,6 +461,17 @@ LogReader
 					{
 						blockSize = remain;
 					}
+
+					if (remain > blockSize && item.IsValid())
+					{
+						// start reading the next block while copying this one
+						BufferPage nextPage;
+						vuint64_t nextOffset;
+						if (bm->DecodePointer(item, nextPage, nextOffset) && nextPage != page)
+						{
+							bm->PrefetchPages(source, &nextPage, 1);
+						}
+					}
 					
 					if (blockSize > 0)
 					{
@@ -469,7 +486,7 @@ LogReader
 						break;
 					}
 					CHECK_ERROR(bm->DecodePointer(item, page, offset), L"vl::database::log_internal::LogReader::NextItem()#Internal error: Unable to decode pointer.");
-					pointer = bm->LockPage(source, page);
+					pointer = bm->LockPage(source, page, PageLatch::Shared, strategy);
 					numbers = (vuint64_t*)((char*)pointer + offset);
 					block = numbers;
 				}
@@ -490,6 +507,7 @@ LogManager
 			,logAddressItem(_bm, _source)
 			,logBlocks(_bm, _source)
 		{
+			bm->SetSourcePriority(source, BufferPriority::Log);
 			vuint64_t usedTransactionCount = 0;
 			if (_createNew)
 			{
@@ -523,17 +541,19 @@ LogManager
 		BufferTransaction LogManager::OpenTransaction()
 		{
 			BufferTransaction trans;
-			SPIN_LOCK(lock)
+			BufferTicket ticket;
+			CS_LOCK(lock)
 			{
-				trans = logTransactions.OpenTransaction();
+				trans = logTransactions.OpenTransaction(ticket);
 			}
+			bm->WaitForPersistance(source, ticket);
 			return trans;
 		}
 
 		bool LogManager::CloseTransaction(BufferTransaction transaction)
 		{
 			bool success = false;
-			SPIN_LOCK(lock)
+			CS_LOCK(lock)
 			{
 				success = logTransactions.CloseTransaction(transaction);
 			}
@@ -543,7 +563,7 @@ LogManager
 		bool LogManager::IsActive(BufferTransaction transaction)
 		{
 			bool success = false;
-			SPIN_LOCK(lock)
+			CS_LOCK(lock)
 			{
 				success = logTransactions.IsActive(transaction);
 			}
@@ -553,7 +573,7 @@ LogManager
 		Ptr<ILogWriter> LogManager::OpenLogItem(BufferTransaction transaction)
 		{
 			Ptr<ILogWriter> writer;
-			SPIN_LOCK(lock)
+			CS_LOCK(lock)
 			{
 				if (auto desc = logTransactions.GetTransDesc(transaction))
 				{
@@ -567,25 +587,25 @@ LogManager
 			return writer;
 		}
 
-		Ptr<ILogReader> LogManager::EnumLogItem(BufferTransaction transaction)
+		Ptr<ILogReader> LogManager::EnumLogItem(BufferTransaction transaction, BufferAccessStrategy* strategy)
 		{
-			SPIN_LOCK(lock)
+			CS_LOCK(lock)
 			{
 				if (logTransactions.IsActive(transaction))
 				{
-					return new LogReader(lock, bm, source, &logAddressItem, &logTransactions, transaction);
+					return new LogReader(lock, bm, source, &logAddressItem, &logTransactions, transaction, strategy);
 				}
 			}
 			return nullptr;
 		}
 
-		Ptr<ILogReader> LogManager::EnumInactiveLogItem(BufferTransaction transaction)
+		Ptr<ILogReader> LogManager::EnumInactiveLogItem(BufferTransaction transaction, BufferAccessStrategy* strategy)
 		{
-			SPIN_LOCK(lock)
+			CS_LOCK(lock)
 			{
 				if (logTransactions.IsInactive(transaction))
 				{
-					return new LogReader(lock, bm, source, &logAddressItem, &logTransactions, transaction);
+					return new LogReader(lock, bm, source, &logAddressItem, &logTransactions, transaction, strategy);
 				}
 			}
 			return nullptr;
@@ -9,6 +9,7 @@ Database::Utility
 #define VCZH_DATABASE_UTILITY_LOG
 
 #include "Buffer.h"
+#include "PageGeometry.h"
 
 namespace vl
 {
@@ -52,12 +53,13 @@ namespace vl
 			class LogAddressItem : public Object
 			{
 				typedef collections::List<BufferPage>												PageList;
+				typedef buffer_internal::PageLayout<2, 1>											IndexPageLayout;
 			private:
 				BufferManager*					bm;
 				BufferSource					source;
 
 				vuint64_t						pageSize;
-				vuint64_t						indexPageItemCount;
+				IndexPageLayout					indexPageLayout;
 				PageList						indexPages;
 
 			public:
@@ -67,7 +69,7 @@ namespace vl
 				vuint64_t						InitializeExistingItems();
 
 				BufferPointer					ReadAddressItem(BufferTransaction transaction);
-				bool							WriteAddressItem(BufferTransaction transaction, BufferPointer address);
+				bool							WriteAddressItem(BufferTransaction transaction, BufferPointer address, BufferTicket& ticket);
 			};
 
 			class LogTransactions : public Object
@@ -87,7 +89,7 @@ namespace vl
 				BufferTransaction				GetTransaction(vuint64_t index);
 				Ptr<LogTransDesc>				GetTransDesc(BufferTransaction transaction);
 
-				BufferTransaction				OpenTransaction();
+				BufferTransaction				OpenTransaction(BufferTicket& ticket);
 				bool							CloseTransaction(BufferTransaction transaction);
 				bool							IsInactive(BufferTransaction transaction);
 				bool							IsActive(BufferTransaction transaction);
@@ -110,7 +112,7 @@ namespace vl
 			class LogWriter : public Object, public ILogWriter
 			{
 			private:
-				SpinLock&						lock;
+				CriticalSection&					lock;
 				BufferManager*					bm;
 				BufferSource					source;
 				LogAddressItem*					logAddressItem;
@@ -122,7 +124,7 @@ namespace vl
 				bool							opening;
 
 			public:
-				LogWriter(SpinLock& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, LogBlocks* _logBlocks, BufferTransaction _trans);
+				LogWriter(CriticalSection& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, LogBlocks* _logBlocks, BufferTransaction _trans);
 				~LogWriter();
 
 				BufferTransaction				GetTransaction()override;
@@ -134,7 +136,7 @@ namespace vl
 			class LogReader : public Object, public ILogReader
 			{
 			private:
-				SpinLock&						lock;
+				CriticalSection&					lock;
 				BufferManager*					bm;
 				BufferSource					source;
 				LogAddressItem*					logAddressItem;
@@ -143,9 +145,10 @@ namespace vl
 				BufferTransaction				trans;
 				BufferPointer					item;
 				Ptr<stream::MemoryStream>		stream;
+				BufferAccessStrategy*			strategy;
 
 			public:
-				LogReader(SpinLock& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, BufferTransaction _trans);
+				LogReader(CriticalSection& _lock, BufferManager* _bm, BufferSource _source, LogAddressItem* _logAddressItem, LogTransactions* _logTransactions, BufferTransaction _trans, BufferAccessStrategy* _strategy);
 				~LogReader();
 
 				BufferTransaction				GetTransaction()override;
@@ -165,7 +168,7 @@ namespace vl
 			log_internal::LogBlocks				logBlocks;
 			log_internal::LogTransactions		logTransactions;
 
-			SpinLock							lock;
+			CriticalSection						lock;
 
 		public:
 			LogManager(BufferManager* _bm, BufferSource _source, bool _createNew, bool _autoUnload = true);
@@ -179,8 +182,10 @@ namespace vl
 			bool								IsActive(BufferTransaction transaction);
 
 			Ptr<ILogWriter>						OpenLogItem(BufferTransaction transaction);
-			Ptr<ILogReader>						EnumLogItem(BufferTransaction transaction);
-			Ptr<ILogReader>						EnumInactiveLogItem(BufferTransaction transaction);
+
+			// Pages of log items are read through the strategy when it is given, the strategy should live longer than the reader
+			Ptr<ILogReader>						EnumLogItem(BufferTransaction transaction, BufferAccessStrategy* strategy = nullptr);
+			Ptr<ILogReader>						EnumInactiveLogItem(BufferTransaction transaction, BufferAccessStrategy* strategy = nullptr);
 		};
 	}
 }
@@ -0,0 +1,231 @@
+#include "PageBitmap.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			static const vuint64_t			FullItem = ~(vuint64_t)0;
+
+			typedef vuint64_t(*SkipFullItemsProc)(const vuint64_t* items, vuint64_t index, vuint64_t end);
+			typedef vuint64_t(*SkipEmptyItemsProc)(const vuint64_t* items, vuint64_t index, vuint64_t end);
+
+/***********************************************************************
+Portable
+***********************************************************************/
+
+			static vuint64_t SkipFullItemsPortable(const vuint64_t* items, vuint64_t index, vuint64_t end)
+			{
+				while (index < end && items[index] == FullItem)
+				{
+					index++;
+				}
+				return index;
+			}
+
+			static vuint64_t SkipEmptyItemsPortable(const vuint64_t* items, vuint64_t index, vuint64_t end)
+			{
+				while (index < end && items[index] == 0)
+				{
+					index++;
+				}
+				return index;
+			}
+
+			// Items with all bits set are skipped by skipFullItems when no zero bits are counted
+			static vuint64_t FindZeroBitsInternal(const vuint64_t* items, vuint64_t begin, vuint64_t end, vuint64_t count, SkipFullItemsProc skipFullItems)
+			{
+				if (begin >= end) return end;
+				if (count == 0) return begin;
+
+				vuint64_t runBegin = begin;
+				vuint64_t runLength = 0;
+				vuint64_t index = begin / 64;
+				vuint64_t itemEnd = (end + 63) / 64;
+				while (index < itemEnd)
+				{
+					if (runLength == 0)
+					{
+						index = skipFullItems(items, index, itemEnd);
+						if (index == itemEnd) break;
+					}
+
+					// bits out of [begin, end) are treated as set
+					vuint64_t item = items[index];
+					vuint64_t base = index * 64;
+					if (base < begin) item |= ((vuint64_t)1 << (begin - base)) - 1;
+					if (end - base < 64) item |= FullItem << (end - base);
+
+					vuint64_t bit = 0;
+					while (bit < 64)
+					{
+						vuint64_t rest = item >> bit;
+						vuint64_t zeros = rest == 0 ? 64 - bit : __builtin_ctzll(rest);
+						if (zeros > 0)
+						{
+							if (runLength == 0) runBegin = base + bit;
+							runLength += zeros;
+							if (runLength >= count) return runBegin;
+							bit += zeros;
+							if (bit == 64) break;
+						}
+
+						vuint64_t inverted = ~(item >> bit);
+						bit += inverted == 0 ? 64 : __builtin_ctzll(inverted);
+						runLength = 0;
+					}
+					index++;
+				}
+				return end;
+			}
+
+			static vuint64_t FindSetBitInternal(const vuint64_t* items, vuint64_t begin, vuint64_t end, SkipEmptyItemsProc skipEmptyItems)
+			{
+				if (begin >= end) return end;
+
+				// bits before begin are cleared in the first item
+				vuint64_t index = begin / 64;
+				vuint64_t item = items[index] & (FullItem << (begin % 64));
+				if (item == 0)
+				{
+					index = skipEmptyItems(items, index + 1, (end + 63) / 64);
+					if (index == (end + 63) / 64) return end;
+					item = items[index];
+				}
+
+				vuint64_t found = index * 64 + __builtin_ctzll(item);
+				return found < end ? found : end;
+			}
+
+			vuint64_t CountBitsPortable(const vuint64_t* items, vuint64_t itemCount)
+			{
+				vuint64_t count = 0;
+				for (vuint64_t i = 0; i < itemCount; i++)
+				{
+					count += __builtin_popcountll(items[i]);
+				}
+				return count;
+			}
+
+			vuint64_t FindZeroBitsPortable(const vuint64_t* items, vuint64_t begin, vuint64_t end, vuint64_t count)
+			{
+				return FindZeroBitsInternal(items, begin, end, count, &SkipFullItemsPortable);
+			}
+
+			vuint64_t FindSetBitPortable(const vuint64_t* items, vuint64_t begin, vuint64_t end)
+			{
+				return FindSetBitInternal(items, begin, end, &SkipEmptyItemsPortable);
+			}
+
+/***********************************************************************
+AVX2
+***********************************************************************/
+
+#if defined(__x86_64__)
+			/*
+			 * Bits are counted by looking up each 4 bits in a table of 16 bytes by vpshufb,
+			 * and the counts of bytes are summed by vpsadbw.
+			 */
+			__attribute__((target("avx2")))
+			static vuint64_t CountBitsAvx2(const vuint64_t* items, vuint64_t itemCount)
+			{
+				const __m256i lookup = _mm256_setr_epi8(
+					0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+					0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+					);
+				const __m256i lowMask = _mm256_set1_epi8(0x0F);
+				const __m256i zero = _mm256_setzero_si256();
+
+				__m256i total = zero;
+				vuint64_t i = 0;
+				for (; i + 4 <= itemCount; i += 4)
+				{
+					__m256i block = _mm256_loadu_si256((const __m256i*)(items + i));
+					__m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(block, lowMask));
+					__m256i high = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(block, 4), lowMask));
+					total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(low, high), zero));
+				}
+
+				vuint64_t count = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) + _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+				for (; i < itemCount; i++)
+				{
+					count += __builtin_popcountll(items[i]);
+				}
+				return count;
+			}
+
+			__attribute__((target("avx2")))
+			static vuint64_t SkipFullItemsAvx2(const vuint64_t* items, vuint64_t index, vuint64_t end)
+			{
+				const __m256i full = _mm256_set1_epi64x(-1);
+				for (; index + 4 <= end; index += 4)
+				{
+					__m256i block = _mm256_loadu_si256((const __m256i*)(items + index));
+					if (!_mm256_testc_si256(block, full)) break;
+				}
+				return SkipFullItemsPortable(items, index, end);
+			}
+
+			__attribute__((target("avx2")))
+			static vuint64_t SkipEmptyItemsAvx2(const vuint64_t* items, vuint64_t index, vuint64_t end)
+			{
+				for (; index + 4 <= end; index += 4)
+				{
+					__m256i block = _mm256_loadu_si256((const __m256i*)(items + index));
+					if (!_mm256_testz_si256(block, block)) break;
+				}
+				return SkipEmptyItemsPortable(items, index, end);
+			}
+
+			bool IsBitmapScanAccelerated()
+			{
+				static bool accelerated = __builtin_cpu_supports("avx2");
+				return accelerated;
+			}
+
+			vuint64_t CountBits(const vuint64_t* items, vuint64_t itemCount)
+			{
+				if (IsBitmapScanAccelerated())
+				{
+					return CountBitsAvx2(items, itemCount);
+				}
+				return CountBitsPortable(items, itemCount);
+			}
+
+			vuint64_t FindZeroBits(const vuint64_t* items, vuint64_t begin, vuint64_t end, vuint64_t count)
+			{
+				return FindZeroBitsInternal(items, begin, end, count, IsBitmapScanAccelerated() ? &SkipFullItemsAvx2 : &SkipFullItemsPortable);
+			}
+
+			vuint64_t FindSetBit(const vuint64_t* items, vuint64_t begin, vuint64_t end)
+			{
+				return FindSetBitInternal(items, begin, end, IsBitmapScanAccelerated() ? &SkipEmptyItemsAvx2 : &SkipEmptyItemsPortable);
+			}
+#else
+			bool IsBitmapScanAccelerated()
+			{
+				return false;
+			}
+
+			vuint64_t CountBits(const vuint64_t* items, vuint64_t itemCount)
+			{
+				return CountBitsPortable(items, itemCount);
+			}
+
+			vuint64_t FindZeroBits(const vuint64_t* items, vuint64_t begin, vuint64_t end, vuint64_t count)
+			{
+				return FindZeroBitsPortable(items, begin, end, count);
+			}
+
+			vuint64_t FindSetBit(const vuint64_t* items, vuint64_t begin, vuint64_t end)
+			{
+				return FindSetBitPortable(items, begin, end);
+			}
+#endif
+		}
+	}
+}
@@ -0,0 +1,39 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_PAGEBITMAP
+#define VCZH_DATABASE_UTILITY_PAGEBITMAP
+
+#include "Common.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * Scans over bitmaps of pages, bit i of items[j] is the bit of page j * 64 + i.
+			 * AVX2 is used when the processor supports it.
+			 */
+			extern bool						IsBitmapScanAccelerated();
+
+			extern vuint64_t				CountBits(const vuint64_t* items, vuint64_t itemCount);
+			extern vuint64_t				CountBitsPortable(const vuint64_t* items, vuint64_t itemCount);
+
+			// Returns the first bit of count zero bits in a row in [begin, end), or end if there is no such bits
+			extern vuint64_t				FindZeroBits(const vuint64_t* items, vuint64_t begin, vuint64_t end, vuint64_t count);
+			extern vuint64_t				FindZeroBitsPortable(const vuint64_t* items, vuint64_t begin, vuint64_t end, vuint64_t count);
+
+			// Returns the first set bit in [begin, end), or end if there is no such bit
+			extern vuint64_t				FindSetBit(const vuint64_t* items, vuint64_t begin, vuint64_t end);
+			extern vuint64_t				FindSetBitPortable(const vuint64_t* items, vuint64_t begin, vuint64_t end);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include "PageChecksum.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			static const vuint32_t			Crc32cPolynomial = 0x82F63B78;		// reflected 0x1EDC6F41
+			static const vuint32_t			PageChecksumMagic = 0x5A435243;		// CRCZ
+			static const vuint64_t			LaneSize = 256;
+
+/***********************************************************************
+Portable
+***********************************************************************/
+
+			/*
+			 * Raw CRC updates do not invert the state before and after, so that they are linear:
+			 *		raw(s, X + Y) = shift(raw(s, X), |Y|) ^ raw(0, Y)
+			 * where shift(s, n) = raw(s, n zero bytes).
+			 */
+			struct Crc32cTables
+			{
+				vuint32_t					slices[8][256];
+				vuint32_t					laneShift[4][256];		// shift(s, LaneSize) by bytes of s
+
+				Crc32cTables()
+				{
+					for (vuint32_t i = 0; i < 256; i++)
+					{
+						vuint32_t crc = i;
+						for (vint j = 0; j < 8; j++)
+						{
+							crc = crc & 1 ? (crc >> 1) ^ Crc32cPolynomial : crc >> 1;
+						}
+						slices[0][i] = crc;
+					}
+					for (vint k = 1; k < 8; k++)
+					{
+						for (vint i = 0; i < 256; i++)
+						{
+							slices[k][i] = (slices[k - 1][i] >> 8) ^ slices[0][slices[k - 1][i] & 0xFF];
+						}
+					}
+
+					// shift is linear, so it is built from shifting each bit
+					vuint32_t bitShift[32];
+					for (vint b = 0; b < 32; b++)
+					{
+						vuint32_t crc = (vuint32_t)1 << b;
+						for (vuint64_t i = 0; i < LaneSize; i++)
+						{
+							crc = (crc >> 8) ^ slices[0][crc & 0xFF];
+						}
+						bitShift[b] = crc;
+					}
+					for (vint k = 0; k < 4; k++)
+					{
+						for (vint i = 0; i < 256; i++)
+						{
+							vuint32_t crc = 0;
+							for (vint b = 0; b < 8; b++)
+							{
+								if (i & (1 << b)) crc ^= bitShift[k * 8 + b];
+							}
+							laneShift[k][i] = crc;
+						}
+					}
+				}
+
+				vuint32_t ShiftLane(vuint32_t crc)const
+				{
+					return laneShift[0][crc & 0xFF] ^ laneShift[1][(crc >> 8) & 0xFF] ^ laneShift[2][(crc >> 16) & 0xFF] ^ laneShift[3][crc >> 24];
+				}
+			};
+
+			static const Crc32cTables& GetCrc32cTables()
+			{
+				static Crc32cTables tables;
+				return tables;
+			}
+
+			static vuint32_t UpdateCrc32cPortable(const Crc32cTables& tables, vuint32_t crc, const vuint8_t* data, vuint64_t size)
+			{
+				while (size >= 8)
+				{
+					vuint64_t word;
+					memcpy(&word, data, sizeof(word));
+					word ^= crc;
+					crc = tables.slices[7][word & 0xFF]
+						^ tables.slices[6][(word >> 8) & 0xFF]
+						^ tables.slices[5][(word >> 16) & 0xFF]
+						^ tables.slices[4][(word >> 24) & 0xFF]
+						^ tables.slices[3][(word >> 32) & 0xFF]
+						^ tables.slices[2][(word >> 40) & 0xFF]
+						^ tables.slices[1][(word >> 48) & 0xFF]
+						^ tables.slices[0][word >> 56];
+					data += 8;
+					size -= 8;
+				}
+				while (size-- > 0)
+				{
+					crc = (crc >> 8) ^ tables.slices[0][(crc ^ *data++) & 0xFF];
+				}
+				return crc;
+			}
+
+			vuint32_t ComputeCrc32cPortable(const void* data, vuint64_t size)
+			{
+				return ~UpdateCrc32cPortable(GetCrc32cTables(), ~(vuint32_t)0, (const vuint8_t*)data, size);
+			}
+
+/***********************************************************************
+SSE4.2
+***********************************************************************/
+
+#if defined(__x86_64__)
+			/*
+			 * The crc32 instruction takes 3 cycles but a new one starts every cycle,
+			 * so three lanes are computed together and combined by shifting.
+			 */
+			__attribute__((target("sse4.2")))
+			static vuint32_t UpdateCrc32cHardware(const Crc32cTables& tables, vuint32_t crc, const vuint8_t* data, vuint64_t size)
+			{
+				vuint64_t crcA = crc;
+				while (size >= LaneSize * 3)
+				{
+					vuint64_t crcB = 0;
+					vuint64_t crcC = 0;
+					for (vuint64_t i = 0; i < LaneSize; i += 8)
+					{
+						vuint64_t wordA, wordB, wordC;
+						memcpy(&wordA, data + i, sizeof(vuint64_t));
+						memcpy(&wordB, data + LaneSize + i, sizeof(vuint64_t));
+						memcpy(&wordC, data + LaneSize * 2 + i, sizeof(vuint64_t));
+						crcA = _mm_crc32_u64(crcA, wordA);
+						crcB = _mm_crc32_u64(crcB, wordB);
+						crcC = _mm_crc32_u64(crcC, wordC);
+					}
+					crcA = tables.ShiftLane(tables.ShiftLane((vuint32_t)crcA) ^ (vuint32_t)crcB) ^ (vuint32_t)crcC;
+					data += LaneSize * 3;
+					size -= LaneSize * 3;
+				}
+
+				while (size >= 8)
+				{
+					vuint64_t word;
+					memcpy(&word, data, sizeof(word));
+					crcA = _mm_crc32_u64(crcA, word);
+					data += 8;
+					size -= 8;
+				}
+				auto crc32 = (vuint32_t)crcA;
+				while (size-- > 0)
+				{
+					crc32 = _mm_crc32_u8(crc32, *data++);
+				}
+				return crc32;
+			}
+
+			bool IsCrc32cAccelerated()
+			{
+				static bool accelerated = __builtin_cpu_supports("sse4.2");
+				return accelerated;
+			}
+
+			vuint32_t ComputeCrc32c(const void* data, vuint64_t size)
+			{
+				if (IsCrc32cAccelerated())
+				{
+					return ~UpdateCrc32cHardware(GetCrc32cTables(), ~(vuint32_t)0, (const vuint8_t*)data, size);
+				}
+				return ComputeCrc32cPortable(data, size);
+			}
+#else
+			bool IsCrc32cAccelerated()
+			{
+				return false;
+			}
+
+			vuint32_t ComputeCrc32c(const void* data, vuint64_t size)
+			{
+				return ComputeCrc32cPortable(data, size);
+			}
+#endif
+
+/***********************************************************************
+Pages
+***********************************************************************/
+
+			void SealPage(void* page, vuint64_t pageSize)
+			{
+				vuint64_t dataSize = pageSize - PageChecksumSize;
+				vuint32_t trailer[2] = {ComputeCrc32c(page, dataSize), PageChecksumMagic};
+				memcpy((char*)page + dataSize, trailer, sizeof(trailer));
+			}
+
+			bool VerifyPage(const void* page, vuint64_t pageSize)
+			{
+				vuint64_t dataSize = pageSize - PageChecksumSize;
+				vuint32_t trailer[2];
+				memcpy(trailer, (const char*)page + dataSize, sizeof(trailer));
+				if (trailer[1] == PageChecksumMagic)
+				{
+					return trailer[0] == ComputeCrc32c(page, dataSize);
+				}
+				if (trailer[0] != 0 || trailer[1] != 0)
+				{
+					return false;
+				}
+
+				// a page never written is filled with zero
+				auto words = (const vuint64_t*)page;
+				for (vuint64_t i = 0; i < dataSize / sizeof(vuint64_t); i++)
+				{
+					if (words[i] != 0) return false;
+				}
+				return true;
+			}
+		}
+	}
+}
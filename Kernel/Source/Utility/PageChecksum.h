@@ -0,0 +1,37 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_PAGECHECKSUM
+#define VCZH_DATABASE_UTILITY_PAGECHECKSUM
+
+#include "Common.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			// CRC32C (Castagnoli), computed by the SSE4.2 crc32 instruction when the processor supports it
+			extern vuint32_t				ComputeCrc32c(const void* data, vuint64_t size);
+			extern vuint32_t				ComputeCrc32cPortable(const void* data, vuint64_t size);
+			extern bool						IsCrc32cAccelerated();
+
+			/*
+			 * A checksummed page ends with a trailer of [uint32 Crc32c][uint32 Magic],
+			 * the checksum covers all bytes before the trailer.
+			 * A page whose bytes are all zero is valid, it is a page that has never been written.
+			 */
+			static const vuint64_t			PageChecksumSize = 2 * sizeof(vuint32_t);
+
+			extern void						SealPage(void* page, vuint64_t pageSize);
+			extern bool						VerifyPage(const void* page, vuint64_t pageSize);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,130 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_PAGEGEOMETRY
+#define VCZH_DATABASE_UTILITY_PAGEGEOMETRY
+
+#include "Common.h"
+#include "PageChecksum.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * Layouts of pages of 2^Bits bytes, everything is known at compile time.
+			 */
+			template<vuint64_t Bits>
+			struct PageGeometry
+			{
+				static const vuint64_t		PageSize = (vuint64_t)1 << Bits;
+				static const vuint64_t		PageItemCount = PageSize / sizeof(vuint64_t);
+
+				// A page begins with HeaderCount uint64 items and ends with TrailerCount uint64 items,
+				// and each uint64 item between them stores EntriesPerItem entries
+				template<vuint64_t HeaderCount, vuint64_t EntriesPerItem, vuint64_t TrailerCount = 0>
+				struct Layout
+				{
+					static const vuint64_t	EntryCount = (PageItemCount - HeaderCount - TrailerCount) * EntriesPerItem;
+
+					static void Locate(vuint64_t entry, vuint64_t& page, vuint64_t& index)
+					{
+						page = entry / EntryCount;
+						index = entry % EntryCount;
+					}
+				};
+			};
+
+			/*
+			 * Locates entries in a chain of pages sharing the same layout.
+			 * 4K, 16K and 64K pages, with or without a checksum trailer of PageChecksumSize bytes, are recognized when the layout is created.
+			 * Locate switches on the recognized page size, so each case divides by a constant that is inlined into the caller,
+			 * which becomes a shift and a mask when the entry count is a power of 2.
+			 * Other page sizes fall back to a division instruction.
+			 */
+			template<vuint64_t HeaderCount, vuint64_t EntriesPerItem>
+			class PageLayout
+			{
+			public:
+				static const vuint64_t		HeaderItemCount = HeaderCount;
+				static const vuint64_t		ChecksumItemCount = PageChecksumSize / sizeof(vuint64_t);
+				static_assert(PageChecksumSize % sizeof(vuint64_t) == 0, "The checksum trailer should be made of whole uint64 items.");
+			private:
+				enum class Geometry
+				{
+					Unknown,
+					Page4K,
+					Page16K,
+					Page64K,
+					Page4KTrailer,
+					Page16KTrailer,
+					Page64KTrailer,
+				};
+
+				vuint64_t					entryCount = 0;
+				Geometry					geometry = Geometry::Unknown;
+
+				template<vuint64_t Bits, vuint64_t TrailerCount>
+				static bool TryDispatch(vuint64_t pageSize, Geometry geometry, PageLayout& layout)
+				{
+					if (pageSize != PageGeometry<Bits>::PageSize - TrailerCount * sizeof(vuint64_t)) return false;
+					layout.geometry = geometry;
+					return true;
+				}
+
+				template<vuint64_t Bits, vuint64_t TrailerCount>
+				static void LocateIn(vuint64_t entry, vuint64_t& page, vuint64_t& index)
+				{
+					PageGeometry<Bits>::template Layout<HeaderCount, EntriesPerItem, TrailerCount>::Locate(entry, page, index);
+				}
+			public:
+				static PageLayout Create(vuint64_t pageSize)
+				{
+					PageLayout layout;
+					layout.entryCount = (pageSize / sizeof(vuint64_t) - HeaderCount) * EntriesPerItem;
+					TryDispatch<12, 0>(pageSize, Geometry::Page4K, layout)
+						|| TryDispatch<14, 0>(pageSize, Geometry::Page16K, layout)
+						|| TryDispatch<16, 0>(pageSize, Geometry::Page64K, layout)
+						|| TryDispatch<12, ChecksumItemCount>(pageSize, Geometry::Page4KTrailer, layout)
+						|| TryDispatch<14, ChecksumItemCount>(pageSize, Geometry::Page16KTrailer, layout)
+						|| TryDispatch<16, ChecksumItemCount>(pageSize, Geometry::Page64KTrailer, layout);
+					return layout;
+				}
+
+				vuint64_t GetEntryCount()const
+				{
+					return entryCount;
+				}
+
+				bool IsSpecialized()const
+				{
+					return geometry != Geometry::Unknown;
+				}
+
+				void Locate(vuint64_t entry, vuint64_t& page, vuint64_t& index)const
+				{
+					switch (geometry)
+					{
+					case Geometry::Page4K:			LocateIn<12, 0>(entry, page, index); break;
+					case Geometry::Page16K:			LocateIn<14, 0>(entry, page, index); break;
+					case Geometry::Page64K:			LocateIn<16, 0>(entry, page, index); break;
+					case Geometry::Page4KTrailer:	LocateIn<12, ChecksumItemCount>(entry, page, index); break;
+					case Geometry::Page16KTrailer:	LocateIn<14, ChecksumItemCount>(entry, page, index); break;
+					case Geometry::Page64KTrailer:	LocateIn<16, ChecksumItemCount>(entry, page, index); break;
+					default:
+						page = entry / entryCount;
+						index = entry % entryCount;
+					}
+				}
+			};
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include "PageTable.h"
+#include <string.h>
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			using namespace collections;
+
+/***********************************************************************
+PageTable
+***********************************************************************/
+
+			vint PageTable::GetHomeSlot(vuint64_t page)
+			{
+				return (vint)((page * 0x9E3779B97F4A7C15ULL) >> (64 - slotBits));
+			}
+
+			vint PageTable::FindSlot(vuint64_t page)
+			{
+				vint mask = slotCount - 1;
+				vint slot = GetHomeSlot(page);
+				while (slots[slot].frame)
+				{
+					if (slots[slot].page == page) return slot;
+					slot = (slot + 1) & mask;
+				}
+				return -1;
+			}
+
+			void PageTable::Resize(vint bits)
+			{
+				auto oldSlots = slots;
+				auto oldSlotCount = slotCount;
+
+				slotBits = bits;
+				slotCount = ((vint)1) << bits;
+				slots = new Slot[slotCount];
+				memset(slots, 0, sizeof(Slot) * slotCount);
+
+				vint mask = slotCount - 1;
+				for (vint i = 0; i < oldSlotCount; i++)
+				{
+					if (oldSlots[i].frame)
+					{
+						vint slot = GetHomeSlot(oldSlots[i].page);
+						while (slots[slot].frame)
+						{
+							slot = (slot + 1) & mask;
+						}
+						slots[slot] = oldSlots[i];
+					}
+				}
+				delete[] oldSlots;
+			}
+
+			PageTable::Frame* PageTable::AllocateFrame()
+			{
+				if (!freeFrames)
+				{
+					auto chunk = new Frame[FrameChunkSize];
+					frameChunks.Add(chunk);
+					for (vint i = FrameChunkSize - 1; i >= 0; i--)
+					{
+						chunk[i].nextFreeFrame = freeFrames;
+						freeFrames = &chunk[i];
+					}
+				}
+
+				auto frame = freeFrames;
+				freeFrames = frame->nextFreeFrame;
+				frame->desc = BufferPageDesc();
+				frame->nextFreeFrame = nullptr;
+				return frame;
+			}
+
+			void PageTable::FreeFrame(Frame* frame)
+			{
+				frame->nextFreeFrame = freeFrames;
+				freeFrames = frame;
+			}
+
+			PageTable::PageTable()
+			{
+				Resize(6);
+			}
+
+			PageTable::~PageTable()
+			{
+				delete[] slots;
+				FOREACH(Frame*, chunk, frameChunks)
+				{
+					delete[] chunk;
+				}
+			}
+
+			vint PageTable::Count()
+			{
+				return usedSlotCount;
+			}
+
+			vint PageTable::GetSlotCount()
+			{
+				return slotCount;
+			}
+
+			BufferPageDesc* PageTable::GetSlot(vint slot, BufferPage& page)
+			{
+				if (slot < 0 || slot >= slotCount || !slots[slot].frame)
+				{
+					return nullptr;
+				}
+				page.index = slots[slot].page;
+				return &slots[slot].frame->desc;
+			}
+
+			BufferPageDesc* PageTable::Get(BufferPage page)
+			{
+				vint slot = FindSlot(page.index);
+				return slot == -1 ? nullptr : &slots[slot].frame->desc;
+			}
+
+			BufferPageDesc* PageTable::Add(BufferPage page)
+			{
+				CHECK_ERROR(FindSlot(page.index) == -1, L"vl::database::buffer_internal::PageTable::Add(BufferPage)#Internal error: The page has already been added.");
+
+				// keep the load factor not greater than 1/2
+				if ((usedSlotCount + 1) * 2 > slotCount)
+				{
+					Resize(slotBits + 1);
+				}
+
+				vint mask = slotCount - 1;
+				vint slot = GetHomeSlot(page.index);
+				while (slots[slot].frame)
+				{
+					slot = (slot + 1) & mask;
+				}
+
+				slots[slot].page = page.index;
+				slots[slot].frame = AllocateFrame();
+				usedSlotCount++;
+				return &slots[slot].frame->desc;
+			}
+
+			bool PageTable::Remove(BufferPage page)
+			{
+				vint slot = FindSlot(page.index);
+				if (slot == -1) return false;
+
+				FreeFrame(slots[slot].frame);
+				usedSlotCount--;
+
+				// backward shift deletion, move following entries of the same cluster into the hole
+				vint mask = slotCount - 1;
+				vint hole = slot;
+				vint next = slot;
+				while (true)
+				{
+					next = (next + 1) & mask;
+					if (!slots[next].frame) break;
+
+					vint home = GetHomeSlot(slots[next].page);
+					bool movable = hole <= next
+						? (home <= hole || home > next)
+						: (home <= hole && home > next);
+					if (movable)
+					{
+						slots[hole] = slots[next];
+						hole = next;
+					}
+				}
+				slots[hole].frame = nullptr;
+				return true;
+			}
+
+			void PageTable::Clear()
+			{
+				for (vint i = 0; i < slotCount; i++)
+				{
+					if (slots[i].frame)
+					{
+						FreeFrame(slots[i].frame);
+						slots[i].frame = nullptr;
+					}
+				}
+				usedSlotCount = 0;
+			}
+		}
+	}
+}
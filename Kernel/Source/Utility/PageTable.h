@@ -0,0 +1,74 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_PAGETABLE
+#define VCZH_DATABASE_UTILITY_PAGETABLE
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		namespace buffer_internal
+		{
+			/*
+			 * An open addressing (linear probing) hash table from page ids to page descriptors.
+			 * Descriptors are allocated in chunks and recycled through a free list,
+			 * so mapping and unmapping pages do not allocate memory after the table is warmed up.
+			 */
+			class PageTable : public Object, public NotCopyable
+			{
+			protected:
+				struct Frame
+				{
+					BufferPageDesc				desc;
+					Frame*						nextFreeFrame = nullptr;
+				};
+
+				struct Slot
+				{
+					vuint64_t					page;
+					Frame*						frame;
+				};
+
+				static const vint				InitialSlotCount = 64;
+				static const vint				FrameChunkSize = 256;
+
+				typedef collections::List<Frame*>								FrameChunkList;
+
+				Slot*							slots = nullptr;
+				vint							slotBits = 0;
+				vint							slotCount = 0;
+				vint							usedSlotCount = 0;
+				FrameChunkList					frameChunks;
+				Frame*							freeFrames = nullptr;
+
+				vint							GetHomeSlot(vuint64_t page);
+				vint							FindSlot(vuint64_t page);
+				void							Resize(vint bits);
+				Frame*							AllocateFrame();
+				void							FreeFrame(Frame* frame);
+
+			public:
+				PageTable();
+				~PageTable();
+
+				vint							Count();
+				vint							GetSlotCount();
+				BufferPageDesc*					GetSlot(vint slot, BufferPage& page);
+
+				BufferPageDesc*					Get(BufferPage page);
+				BufferPageDesc*					Add(BufferPage page);
+				bool							Remove(BufferPage page);
+				void							Clear();
+			};
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "ReplacementPolicy.h"
+#include "BufferMetrics.h"
+
+namespace vl
+{
+	namespace database
+	{
+		using namespace collections;
+
+/***********************************************************************
+ClockReplacementPolicy
+***********************************************************************/
+
+		void ClockReplacementPolicy::UnloadSource(BufferSource source)
+		{
+			hands.Remove(source);
+		}
+
+		void ClockReplacementPolicy::SelectVictims(SourceList& sources, vuint64_t expectCount, bool cleanOnly, VictimList& victims)
+		{
+			vint sourceCount = sources.Count();
+			for (vint i = 0; i < sourceCount && (vuint64_t)victims.Count() < expectCount; i++)
+			{
+				auto source = sources[(nextSource + i) % sourceCount];
+				SOURCE_LOCK(source)
+				{
+					vint slotCount = source->GetPageSlotCount();
+					if (slotCount == 0) continue;
+
+					vint index = hands.Keys().IndexOf(source->GetBufferSource());
+					vint hand = index == -1 ? 0 : hands.Values()[index];
+					vint firstVictimStep = -1;
+
+					// visit every slot twice at most, and collect a slot only once
+					for (vint step = 0; step < slotCount * 2 && (vuint64_t)victims.Count() < expectCount; step++)
+					{
+						if (firstVictimStep != -1 && step - firstVictimStep >= slotCount) break;
+						if (hand >= slotCount) hand = 0;
+
+						BufferPage page;
+						auto pageDesc = source->GetPageSlot(hand++, page);
+						if (!pageDesc || pageDesc->IsPinned()) continue;
+						if (cleanOnly && pageDesc->dirty) continue;
+
+						if (pageDesc->referenced)
+						{
+							pageDesc->referenced = false;
+						}
+						else
+						{
+							if (firstVictimStep == -1) firstVictimStep = step;
+							victims.Add(VictimTuple(source, page));
+						}
+					}
+					hands.Set(source->GetBufferSource(), hand);
+				}
+			}
+
+			if (sourceCount > 0)
+			{
+				nextSource = (nextSource + 1) % sourceCount;
+			}
+		}
+
+/***********************************************************************
+LruKReplacementPolicy
+***********************************************************************/
+
+		LruKReplacementPolicy::LruKReplacementPolicy(vint _k)
+			:k(_k)
+		{
+			CHECK_ERROR(k == 1 || k == 2, L"vl::database::LruKReplacementPolicy::LruKReplacementPolicy(vint)#Only K = 1 or K = 2 is supported.");
+		}
+
+		void LruKReplacementPolicy::UnloadSource(BufferSource source)
+		{
+		}
+
+		void LruKReplacementPolicy::SelectVictims(SourceList& sources, vuint64_t expectCount, bool cleanOnly, VictimList& victims)
+		{
+			if (expectCount == 0) return;
+
+			// a max-heap keeping the expectCount least valuable pages
+			CandidateHeap heap;
+			FOREACH(IBufferSource*, source, sources)
+			{
+				SOURCE_LOCK(source)
+				{
+					vint slotCount = source->GetPageSlotCount();
+					for (vint slot = 0; slot < slotCount; slot++)
+					{
+						Candidate candidate;
+						auto pageDesc = source->GetPageSlot(slot, candidate.page);
+						if (!pageDesc || pageDesc->IsPinned()) continue;
+						if (cleanOnly && pageDesc->dirty) continue;
+
+						candidate.source = source;
+						candidate.kthAccessTime = k == 1 ? pageDesc->lastAccessTime : pageDesc->previousAccessTime;
+						candidate.lastAccessTime = pageDesc->lastAccessTime;
+
+						if ((vuint64_t)heap.Count() < expectCount)
+						{
+							vint index = heap.Add(candidate);
+							while (index > 0)
+							{
+								vint parent = (index - 1) / 2;
+								if (!(heap[parent] < heap[index])) break;
+								auto temp = heap[parent];
+								heap[parent] = heap[index];
+								heap[index] = temp;
+								index = parent;
+							}
+						}
+						else if (candidate < heap[0])
+						{
+							heap[0] = candidate;
+							vint index = 0;
+							vint count = heap.Count();
+							while (true)
+							{
+								vint largest = index;
+								vint left = index * 2 + 1;
+								vint right = left + 1;
+								if (left < count && heap[largest] < heap[left]) largest = left;
+								if (right < count && heap[largest] < heap[right]) largest = right;
+								if (largest == index) break;
+								auto temp = heap[largest];
+								heap[largest] = heap[index];
+								heap[index] = temp;
+								index = largest;
+							}
+						}
+					}
+				}
+			}
+
+			FOREACH(Candidate, candidate, heap)
+			{
+				victims.Add(VictimTuple(candidate.source, candidate.page));
+			}
+		}
+
+/***********************************************************************
+CreateReplacementPolicy
+***********************************************************************/
+
+		IBufferReplacementPolicy* CreateReplacementPolicy(BufferReplacement replacement)
+		{
+			switch (replacement)
+			{
+			case BufferReplacement::LeastRecentlyUsed:
+				return new LruKReplacementPolicy(1);
+			case BufferReplacement::LeastRecentlyUsed2:
+				return new LruKReplacementPolicy(2);
+			case BufferReplacement::Clock:
+				return new ClockReplacementPolicy;
+			default:
+				return nullptr;
+			}
+		}
+	}
+}
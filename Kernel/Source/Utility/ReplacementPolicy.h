@@ -0,0 +1,69 @@
+/***********************************************************************
+Vczh Library++ 3.0
+Developer: Zihan Chen(vczh)
+Database::Utility
+
+***********************************************************************/
+
+#ifndef VCZH_DATABASE_UTILITY_REPLACEMENTPOLICY
+#define VCZH_DATABASE_UTILITY_REPLACEMENTPOLICY
+
+#include "Buffer.h"
+
+namespace vl
+{
+	namespace database
+	{
+		/*
+		 * Each source has a clock hand sweeping its page slots.
+		 * A referenced page gets a second chance by clearing its referenced bit.
+		 */
+		class ClockReplacementPolicy : public Object, public IBufferReplacementPolicy
+		{
+			typedef collections::Dictionary<BufferSource, vint>				HandMap;
+		private:
+			HandMap					hands;
+			vint					nextSource = 0;
+
+		public:
+			void					UnloadSource(BufferSource source)override;
+			void					SelectVictims(SourceList& sources, vuint64_t expectCount, bool cleanOnly, VictimList& victims)override;
+		};
+
+		/*
+		 * Evicts pages with the oldest K-th most recent access, K could be 1 or 2.
+		 * When K == 2, pages that have been accessed only once are evicted first.
+		 */
+		class LruKReplacementPolicy : public Object, public IBufferReplacementPolicy
+		{
+		protected:
+			struct Candidate
+			{
+				IBufferSource*		source;
+				BufferPage			page;
+				vuint64_t			kthAccessTime;
+				vuint64_t			lastAccessTime;
+
+				bool operator<(const Candidate& candidate)const
+				{
+					if (kthAccessTime != candidate.kthAccessTime) return kthAccessTime < candidate.kthAccessTime;
+					return lastAccessTime < candidate.lastAccessTime;
+				}
+			};
+
+			typedef collections::List<Candidate>							CandidateHeap;
+		private:
+			vint					k;
+
+		public:
+			LruKReplacementPolicy(vint _k);
+
+			void					UnloadSource(BufferSource source)override;
+			void					SelectVictims(SourceList& sources, vuint64_t expectCount, bool cleanOnly, VictimList& victims)override;
+		};
+
+		extern IBufferReplacementPolicy*	CreateReplacementPolicy(BufferReplacement replacement);
+	}
+}
+
+#endif
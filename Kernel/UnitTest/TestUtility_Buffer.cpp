@@ -2,6 +2,10 @@
 #include "../Source/Utility/Buffer.h"
 #include "../Source/Utility/InMemoryBuffer.h"
 #include "../Source/Utility/FileBuffer.h"
+#include "../Source/Utility/PageChecksum.h"
+#include "../Source/Utility/PageBitmap.h"
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace vl;
 using namespace vl::database;
@@ -50,6 +54,24 @@ TEST_CASE(Utility_Buffer_File_##NAME)												\
 	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);						\
 	TestCase_Utility_Buffer_##NAME(bm, source);										\
 }																					\
+TEST_CASE(Utility_Buffer_PooledFile_##NAME)											\
+{																					\
+	BufferManager bm(64 KB, 16);													\
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);	\
+	TestCase_Utility_Buffer_##NAME(bm, source);										\
+}																					\
+TEST_CASE(Utility_Buffer_AsyncFile_##NAME)											\
+{																					\
+	BufferManager bm(64 KB, 16);													\
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::AsyncFrames);	\
+	TestCase_Utility_Buffer_##NAME(bm, source);										\
+}																					\
+TEST_CASE(Utility_Buffer_CompressedFile_##NAME)										\
+{																					\
+	BufferManager bm(64 KB, 16);													\
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::CompressedFrames);	\
+	TestCase_Utility_Buffer_##NAME(bm, source);										\
+}																					\
 void TestCase_Utility_Buffer_##NAME(BufferManager& bm, BufferSource source)			\
 
 TEST_CASE_SOURCE(LockUnlockPage)
@@ -72,6 +94,293 @@ TEST_CASE_SOURCE(LockUnlockPage)
 	TEST_ASSERT(bm.UnlockPage(source, page, addr, PersistanceType::NoChanging) == false);
 }
 
+TEST_CASE_SOURCE(PageHandle)
+{
+	auto page = bm.AllocatePage(source);
+	TEST_ASSERT(page.IsValid());
+	TEST_ASSERT(bm.LockPageHandle(source, BufferPage{(vuint64_t)12345}).IsValid() == false);
+	TEST_ASSERT(bm.LockPageHandle(BufferSource::Invalid(), page).IsValid() == false);
+
+	{
+		auto handle = bm.LockPageHandle(source, page);
+		TEST_ASSERT(handle.IsValid());
+		TEST_ASSERT(handle.GetPage().index == page.index);
+		TEST_ASSERT(handle.GetLatch() == PageLatch::Exclusive);
+		TEST_ASSERT(bm.LockPage(source, page) == nullptr);
+		TEST_ASSERT(handle.GetView<vint>(bm.GetPageSize()) == nullptr);
+		TEST_ASSERT(handle.GetView<vint>(bm.GetPageSize() - sizeof(vint)) != nullptr);
+
+		vuint64_t count = 0;
+		auto numbers = handle.GetArray<vint>(count);
+		TEST_ASSERT(numbers == handle.GetAddress());
+		TEST_ASSERT(count == bm.GetPageSize() / sizeof(vint));
+		*handle.GetView<vint>() = 42;
+		TEST_ASSERT(handle.SetPersistanceType(PersistanceType::Changed));
+
+		// moving a handle keeps the page locked
+		PageHandle moved(MoveValue(handle));
+		TEST_ASSERT(handle.IsValid() == false);
+		TEST_ASSERT(handle.Release() == false);
+		TEST_ASSERT(moved.IsValid());
+		TEST_ASSERT(moved.GetPersistanceType() == PersistanceType::Changed);
+		TEST_ASSERT(bm.LockPage(source, page) == nullptr);
+	}
+
+	{
+		auto shared1 = bm.LockPageHandle(source, page, PageLatch::Shared);
+		auto shared2 = bm.LockPageHandle(source, page, PageLatch::Shared);
+		TEST_ASSERT(shared1.IsValid());
+		TEST_ASSERT(shared2.IsValid());
+		TEST_ASSERT(*shared1.GetView<vint>() == 42);
+		TEST_ASSERT(shared1.SetPersistanceType(PersistanceType::Changed) == false);
+		TEST_ASSERT(bm.LockPageHandle(source, page).IsValid() == false);
+
+		shared2 = MoveValue(shared1);
+		TEST_ASSERT(shared1.IsValid() == false);
+		TEST_ASSERT(shared2.Release() == true);
+		TEST_ASSERT(shared2.Release() == false);
+	}
+
+	{
+		auto handle = bm.LockPageHandle(source, page);
+		TEST_ASSERT(handle.IsValid());
+		*handle.GetView<vint>() = 100;
+		TEST_ASSERT(handle.SetPersistanceType(PersistanceType::ChangedAndPersist));
+		TEST_ASSERT(handle.Release() == true);
+	}
+
+	auto address = (vint*)bm.LockPage(source, page);
+	TEST_ASSERT(address != nullptr);
+	TEST_ASSERT(*address == 100);
+	TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::NoChanging));
+	TEST_ASSERT(bm.FreePage(source, page));
+}
+
+TEST_CASE_SOURCE(SharedExclusiveLatch)
+{
+	auto page = bm.AllocatePage(source);
+	TEST_ASSERT(page.IsValid());
+
+	auto addr1 = bm.LockPageShared(source, page);
+	TEST_ASSERT(addr1 != nullptr);
+	auto addr2 = bm.LockPageShared(source, page);
+	TEST_ASSERT(addr2 == addr1);
+	TEST_ASSERT(bm.LockPageExclusive(source, page) == nullptr);
+	TEST_ASSERT(bm.LockPage(source, page) == nullptr);
+	TEST_ASSERT(bm.FreePage(source, page) == false);
+
+	TEST_ASSERT(bm.UnlockPage(source, page, addr1, PersistanceType::Changed) == false);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr1, PersistanceType::ChangedAndPersist) == false);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr1, PersistanceType::NoChanging) == true);
+	TEST_ASSERT(bm.LockPageExclusive(source, page) == nullptr);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr2, PersistanceType::NoChanging) == true);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr2, PersistanceType::NoChanging) == false);
+
+	auto addr3 = bm.LockPageExclusive(source, page);
+	TEST_ASSERT(addr3 == addr1);
+	TEST_ASSERT(bm.LockPageShared(source, page) == nullptr);
+	strcpy((char*)addr3, "Shared");
+	TEST_ASSERT(bm.UnlockPage(source, page, addr3, PersistanceType::Changed) == true);
+
+	auto addr4 = bm.LockPageShared(source, page);
+	TEST_ASSERT(addr4 != nullptr);
+	TEST_ASSERT(strcmp((char*)addr4, "Shared") == 0);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr4, PersistanceType::NoChanging) == true);
+	TEST_ASSERT(bm.FreePage(source, page) == true);
+}
+
+TEST_CASE_SOURCE(LockUnlockPages)
+{
+	const vint pageCount = 8;
+	BufferPage pages[pageCount];
+	void* buffers[pageCount];
+	for (vint i = 0; i < pageCount; i++)
+	{
+		pages[i] = bm.AllocatePage(source);
+		TEST_ASSERT(pages[i].IsValid());
+	}
+
+	TEST_ASSERT(bm.LockPages(source, pages, pageCount, buffers, PageLatch::Exclusive) == true);
+	for (vint i = 0; i < pageCount; i++)
+	{
+		TEST_ASSERT(buffers[i] != nullptr);
+		TEST_ASSERT(bm.LockPageShared(source, pages[i]) == nullptr);
+		*(vint*)buffers[i] = i;
+	}
+	TEST_ASSERT(bm.UnlockPages(source, pages, pageCount, buffers, PersistanceType::Changed) == true);
+	TEST_ASSERT(bm.UnlockPages(source, pages, pageCount, buffers, PersistanceType::NoChanging) == false);
+
+	TEST_ASSERT(bm.LockPages(source, pages, pageCount, buffers, PageLatch::Shared) == true);
+	for (vint i = 0; i < pageCount; i++)
+	{
+		TEST_ASSERT(*(vint*)buffers[i] == i);
+	}
+	TEST_ASSERT(bm.UnlockPages(source, pages, pageCount, buffers, PersistanceType::NoChanging) == true);
+
+	auto addr = bm.LockPage(source, pages[pageCount - 1]);
+	TEST_ASSERT(addr != nullptr);
+	TEST_ASSERT(bm.LockPages(source, pages, pageCount, buffers, PageLatch::Shared) == false);
+	for (vint i = 0; i < pageCount - 1; i++)
+	{
+		TEST_ASSERT(buffers[i] == nullptr);
+		auto addr = bm.LockPageExclusive(source, pages[i]);
+		TEST_ASSERT(addr != nullptr);
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], addr, PersistanceType::NoChanging) == true);
+	}
+	TEST_ASSERT(bm.UnlockPage(source, pages[pageCount - 1], addr, PersistanceType::NoChanging) == true);
+
+	TEST_ASSERT(bm.PrefetchPages(source, pages, pageCount) == 0);
+	for (vint i = 0; i < pageCount; i++)
+	{
+		TEST_ASSERT(bm.FreePage(source, pages[i]) == true);
+	}
+}
+
+TEST_CASE_SOURCE(LockPageAsync)
+{
+	// more pages than the cache, so that file sources read evicted pages back
+	const vint pageCount = 32;
+	BufferPage pages[pageCount];
+	for (vint i = 0; i < pageCount; i++)
+	{
+		pages[i] = bm.AllocatePage(source);
+		TEST_ASSERT(pages[i].IsValid());
+		auto address = (vint*)bm.LockPage(source, pages[i]);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::Changed));
+	}
+
+	// two shared requests of the same page are both completed
+	Ptr<BufferCompletion> completions[pageCount * 2];
+	for (vint i = 0; i < pageCount; i++)
+	{
+		completions[i * 2] = bm.LockPageAsync(source, pages[i], PageLatch::Shared);
+		completions[i * 2 + 1] = bm.LockPageAsync(source, pages[i], PageLatch::Shared);
+	}
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto address1 = (vint*)completions[i * 2]->Wait();
+		auto address2 = (vint*)completions[i * 2 + 1]->Wait();
+		TEST_ASSERT(completions[i * 2]->IsCompleted());
+		TEST_ASSERT(address1 != nullptr);
+		TEST_ASSERT(address1 == address2);
+		TEST_ASSERT(*address1 == i);
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address1, PersistanceType::NoChanging));
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address2, PersistanceType::NoChanging));
+	}
+
+	// only one of two exclusive requests of the same page is completed with the page
+	for (vint i = 0; i < pageCount; i++)
+	{
+		completions[i * 2] = bm.LockPageAsync(source, pages[i], PageLatch::Exclusive);
+		completions[i * 2 + 1] = bm.LockPageAsync(source, pages[i], PageLatch::Exclusive);
+	}
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto address1 = (vint*)completions[i * 2]->Wait();
+		auto address2 = (vint*)completions[i * 2 + 1]->Wait();
+		TEST_ASSERT(address1 != nullptr);
+		TEST_ASSERT(address2 == nullptr);
+		TEST_ASSERT(*address1 == i);
+		*address1 = i * 2;
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address1, PersistanceType::Changed));
+	}
+
+	// a page being read is read again when it is locked synchronously
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto completion = bm.LockPageAsync(source, pages[i], PageLatch::Shared);
+		auto address1 = (vint*)bm.LockPageShared(source, pages[i]);
+		auto address2 = (vint*)completion->Wait();
+		TEST_ASSERT(address1 != nullptr);
+		TEST_ASSERT(address1 == address2);
+		TEST_ASSERT(*address1 == i * 2);
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address1, PersistanceType::NoChanging));
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address2, PersistanceType::NoChanging));
+	}
+
+	TEST_ASSERT(bm.LockPageAsync(source, BufferPage{1024}, PageLatch::Shared)->Wait() == nullptr);
+	TEST_ASSERT(bm.LockPageAsync(BufferSource{source.index + 1}, pages[0], PageLatch::Shared)->Wait() == nullptr);
+}
+
+TEST_CASE_SOURCE(PersistanceTicket)
+{
+	bool fileSource = bm.GetSourceFileName(source) != L"";
+	auto page = bm.AllocatePage(source);
+	TEST_ASSERT(page.IsValid());
+
+	BufferTicket ticket1, ticket2;
+	auto addr = bm.LockPage(source, page);
+	TEST_ASSERT(addr != nullptr);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr, PersistanceType::Changed, ticket1) == true);
+	TEST_ASSERT(!ticket1.IsValid());
+
+	addr = bm.LockPage(source, page);
+	TEST_ASSERT(addr != nullptr);
+	strcpy((char*)addr, "Persisted");
+	TEST_ASSERT(bm.UnlockPage(source, page, addr, PersistanceType::ChangedAndPersist, ticket1) == true);
+	TEST_ASSERT(ticket1.IsValid() == fileSource);
+
+	addr = bm.LockPage(source, page);
+	TEST_ASSERT(addr != nullptr);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr, PersistanceType::ChangedAndPersist, ticket2) == true);
+	TEST_ASSERT(ticket2.IsValid() == fileSource);
+	if (fileSource)
+	{
+		TEST_ASSERT(ticket1 < ticket2);
+	}
+
+	TEST_ASSERT(bm.WaitForPersistance(source, ticket2) == true);
+	TEST_ASSERT(bm.WaitForPersistance(source, ticket1) == true);
+	TEST_ASSERT(bm.WaitForPersistance(source, BufferTicket::Invalid()) == true);
+	TEST_ASSERT(bm.WaitForPersistance(source, BufferTicket{1000000}) == false);
+
+	addr = bm.LockPageShared(source, page);
+	TEST_ASSERT(addr != nullptr);
+	TEST_ASSERT(strcmp((char*)addr, "Persisted") == 0);
+	TEST_ASSERT(bm.UnlockPage(source, page, addr, PersistanceType::NoChanging) == true);
+	TEST_ASSERT(bm.FreePage(source, page) == true);
+}
+
+TEST_CASE_SOURCE(AllocatePages)
+{
+	BufferPage pages[8];
+	TEST_ASSERT(bm.AllocatePages(source, 8, true, pages));
+	for (vint i = 0; i < 8; i++)
+	{
+		TEST_ASSERT(pages[i].index == pages[0].index + i);
+		auto address = (vint*)bm.LockPage(source, pages[i]);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::ChangedAndPersist));
+	}
+
+	TEST_ASSERT(bm.FreePages(source, pages + 2, 4));
+	TEST_ASSERT(bm.FreePages(source, pages + 2, 1) == false);
+	TEST_ASSERT(bm.LockPage(source, pages[2]) == nullptr);
+
+	// freed pages are reused
+	BufferPage reused[4];
+	TEST_ASSERT(bm.AllocatePages(source, 4, false, reused));
+	for (vint i = 0; i < 4; i++)
+	{
+		TEST_ASSERT(reused[i].index >= pages[2].index && reused[i].index <= pages[5].index);
+		for (vint j = 0; j < i; j++)
+		{
+			TEST_ASSERT(reused[i] != reused[j]);
+		}
+	}
+	TEST_ASSERT(bm.AllocatePages(source, 0, true, reused));
+
+	auto address = (vint*)bm.LockPage(source, pages[7], PageLatch::Shared);
+	TEST_ASSERT(address && *address == 7);
+	TEST_ASSERT(bm.UnlockPage(source, pages[7], address, PersistanceType::NoChanging));
+	TEST_ASSERT(bm.FreePages(source, pages, 2));
+	TEST_ASSERT(bm.FreePages(source, pages + 6, 2));
+	TEST_ASSERT(bm.FreePages(source, reused, 4));
+}
+
 TEST_CASE_SOURCE(AllocateFreePage)
 {
 	auto indexPage = bm.GetIndexPage(source);
@@ -128,6 +437,35 @@ TEST_CASE_SOURCE(AllocateFreePage)
 	TEST_ASSERT(bm.UnlockPage(source, page3, addr3, PersistanceType::ChangedAndPersist) == true);
 }
 
+TEST_CASE(Utility_Buffer_PageHandleUnload)
+{
+	BufferManager bm(4 KB, 16);
+	auto a = bm.LoadMemorySource();
+	auto b = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+	auto page = bm.AllocatePage(a);
+	auto handle = bm.LockPageHandle(a, page);
+	TEST_ASSERT(handle.IsValid());
+
+	// a handle only pins its own source
+	TEST_ASSERT(bm.UnloadSource(b));
+
+	EventObject unloadedEvent;
+	unloadedEvent.CreateManualUnsignal(false);
+	volatile bool unloaded = false;
+	Thread::CreateAndStart([&]()
+	{
+		TEST_ASSERT(bm.UnloadSource(a));
+		unloaded = true;
+		unloadedEvent.Signal();
+	}, true);
+
+	Thread::Sleep(10);
+	TEST_ASSERT(unloaded == false);
+	TEST_ASSERT(handle.Release());
+	unloadedEvent.Wait();
+	TEST_ASSERT(unloaded == true);
+}
+
 #define TEST_ASSERT_CACHE														\
 	console::Console::Write(L"    <CACHED-PAGE-COUNT>: ");						\
 	console::Console::WriteLine(itow(bm.GetCurrentlyCachedPageCount()));		\
@@ -179,93 +517,1745 @@ TEST_CASE(Utility_Buffer_AllocateAndSwap)
 	}
 }
 
-TEST_CASE(Utility_Buffer_FileUseMasks)
+TEST_CASE(Utility_Buffer_PooledFileWriteBack)
 {
-	vuint64_t pageSize = 4 KB;
-	auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
-	volatile vuint64_t totalUsedPages = 0;
+	const vint pageCount = 64;
+	Array<BufferPage> pages(pageCount);
+	{
+		BufferManager bm(4 KB, 16);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+			TEST_ASSERT(pages[i].IsValid());
+			auto address = (vint*)bm.LockPage(source, pages[i]);
+			TEST_ASSERT(address != nullptr);
+			*address = i;
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, i % 2 == 0 ? PersistanceType::Changed : PersistanceType::ChangedAndPersist));
+			TEST_ASSERT_CACHE;
+		}
+		TEST_ASSERT(bm.GetEvictedPageCount() > 0);
 
-	FileMapping fileMapping(pageSize, fd, &totalUsedPages);
-	FileUseMasks fileUseMasks(pageSize, fd);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			auto address = (vint*)bm.LockPageShared(source, pages[i]);
+			TEST_ASSERT(address != nullptr);
+			TEST_ASSERT(*address == i);
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		}
+		TEST_ASSERT(bm.UnloadSource(source));
+	}
+	{
+		BufferManager bm(4 KB, 16);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			auto address = (vint*)bm.LockPageShared(source, pages[i]);
+			TEST_ASSERT(address != nullptr);
+			TEST_ASSERT(*address == i);
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		}
+	}
+}
 
-	fileMapping.InitializeEmptySource();
-	fileUseMasks.InitializeEmptySource(&fileMapping);
+TEST_CASE(Utility_Buffer_PoolOptions)
+{
+	BufferHugePages hugePagesOptions[] = {BufferHugePages::None, BufferHugePages::Transparent, BufferHugePages::Explicit};
+	for (auto hugePages : hugePagesOptions)
+	{
+		for (vint nodeLocal = 0; nodeLocal < 2; nodeLocal++)
+		{
+			{
+				FramePool pool(4 KB, 100, hugePages, nodeLocal == 1);
+				TEST_ASSERT(pool.GetNodeCount() == (nodeLocal == 1 ? GetNumaNodeCount() : 1));
+				TEST_ASSERT(pool.GetTotalFrameCount() >= 100);
+				if (hugePages != BufferHugePages::None)
+				{
+					TEST_ASSERT(pool.GetTotalFrameCount() % 512 == 0);
+				}
 
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == false);
+				// allocate beyond the reserved frames to grow the pool
+				const vint frameCount = 1000;
+				Array<void*> frames(frameCount);
+				for (vint i = 0; i < frameCount; i++)
+				{
+					frames[i] = pool.AllocateFrame();
+					TEST_ASSERT(frames[i] != nullptr);
+					TEST_ASSERT((vuint64_t)frames[i] % (4 KB) == 0);
+					*(vint*)frames[i] = i;
+				}
+				TEST_ASSERT(pool.GetUsedFrameCount() == frameCount);
+				TEST_ASSERT(pool.GetTotalFrameCount() >= frameCount);
 
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1024}, true);
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32768}, true);
+				vuint64_t nodeUsedFrameCount = 0;
+				for (vint i = 0; i < pool.GetNodeCount(); i++)
+				{
+					nodeUsedFrameCount += pool.GetNodeUsedFrameCount(i);
+				}
+				TEST_ASSERT(nodeUsedFrameCount == frameCount);
 
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == true);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32767}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32768}) == true);
+				for (vint i = 0; i < frameCount; i++)
+				{
+					TEST_ASSERT(*(vint*)frames[i] == i);
+					pool.FreeFrame(frames[i]);
+				}
+				TEST_ASSERT(pool.GetUsedFrameCount() == 0);
+			}
+			{
+				BufferPoolOptions options;
+				options.hugePages = hugePages;
+				options.nodeLocal = nodeLocal == 1;
+				BufferManager bm(4 KB, 16, BufferReplacement::Clock, options);
+				auto source = bm.LoadMemorySource();
+				const vint pageCount = 32;
+				Array<BufferPage> pages(pageCount);
+				for (vint i = 0; i < pageCount; i++)
+				{
+					pages[i] = bm.AllocatePage(source);
+					TEST_ASSERT(pages[i].IsValid());
+					auto address = (vint*)bm.LockPage(source, pages[i]);
+					TEST_ASSERT(address != nullptr);
+					*address = i;
+					TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::Changed));
+				}
+				for (vint i = 0; i < pageCount; i++)
+				{
+					auto address = (vint*)bm.LockPageShared(source, pages[i]);
+					TEST_ASSERT(address != nullptr);
+					TEST_ASSERT(*address == i);
+					TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+				}
+				TEST_ASSERT(bm.UnloadSource(source));
+			}
+		}
+	}
+}
 
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1023}, true);
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1024}, false);
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32767}, true);
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32768}, false);
+TEST_CASE(Utility_Buffer_AsyncFileReaders)
+{
+	class CountedRead : public AsyncReadRequest
+	{
+	public:
+		volatile vint*			completed = nullptr;
 
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == true);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32767}) == true);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32768}) == false);
+		void OnCompleted()override
+		{
+			INCRC(completed);
+		}
+	};
 
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1023}, false);
-	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32767}, false);
+	const vint pageCount = 64;
+	auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+	TEST_ASSERT(fd != -1);
+	for (vint i = 0; i < pageCount; i++)
+	{
+		vint page[4 KB / sizeof(vint)];
+		for (vint j = 0; j < sizeof(page) / sizeof(*page); j++)
+		{
+			page[j] = i;
+		}
+		TEST_ASSERT(pwrite(fd, page, sizeof(page), i * 4 KB) == sizeof(page));
+	}
 
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32767}) == false);
-	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32768}) == false);
+	FramePool pool(4 KB, pageCount);
+	for (vint c = 0; c < 2; c++)
+	{
+		Ptr<AsyncFileReader> reader = c == 0 ? CreateUringFileReader(16) : CreateThreadPoolFileReader(4);
+		if (!reader)
+		{
+			// io_uring could be disabled in the system
+			continue;
+		}
+		TEST_ASSERT(reader->IsKernelQueue() == (c == 0));
 
-	fileMapping.UnmapAllPages();
+		volatile vint completed = 0;
+		CountedRead reads[pageCount + 1];
+		for (vint i = 0; i <= pageCount; i++)
+		{
+			reads[i].completed = &completed;
+			reads[i].fileDescriptor = fd;
+			reads[i].buffer = pool.AllocateFrame();
+			reads[i].size = 4 KB;
+			reads[i].offset = i * 4 KB;
+			TEST_ASSERT(reader->Submit(&reads[i]));
+		}
+
+		// a read crossing the end of the file stops there
+		Array<vint> tail(3 * 4 KB / sizeof(vint));
+		CountedRead tailRead;
+		tailRead.completed = &completed;
+		tailRead.fileDescriptor = fd;
+		tailRead.buffer = &tail[0];
+		tailRead.size = 3 * 4 KB;
+		tailRead.offset = (pageCount - 2) * 4 KB;
+		TEST_ASSERT(reader->Submit(&tailRead));
+		while (completed < pageCount + 2)
+		{
+			Thread::Sleep(1);
+		}
+		TEST_ASSERT(tailRead.result == 2 * 4 KB);
+		TEST_ASSERT(tail[0] == pageCount - 2 && tail[2 * 4 KB / sizeof(vint) - 1] == pageCount - 1);
+
+		for (vint i = 0; i < pageCount; i++)
+		{
+			TEST_ASSERT(reads[i].result == 4 KB);
+			TEST_ASSERT(((vint*)reads[i].buffer)[0] == i);
+			TEST_ASSERT(((vint*)reads[i].buffer)[4 KB / sizeof(vint) - 1] == i);
+		}
+		TEST_ASSERT(reads[pageCount].result == 0);
+
+		for (vint i = 0; i <= pageCount; i++)
+		{
+			pool.FreeFrame(reads[i].buffer);
+		}
+	}
 	CloseFileForFileSource(fd);
-	TEST_ASSERT(totalUsedPages == 0);
 }
 
-TEST_CASE(Utility_Buffer_FileFreePages)
+TEST_CASE(Utility_Buffer_PageCompression)
 {
-	vuint64_t pageSize = 4 KB;
-	auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
-	volatile vuint64_t totalUsedPages = 0;
+	const vuint64_t pageSize = 4 KB;
+	Array<vuint8_t> page(pageSize), compressed(pageSize), decompressed(pageSize);
+	for (vint pattern = 0; pattern < 4; pattern++)
+	{
+		vuint64_t seed = 1;
+		for (vint i = 0; i < (vint)pageSize; i++)
+		{
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			switch (pattern)
+			{
+			case 0: page[i] = 0; break;
+			case 1: page[i] = (vuint8_t)(i % 64 == 0 ? seed >> 56 : i % 13); break;
+			case 2: page[i] = (vuint8_t)(i < 3072 ? i % 251 : seed >> 56); break;
+			case 3: page[i] = (vuint8_t)(seed >> 56); break;
+			}
+		}
 
-	FileMapping fileMapping(pageSize, fd, &totalUsedPages);
-	FileUseMasks fileUseMasks(pageSize, fd);
-	FileFreePages fileFreePages(pageSize);
+		auto size = CompressPage(&page[0], pageSize, &compressed[0], pageSize);
+		if (pattern == 3)
+		{
+			// random data does not compress
+			TEST_ASSERT(size == 0);
+			continue;
+		}
+		TEST_ASSERT(size > 0 && size < pageSize / 2);
+		TEST_ASSERT(CompressPage(&page[0], pageSize, &compressed[0], size - 1) == 0);
 
-	fileMapping.InitializeEmptySource();
-	fileUseMasks.InitializeEmptySource(&fileMapping);
-	fileFreePages.InitializeEmptySource(&fileMapping, &fileUseMasks);
+		// padding after the compressed data is ignored
+		memset(&compressed[0] + size, 0xFF, pageSize - size);
+		TEST_ASSERT(DecompressPage(&compressed[0], pageSize, &decompressed[0], pageSize));
+		TEST_ASSERT(memcmp(&page[0], &decompressed[0], pageSize) == 0);
+
+		TEST_ASSERT(!DecompressPage(&compressed[0], size / 2, &decompressed[0], pageSize));
+		compressed[0] = 0x0F;
+		TEST_ASSERT(!DecompressPage(&compressed[0], size, &decompressed[0], pageSize));
+	}
 
-	vint pushCount = 1024;
-	for (vint i = 0; i < pushCount; i++)
+	for (vint c = 0; c < 2; c++)
 	{
-		BufferPage page{(vuint64_t)(1024 + i)};
-		console::Console::WriteLine(L"Pushing free page: " + itow(page.index));
-		fileFreePages.PushFreePage(page);
+		BufferManager bm(pageSize, 16);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, c == 0 ? FileSourceMode::PooledFrames : FileSourceMode::CompressedFrames);
+		TEST_ASSERT(source.IsValid());
+		List<BufferPage> pages;
+		for (vint i = 0; i < 64; i++)
+		{
+			auto page = bm.AllocatePage(source);
+			TEST_ASSERT(page.IsValid());
+			pages.Add(page);
+			auto address = (vuint64_t*)bm.LockPage(source, page);
+			TEST_ASSERT(address != nullptr);
+			for (vint j = 0; j < (vint)(pageSize / sizeof(vuint64_t)); j++)
+			{
+				address[j] = i % 2 == 0 ? i : (i + j) * 0x9E3779B97F4A7C15ULL;
+			}
+			TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+		}
+
+		// pages keep their extents or reuse extents freed by the previous sync
+		BufferTicket ticket;
+		for (vint k = 0; k < 3; k++)
+		{
+			for (vint i = 0; i < pages.Count(); i++)
+			{
+				auto address = (vuint64_t*)bm.LockPage(source, pages[i]);
+				TEST_ASSERT(address != nullptr);
+				address[0] = k;
+				TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::ChangedAndPersist, ticket));
+			}
+			TEST_ASSERT(bm.WaitForPersistance(source, ticket));
+		}
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		struct stat fileState;
+		TEST_ASSERT(stat(wtoa(TEMP_DIR L"db.bin").Buffer(), &fileState) == 0);
+		if (c == 0)
+		{
+			TEST_ASSERT((vuint64_t)fileState.st_size == (pages[pages.Count() - 1].index + 1) * pageSize);
+		}
+		else
+		{
+			// even pages compress well, odd pages are stored as they are
+			TEST_ASSERT((vuint64_t)fileState.st_size < (pages.Count() / 2 + 16) * pageSize);
+		}
+
+		source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, c == 0 ? FileSourceMode::PooledFrames : FileSourceMode::CompressedFrames);
+		TEST_ASSERT(source.IsValid());
+		for (vint i = 0; i < pages.Count(); i++)
+		{
+			auto address = (vuint64_t*)bm.LockPage(source, pages[i]);
+			TEST_ASSERT(address != nullptr);
+			TEST_ASSERT(address[0] == 2);
+			for (vint j = 1; j < (vint)(pageSize / sizeof(vuint64_t)); j++)
+			{
+				TEST_ASSERT(address[j] == (i % 2 == 0 ? i : (i + j) * 0x9E3779B97F4A7C15ULL));
+			}
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		}
+		TEST_ASSERT(bm.UnloadSource(source));
 	}
-	for (vint i = pushCount - 1; i >= 0; i--)
+
 	{
-		auto page = fileFreePages.PopFreePage();
-		console::Console::WriteLine(L"Popping free page: " + itow(page.index) + L", expecting " + itow(1024 + i));
-		TEST_ASSERT(page.index == 1024 + i);
+		// a map file with overlapping extents or fewer entries than its header is rejected
+		auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+		auto mapFd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin.pagemap");
+		vuint64_t entries[2];
+		TEST_ASSERT(pread(mapFd, entries, sizeof(entries), CompressedPageStore::MapBlockSize + 3 * sizeof(vuint64_t)) == sizeof(entries));
+		TEST_ASSERT(entries[0] != 0 && entries[1] != 0);
+		TEST_ASSERT(pwrite(mapFd, &entries[0], sizeof(vuint64_t), CompressedPageStore::MapBlockSize + 4 * sizeof(vuint64_t)) == sizeof(vuint64_t));
+		{
+			CompressedPageStore store(pageSize, fd);
+			TEST_ASSERT(!store.InitializeExistingSource(TEMP_DIR L"db.bin.pagemap"));
+		}
+		TEST_ASSERT(pwrite(mapFd, &entries[1], sizeof(vuint64_t), CompressedPageStore::MapBlockSize + 4 * sizeof(vuint64_t)) == sizeof(vuint64_t));
+		{
+			CompressedPageStore store(pageSize, fd);
+			TEST_ASSERT(store.InitializeExistingSource(TEMP_DIR L"db.bin.pagemap"));
+		}
+		TEST_ASSERT(ftruncate(mapFd, CompressedPageStore::MapBlockSize + 8 * sizeof(vuint64_t)) == 0);
+		{
+			CompressedPageStore store(pageSize, fd);
+			TEST_ASSERT(!store.InitializeExistingSource(TEMP_DIR L"db.bin.pagemap"));
+		}
+		CloseFileForFileSource(mapFd);
+		CloseFileForFileSource(fd);
 	}
-	for (vint i = 0; i < pushCount; i++)
+
+	// a compressed source cannot be opened without its map file
+	BufferManager bm(pageSize, 16);
+	unlink(wtoa(TEMP_DIR L"db.bin.pagemap").Buffer());
+	TEST_ASSERT(!bm.LoadFileSource(TEMP_DIR L"db.bin", false, FileSourceMode::CompressedFrames).IsValid());
+}
+
+TEST_CASE(Utility_Buffer_PageChecksums)
+{
+	const char* digits = "123456789";
+	TEST_ASSERT(ComputeCrc32c(digits, 9) == 0xE3069283);
+	TEST_ASSERT(ComputeCrc32cPortable(digits, 9) == 0xE3069283);
+	TEST_ASSERT(ComputeCrc32c(digits, 0) == 0);
+
+	Array<vuint8_t> buffer(8 KB);
+	for (vint i = 0; i < buffer.Count(); i++)
 	{
-		BufferPage page{(vuint64_t)(1024 + i)};
-		console::Console::WriteLine(L"Pushing free page: " + itow(page.index));
-		fileFreePages.PushFreePage(page);
+		buffer[i] = (vuint8_t)(i * 7 + (i >> 5));
 	}
-	for (vint i = pushCount - 1; i >= 0; i--)
+	vint sizes[] = {1, 7, 8, 255, 768, 769, 2000, 4088, 8000};
+	for (vint i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
 	{
-		auto page = fileFreePages.PopFreePage();
-		console::Console::WriteLine(L"Popping free page: " + itow(page.index) + L", expecting " + itow(1024 + i));
-		TEST_ASSERT(page.index == 1024 + i);
+		for (vint offset = 0; offset < 3; offset++)
+		{
+			TEST_ASSERT(ComputeCrc32c(&buffer[offset], sizes[i]) == ComputeCrc32cPortable(&buffer[offset], sizes[i]));
+		}
 	}
 
-	fileMapping.UnmapAllPages();
-	CloseFileForFileSource(fd);
-	TEST_ASSERT(totalUsedPages == 0);
+	auto layout = PageLayout<2, 1>::Create(4 KB - PageChecksumSize);
+	TEST_ASSERT(layout.IsSpecialized());
+	TEST_ASSERT(layout.GetEntryCount() == 4 KB / sizeof(vuint64_t) - 3);
+
+	// a page never written passes, a sealed page fails after any byte is changed
+	memset(&buffer[0], 0, 4 KB);
+	TEST_ASSERT(VerifyPage(&buffer[0], 4 KB));
+	buffer[100] = 1;
+	TEST_ASSERT(!VerifyPage(&buffer[0], 4 KB));
+	SealPage(&buffer[0], 4 KB);
+	TEST_ASSERT(VerifyPage(&buffer[0], 4 KB));
+	buffer[4 KB - 1] ^= 1;
+	TEST_ASSERT(!VerifyPage(&buffer[0], 4 KB));
+
+	BufferPoolOptions options;
+	options.pageChecksums = true;
+	for (vint m = 0; m < 2; m++)
+	{
+		auto mode = m == 0 ? FileSourceMode::PooledFrames : FileSourceMode::AsyncFrames;
+		BufferManager bm(4 KB, 16, BufferReplacement::Clock, options);
+		TEST_ASSERT(bm.GetPageSize() == 4 KB);
+		TEST_ASSERT(bm.GetPageDataSize() == 4 KB - PageChecksumSize);
+
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, mode);
+		List<BufferPage> pages;
+		for (vint i = 0; i < 32; i++)
+		{
+			auto page = bm.AllocatePage(source);
+			TEST_ASSERT(page.IsValid());
+			pages.Add(page);
+			auto handle = bm.LockPageHandle(source, page);
+			vuint64_t count = 0;
+			auto items = handle.GetArray<vuint64_t>(count);
+			TEST_ASSERT(count == (4 KB - PageChecksumSize) / sizeof(vuint64_t));
+			for (vuint64_t j = 0; j < count; j++)
+			{
+				items[j] = i * count + j;
+			}
+			TEST_ASSERT(handle.SetPersistanceType(PersistanceType::Changed));
+		}
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		// flip one bit of a page in the file
+		auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+		vuint8_t byte = 0;
+		TEST_ASSERT(pread(fd, &byte, 1, pages[5].index * 4 KB + 123) == 1);
+		byte ^= 0x10;
+		TEST_ASSERT(pwrite(fd, &byte, 1, pages[5].index * 4 KB + 123) == 1);
+		CloseFileForFileSource(fd);
+
+		source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, mode);
+		for (vint i = 0; i < pages.Count(); i++)
+		{
+			void* address = nullptr;
+			if (m == 0)
+			{
+				address = bm.LockPage(source, pages[i], PageLatch::Shared);
+			}
+			else
+			{
+				address = bm.LockPageAsync(source, pages[i], PageLatch::Shared)->Wait();
+			}
+
+			if (i == 5)
+			{
+				TEST_ASSERT(address == nullptr);
+				continue;
+			}
+			TEST_ASSERT(address != nullptr);
+			TEST_ASSERT(((vuint64_t*)address)[7] == i * ((4 KB - PageChecksumSize) / sizeof(vuint64_t)) + 7);
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		}
+
+		BufferMetrics metrics;
+		TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+		TEST_ASSERT(metrics.Get(BufferCounter::ChecksumFailures) == 1);
+	}
+}
+
+TEST_CASE(Utility_Buffer_PageChecksumsWhilePersisting)
+{
+	BufferPoolOptions options;
+	options.pageChecksums = true;
+	BufferManager bm(4 KB, 64, BufferReplacement::Clock, options);
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+	List<BufferPage> pages;
+	for (vint i = 0; i < 32; i++)
+	{
+		pages.Add(bm.AllocatePage(source));
+	}
+	auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+	Array<vuint8_t> buffer(4 KB);
+
+	// a page changed under the exclusive latch while it is being persisted is still written with a matching checksum
+	for (vint i = 0; i < 20; i++)
+	{
+		BufferTicket ticket;
+		for (vint j = 0; j < pages.Count(); j++)
+		{
+			auto address = (vuint64_t*)bm.LockPage(source, pages[j]);
+			address[0] = i;
+			TEST_ASSERT(bm.UnlockPage(source, pages[j], address, PersistanceType::ChangedAndPersist, ticket));
+		}
+
+		auto address = (volatile vuint64_t*)bm.LockPage(source, pages[0]);
+		EventObject persistedEvent;
+		persistedEvent.CreateManualUnsignal(false);
+		volatile bool persisted = false;
+		Thread::CreateAndStart([&]()
+		{
+			TEST_ASSERT(bm.WaitForPersistance(source, ticket));
+			persisted = true;
+			persistedEvent.Signal();
+		}, true);
+
+		vuint64_t count = (4 KB - PageChecksumSize) / sizeof(vuint64_t);
+		for (vuint64_t k = 0; !persisted; k++)
+		{
+			address[k % count] = k;
+		}
+		persistedEvent.Wait();
+		TEST_ASSERT(bm.UnlockPage(source, pages[0], (void*)address, PersistanceType::Changed));
+
+		TEST_ASSERT(pread(fd, &buffer[0], 4 KB, pages[0].index * 4 KB) == 4 KB);
+		TEST_ASSERT(VerifyPage(&buffer[0], 4 KB));
+	}
+
+	CloseFileForFileSource(fd);
+	TEST_ASSERT(bm.UnloadSource(source));
+}
+
+TEST_CASE(Utility_Buffer_MemorySpill)
+{
+	const vint pageCount = 256;
+	BufferPoolOptions options;
+	options.spillDirectory = GetTempFolder();
+	BufferManager bm(4 KB, 64, BufferReplacement::Clock, options);
+	auto source = bm.LoadMemorySource();
+
+	// a memory source larger than the cache spills cold pages
+	List<BufferPage> pages;
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto page = bm.AllocatePage(source);
+		TEST_ASSERT(page.IsValid());
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		address[0] = i;
+		address[4 KB / sizeof(vint) - 1] = -i;
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+	TEST_ASSERT(bm.GetCurrentlyCachedPageCount() <= 64);
+	TEST_ASSERT(bm.GetSourceCachedPageCount(source) < pageCount);
+
+	BufferMetrics metrics;
+	TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+	auto writeBacks = metrics.Get(BufferCounter::PageWriteBacks);
+	auto dirtyPageCount = bm.GetSourceCachedPageCount(source);
+	TEST_ASSERT(writeBacks > 0);
+
+	// spilled pages are read back when they are locked, clean pages are not written again when they are evicted
+	for (vint r = 0; r < 2; r++)
+	{
+		for (vint i = 0; i < pageCount; i++)
+		{
+			auto address = (vint*)bm.LockPage(source, pages[i], PageLatch::Shared);
+			TEST_ASSERT(address != nullptr);
+			TEST_ASSERT(address[0] == i);
+			TEST_ASSERT(address[4 KB / sizeof(vint) - 1] == -i);
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		}
+	}
+	TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+	TEST_ASSERT(metrics.Get(BufferCounter::PageWriteBacks) <= writeBacks + dirtyPageCount);
+	TEST_ASSERT(metrics.Get(BufferCounter::PageMisses) > (vuint64_t)pageCount * 2);
+
+	// a freed page is not read from the spill file again, and its index is reused
+	TEST_ASSERT(bm.FreePage(source, pages[0]) == true);
+	TEST_ASSERT(bm.FreePage(source, pages[0]) == false);
+	TEST_ASSERT(bm.LockPage(source, pages[0]) == nullptr);
+	TEST_ASSERT(bm.AllocatePage(source).index == pages[0].index);
+
+	// dirty pages of memory sources are not written back by checkpoints
+	BufferCheckpoint checkpoint;
+	bm.Checkpoint(checkpoint);
+	TEST_ASSERT(checkpoint.writtenPageCount == 0);
+	TEST_ASSERT(bm.UnloadSource(source));
+
+	// pages stay in memory when the spill file cannot be created
+	options.spillDirectory = GetTempFolder() + L"MissingFolder";
+	BufferManager bm2(4 KB, 16, BufferReplacement::Clock, options);
+	source = bm2.LoadMemorySource();
+	pages.Clear();
+	for (vint i = 0; i < 64; i++)
+	{
+		auto page = bm2.AllocatePage(source);
+		TEST_ASSERT(page.IsValid());
+		pages.Add(page);
+		auto address = (vint*)bm2.LockPage(source, page);
+		address[0] = i;
+		TEST_ASSERT(bm2.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+	TEST_ASSERT(bm2.GetSourceCachedPageCount(source) == 65);
+	for (vint i = 0; i < pages.Count(); i++)
+	{
+		auto address = (vint*)bm2.LockPage(source, pages[i], PageLatch::Shared);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(address[0] == i);
+		TEST_ASSERT(bm2.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+	}
+}
+
+TEST_CASE(Utility_Buffer_MemorySnapshot)
+{
+	const vint pageCount = 200;
+	BufferPoolOptions options;
+	options.spillDirectory = GetTempFolder();
+	BufferManager bm(4 KB, 64, BufferReplacement::Clock, options);
+	auto source = bm.LoadMemorySource();
+
+	// some pages are spilled and some pages are freed before dumping
+	List<BufferPage> pages;
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto page = bm.AllocatePage(source);
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(source, page);
+		address[0] = i;
+		address[4 KB / sizeof(vint) - 1] = -i;
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+	for (vint i = 0; i < pageCount; i += 7)
+	{
+		TEST_ASSERT(bm.FreePage(source, pages[i]));
+	}
+
+	auto address = bm.LockPage(source, pages[1], PageLatch::Exclusive);
+	TEST_ASSERT(bm.DumpMemorySource(source, TEMP_DIR L"memory.snapshot") == false);
+	TEST_ASSERT(bm.UnlockPage(source, pages[1], address, PersistanceType::NoChanging));
+	TEST_ASSERT(bm.DumpMemorySource(source, TEMP_DIR L"memory.snapshot") == true);
+
+	// pages latched for dumping are released
+	address = bm.LockPage(source, pages[1], PageLatch::Exclusive);
+	TEST_ASSERT(address != nullptr);
+	TEST_ASSERT(bm.UnlockPage(source, pages[1], address, PersistanceType::NoChanging));
+
+	BufferManager bm2(4 KB, 64, BufferReplacement::Clock, options);
+	auto restored = bm2.RestoreMemorySource(TEMP_DIR L"memory.snapshot");
+	TEST_ASSERT(restored.IsValid());
+	TEST_ASSERT(bm2.GetIndexPage(restored).index == bm.GetIndexPage(source).index);
+	TEST_ASSERT(bm2.GetSourceCachedPageCount(restored) == 0);
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto address = (vint*)bm2.LockPage(restored, pages[i], PageLatch::Shared);
+		if (i % 7 == 0)
+		{
+			TEST_ASSERT(address == nullptr);
+			continue;
+		}
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(address[0] == i);
+		TEST_ASSERT(address[4 KB / sizeof(vint) - 1] == -i);
+		TEST_ASSERT(bm2.UnlockPage(restored, pages[i], address, PersistanceType::NoChanging));
+	}
+
+	// freed pages are reused in the same order
+	for (vint i = 0; i < 3; i++)
+	{
+		TEST_ASSERT(bm2.AllocatePage(restored).index == bm.AllocatePage(source).index);
+	}
+	TEST_ASSERT(bm.UnloadSource(source));
+
+	// a restored source could be dumped over the snapshot it is still reading
+	address = bm2.LockPage(restored, pages[1]);
+	((vint*)address)[0] = 100;
+	TEST_ASSERT(bm2.UnlockPage(restored, pages[1], address, PersistanceType::Changed));
+	TEST_ASSERT(bm2.DumpMemorySource(restored, TEMP_DIR L"memory.snapshot") == true);
+	address = bm2.LockPage(restored, pages[2], PageLatch::Shared);
+	TEST_ASSERT(((vint*)address)[0] == 2);
+	TEST_ASSERT(bm2.UnlockPage(restored, pages[2], address, PersistanceType::NoChanging));
+
+	BufferManager bm3(4 KB, 64, BufferReplacement::Clock, options);
+	auto restoredAgain = bm3.RestoreMemorySource(TEMP_DIR L"memory.snapshot");
+	TEST_ASSERT(restoredAgain.IsValid());
+	for (vint i = 1; i < pageCount; i++)
+	{
+		if (i % 7 == 0) continue;
+		auto address = (vint*)bm3.LockPage(restoredAgain, pages[i], PageLatch::Shared);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(address[0] == (i == 1 ? 100 : i));
+		TEST_ASSERT(bm3.UnlockPage(restoredAgain, pages[i], address, PersistanceType::NoChanging));
+	}
+
+	TEST_ASSERT(bm3.RestoreMemorySource(TEMP_DIR L"missing.snapshot").IsValid() == false);
+	BufferManager bm4(8 KB, 64);
+	TEST_ASSERT(bm4.RestoreMemorySource(TEMP_DIR L"memory.snapshot").IsValid() == false);
+	auto fileSource = bm4.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+	TEST_ASSERT(bm4.DumpMemorySource(fileSource, TEMP_DIR L"memory.snapshot") == false);
+}
+
+TEST_CASE(Utility_Buffer_FreeExtents)
+{
+	FileSourceMode modes[] = {FileSourceMode::MemoryMapped, FileSourceMode::PooledFrames, FileSourceMode::CompressedFrames};
+	for (vint m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+	{
+		BufferManager bm(4 KB, 1024);
+		BufferPage pages[100];
+		BufferPage allocated[15];
+		{
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, modes[m]);
+			TEST_ASSERT(bm.AllocatePages(source, 100, true, pages));
+			for (vint i = 0; i < 100; i++)
+			{
+				TEST_ASSERT(pages[i].index == 3 + i);
+				auto address = (vint*)bm.LockPage(source, pages[i]);
+				TEST_ASSERT(address != nullptr);
+				*address = i;
+				TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::Changed));
+			}
+
+			// free pages: [13, 23) [53, 63) [98, 103)
+			TEST_ASSERT(bm.FreePages(source, pages + 10, 10));
+			TEST_ASSERT(bm.FreePages(source, pages + 50, 10));
+			TEST_ASSERT(bm.FreePages(source, pages + 95, 5));
+			TEST_ASSERT(bm.FreePages(source, pages + 95, 1) == false);
+
+			// pages at the end of the file continue with appended pages
+			TEST_ASSERT(bm.AllocatePages(source, 15, true, allocated));
+			TEST_ASSERT(allocated[0].index == 98 && allocated[14].index == 112);
+			TEST_ASSERT(bm.AllocatePages(source, 10, true, allocated));
+			TEST_ASSERT(allocated[0].index == 13 && allocated[9].index == 22);
+			TEST_ASSERT(bm.UnloadSource(source));
+		}
+		{
+			// free extents are rebuilt from use masks
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, modes[m]);
+			TEST_ASSERT(bm.AllocatePages(source, 12, false, allocated));
+			for (vint i = 0; i < 10; i++)
+			{
+				TEST_ASSERT(allocated[i].index == 53 + i);
+			}
+			TEST_ASSERT(allocated[10].index == 113 && allocated[11].index == 114);
+			TEST_ASSERT(bm.AllocatePage(source).index == 115);
+
+			auto address = (vint*)bm.LockPage(source, pages[99 - 5], PageLatch::Shared);
+			TEST_ASSERT(address && *address == 94);
+			TEST_ASSERT(bm.UnlockPage(source, pages[94], address, PersistanceType::NoChanging));
+			TEST_ASSERT(bm.UnloadSource(source));
+		}
+		{
+			// free pages at the end of the file are appended again after the file is opened
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, modes[m]);
+			TEST_ASSERT(bm.FreePages(source, allocated + 10, 2));
+			TEST_ASSERT(bm.FreePage(source, BufferPage{(vuint64_t)115}));
+			TEST_ASSERT(bm.UnloadSource(source));
+
+			source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, modes[m]);
+			TEST_ASSERT(bm.AllocatePage(source).index == 113);
+			TEST_ASSERT(bm.UnloadSource(source));
+		}
+	}
+
+	{
+		// pages chained after INDEX_PAGE_FREEITEM by older files are freed
+		BufferManager bm(4 KB, 1024);
+		BufferPage pages[10];
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		TEST_ASSERT(bm.AllocatePages(source, 10, true, pages));
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+		volatile vuint64_t totalUsedPages = 0;
+		FileMapping fileMapping(4 KB, fd, &totalUsedPages, nullptr);
+		FileUseMasks fileUseMasks(4 KB, fd);
+		fileMapping.InitializeExistingSource();
+		fileUseMasks.InitializeExistingSource(&fileMapping);
+		auto numbers = (vuint64_t*)fileMapping.MapPage(BufferPage{(vuint64_t)1})->address;
+		numbers[0] = 12;
+		numbers[1] = 1;
+		numbers[2] = 5;
+		numbers = (vuint64_t*)fileMapping.MapPage(BufferPage{(vuint64_t)12})->address;
+		numbers[0] = ~(vuint64_t)0;
+		numbers[1] = 0;
+		fileUseMasks.SetUseMask(BufferPage{(vuint64_t)5}, false);
+		fileUseMasks.WriteDirtyPages();
+		fileMapping.UnmapAllPages();
+		CloseFileForFileSource(fd);
+
+		source = bm.LoadFileSource(TEMP_DIR L"db.bin", false);
+		TEST_ASSERT(bm.AllocatePages(source, 2, false, pages));
+		TEST_ASSERT(pages[0].index == 5 && pages[1].index == 12);
+		TEST_ASSERT(bm.UnloadSource(source));
+	}
+}
+
+TEST_CASE(Utility_Buffer_AllocatePagesBeyondUseMasks)
+{
+	// a 4K use mask page covers 32704 pages, so pages appended in one call need more than two new use mask pages
+	const vint pageCount = 100000;
+	for (vint c = 0; c < 2; c++)
+	{
+		bool contiguous = c == 0;
+		BufferManager bm(4 KB, 1024);
+		Array<BufferPage> pages(pageCount);
+		{
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+			TEST_ASSERT(bm.AllocatePages(source, pageCount, contiguous, &pages[0]));
+			for (vint i = 1; i < pageCount; i++)
+			{
+				TEST_ASSERT(contiguous ? pages[i].index == pages[0].index + i : pages[i].index > pages[i - 1].index);
+			}
+
+			auto address = (vint*)bm.LockPage(source, pages[pageCount - 1]);
+			TEST_ASSERT(address != nullptr);
+			*address = pageCount;
+			TEST_ASSERT(bm.UnlockPage(source, pages[pageCount - 1], address, PersistanceType::Changed));
+			TEST_ASSERT(bm.UnloadSource(source));
+		}
+		{
+			// all pages are still in use after use masks are read from the file
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false);
+			TEST_ASSERT(bm.AllocatePage(source).index > pages[pageCount - 1].index);
+			auto address = (vint*)bm.LockPage(source, pages[pageCount - 1], PageLatch::Shared);
+			TEST_ASSERT(address && *address == pageCount);
+			TEST_ASSERT(bm.UnlockPage(source, pages[pageCount - 1], address, PersistanceType::NoChanging));
+			TEST_ASSERT(bm.FreePages(source, &pages[0], pageCount));
+			TEST_ASSERT(bm.UnloadSource(source));
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_FileGrowth)
+{
+	auto getFileSize = []()
+	{
+		struct stat fileState;
+		TEST_ASSERT(stat(wtoa(TEMP_DIR L"db.bin").Buffer(), &fileState) == 0);
+		return (vuint64_t)fileState.st_size;
+	};
+
+	for (vint m = 0; m < 2; m++)
+	{
+		auto mode = m == 0 ? FileSourceMode::PooledFrames : FileSourceMode::MemoryMapped;
+		BufferManager bm(4 KB, 1024);
+		List<BufferPage> pages;
+		{
+			// the file grows by extents and is truncated to its pages when it is unloaded
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, mode);
+			for (vint i = 0; i < 100; i++)
+			{
+				auto page = bm.AllocatePage(source);
+				TEST_ASSERT(page.index == i + 3);
+				pages.Add(page);
+				auto address = (vint*)bm.LockPage(source, page);
+				*address = i;
+				TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+			}
+			TEST_ASSERT(getFileSize() > 103 * 4 KB);
+			TEST_ASSERT(bm.FreePage(source, pages[99]));
+			TEST_ASSERT(bm.UnloadSource(source));
+			TEST_ASSERT(getFileSize() == 103 * 4 KB);
+		}
+
+		{
+			// an extent left by a source that is not unloaded is reused
+			auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+			TEST_ASSERT(ftruncate(fd, 200 * 4 KB) == 0);
+			CloseFileForFileSource(fd);
+
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, mode);
+			TEST_ASSERT(bm.AllocatePage(source).index == pages[99].index);
+			TEST_ASSERT(bm.AllocatePage(source).index == 103);
+			for (vint i = 0; i < 99; i++)
+			{
+				auto address = (vint*)bm.LockPage(source, pages[i], PageLatch::Shared);
+				TEST_ASSERT(address && *address == i);
+				TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+			}
+			TEST_ASSERT(bm.UnloadSource(source));
+			TEST_ASSERT(getFileSize() == 104 * 4 KB);
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_SegmentMapping)
+{
+	// 1024 pages in a segment
+	vuint64_t pageSize = 64 KB;
+	vuint64_t pageCount = 1100;
+	auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+	volatile vuint64_t totalUsedPages = 0;
+	FileMapping fileMapping(pageSize, fd, &totalUsedPages, nullptr);
+	fileMapping.InitializeEmptySource();
+
+	auto getAddress = [&](vuint64_t index)
+	{
+		return (char*)fileMapping.GetMappedPageDesc(BufferPage{index})->address;
+	};
+	auto getSegmentMaps = [&]()
+	{
+		BufferMetrics metrics;
+		fileMapping.GetCounters().Collect(metrics);
+		return metrics.Get(BufferCounter::SegmentMaps);
+	};
+
+	for (vuint64_t i = 0; i < pageCount; i++)
+	{
+		if (i >= 3)
+		{
+			TEST_ASSERT(fileMapping.AppendPage().index == i);
+		}
+		else
+		{
+			TEST_ASSERT(fileMapping.MapPage(BufferPage{i}));
+		}
+		*(vuint64_t*)getAddress(i) = i;
+	}
+	TEST_ASSERT(getSegmentMaps() == 2);
+	TEST_ASSERT(getAddress(1023) == getAddress(0) + 1023 * pageSize);
+	TEST_ASSERT(getAddress(1099) == getAddress(1024) + 75 * pageSize);
+
+	// a segment stays mapped after all pages in it are unmapped
+	for (vuint64_t i = 1; i < 1024; i++)
+	{
+		TEST_ASSERT(fileMapping.UnmapPage(BufferPage{i}));
+	}
+	TEST_ASSERT(*(vuint64_t*)getAddress(0) == 0);
+	TEST_ASSERT(fileMapping.UnmapPage(BufferPage{(vuint64_t)0}));
+	for (vuint64_t i = 0; i < 1024; i += 100)
+	{
+		TEST_ASSERT(fileMapping.MapPage(BufferPage{i}));
+		TEST_ASSERT(*(vuint64_t*)getAddress(i) == i);
+	}
+	TEST_ASSERT(getSegmentMaps() == 2);
+	TEST_ASSERT(*(vuint64_t*)getAddress(1099) == 1099);
+
+	fileMapping.UnmapAllPages();
+	fileMapping.TruncateFile();
+	CloseFileForFileSource(fd);
+	TEST_ASSERT(totalUsedPages == 0);
+}
+
+TEST_CASE(Utility_Buffer_PrefetchPages)
+{
+	const vint pageCount = 16;
+	BufferPage pages[pageCount];
+	void* buffers[pageCount];
+	{
+		BufferManager bm(4 KB, 64);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+			TEST_ASSERT(pages[i].IsValid());
+		}
+		TEST_ASSERT(bm.PrefetchPages(source, pages, pageCount) == 0);
+	}
+
+	FileSourceMode modes[] = {FileSourceMode::MemoryMapped, FileSourceMode::PooledFrames};
+	for (vint m = 0; m < 2; m++)
+	{
+		BufferManager bm(4 KB, 64);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, modes[m]);
+		TEST_ASSERT(bm.PrefetchPages(source, pages, pageCount) == pageCount);
+		TEST_ASSERT(bm.LockPages(source, pages, pageCount / 2, buffers, PageLatch::Shared) == true);
+		TEST_ASSERT(bm.PrefetchPages(source, pages, pageCount) == pageCount / 2);
+		TEST_ASSERT(bm.UnlockPages(source, pages, pageCount / 2, buffers, PersistanceType::NoChanging) == true);
+	}
+}
+
+TEST_CASE(Utility_Buffer_FileUseMasks)
+{
+	vuint64_t pageSize = 4 KB;
+	auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+	volatile vuint64_t totalUsedPages = 0;
+
+	FileMapping fileMapping(pageSize, fd, &totalUsedPages, nullptr);
+	FileUseMasks fileUseMasks(pageSize, fd);
+
+	fileMapping.InitializeEmptySource();
+	fileUseMasks.InitializeEmptySource(&fileMapping);
+
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == false);
+
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1024}, true);
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32768}, true);
+
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == true);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32767}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32768}) == true);
+
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1023}, true);
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1024}, false);
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32767}, true);
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32768}, false);
+
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == true);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32767}) == true);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32768}) == false);
+
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1023}, false);
+	fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32767}, false);
+
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1023}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1024}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32767}) == false);
+	TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32768}) == false);
+
+	fileMapping.UnmapAllPages();
+	CloseFileForFileSource(fd);
+	TEST_ASSERT(totalUsedPages == 0);
+}
+
+TEST_CASE(Utility_Buffer_FileUseMasksMirror)
+{
+	// 32704 pages in a use mask page
+	vuint64_t pageSize = 4 KB;
+	vuint64_t pageCount = 32710;
+	volatile vuint64_t totalUsedPages = 0;
+	{
+		auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+		FileMapping fileMapping(pageSize, fd, &totalUsedPages, nullptr);
+		FileUseMasks fileUseMasks(pageSize, fd);
+		fileMapping.InitializeEmptySource();
+		fileUseMasks.InitializeEmptySource(&fileMapping);
+		fileUseMasks.SetUseMask(BufferPage{(vuint64_t)0}, true);
+		fileUseMasks.SetUseMask(BufferPage{(vuint64_t)1}, true);
+		fileUseMasks.SetUseMask(BufferPage{(vuint64_t)2}, true);
+
+		// the second use mask page is appended after page 32703, so its own bit is in itself
+		while (fileMapping.GetTotalPageCount() < pageCount)
+		{
+			auto page = fileMapping.AppendPage();
+			fileUseMasks.SetUseMask(page, true);
+			fileMapping.UnmapPage(page);
+		}
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32705}) == true);
+		TEST_ASSERT(fileUseMasks.GetUsedPageCount() == pageCount);
+
+		for (vuint64_t i = 1000; i < 1010; i++)
+		{
+			fileUseMasks.SetUseMask(BufferPage{i}, false);
+		}
+		fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32700}, false);
+		fileUseMasks.SetUseMask(BufferPage{(vuint64_t)32701}, false);
+		TEST_ASSERT(fileUseMasks.GetUsedPageCount() == pageCount - 12);
+		TEST_ASSERT(fileUseMasks.FindFreePages(BufferPage{(vuint64_t)0}, 2) == BufferPage{(vuint64_t)1000});
+		TEST_ASSERT(fileUseMasks.FindFreePages(BufferPage{(vuint64_t)1005}, 6).IsValid() == false);
+		TEST_ASSERT(fileUseMasks.FindFreePages(BufferPage{(vuint64_t)1005}, 2) == BufferPage{(vuint64_t)1005});
+		TEST_ASSERT(fileUseMasks.FindFreePages(BufferPage{(vuint64_t)1009}, 2) == BufferPage{(vuint64_t)32700});
+
+		// bits are written to use mask pages only by WriteDirtyPages
+		TEST_ASSERT(fileUseMasks.HasDirtyPages());
+		fileUseMasks.WriteDirtyPages();
+		TEST_ASSERT(!fileUseMasks.HasDirtyPages());
+		fileMapping.UnmapAllPages();
+		fileMapping.TruncateFile();
+		CloseFileForFileSource(fd);
+	}
+	{
+		auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+		FileMapping fileMapping(pageSize, fd, &totalUsedPages, nullptr);
+		FileUseMasks fileUseMasks(pageSize, fd);
+		fileMapping.InitializeExistingSource();
+		fileUseMasks.InitializeExistingSource(&fileMapping);
+		fileMapping.UnmapAllPages();
+
+		TEST_ASSERT(fileUseMasks.GetUsedPageEnd() == pageCount);
+		TEST_ASSERT(fileUseMasks.GetUsedPageCount() == pageCount - 12);
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)999}) == true);
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1000}) == false);
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)32701}) == false);
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{pageCount - 1}) == true);
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{pageCount}) == false);
+		TEST_ASSERT(fileUseMasks.GetUseMask(BufferPage{(vuint64_t)1000000}) == false);
+		TEST_ASSERT(fileMapping.GetMappedPageCount() == 0);
+		CloseFileForFileSource(fd);
+	}
+	TEST_ASSERT(totalUsedPages == 0);
+}
+
+TEST_CASE(Utility_Buffer_PageBitmap)
+{
+	Array<vuint64_t> items(37);
+	for (vint i = 0; i < items.Count(); i++)
+	{
+		items[i] = ~(vuint64_t)0;
+	}
+	TEST_ASSERT(CountBits(&items[0], 37) == 37 * 64);
+	TEST_ASSERT(FindZeroBits(&items[0], 0, 37 * 64, 1) == 37 * 64);
+
+	// zero bits: 100-109, 640-767 and 2300-2367
+	items[1] &= ~((vuint64_t)0x3FF << 36);
+	items[10] = 0;
+	items[11] = 0;
+	items[35] &= ~(~(vuint64_t)0 << 60);
+	items[36] = 0;
+	vuint64_t counts[] = {1, 10, 11, 64, 128, 129};
+	vuint64_t expected[] = {100, 100, 640, 640, 640, 37 * 64};
+	for (vint i = 0; i < sizeof(counts) / sizeof(*counts); i++)
+	{
+		TEST_ASSERT(FindZeroBits(&items[0], 0, 37 * 64, counts[i]) == expected[i]);
+		TEST_ASSERT(FindZeroBitsPortable(&items[0], 0, 37 * 64, counts[i]) == expected[i]);
+	}
+	TEST_ASSERT(FindZeroBits(&items[0], 105, 37 * 64, 5) == 105);
+	TEST_ASSERT(FindZeroBits(&items[0], 105, 37 * 64, 6) == 640);
+	TEST_ASSERT(FindZeroBits(&items[0], 0, 700, 60) == 640);
+	TEST_ASSERT(FindZeroBits(&items[0], 0, 700, 61) == 700);
+	TEST_ASSERT(FindZeroBits(&items[0], 2000, 37 * 64, 68) == 2300);
+	TEST_ASSERT(FindZeroBits(&items[0], 2330, 37 * 64, 38) == 2330);
+	TEST_ASSERT(FindZeroBits(&items[0], 2330, 37 * 64, 39) == 37 * 64);
+
+	for (vint i = 0; i < items.Count(); i++)
+	{
+		items[i] = (vuint64_t)i * 0x9E3779B97F4A7C15ULL;
+	}
+	for (vint count = 0; count <= items.Count(); count++)
+	{
+		TEST_ASSERT(CountBits(&items[0], count) == CountBitsPortable(&items[0], count));
+	}
+}
+
+TEST_CASE(Utility_Buffer_PageGeometry)
+{
+	TEST_ASSERT(PageGeometry<12>::PageSize == 4 KB);
+	TEST_ASSERT(PageGeometry<14>::PageItemCount == 2 KB);
+	TEST_ASSERT((PageGeometry<12>::Layout<1, 64>::EntryCount == 511 * 64));
+
+	vuint64_t pageSizes[] = {4 KB, 8 KB, 16 KB, 64 KB};
+	bool specialized[] = {true, false, true, true};
+	for (vint i = 0; i < sizeof(pageSizes) / sizeof(*pageSizes); i++)
+	{
+		auto layout = PageLayout<2, 1>::Create(pageSizes[i]);
+		TEST_ASSERT(layout.IsSpecialized() == specialized[i]);
+		TEST_ASSERT(layout.GetEntryCount() == pageSizes[i] / sizeof(vuint64_t) - 2);
+		for (vuint64_t entry = 0; entry < 100000; entry += 997)
+		{
+			vuint64_t page = 0, index = 0;
+			layout.Locate(entry, page, index);
+			TEST_ASSERT(page == entry / layout.GetEntryCount());
+			TEST_ASSERT(index == entry % layout.GetEntryCount());
+		}
+	}
+
+	// offsets in pages whose size is not a power of 2 do not overlap with page numbers
+	vuint64_t managerPageSizes[] = {4 KB, 12 KB, 64 KB};
+	for (vint i = 0; i < sizeof(managerPageSizes) / sizeof(*managerPageSizes); i++)
+	{
+		BufferManager bm(managerPageSizes[i], 16);
+		vuint64_t offsets[] = {0, 1, bm.GetPageSize() - 1};
+		for (vint j = 0; j < sizeof(offsets) / sizeof(*offsets); j++)
+		{
+			BufferPointer pointer;
+			BufferPage page{(vuint64_t)12345}, decodedPage;
+			vuint64_t decodedOffset = 0;
+			TEST_ASSERT(bm.EncodePointer(pointer, page, offsets[j]));
+			TEST_ASSERT(bm.DecodePointer(pointer, decodedPage, decodedOffset));
+			TEST_ASSERT(decodedPage.index == page.index);
+			TEST_ASSERT(decodedOffset == offsets[j]);
+		}
+		BufferPointer pointer;
+		TEST_ASSERT(bm.EncodePointer(pointer, BufferPage{(vuint64_t)0}, bm.GetPageSize()) == false);
+	}
+}
+
+TEST_CASE(Utility_Buffer_FileFreeExtents)
+{
+	FileFreeExtents extents(4 KB);
+	BufferPage first;
+	TEST_ASSERT(extents.PopFreePages(1, first) == 0);
+
+	// adjacent pages are merged into one extent
+	for (vuint64_t i = 0; i < 10; i++)
+	{
+		extents.PushFreePages(BufferPage{100 + i * 2}, 1);
+	}
+	TEST_ASSERT(extents.GetExtentCount() == 10);
+	for (vuint64_t i = 0; i < 10; i++)
+	{
+		extents.PushFreePages(BufferPage{101 + i * 2}, 1);
+	}
+	TEST_ASSERT(extents.GetExtentCount() == 1);
+	TEST_ASSERT(extents.GetFreePageCount() == 20);
+	extents.PushFreePages(BufferPage{(vuint64_t)50}, 10);
+	extents.PushFreePages(BufferPage{(vuint64_t)200}, 30);
+	TEST_ASSERT(extents.GetExtentCount() == 3);
+	TEST_ASSERT(extents.GetFreePageCount() == 60);
+
+	// [50, 60) [100, 120) [200, 230)
+	TEST_ASSERT(extents.PopContiguousPages(15) == BufferPage{(vuint64_t)100});
+	TEST_ASSERT(extents.PopContiguousPages(6) == BufferPage{(vuint64_t)50});
+	TEST_ASSERT(extents.PopContiguousPages(31).IsValid() == false);
+	TEST_ASSERT(extents.PopTailPages(231, first) == 0);
+	TEST_ASSERT(extents.PopTailPages(230, first) == 30 && first.index == 200);
+
+	// [56, 60) [115, 120)
+	TEST_ASSERT(extents.PopFreePages(3, first) == 3 && first.index == 56);
+	TEST_ASSERT(extents.PopFreePages(3, first) == 1 && first.index == 59);
+	TEST_ASSERT(extents.PopFreePages(10, first) == 5 && first.index == 115);
+	TEST_ASSERT(extents.GetExtentCount() == 0);
+	TEST_ASSERT(extents.GetFreePageCount() == 0);
+
+	// fragmented free pages, every extent i has (i % 7 + 1) pages followed by a page in use
+	vint extentCount = 100000;
+	vuint64_t page = 1000;
+	for (vint i = 0; i < extentCount; i++)
+	{
+		vuint64_t count = (vuint64_t)(i % 7 + 1);
+		extents.PushFreePages(BufferPage{page}, count);
+		page += count + 1;
+	}
+	TEST_ASSERT(extents.GetExtentCount() == extentCount);
+
+	// extents with 7 pages begin every 35 pages from page 1027
+	vuint64_t lastCount = (vuint64_t)((extentCount - 1) % 7 + 1);
+	vuint64_t lastFirst = page - 1 - lastCount;
+	TEST_ASSERT(extents.PopContiguousPages(8).IsValid() == false);
+	TEST_ASSERT(extents.PopContiguousPages(7) == BufferPage{(vuint64_t)1027});
+	TEST_ASSERT(extents.PopContiguousPages(7) == BufferPage{(vuint64_t)1062});
+	TEST_ASSERT(extents.PopTailPages(page - 1, first) == lastCount && first.index == lastFirst);
+	TEST_ASSERT(extents.GetExtentCount() == extentCount - 3);
+
+	// freeing all pages merges all extents
+	page = 1000;
+	for (vint i = 0; i < extentCount; i++)
+	{
+		page += (vuint64_t)(i % 7 + 1);
+		extents.PushFreePages(BufferPage{page}, 1);
+		page++;
+	}
+	extents.PushFreePages(BufferPage{(vuint64_t)1027}, 7);
+	extents.PushFreePages(BufferPage{(vuint64_t)1062}, 7);
+	extents.PushFreePages(BufferPage{lastFirst}, lastCount);
+	TEST_ASSERT(extents.GetExtentCount() == 1);
+	TEST_ASSERT(extents.GetFreePageCount() == page - 1000);
+	TEST_ASSERT(extents.PopFreePages(page, first) == page - 1000 && first.index == 1000);
+}
+
+TEST_CASE(Utility_Buffer_PageTable)
+{
+	PageTable pageTable;
+	vint pageCount = 4096;
+	Dictionary<vuint64_t, BufferPageDesc*> expected;
+
+	for (vint i = 0; i < pageCount; i++)
+	{
+		BufferPage page{(vuint64_t)(i * 7)};
+		auto pageDesc = pageTable.Add(page);
+		TEST_ASSERT(pageDesc);
+		TEST_ASSERT(pageDesc->address == nullptr);
+		TEST_ASSERT(!pageDesc->IsPinned());
+		pageDesc->offset = page.index;
+		expected.Add(page.index, pageDesc);
+	}
+	TEST_ASSERT(pageTable.Count() == pageCount);
+	TEST_ASSERT(pageTable.GetSlotCount() >= pageCount * 2);
+
+	for (vint i = 0; i < pageCount * 7; i++)
+	{
+		BufferPage page{(vuint64_t)i};
+		auto pageDesc = pageTable.Get(page);
+		if (i % 7 == 0)
+		{
+			TEST_ASSERT(pageDesc == expected[page.index]);
+			TEST_ASSERT(pageDesc->offset == page.index);
+		}
+		else
+		{
+			TEST_ASSERT(pageDesc == nullptr);
+		}
+	}
+
+	vint visited = 0;
+	for (vint i = 0; i < pageTable.GetSlotCount(); i++)
+	{
+		BufferPage page;
+		if (auto pageDesc = pageTable.GetSlot(i, page))
+		{
+			TEST_ASSERT(pageDesc->offset == page.index);
+			visited++;
+		}
+	}
+	TEST_ASSERT(visited == pageCount);
+
+	for (vint i = 0; i < pageCount; i += 2)
+	{
+		TEST_ASSERT(pageTable.Remove(BufferPage{(vuint64_t)(i * 7)}));
+		TEST_ASSERT(!pageTable.Remove(BufferPage{(vuint64_t)(i * 7)}));
+	}
+	TEST_ASSERT(pageTable.Count() == pageCount / 2);
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto pageDesc = pageTable.Get(BufferPage{(vuint64_t)(i * 7)});
+		if (i % 2 == 0)
+		{
+			TEST_ASSERT(pageDesc == nullptr);
+		}
+		else
+		{
+			TEST_ASSERT(pageDesc == expected[i * 7]);
+		}
+	}
+
+	// removed descriptors are recycled
+	auto slotCount = pageTable.GetSlotCount();
+	for (vint i = 0; i < pageCount; i += 2)
+	{
+		auto pageDesc = pageTable.Add(BufferPage{(vuint64_t)(i * 7)});
+		TEST_ASSERT(expected.Values().Contains(pageDesc));
+		TEST_ASSERT(pageDesc->offset == 0);
+	}
+	TEST_ASSERT(pageTable.Count() == pageCount);
+	TEST_ASSERT(pageTable.GetSlotCount() == slotCount);
+
+	pageTable.Clear();
+	TEST_ASSERT(pageTable.Count() == 0);
+	TEST_ASSERT(pageTable.Get(BufferPage{7}) == nullptr);
+}
+
+TEST_CASE(Utility_Buffer_ReplacementPolicies)
+{
+	BufferReplacement replacements[] = {BufferReplacement::LeastRecentlyUsed, BufferReplacement::LeastRecentlyUsed2, BufferReplacement::Clock};
+	const wchar_t* replacementNames[] = {L"LeastRecentlyUsed", L"LeastRecentlyUsed2", L"Clock"};
+
+	for (vint r = 0; r < sizeof(replacements) / sizeof(*replacements); r++)
+	{
+		console::Console::WriteLine(WString(L"Replacement: ") + replacementNames[r]);
+		BufferManager bm(4 KB, 8, replacements[r]);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		List<BufferPage> pages;
+
+		auto pinnedPage = bm.AllocatePage(source);
+		auto pinnedAddress = (vint*)bm.LockPage(source, pinnedPage);
+		TEST_ASSERT(pinnedAddress != nullptr);
+		*pinnedAddress = -1;
+		TEST_ASSERT(bm.UnlockPage(source, pinnedPage, pinnedAddress, PersistanceType::Changed));
+		TEST_ASSERT(bm.LockPageShared(source, pinnedPage) == pinnedAddress);
+
+		for (vint i = 0; i < 64; i++)
+		{
+			auto page = bm.AllocatePage(source);
+			TEST_ASSERT(page.IsValid());
+			pages.Add(page);
+			auto address = (vint*)bm.LockPage(source, page);
+			TEST_ASSERT(address != nullptr);
+			*address = i;
+			TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+			TEST_ASSERT_CACHE;
+		}
+		TEST_ASSERT(bm.GetEvictedPageCount() > 0);
+
+		for (vint i = 0; i < pages.Count(); i++)
+		{
+			auto page = pages[i];
+			auto address = (vint*)bm.LockPage(source, page);
+			TEST_ASSERT(address != nullptr);
+			TEST_ASSERT(*address == i);
+			TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::NoChanging));
+			TEST_ASSERT_CACHE;
+		}
+
+		TEST_ASSERT(*pinnedAddress == -1);
+		TEST_ASSERT(bm.UnlockPage(source, pinnedPage, pinnedAddress, PersistanceType::NoChanging));
+	}
+}
+
+TEST_CASE(Utility_Buffer_AccessStrategy)
+{
+	const vint pageCount = 256;
+	Array<BufferPage> pages(pageCount);
+	BufferManager bm(4 KB, 64);
+	{
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+			auto address = (vint*)bm.LockPage(source, pages[i]);
+			*address = i;
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::Changed));
+		}
+		TEST_ASSERT(bm.UnloadSource(source));
+	}
+
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, FileSourceMode::PooledFrames);
+	auto hotSource = bm.LoadMemorySource();
+	auto cachedPageCount = bm.GetSourceCachedPageCount(source);
+	BufferAccessStrategy strategy(8);
+	TEST_ASSERT(strategy.GetRingSize() == 8);
+
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto address = (vint*)bm.LockPage(source, pages[i], PageLatch::Shared, &strategy);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(*address == i);
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+
+		// locking a page in the ring again keeps it recyclable
+		address = (vint*)bm.LockPage(source, pages[i], PageLatch::Exclusive, &strategy);
+		TEST_ASSERT(address != nullptr);
+		*address = i * 2;
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::Changed));
+		TEST_ASSERT(bm.GetSourceCachedPageCount(source) <= cachedPageCount + strategy.GetRingSize());
+	}
+	TEST_ASSERT(strategy.GetRecycledPageCount() == pageCount - strategy.GetRingSize());
+
+	BufferMetrics metrics;
+	TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+	TEST_ASSERT(metrics.Get(BufferCounter::RecycledPages) == strategy.GetRecycledPageCount());
+
+	// a page accessed by others after it enters the ring is not recycled
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto address = (vint*)bm.LockPage(source, pages[i], PageLatch::Shared, &strategy);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(*address == i * 2);
+		TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		if (i == 0)
+		{
+			address = (vint*)bm.LockPageShared(source, pages[i]);
+			TEST_ASSERT(bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging));
+		}
+	}
+	TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+	auto misses = metrics.Get(BufferCounter::PageMisses);
+	auto address = bm.LockPageShared(source, pages[0]);
+	TEST_ASSERT(bm.UnlockPage(source, pages[0], address, PersistanceType::NoChanging));
+	TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+	TEST_ASSERT(metrics.Get(BufferCounter::PageMisses) == misses);
+
+	// pages already in memory never enter the ring
+	auto hotPage = bm.AllocatePage(hotSource);
+	auto recycledPageCount = strategy.GetRecycledPageCount();
+	address = bm.LockPage(hotSource, hotPage, PageLatch::Shared, &strategy);
+	TEST_ASSERT(address != nullptr);
+	TEST_ASSERT(bm.UnlockPage(hotSource, hotPage, address, PersistanceType::NoChanging));
+	TEST_ASSERT(strategy.GetRecycledPageCount() == recycledPageCount);
+	TEST_ASSERT(bm.LockPage(source, BufferPage{1024}, PageLatch::Shared, &strategy) == nullptr);
+}
+
+TEST_CASE(Utility_Buffer_SourceQuotas)
+{
+	BufferManager bm(4 KB, 32);
+	auto metadata = bm.LoadFileSource(TEMP_DIR L"db1.bin", true);
+	auto data = bm.LoadFileSource(TEMP_DIR L"db2.bin", true);
+
+	TEST_ASSERT(bm.SetSourceQuota(metadata, 8, 4) == false);
+	TEST_ASSERT(bm.SetSourceQuota(metadata, 64, 64) == false);
+	TEST_ASSERT(bm.SetSourceQuota(metadata, 8, 16) == true);
+	TEST_ASSERT(bm.SetSourcePriority(metadata, BufferPriority::System) == true);
+	TEST_ASSERT(bm.SetSourcePriority(data, BufferPriority::Scan) == true);
+	TEST_ASSERT(bm.SetSourcePriority(BufferSource::Invalid(), BufferPriority::Scan) == false);
+
+	BufferSourceQuota quota;
+	TEST_ASSERT(bm.GetSourceQuota(metadata, quota) == true);
+	TEST_ASSERT(quota.priority == BufferPriority::System);
+	TEST_ASSERT(quota.minPageCount == 8);
+	TEST_ASSERT(quota.maxPageCount == 16);
+
+	for (vint i = 0; i < 8; i++)
+	{
+		auto page = bm.AllocatePage(metadata);
+		TEST_ASSERT(page.IsValid());
+		auto address = (vint*)bm.LockPage(metadata, page);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(metadata, page, address, PersistanceType::Changed));
+	}
+	auto metadataPageCount = bm.GetSourceCachedPageCount(metadata);
+	TEST_ASSERT(metadataPageCount >= 8);
+
+	// scanning pages evicts only pages of the scan source
+	List<BufferPage> pages;
+	for (vint i = 0; i < 128; i++)
+	{
+		auto page = bm.AllocatePage(data);
+		TEST_ASSERT(page.IsValid());
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(data, page);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(data, page, address, PersistanceType::Changed));
+		TEST_ASSERT_CACHE;
+	}
+	TEST_ASSERT(bm.GetSourceCachedPageCount(metadata) == metadataPageCount);
+
+	// the maximum quota applies even when the cache is not full
+	TEST_ASSERT(bm.SetSourceQuota(data, 0, 8) == true);
+	TEST_ASSERT(bm.GetSourceCachedPageCount(data) <= 8);
+	for (vint i = 0; i < pages.Count(); i++)
+	{
+		auto page = pages[i];
+		auto address = (vint*)bm.LockPage(data, page);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(*address == i);
+		TEST_ASSERT(bm.UnlockPage(data, page, address, PersistanceType::NoChanging));
+		TEST_ASSERT(bm.GetSourceCachedPageCount(data) <= 8);
+	}
+	TEST_ASSERT(bm.GetSourceCachedPageCount(metadata) == metadataPageCount);
+}
+
+TEST_CASE(Utility_Buffer_Metrics)
+{
+	{
+		BufferCounters counters;
+		counters.RecordLockPageLatency(0);
+		counters.RecordLockPageLatency(1);
+		counters.RecordLockPageLatency(1000);
+		counters.RecordLockPageLatency(~(vuint64_t)0);
+		counters.Increase(BufferCounter::PageHits, 3);
+
+		BufferMetrics metrics;
+		counters.Collect(metrics);
+		TEST_ASSERT(metrics.Get(BufferCounter::PageHits) == 3);
+		TEST_ASSERT(metrics.GetSampledLockPageCount() == 4);
+		TEST_ASSERT(metrics.lockPageLatency[0] == 1);
+		TEST_ASSERT(metrics.lockPageLatency[1] == 1);
+		TEST_ASSERT(metrics.lockPageLatency[10] == 1);
+		TEST_ASSERT(metrics.lockPageLatency[BufferMetrics::LatencyBucketCount - 1] == 1);
+	}
+
+	BufferManager bm(4 KB, 8);
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+	List<BufferPage> pages;
+	for (vint i = 0; i < 16; i++)
+	{
+		auto page = bm.AllocatePage(source);
+		TEST_ASSERT(page.IsValid());
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+
+	BufferMetrics metrics, sourceMetrics;
+	bm.GetMetrics(metrics);
+	TEST_ASSERT(bm.GetSourceMetrics(source, sourceMetrics) == true);
+	TEST_ASSERT(bm.GetSourceMetrics(BufferSource::Invalid(), sourceMetrics) == false);
+	TEST_ASSERT(bm.GetSourceMetrics(source, sourceMetrics) == true);
+	TEST_ASSERT(metrics.Get(BufferCounter::PageMisses) >= 16);
+	TEST_ASSERT(metrics.Get(BufferCounter::PageUnmaps) > 0);
+	TEST_ASSERT(metrics.Get(BufferCounter::PageWriteBacks) > 0);
+	TEST_ASSERT(metrics.Get(BufferCounter::WrittenBytes) == metrics.Get(BufferCounter::PageWriteBacks) * bm.GetPageSize());
+	TEST_ASSERT(metrics.Get(BufferCounter::EvictionBatches) > 0);
+	TEST_ASSERT(metrics.Get(BufferCounter::EvictedPages) == bm.GetEvictedPageCount());
+	TEST_ASSERT(metrics.GetSampledLockPageCount() > 0);
+	TEST_ASSERT(sourceMetrics.Get(BufferCounter::PageMisses) == metrics.Get(BufferCounter::PageMisses));
+	TEST_ASSERT(sourceMetrics.Get(BufferCounter::EvictionBatches) == 0);
+
+	{
+		// only ChangedAndPersist waits for a group commit, a page waiting for another ticket is not persisted by NoChanging
+		BufferTicket ticket;
+		auto address = bm.LockPage(source, pages[0]);
+		TEST_ASSERT(bm.UnlockPage(source, pages[0], address, PersistanceType::ChangedAndPersist, ticket));
+		TEST_ASSERT(ticket.IsValid());
+
+		void* buffer = nullptr;
+		BufferMetrics unlockedMetrics, persistedMetrics;
+		bm.GetMetrics(unlockedMetrics);
+		TEST_ASSERT(bm.LockPages(source, &pages[1], 1, &buffer, PageLatch::Shared) == true);
+		TEST_ASSERT(bm.UnlockPages(source, &pages[1], 1, &buffer, PersistanceType::NoChanging) == true);
+		bm.GetMetrics(persistedMetrics);
+		TEST_ASSERT(persistedMetrics.Get(BufferCounter::FileSyncs) == unlockedMetrics.Get(BufferCounter::FileSyncs));
+		TEST_ASSERT(bm.WaitForPersistance(source, ticket));
+		bm.GetMetrics(metrics);
+		TEST_ASSERT(metrics.Get(BufferCounter::FileSyncs) > unlockedMetrics.Get(BufferCounter::FileSyncs));
+	}
+
+	auto page = pages[pages.Count() - 1];
+	auto address = bm.LockPage(source, page);
+	TEST_ASSERT(address != nullptr);
+	TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::ChangedAndPersist));
+	BufferMetrics persistedMetrics;
+	bm.GetMetrics(persistedMetrics);
+	TEST_ASSERT(persistedMetrics.Get(BufferCounter::PageHits) > metrics.Get(BufferCounter::PageHits));
+	TEST_ASSERT(persistedMetrics.Get(BufferCounter::FileSyncs) > metrics.Get(BufferCounter::FileSyncs));
+	TEST_ASSERT(persistedMetrics.GetSampledLockPageCount() >= metrics.GetSampledLockPageCount());
+	TEST_ASSERT(persistedMetrics.ToString().Left(10) == L"PageHits: ");
+
+	SpinLock dumpLock;
+	List<WString> dumps;
+	TEST_ASSERT(bm.StartMetricsDump(0, [&](const WString& text){}) == false);
+	TEST_ASSERT(bm.StartMetricsDump(1, [&](const WString& text)
+	{
+		SPIN_LOCK(dumpLock)
+		{
+			dumps.Add(text);
+		}
+	}) == true);
+	TEST_ASSERT(bm.StartMetricsDump(1, [&](const WString& text){}) == false);
+	for (vint i = 0; i < 1000; i++)
+	{
+		vint count = 0;
+		SPIN_LOCK(dumpLock)
+		{
+			count = dumps.Count();
+		}
+		if (count > 0) break;
+		Thread::Sleep(1);
+	}
+	TEST_ASSERT(bm.StopMetricsDump() == true);
+	TEST_ASSERT(bm.StopMetricsDump() == false);
+	TEST_ASSERT(dumps.Count() > 0);
+	TEST_ASSERT(dumps[0].Left(10) == L"PageHits: ");
+
+	// counters of unloaded sources are kept
+	TEST_ASSERT(bm.UnloadSource(source));
+	BufferMetrics unloadedMetrics;
+	bm.GetMetrics(unloadedMetrics);
+	TEST_ASSERT(unloadedMetrics.Get(BufferCounter::PageMisses) == persistedMetrics.Get(BufferCounter::PageMisses));
+	TEST_ASSERT(unloadedMetrics.Get(BufferCounter::PageUnmaps) > persistedMetrics.Get(BufferCounter::PageUnmaps));
+}
+
+TEST_CASE(Utility_Buffer_BackgroundCleaner)
+{
+	BufferManager bm(4 KB, 16);
+	TEST_ASSERT(bm.SetCleanerWatermarks(16, 8) == false);
+	TEST_ASSERT(bm.SetCleanerWatermarks(8, 32) == false);
+	TEST_ASSERT(bm.SetCleanerWatermarks(8, 12) == true);
+	bm.SetCleanerInterval(1);
+
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+	TEST_ASSERT(bm.IsBackgroundCleanerRunning() == false);
+	TEST_ASSERT(bm.StartBackgroundCleaner() == true);
+	TEST_ASSERT(bm.StartBackgroundCleaner() == false);
+	TEST_ASSERT(bm.IsBackgroundCleanerRunning() == true);
+
+	List<BufferPage> pages;
+	for (vint i = 0; i < 64; i++)
+	{
+		auto page = bm.AllocatePage(source);
+		TEST_ASSERT(page.IsValid());
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+
+	for (vint i = 0; i < 1000 && bm.GetCurrentlyCachedPageCount() > 12; i++)
+	{
+		Thread::Sleep(1);
+	}
+	TEST_ASSERT(bm.GetCurrentlyCachedPageCount() <= 12);
+	TEST_ASSERT(bm.GetForegroundStallCount() == 0);
+	TEST_ASSERT(bm.GetCleanedPageCount() + bm.GetEvictedPageCount() > 0);
+
+	TEST_ASSERT(bm.StopBackgroundCleaner() == true);
+	TEST_ASSERT(bm.StopBackgroundCleaner() == false);
+	TEST_ASSERT(bm.IsBackgroundCleanerRunning() == false);
+
+	for (vint i = 0; i < pages.Count(); i++)
+	{
+		auto page = pages[i];
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(*address == i);
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::NoChanging));
+		TEST_ASSERT_CACHE;
+	}
+}
+
+TEST_CASE(Utility_Buffer_Checkpoint)
+{
+	unlink(wtoa(TEMP_DIR L"checkpoint.bin").Buffer());
+	BufferPoolOptions options;
+	options.checkpointFile = TEMP_DIR L"checkpoint.bin";
+	BufferManager bm(4 KB, 64, BufferReplacement::Clock, options);
+	BufferCheckpoint checkpoint;
+	TEST_ASSERT(bm.GetLastCheckpoint(checkpoint) == false);
+	TEST_ASSERT(BufferManager::ReadCheckpointFile(options.checkpointFile, checkpoint) == false);
+
+	// memory sources have no dirty page table
+	auto memorySource = bm.LoadMemorySource();
+	{
+		auto page = bm.AllocatePage(memorySource);
+		auto address = bm.LockPage(memorySource, page);
+		TEST_ASSERT(bm.UnlockPage(memorySource, page, address, PersistanceType::Changed));
+		TEST_ASSERT(bm.GetOldestDirtyTime() == ~(vuint64_t)0);
+	}
+
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+	List<BufferPage> pages;
+	for (vint i = 0; i < 16; i++)
+	{
+		auto page = bm.AllocatePage(source);
+		TEST_ASSERT(page.IsValid());
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		*address = i;
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+	auto oldestDirtyTime = bm.GetOldestDirtyTime();
+	TEST_ASSERT(oldestDirtyTime != ~(vuint64_t)0);
+
+	// an exclusively latched page is skipped and holds back the recovery time
+	auto latched = (vint*)bm.LockPage(source, pages[3]);
+	TEST_ASSERT(latched != nullptr);
+	TEST_ASSERT(bm.Checkpoint(checkpoint));
+	TEST_ASSERT(checkpoint.sequence == 1);
+	TEST_ASSERT(checkpoint.beginTime <= checkpoint.endTime);
+	TEST_ASSERT(checkpoint.beginLsn <= checkpoint.endLsn);
+	TEST_ASSERT(checkpoint.writtenPageCount >= 15);
+	TEST_ASSERT(checkpoint.skippedPageCount == 1);
+	TEST_ASSERT(checkpoint.recoveryTime < checkpoint.beginTime);
+	TEST_ASSERT(checkpoint.recoveryTime >= oldestDirtyTime);
+	TEST_ASSERT(checkpoint.recoveryLsn <= checkpoint.beginLsn);
+	TEST_ASSERT(bm.UnlockPage(source, pages[3], latched, PersistanceType::NoChanging));
+
+	BufferCheckpoint lastCheckpoint;
+	TEST_ASSERT(bm.GetLastCheckpoint(lastCheckpoint) == true);
+	TEST_ASSERT(lastCheckpoint.sequence == 1);
+	TEST_ASSERT(lastCheckpoint.recoveryTime == checkpoint.recoveryTime);
+	TEST_ASSERT(BufferManager::ReadCheckpointFile(options.checkpointFile, lastCheckpoint) == true);
+	TEST_ASSERT(lastCheckpoint.sequence == 1);
+	TEST_ASSERT(lastCheckpoint.recoveryLsn == checkpoint.recoveryLsn);
+	TEST_ASSERT(lastCheckpoint.skippedPageCount == 1);
+
+	TEST_ASSERT(bm.Checkpoint(checkpoint));
+	TEST_ASSERT(checkpoint.sequence == 2);
+	TEST_ASSERT(checkpoint.writtenPageCount >= 1);
+	TEST_ASSERT(checkpoint.skippedPageCount == 0);
+	TEST_ASSERT(checkpoint.recoveryTime == checkpoint.beginTime);
+	TEST_ASSERT(checkpoint.recoveryLsn == checkpoint.beginLsn + 1);
+	TEST_ASSERT(bm.GetOldestDirtyTime() == ~(vuint64_t)0);
+
+	// pages changed after a checkpoint begins are left to the next one
+	auto address = (vint*)bm.LockPage(source, pages[5]);
+	TEST_ASSERT(address != nullptr);
+	*address = 100;
+	TEST_ASSERT(bm.UnlockPage(source, pages[5], address, PersistanceType::Changed));
+	TEST_ASSERT(bm.GetOldestDirtyTime() > checkpoint.endTime);
+
+	volatile vint callbackCount = 0;
+	volatile vint skippedPageCount = 0;
+	Func<void(const BufferCheckpoint&)> callback = [&](const BufferCheckpoint& record)
+	{
+		__sync_add_and_fetch(&skippedPageCount, (vint)record.skippedPageCount);
+		INCRC(&callbackCount);
+	};
+	TEST_ASSERT(bm.StartCheckpointer(0, callback) == false);
+	TEST_ASSERT(bm.StartCheckpointer(1, callback) == true);
+	TEST_ASSERT(bm.StartCheckpointer(1, callback) == false);
+	for (vint i = 0; i < 1000 && callbackCount == 0; i++)
+	{
+		Thread::Sleep(1);
+	}
+	TEST_ASSERT(bm.StopCheckpointer() == true);
+	TEST_ASSERT(bm.StopCheckpointer() == false);
+	TEST_ASSERT(callbackCount > 0);
+	TEST_ASSERT(skippedPageCount == 0);
+	TEST_ASSERT(bm.GetOldestDirtyTime() == ~(vuint64_t)0);
+	TEST_ASSERT(bm.GetLastCheckpoint(lastCheckpoint) == true);
+	TEST_ASSERT(lastCheckpoint.sequence > 2);
+
+	TEST_ASSERT(bm.UnloadSource(source));
+	source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, FileSourceMode::PooledFrames);
+	for (vint i = 0; i < pages.Count(); i++)
+	{
+		auto page = pages[i];
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		TEST_ASSERT(*address == (i == 5 ? 100 : i));
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::NoChanging));
+	}
+
+	// the last record is loaded by a new buffer manager, and pages are stamped with greater LSNs
+	{
+		BufferManager restarted(4 KB, 64, BufferReplacement::Clock, options);
+		BufferCheckpoint restartedCheckpoint;
+		TEST_ASSERT(restarted.GetLastCheckpoint(restartedCheckpoint) == true);
+		TEST_ASSERT(restartedCheckpoint.sequence == lastCheckpoint.sequence);
+		TEST_ASSERT(restartedCheckpoint.endLsn == lastCheckpoint.endLsn);
+		TEST_ASSERT(GetBufferLsn() >= lastCheckpoint.endLsn);
+		TEST_ASSERT(restarted.Checkpoint(restartedCheckpoint));
+		TEST_ASSERT(restartedCheckpoint.sequence == lastCheckpoint.sequence + 1);
+	}
+
+	// a damaged record is not loaded
+	auto fd = OpenExistingFileForFileSource(options.checkpointFile);
+	vuint8_t byte = 0;
+	TEST_ASSERT(pread(fd, &byte, 1, 20) == 1);
+	byte ^= 1;
+	TEST_ASSERT(pwrite(fd, &byte, 1, 20) == 1);
+	CloseFileForFileSource(fd);
+	TEST_ASSERT(BufferManager::ReadCheckpointFile(options.checkpointFile, checkpoint) == false);
 }
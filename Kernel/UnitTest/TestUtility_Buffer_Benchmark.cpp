@@ -0,0 +1,1590 @@
+#include "UnitTest.h"
+#include "../Source/Utility/Buffer.h"
+#include "../Source/Utility/FileBuffer.h"
+#include "../Source/Utility/Log.h"
+#include "../Source/Utility/PageChecksum.h"
+#include "../Source/Utility/PageBitmap.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <math.h>
+
+using namespace vl;
+using namespace vl::database;
+using namespace vl::database::buffer_internal;
+using namespace vl::collections;
+
+extern WString GetTempFolder();
+#define TEMP_DIR GetTempFolder()+
+#define KB *1024
+#define MB *1024*1024
+
+namespace buffer_benchmark
+{
+	vuint64_t GetBenchmarkTime()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (vuint64_t)ts.tv_sec * 1000000000 + (vuint64_t)ts.tv_nsec;
+	}
+
+	void RunBenchmarkThreads(vint threadCount, const Func<void(vint)>& proc)
+	{
+		// a thread still touches itself after Wait() returns, so threads delete themselves and report finishing by an event
+		EventObject startEvent, finishEvent;
+		startEvent.CreateManualUnsignal(false);
+		finishEvent.CreateManualUnsignal(false);
+		volatile vint running = threadCount;
+		for (vint i = 0; i < threadCount; i++)
+		{
+			Thread::CreateAndStart([&, i]()
+			{
+				startEvent.Wait();
+				proc(i);
+				if (DECRC(&running) == 0)
+				{
+					finishEvent.Signal();
+				}
+			}, true);
+		}
+		startEvent.Signal();
+		finishEvent.Wait();
+	}
+
+	void PrintBenchmark(const WString& name, vuint64_t operations, vuint64_t nanoseconds)
+	{
+		vuint64_t opsPerSecond = nanoseconds == 0 ? 0 : (vuint64_t)((double)operations * 1000000000 / nanoseconds);
+		console::Console::WriteLine(L"    <BENCHMARK> " + name + L": " + u64tow(operations) + L" ops in " + u64tow(nanoseconds / 1000000) + L" ms, " + u64tow(opsPerSecond) + L" ops/s");
+	}
+}
+using namespace buffer_benchmark;
+
+TEST_CASE(Utility_Buffer_Benchmark_ConcurrentLockUnlock)
+{
+	const vint iterations = 200000;
+	const vint pagesPerThread = 16;
+	vint cpuCount = Thread::GetCPUCount();
+
+	for (vint threadCount = 1; ; threadCount *= 2)
+	{
+		if (threadCount > cpuCount) threadCount = cpuCount;
+
+		BufferManager bm(4 KB, 1024);
+		Array<BufferSource> sources(threadCount);
+		Array<BufferPage> pages(threadCount * pagesPerThread);
+		for (vint i = 0; i < threadCount; i++)
+		{
+			sources[i] = bm.LoadMemorySource();
+			for (vint j = 0; j < pagesPerThread; j++)
+			{
+				pages[i * pagesPerThread + j] = bm.AllocatePage(sources[i]);
+			}
+		}
+
+		volatile vint failures = 0;
+		auto start = GetBenchmarkTime();
+		RunBenchmarkThreads(threadCount, [&](vint index)
+		{
+			auto source = sources[index];
+			for (vint i = 0; i < iterations; i++)
+			{
+				auto page = pages[index * pagesPerThread + i % pagesPerThread];
+				auto address = bm.LockPage(source, page);
+				if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging))
+				{
+					INCRC(&failures);
+				}
+			}
+		});
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(L"LockPage/UnlockPage with " + itow(threadCount) + L" thread(s)", threadCount * iterations, stop - start);
+		TEST_ASSERT(failures == 0);
+		if (threadCount == cpuCount) break;
+	}
+}
+
+namespace buffer_benchmark
+{
+	class BenchmarkRandom
+	{
+	private:
+		vuint64_t					state;
+	public:
+		BenchmarkRandom(vuint64_t seed)
+			:state(seed)
+		{
+		}
+
+		vuint64_t Next()
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+
+		double NextDouble()
+		{
+			return (double)(Next() >> 11) / (double)(((vuint64_t)1) << 53);
+		}
+	};
+
+	class ZipfianGenerator
+	{
+	private:
+		Array<double>				cdf;
+		BenchmarkRandom				random;
+	public:
+		ZipfianGenerator(vint count, double skew, vuint64_t seed)
+			:cdf(count)
+			,random(seed)
+		{
+			double sum = 0;
+			for (vint i = 0; i < count; i++)
+			{
+				sum += 1.0 / pow((double)(i + 1), skew);
+				cdf[i] = sum;
+			}
+			for (vint i = 0; i < count; i++)
+			{
+				cdf[i] /= sum;
+			}
+		}
+
+		vint Next()
+		{
+			double value = random.NextDouble();
+			vint start = 0;
+			vint end = cdf.Count() - 1;
+			while (start < end)
+			{
+				vint middle = (start + end) / 2;
+				if (cdf[middle] < value) start = middle + 1;
+				else end = middle;
+			}
+			return start;
+		}
+	};
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_ReplacementPolicies)
+{
+	BufferReplacement replacements[] = {BufferReplacement::LeastRecentlyUsed, BufferReplacement::LeastRecentlyUsed2, BufferReplacement::Clock};
+	const wchar_t* replacementNames[] = {L"LeastRecentlyUsed", L"LeastRecentlyUsed2", L"Clock"};
+	const wchar_t* workloadNames[] = {L"Zipfian", L"Zipfian+Scan"};
+	const vint pageCount = 1024;
+	const vint cachePageCount = 256;
+	const vint accessCount = 20000;
+
+	for (vint w = 0; w < 2; w++)
+	{
+		for (vint r = 0; r < sizeof(replacements) / sizeof(*replacements); r++)
+		{
+			BufferManager bm(4 KB, cachePageCount, replacements[r]);
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+			Array<BufferPage> pages(pageCount);
+			for (vint i = 0; i < pageCount; i++)
+			{
+				pages[i] = bm.AllocatePage(source);
+			}
+
+			ZipfianGenerator zipfian(pageCount, 0.99, 1);
+			vint scanPosition = 0;
+			vint failures = 0;
+			auto cachedBefore = bm.GetCurrentlyCachedPageCount();
+			auto evictedBefore = bm.GetEvictedPageCount();
+			auto start = GetBenchmarkTime();
+			for (vint i = 0; i < accessCount; i++)
+			{
+				vint index = 0;
+				if (w == 1 && i % 2 == 1)
+				{
+					index = scanPosition;
+					scanPosition = (scanPosition + 1) % pageCount;
+				}
+				else
+				{
+					index = zipfian.Next();
+				}
+
+				auto address = bm.LockPage(source, pages[index]);
+				if (!address || !bm.UnlockPage(source, pages[index], address, PersistanceType::NoChanging))
+				{
+					failures++;
+				}
+			}
+			auto stop = GetBenchmarkTime();
+
+			auto misses = bm.GetEvictedPageCount() - evictedBefore + bm.GetCurrentlyCachedPageCount() - cachedBefore;
+			auto hitRatio = (double)(accessCount - misses) / accessCount;
+			PrintBenchmark(WString(workloadNames[w]) + L" with " + replacementNames[r] + L" (hit ratio " + ftow(hitRatio) + L")", accessCount, stop - start);
+			TEST_ASSERT(failures == 0);
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_BackgroundCleaner)
+{
+	const vint pageCount = 1024;
+	const vint cachePageCount = 256;
+	const vint accessCount = 4000;
+
+	for (vint c = 0; c < 2; c++)
+	{
+		BufferManager bm(4 KB, cachePageCount);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		Array<BufferPage> pages(pageCount);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+		}
+		if (c == 1)
+		{
+			bm.SetCleanerInterval(1);
+			bm.StartBackgroundCleaner();
+		}
+
+		BenchmarkRandom random(1);
+		vint failures = 0;
+		vuint64_t maxLatency = 0;
+		auto stallsBefore = bm.GetForegroundStallCount();
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < accessCount; i++)
+		{
+			auto page = pages[random.Next() % pageCount];
+			auto operationStart = GetBenchmarkTime();
+			auto address = (vint*)bm.LockPage(source, page);
+			if (address)
+			{
+				*address = i;
+				if (!bm.UnlockPage(source, page, address, PersistanceType::Changed)) failures++;
+			}
+			else
+			{
+				failures++;
+			}
+			auto latency = GetBenchmarkTime() - operationStart;
+			if (maxLatency < latency) maxLatency = latency;
+		}
+		auto stop = GetBenchmarkTime();
+
+		auto stalls = bm.GetForegroundStallCount() - stallsBefore;
+		PrintBenchmark(WString(c == 0 ? L"Update without cleaner" : L"Update with cleaner") + L" (foreground stalls " + u64tow(stalls) + L", max latency " + u64tow(maxLatency / 1000) + L" us)", accessCount, stop - start);
+		TEST_ASSERT(failures == 0);
+		if (c == 1)
+		{
+			TEST_ASSERT(stalls == 0);
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_SharedLatch)
+{
+	const vint iterations = 200000;
+	vint cpuCount = Thread::GetCPUCount();
+
+	for (vint threadCount = 1; ; threadCount *= 2)
+	{
+		if (threadCount > cpuCount) threadCount = cpuCount;
+
+		BufferManager bm(4 KB, 1024);
+		auto source = bm.LoadMemorySource();
+		auto page = bm.GetIndexPage(source);
+
+		volatile vint failures = 0;
+		auto start = GetBenchmarkTime();
+		RunBenchmarkThreads(threadCount, [&](vint index)
+		{
+			for (vint i = 0; i < iterations; i++)
+			{
+				auto address = bm.LockPageShared(source, page);
+				if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging))
+				{
+					INCRC(&failures);
+				}
+			}
+		});
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(L"LockPageShared on one page with " + itow(threadCount) + L" thread(s)", threadCount * iterations, stop - start);
+		TEST_ASSERT(failures == 0);
+		if (threadCount == cpuCount) break;
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_PageTable)
+{
+	const vint pageCount = 16384;
+	const vint churnCount = 2000;
+	const vint lookupCount = 500000;
+
+	for (vint c = 0; c < 2; c++)
+	{
+		Dictionary<vuint64_t, Ptr<BufferPageDesc>> dictionary;
+		PageTable pageTable;
+		Array<vuint64_t> residents(pageCount);
+		vuint64_t nextPage = 0;
+		BenchmarkRandom random(1);
+		vint failures = 0;
+
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i++)
+		{
+			residents[i] = nextPage++ * 977;
+			if (c == 0)
+			{
+				dictionary.Add(residents[i], MakePtr<BufferPageDesc>());
+			}
+			else
+			{
+				pageTable.Add(BufferPage{residents[i]});
+			}
+		}
+		for (vint i = 0; i < churnCount; i++)
+		{
+			auto& resident = residents[random.Next() % pageCount];
+			auto page = nextPage++ * 977;
+			if (c == 0)
+			{
+				if (!dictionary.Remove(resident)) failures++;
+				dictionary.Add(page, MakePtr<BufferPageDesc>());
+			}
+			else
+			{
+				if (!pageTable.Remove(BufferPage{resident})) failures++;
+				pageTable.Add(BufferPage{page});
+			}
+			resident = page;
+		}
+		for (vint i = 0; i < lookupCount; i++)
+		{
+			auto page = residents[random.Next() % pageCount];
+			if (c == 0)
+			{
+				if (dictionary.Keys().IndexOf(page) == -1) failures++;
+			}
+			else
+			{
+				if (!pageTable.Get(BufferPage{page})) failures++;
+			}
+		}
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(WString(c == 0 ? L"Dictionary" : L"PageTable") + L" with " + itow(pageCount) + L" resident pages", pageCount + churnCount * 2 + lookupCount, stop - start);
+		TEST_ASSERT(failures == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_FileSourceModes)
+{
+	FileSourceMode modes[] = {FileSourceMode::MemoryMapped, FileSourceMode::PooledFrames};
+	const wchar_t* modeNames[] = {L"MemoryMapped", L"PooledFrames"};
+	const wchar_t* workloadNames[] = {L"Random read", L"Random update"};
+	const vint pageCount = 1024;
+	const vint cachePageCount = 256;
+	const vint accessCount = 10000;
+
+	for (vint w = 0; w < 2; w++)
+	{
+		for (vint m = 0; m < 2; m++)
+		{
+			BufferManager bm(4 KB, cachePageCount);
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, modes[m]);
+			Array<BufferPage> pages(pageCount);
+			for (vint i = 0; i < pageCount; i++)
+			{
+				pages[i] = bm.AllocatePage(source);
+			}
+
+			BenchmarkRandom random(1);
+			vint failures = 0;
+			auto start = GetBenchmarkTime();
+			for (vint i = 0; i < accessCount; i++)
+			{
+				auto page = pages[random.Next() % pageCount];
+				if (w == 0)
+				{
+					auto address = (vint*)bm.LockPageShared(source, page);
+					if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging)) failures++;
+				}
+				else
+				{
+					auto address = (vint*)bm.LockPageExclusive(source, page);
+					if (address)
+					{
+						*address = i;
+						if (!bm.UnlockPage(source, page, address, PersistanceType::Changed)) failures++;
+					}
+					else
+					{
+						failures++;
+					}
+				}
+			}
+			auto stop = GetBenchmarkTime();
+
+			PrintBenchmark(WString(workloadNames[w]) + L" with " + modeNames[m], accessCount, stop - start);
+			TEST_ASSERT(failures == 0);
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_BatchScan)
+{
+	const wchar_t* scanNames[] = {L"LockPage", L"LockPages"};
+	const vint pageCount = 4096;
+	const vint cachePageCount = 256;
+	const vint batchSize = 32;
+
+	{
+		BufferManager bm(4 KB, cachePageCount);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			bm.AllocatePage(source);
+		}
+	}
+
+	for (vint s = 0; s < 2; s++)
+	{
+		BufferManager bm(4 KB, cachePageCount);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, FileSourceMode::PooledFrames);
+		BufferPage pages[batchSize];
+		void* buffers[batchSize];
+		vint failures = 0;
+		vuint64_t checksum = 0;
+
+		// page 0, 1 and 2 are reserved by the file source
+		auto start = GetBenchmarkTime();
+		for (vint i = 3; i < pageCount; i += batchSize)
+		{
+			vint count = pageCount - i < batchSize ? pageCount - i : batchSize;
+			for (vint j = 0; j < count; j++)
+			{
+				pages[j] = BufferPage{(vuint64_t)(i + j)};
+			}
+
+			if (s == 0)
+			{
+				for (vint j = 0; j < count; j++)
+				{
+					auto address = bm.LockPageShared(source, pages[j]);
+					if (!address)
+					{
+						failures++;
+						continue;
+					}
+					checksum += *(vuint64_t*)address;
+					if (!bm.UnlockPage(source, pages[j], address, PersistanceType::NoChanging)) failures++;
+				}
+			}
+			else
+			{
+				if (!bm.LockPages(source, pages, count, buffers, PageLatch::Shared))
+				{
+					failures++;
+					continue;
+				}
+				for (vint j = 0; j < count; j++)
+				{
+					checksum += *(vuint64_t*)buffers[j];
+				}
+				if (!bm.UnlockPages(source, pages, count, buffers, PersistanceType::NoChanging)) failures++;
+			}
+		}
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(WString(L"Sequential scan with ") + scanNames[s], pageCount - 3, stop - start);
+		TEST_ASSERT(failures == 0);
+		TEST_ASSERT(checksum == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_GroupCommit)
+{
+	const vint commitCount = 256;
+	vint threadCounts[] = {1, 8};
+
+	for (vint t = 0; t < sizeof(threadCounts) / sizeof(*threadCounts); t++)
+	{
+		vint threadCount = threadCounts[t];
+		BufferManager bm(4 KB, 1024);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		LogManager log(&bm, source, true, false);
+
+		volatile vint failures = 0;
+		auto start = GetBenchmarkTime();
+		RunBenchmarkThreads(threadCount, [&](vint index)
+		{
+			for (vint i = index; i < commitCount; i += threadCount)
+			{
+				auto trans = log.OpenTransaction();
+				auto writer = log.OpenLogItem(trans);
+				if (!writer)
+				{
+					INCRC(&failures);
+					continue;
+				}
+				writer->GetStream().Write(&i, sizeof(i));
+				if (!writer->Close() || !log.CloseTransaction(trans))
+				{
+					INCRC(&failures);
+				}
+			}
+		});
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(L"LogWriter::Close with " + itow(threadCount) + L" committer(s)", commitCount, stop - start);
+		TEST_ASSERT(failures == 0);
+		TEST_ASSERT(log.GetUsedTransactionCount() == commitCount);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_SourcePriorities)
+{
+	const vint hotPageCount = 64;
+	const vint scanPageCount = 2048;
+	const vint cachePageCount = 128;
+
+	for (vint p = 0; p < 2; p++)
+	{
+		BufferManager bm(4 KB, cachePageCount);
+		auto hot = bm.LoadFileSource(TEMP_DIR L"db1.bin", true, FileSourceMode::PooledFrames);
+		auto scan = bm.LoadFileSource(TEMP_DIR L"db2.bin", true, FileSourceMode::PooledFrames);
+		if (p == 1)
+		{
+			TEST_ASSERT(bm.SetSourcePriority(hot, BufferPriority::System));
+			TEST_ASSERT(bm.SetSourcePriority(scan, BufferPriority::Scan));
+		}
+
+		List<BufferPage> hotPages, scanPages;
+		for (vint i = 0; i < hotPageCount; i++) hotPages.Add(bm.AllocatePage(hot));
+		for (vint i = 0; i < scanPageCount; i++) scanPages.Add(bm.AllocatePage(scan));
+
+		vint failures = 0;
+		vuint64_t checksum = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < scanPageCount; i++)
+		{
+			BufferSource sources[] = {scan, hot};
+			BufferPage pages[] = {scanPages[i], hotPages[i % hotPageCount]};
+			for (vint j = 0; j < 2; j++)
+			{
+				auto address = bm.LockPageShared(sources[j], pages[j]);
+				if (!address)
+				{
+					failures++;
+					continue;
+				}
+				checksum += *(vuint64_t*)address;
+				if (!bm.UnlockPage(sources[j], pages[j], address, PersistanceType::NoChanging)) failures++;
+			}
+		}
+		auto stop = GetBenchmarkTime();
+
+		auto residentCount = bm.GetSourceCachedPageCount(hot);
+		PrintBenchmark(WString(p == 0 ? L"Scan without priorities" : L"Scan with priorities") + L" (resident hot and metadata pages " + u64tow(residentCount) + L")", scanPageCount * 2, stop - start);
+		TEST_ASSERT(failures == 0);
+		TEST_ASSERT(checksum == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_PageGeometry)
+{
+	const vint iterations = 1000000;
+
+	{
+		BufferManager bm(4 KB, 16);
+		vuint64_t checksum = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < iterations; i++)
+		{
+			BufferPage page;
+			vuint64_t offset = 0;
+			bm.DecodePointer(BufferPointer{(vuint64_t)i * 4099}, page, offset);
+			checksum += page.index + offset;
+		}
+		auto stop = GetBenchmarkTime();
+		PrintBenchmark(L"DecodePointer (checksum " + u64tow(checksum % 1000) + L")", iterations, stop - start);
+	}
+
+	{
+		// a volatile divisor keeps the compiler from turning the division into a multiplication
+		auto layout = PageLayout<1, 64>::Create(4 KB);
+		volatile vuint64_t entryCount = layout.GetEntryCount();
+		for (vint c = 0; c < 2; c++)
+		{
+			vuint64_t checksum = 0;
+			auto start = GetBenchmarkTime();
+			for (vint i = 0; i < iterations; i++)
+			{
+				vuint64_t entry = (vuint64_t)i * 7919;
+				vuint64_t page = 0, index = 0;
+				if (c == 0)
+				{
+					vuint64_t divisor = entryCount;
+					page = entry / divisor;
+					index = entry % divisor;
+				}
+				else
+				{
+					layout.Locate(entry, page, index);
+				}
+				checksum += page + index;
+			}
+			auto stop = GetBenchmarkTime();
+			PrintBenchmark(WString(c == 0 ? L"Use mask locating by division" : L"Use mask locating by PageLayout") + L" (checksum " + u64tow(checksum % 1000) + L")", iterations, stop - start);
+		}
+	}
+
+	{
+		vuint64_t pageSize = 4 KB;
+		auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+		volatile vuint64_t totalUsedPages = 0;
+		FileMapping fileMapping(pageSize, fd, &totalUsedPages, nullptr);
+		FileUseMasks fileUseMasks(pageSize, fd);
+		fileMapping.InitializeEmptySource();
+		fileUseMasks.InitializeEmptySource(&fileMapping);
+
+		const vint pageCount = 16384;
+		vint used = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < iterations; i++)
+		{
+			if (fileUseMasks.GetUseMask(BufferPage{(vuint64_t)(i * 7919 % pageCount)})) used++;
+		}
+		auto stop = GetBenchmarkTime();
+		PrintBenchmark(L"FileUseMasks::GetUseMask", iterations, stop - start);
+		TEST_ASSERT(used == 0);
+
+		fileMapping.UnmapAllPages();
+		CloseFileForFileSource(fd);
+	}
+
+	{
+		const vint itemCount = 4096;
+		BufferManager bm(4 KB, 1024);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		LogManager log(&bm, source, true, false);
+		auto trans = log.OpenTransaction();
+
+		vint failures = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < itemCount; i++)
+		{
+			auto writer = log.OpenLogItem(trans);
+			writer->GetStream().Write(&i, sizeof(i));
+			if (!writer->Close()) failures++;
+		}
+		auto stop = GetBenchmarkTime();
+		PrintBenchmark(L"Log block allocation", itemCount, stop - start);
+		TEST_ASSERT(failures == 0);
+		TEST_ASSERT(log.CloseTransaction(trans));
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_PageHandle)
+{
+	const vint iterations = 200000;
+	const vint pageCount = 16;
+
+	for (vint c = 0; c < 2; c++)
+	{
+		BufferManager bm(4 KB, 1024);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		BufferPage pages[pageCount];
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+		}
+
+		vint failures = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < iterations; i++)
+		{
+			auto page = pages[i % pageCount];
+			if (c == 0)
+			{
+				auto address = bm.LockPage(source, page);
+				if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging)) failures++;
+			}
+			else
+			{
+				auto handle = bm.LockPageHandle(source, page);
+				if (!handle.IsValid() || !handle.Release()) failures++;
+			}
+		}
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(c == 0 ? L"LockPage/UnlockPage on a file source" : L"LockPageHandle/Release on a file source", iterations, stop - start);
+		TEST_ASSERT(failures == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_HugePages)
+{
+	const vint pageCount = 8192;
+	const vint iterations = 200000;
+
+	BufferHugePages hugePagesOptions[] = {BufferHugePages::None, BufferHugePages::Transparent};
+	for (auto hugePages : hugePagesOptions)
+	{
+		BufferPoolOptions options;
+		options.hugePages = hugePages;
+		BufferManager bm(4 KB, pageCount, BufferReplacement::Clock, options);
+		auto source = bm.LoadMemorySource();
+		Array<BufferPage> pages(pageCount);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+		}
+
+		// touch pages in a pseudo random order, so that each access lands on a different 4KB page
+		vint failures = 0;
+		vuint64_t sum = 0;
+		vuint64_t index = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < iterations; i++)
+		{
+			index = (index * 6364136223846793005ULL + 1442695040888963407ULL);
+			auto page = pages[(vint)((index >> 33) % pageCount)];
+			auto address = (vint*)bm.LockPage(source, page);
+			if (!address)
+			{
+				failures++;
+				continue;
+			}
+			sum += address[(i * 17) % (4 KB / sizeof(vint))]++;
+			if (!bm.UnlockPage(source, page, address, PersistanceType::Changed)) failures++;
+		}
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(hugePages == BufferHugePages::None ? L"Random page access with 4KB frames" : L"Random page access with transparent huge page frames", iterations, stop - start);
+		TEST_ASSERT(failures == 0);
+		TEST_ASSERT(bm.UnloadSource(source));
+	}
+}
+
+namespace buffer_benchmark
+{
+	// Each read submits itself again with another random page until enough reads are submitted
+	class RandomPageRead : public AsyncReadRequest
+	{
+	public:
+		AsyncFileReader*		reader = nullptr;
+		volatile vint*			remaining = nullptr;
+		volatile vint*			completed = nullptr;
+		volatile vint*			failures = nullptr;
+		vuint64_t				random = 0;
+		vint					pageCount = 0;
+
+		void SubmitRandomPage()
+		{
+			random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+			offset = (random >> 33) % pageCount * size;
+			if (!reader->Submit(this))
+			{
+				INCRC(failures);
+				INCRC(completed);
+			}
+		}
+
+		void OnCompleted()override
+		{
+			if (result != (vint64_t)size) INCRC(failures);
+			if (DECRC(remaining) >= 0)
+			{
+				SubmitRandomPage();
+			}
+			INCRC(completed);
+		}
+	};
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_AsyncRead)
+{
+	const vint pageCount = 4096;
+	const vint readCount = 2000;
+	const vint queueDepths[] = {1, 4, 16, 64};
+
+	{
+		auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+		char page[4 KB];
+		for (vint i = 0; i < pageCount; i++)
+		{
+			memset(page, (char)i, sizeof(page));
+			pwrite(fd, page, sizeof(page), i * 4 KB);
+		}
+		fdatasync(fd);
+		CloseFileForFileSource(fd);
+	}
+
+	// O_DIRECT bypasses the page cache, so that reads reach the device
+	auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin", true);
+	TEST_ASSERT(fd != -1);
+	FramePool pool(4 KB, 64);
+	for (vint c = 0; c < 2; c++)
+	{
+		for (auto queueDepth : queueDepths)
+		{
+			Ptr<AsyncFileReader> reader = c == 0 ? CreateUringFileReader(queueDepth) : CreateThreadPoolFileReader(queueDepth);
+			if (!reader) continue;
+
+			volatile vint remaining = readCount - queueDepth;
+			volatile vint completed = 0;
+			volatile vint failures = 0;
+			Array<RandomPageRead> reads(queueDepth);
+			for (vint i = 0; i < queueDepth; i++)
+			{
+				reads[i].reader = reader.Obj();
+				reads[i].remaining = &remaining;
+				reads[i].completed = &completed;
+				reads[i].failures = &failures;
+				reads[i].random = i;
+				reads[i].pageCount = pageCount;
+				reads[i].fileDescriptor = fd;
+				reads[i].buffer = pool.AllocateFrame();
+				reads[i].size = 4 KB;
+			}
+
+			auto start = GetBenchmarkTime();
+			for (vint i = 0; i < queueDepth; i++)
+			{
+				reads[i].SubmitRandomPage();
+			}
+			while (completed < readCount)
+			{
+				Thread::Sleep(1);
+			}
+			auto stop = GetBenchmarkTime();
+
+			PrintBenchmark(WString(c == 0 ? L"io_uring" : L"pread thread pool") + L" random 4KB reads at queue depth " + itow(queueDepth), readCount, stop - start);
+			TEST_ASSERT(failures == 0);
+			for (vint i = 0; i < queueDepth; i++)
+			{
+				pool.FreeFrame(reads[i].buffer);
+			}
+		}
+	}
+	CloseFileForFileSource(fd);
+
+	// LockPageAsync keeps many page reads in flight for one thread, compared to LockPage reading pages one by one
+	for (vint c = 0; c < 2; c++)
+	{
+		const vint batchSize = 32;
+		BufferManager bm(4 KB, 1024);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, c == 0 ? FileSourceMode::PooledFrames : FileSourceMode::AsyncFrames);
+		const vint sourcePageCount = 4096;
+		Array<BufferPage> pages(sourcePageCount);
+		for (vint i = 0; i < sourcePageCount; i++)
+		{
+			// pages are filled, so that they are not holes in the file
+			pages[i] = bm.AllocatePage(source);
+			auto address = bm.LockPage(source, pages[i]);
+			memset(address, (char)i, 4 KB);
+			bm.UnlockPage(source, pages[i], address, PersistanceType::Changed);
+		}
+		TEST_ASSERT(bm.UnloadSource(source));
+		{
+			// drop the file from the page cache, so that pages are cold for both modes
+			auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			CloseFileForFileSource(fd);
+		}
+		source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, c == 0 ? FileSourceMode::PooledFrames : FileSourceMode::AsyncFrames);
+
+		vint failures = 0;
+		vuint64_t random = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < readCount; i += batchSize)
+		{
+			BufferPage batch[batchSize];
+			void* addresses[batchSize];
+			Ptr<BufferCompletion> completions[batchSize];
+			for (vint j = 0; j < batchSize; j++)
+			{
+				random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+				batch[j] = pages[(vint)((random >> 33) % sourcePageCount)];
+				if (c == 0)
+				{
+					addresses[j] = bm.LockPageShared(source, batch[j]);
+				}
+				else
+				{
+					completions[j] = bm.LockPageAsync(source, batch[j], PageLatch::Shared);
+				}
+			}
+			for (vint j = 0; j < batchSize; j++)
+			{
+				if (c == 1)
+				{
+					addresses[j] = completions[j]->Wait();
+				}
+				if (!addresses[j] || !bm.UnlockPage(source, batch[j], addresses[j], PersistanceType::NoChanging)) failures++;
+			}
+		}
+		auto stop = GetBenchmarkTime();
+
+		PrintBenchmark(c == 0 ? L"LockPage on cold pages of a PooledFrames source" : L"LockPageAsync on cold pages of an AsyncFrames source, 32 in flight", readCount, stop - start);
+		TEST_ASSERT(failures == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_AccessStrategy)
+{
+	const vint hotPageCount = 192;
+	const vint scanPageCount = 4096;
+	const vint lookupsPerScannedPage = 4;
+
+	for (vint c = 0; c < 2; c++)
+	{
+		BufferManager bm(4 KB, 256);
+		auto hotSource = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		auto scanSource = bm.LoadFileSource(TEMP_DIR L"db2.bin", true, FileSourceMode::PooledFrames);
+		Array<BufferPage> hotPages(hotPageCount);
+		Array<BufferPage> scanPages(scanPageCount);
+		for (vint i = 0; i < hotPageCount; i++)
+		{
+			hotPages[i] = bm.AllocatePage(hotSource);
+		}
+		for (vint i = 0; i < scanPageCount; i++)
+		{
+			scanPages[i] = bm.AllocatePage(scanSource);
+		}
+
+		// the scan is interleaved with lookups of hot pages, as if they run concurrently
+		BufferAccessStrategy strategy(16);
+		BufferMetrics before, after;
+		bm.GetSourceMetrics(hotSource, before);
+		vint failures = 0;
+		vuint64_t random = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < scanPageCount; i++)
+		{
+			for (vint j = 0; j < lookupsPerScannedPage; j++)
+			{
+				random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+				auto page = hotPages[(vint)((random >> 33) % hotPageCount)];
+				auto address = bm.LockPageShared(hotSource, page);
+				if (!address || !bm.UnlockPage(hotSource, page, address, PersistanceType::NoChanging)) failures++;
+			}
+
+			auto address = bm.LockPage(scanSource, scanPages[i], PageLatch::Shared, c == 0 ? nullptr : &strategy);
+			if (!address || !bm.UnlockPage(scanSource, scanPages[i], address, PersistanceType::NoChanging)) failures++;
+		}
+		auto stop = GetBenchmarkTime();
+		bm.GetSourceMetrics(hotSource, after);
+
+		auto hits = after.Get(BufferCounter::PageHits) - before.Get(BufferCounter::PageHits);
+		auto misses = after.Get(BufferCounter::PageMisses) - before.Get(BufferCounter::PageMisses);
+		PrintBenchmark(c == 0 ? L"Hot lookups during a scan through the shared cache" : L"Hot lookups during a scan through a ring of 16 pages", scanPageCount * (lookupsPerScannedPage + 1), stop - start);
+		console::Console::WriteLine(L"    <BENCHMARK> Hot page hit ratio: " + itow((vint)(hits * 1000 / (hits + misses))) + L" per mille");
+		TEST_ASSERT(failures == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_Checkpoint)
+{
+	const vint pageCount = 1024;
+	const vint accessCount = 100000;
+
+	for (vint c = 0; c < 2; c++)
+	{
+		BufferManager bm(4 KB, pageCount * 2);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		Array<BufferPage> pages(pageCount);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+		}
+		BufferCheckpoint checkpoint;
+		bm.Checkpoint(checkpoint);
+		if (c == 1)
+		{
+			bm.StartCheckpointer(5, {});
+		}
+
+		BenchmarkRandom random(1);
+		vint failures = 0;
+		vuint64_t maxLatency = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < accessCount; i++)
+		{
+			auto page = pages[random.Next() % pageCount];
+			auto operationStart = GetBenchmarkTime();
+			auto address = (vint*)bm.LockPage(source, page);
+			if (address)
+			{
+				*address = i;
+				if (!bm.UnlockPage(source, page, address, PersistanceType::Changed)) failures++;
+			}
+			else
+			{
+				failures++;
+			}
+			auto latency = GetBenchmarkTime() - operationStart;
+			if (maxLatency < latency) maxLatency = latency;
+		}
+		auto stop = GetBenchmarkTime();
+		if (c == 1)
+		{
+			bm.StopCheckpointer();
+		}
+
+		// changes since the oldest dirty page need to be replayed after a crash
+		auto oldestDirtyTime = bm.GetOldestDirtyTime();
+		auto recoveryLag = oldestDirtyTime == ~(vuint64_t)0 ? 0 : stop - oldestDirtyTime;
+		bm.GetLastCheckpoint(checkpoint);
+		PrintBenchmark(WString(c == 0 ? L"Update without checkpointer" : L"Update with checkpointer") + L" (checkpoints " + u64tow(checkpoint.sequence) + L", recovery lag " + u64tow(recoveryLag / 1000) + L" us, max latency " + u64tow(maxLatency / 1000) + L" us)", accessCount, stop - start);
+		TEST_ASSERT(failures == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_Compression)
+{
+	const vint pageCount = 2048;
+	const vint cachePageCount = 256;
+	const wchar_t* dataNames[] = {L"Compressible", L"Incompressible"};
+	const wchar_t* modeNames[] = {L"PooledFrames", L"CompressedFrames"};
+
+	for (vint d = 0; d < 2; d++)
+	{
+		for (vint m = 0; m < 2; m++)
+		{
+			auto mode = m == 0 ? FileSourceMode::PooledFrames : FileSourceMode::CompressedFrames;
+			BufferPage firstPage, lastPage;
+			vuint64_t writeTime = 0;
+			{
+				BufferManager bm(4 KB, pageCount * 2);
+				auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, mode);
+				BenchmarkRandom random(1);
+				auto start = GetBenchmarkTime();
+				for (vint i = 0; i < pageCount; i++)
+				{
+					auto page = bm.AllocatePage(source);
+					if (i == 0) firstPage = page;
+					lastPage = page;
+					auto address = (char*)bm.LockPage(source, page);
+					TEST_ASSERT(address != nullptr);
+					for (vint r = 0; r < 4 KB / 32; r++)
+					{
+						// records of ids, small numbers and names, or random bytes
+						auto record = (vuint64_t*)(address + r * 32);
+						if (d == 0)
+						{
+							record[0] = i * 128 + r;
+							record[1] = random.Next() % 10;
+							memcpy(&record[2], "customer-name-00", 16);
+						}
+						else
+						{
+							for (vint k = 0; k < 4; k++)
+							{
+								record[k] = random.Next();
+							}
+						}
+					}
+					TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+				}
+				TEST_ASSERT(bm.UnloadSource(source));
+				writeTime = GetBenchmarkTime() - start;
+			}
+
+			struct stat dataState, mapState;
+			stat(wtoa(TEMP_DIR L"db.bin").Buffer(), &dataState);
+			vuint64_t fileSize = dataState.st_size;
+			if (m == 1 && stat(wtoa(TEMP_DIR L"db.bin.pagemap").Buffer(), &mapState) == 0)
+			{
+				fileSize += mapState.st_size;
+			}
+			{
+				// drop the file from the page cache, so that pages are cold for both modes
+				auto fd = OpenExistingFileForFileSource(TEMP_DIR L"db.bin");
+				fdatasync(fd);
+				posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+				CloseFileForFileSource(fd);
+			}
+
+			BufferManager bm(4 KB, cachePageCount);
+			auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, mode);
+			BenchmarkRandom random(2);
+			vint failures = 0;
+			auto pageRange = lastPage.index - firstPage.index + 1;
+			auto start = GetBenchmarkTime();
+			for (vint i = 0; i < pageCount; i++)
+			{
+				BufferPage page{firstPage.index + random.Next() % pageRange};
+				auto address = bm.LockPage(source, page, PageLatch::Shared);
+				if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging)) failures++;
+			}
+			auto readTime = GetBenchmarkTime() - start;
+
+			PrintBenchmark(WString(dataNames[d]) + L" " + modeNames[m] + L" write (" + u64tow(fileSize / 1024) + L" KB on disk)", pageCount, writeTime);
+			PrintBenchmark(WString(dataNames[d]) + L" " + modeNames[m] + L" cold read", pageCount, readTime);
+			TEST_ASSERT(failures == 0);
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_Checksum)
+{
+	{
+		const vint pageCount = 1024;
+		Array<vuint8_t> pages(pageCount * 4 KB);
+		BenchmarkRandom random(1);
+		for (vint i = 0; i < pages.Count(); i += sizeof(vuint64_t))
+		{
+			auto value = random.Next();
+			memcpy(&pages[i], &value, sizeof(value));
+		}
+
+		// crc of every 4 KB page in 64 MB of traffic
+		const vint rounds = 16;
+		for (vint h = 0; h < 2; h++)
+		{
+			if (h == 0 && !IsCrc32cAccelerated()) continue;
+			vuint32_t crc = 0;
+			auto start = GetBenchmarkTime();
+			for (vint r = 0; r < rounds; r++)
+			{
+				for (vint i = 0; i < pageCount; i++)
+				{
+					crc ^= h == 0 ? ComputeCrc32c(&pages[i * 4 KB], 4 KB) : ComputeCrc32cPortable(&pages[i * 4 KB], 4 KB);
+				}
+			}
+			auto time = GetBenchmarkTime() - start;
+			vuint64_t bytes = rounds * pageCount * 4 KB;
+			PrintBenchmark(WString(h == 0 ? L"CRC32C SSE4.2" : L"CRC32C portable") + L" per 4 KB page (" + u64tow(time * 1024 / (bytes / 1024 / 1024) / 1000000) + L" ms per GB, checksum " + itow(crc & 1) + L")", rounds * pageCount, time);
+		}
+	}
+
+	const vint pageCount = 2048;
+	const vint cachePageCount = 256;
+	for (vint c = 0; c < 2; c++)
+	{
+		BufferPoolOptions options;
+		options.pageChecksums = c == 1;
+		BufferManager bm(4 KB, cachePageCount, BufferReplacement::Clock, options);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		List<BufferPage> pages;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i++)
+		{
+			auto page = bm.AllocatePage(source);
+			pages.Add(page);
+			auto address = (vuint64_t*)bm.LockPage(source, page);
+			TEST_ASSERT(address != nullptr);
+			for (vuint64_t j = 0; j < bm.GetPageDataSize() / sizeof(vuint64_t); j++)
+			{
+				address[j] = i + j;
+			}
+			TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+		}
+		auto writeTime = GetBenchmarkTime() - start;
+
+		// the cache holds 1/8 of the pages, so most random reads load and verify a page
+		BenchmarkRandom random(2);
+		vint failures = 0;
+		start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount * 4; i++)
+		{
+			auto page = pages[random.Next() % pageCount];
+			auto address = bm.LockPage(source, page, PageLatch::Shared);
+			if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging)) failures++;
+		}
+		auto readTime = GetBenchmarkTime() - start;
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		BufferMetrics metrics;
+		bm.GetMetrics(metrics);
+		PrintBenchmark(WString(c == 0 ? L"PooledFrames without checksums" : L"PooledFrames with checksums") + L" write", pageCount, writeTime);
+		PrintBenchmark(WString(c == 0 ? L"PooledFrames without checksums" : L"PooledFrames with checksums") + L" random read (" + u64tow(metrics.Get(BufferCounter::PageMisses)) + L" misses)", pageCount * 4, readTime);
+		TEST_ASSERT(failures == 0);
+		TEST_ASSERT(metrics.Get(BufferCounter::ChecksumFailures) == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_MemorySpill)
+{
+	// a memory source holding 4 times the cache, like a sort run larger than memory
+	const vint cachePageCount = 1024;
+	const vint pageCount = cachePageCount * 4;
+	BufferPoolOptions options;
+	options.spillDirectory = GetTempFolder();
+	BufferManager bm(4 KB, cachePageCount, BufferReplacement::Clock, options);
+	auto source = bm.LoadMemorySource();
+
+	List<BufferPage> pages;
+	auto start = GetBenchmarkTime();
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto page = bm.AllocatePage(source);
+		pages.Add(page);
+		auto address = (vint*)bm.LockPage(source, page);
+		TEST_ASSERT(address != nullptr);
+		for (vint j = 0; j < 4 KB / sizeof(vint); j++)
+		{
+			address[j] = i + j;
+		}
+		TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+	}
+	auto writeTime = GetBenchmarkTime() - start;
+
+	BenchmarkRandom random(1);
+	vint failures = 0;
+	start = GetBenchmarkTime();
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto index = random.Next() % pageCount;
+		auto address = (vint*)bm.LockPage(source, pages[index], PageLatch::Shared);
+		if (!address || address[0] != index) failures++;
+		if (!address || !bm.UnlockPage(source, pages[index], address, PersistanceType::NoChanging)) failures++;
+	}
+	auto readTime = GetBenchmarkTime() - start;
+
+	BufferMetrics metrics;
+	TEST_ASSERT(bm.GetSourceMetrics(source, metrics));
+	PrintBenchmark(L"Memory source write with spilling (" + u64tow(metrics.Get(BufferCounter::PageWriteBacks)) + L" pages spilled)", pageCount, writeTime);
+	PrintBenchmark(L"Memory source random read with spilling (" + u64tow(bm.GetSourceCachedPageCount(source)) + L" pages in memory)", pageCount, readTime);
+	TEST_ASSERT(failures == 0);
+	TEST_ASSERT(bm.GetCurrentlyCachedPageCount() <= cachePageCount);
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_MemorySourceChurn)
+{
+	// temporary pages of a memory source are allocated, used and freed again, all of them fit in the cache
+	const vint pageCount = 16384;
+	const vint churnCount = 200000;
+	const vint lookupCount = 1000000;
+	BufferManager bm(4 KB, pageCount * 2);
+	auto source = bm.LoadMemorySource();
+
+	Array<BufferPage> pages(pageCount);
+	BenchmarkRandom random(1);
+	vint failures = 0;
+	auto start = GetBenchmarkTime();
+	for (vint i = 0; i < pageCount; i++)
+	{
+		pages[i] = bm.AllocatePage(source);
+		if (!pages[i].IsValid()) failures++;
+	}
+	for (vint i = 0; i < churnCount; i++)
+	{
+		auto index = random.Next() % pageCount;
+		if (!bm.FreePage(source, pages[index])) failures++;
+		pages[index] = bm.AllocatePage(source);
+		if (!pages[index].IsValid()) failures++;
+	}
+	auto churnTime = GetBenchmarkTime() - start;
+
+	start = GetBenchmarkTime();
+	for (vint i = 0; i < lookupCount; i++)
+	{
+		auto page = pages[random.Next() % pageCount];
+		auto address = bm.LockPage(source, page, PageLatch::Shared);
+		if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging)) failures++;
+	}
+	auto lookupTime = GetBenchmarkTime() - start;
+
+	PrintBenchmark(L"Memory source AllocatePage/FreePage", pageCount + churnCount, churnTime);
+	PrintBenchmark(L"Memory source random LockPage/UnlockPage", lookupCount, lookupTime);
+	TEST_ASSERT(failures == 0);
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_MemorySnapshot)
+{
+	const vint pageCount = 16384;
+	const vuint64_t megabytes = pageCount * 4 KB / 1024 / 1024;
+	List<BufferPage> pages;
+	vuint64_t dumpTime = 0;
+	{
+		BufferManager bm(4 KB, pageCount * 2);
+		auto source = bm.LoadMemorySource();
+		for (vint i = 0; i < pageCount; i++)
+		{
+			auto page = bm.AllocatePage(source);
+			pages.Add(page);
+			auto address = (vint*)bm.LockPage(source, page);
+			TEST_ASSERT(address != nullptr);
+			for (vint j = 0; j < 4 KB / sizeof(vint); j++)
+			{
+				address[j] = i + j;
+			}
+			TEST_ASSERT(bm.UnlockPage(source, page, address, PersistanceType::Changed));
+		}
+
+		auto start = GetBenchmarkTime();
+		TEST_ASSERT(bm.DumpMemorySource(source, TEMP_DIR L"memory.snapshot"));
+		dumpTime = GetBenchmarkTime() - start;
+	}
+
+	{
+		// the snapshot is cold, like after restarting the machine
+		auto fd = OpenExistingFileForFileSource(TEMP_DIR L"memory.snapshot");
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		CloseFileForFileSource(fd);
+	}
+
+	BufferManager bm(4 KB, pageCount * 2);
+	auto start = GetBenchmarkTime();
+	auto source = bm.RestoreMemorySource(TEMP_DIR L"memory.snapshot");
+	auto restoreTime = GetBenchmarkTime() - start;
+	TEST_ASSERT(source.IsValid());
+
+	vint failures = 0;
+	start = GetBenchmarkTime();
+	for (vint i = 0; i < pageCount; i++)
+	{
+		auto address = (vint*)bm.LockPage(source, pages[i], PageLatch::Shared);
+		if (!address || address[1] != i + 1) failures++;
+		if (!address || !bm.UnlockPage(source, pages[i], address, PersistanceType::NoChanging)) failures++;
+	}
+	auto touchTime = GetBenchmarkTime() - start;
+
+	PrintBenchmark(L"Dump memory source (" + u64tow(megabytes * 1000000000 / (dumpTime + 1)) + L" MB/s)", pageCount, dumpTime);
+	PrintBenchmark(L"Restore memory source", 1, restoreTime);
+	PrintBenchmark(L"First lock of restored pages (" + u64tow(megabytes * 1000000000 / (touchTime + 1)) + L" MB/s)", pageCount, touchTime);
+	TEST_ASSERT(failures == 0);
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_PageAllocation)
+{
+	// a bulk insert appending pages to a new file
+	const vint pageCount = 16384;
+	const wchar_t* modeNames[] = {L"MemoryMapped", L"PooledFrames"};
+	for (vint m = 0; m < 2; m++)
+	{
+		auto mode = m == 0 ? FileSourceMode::MemoryMapped : FileSourceMode::PooledFrames;
+		BufferManager bm(4 KB, pageCount * 2);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, mode);
+		vint failures = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i++)
+		{
+			if (!bm.AllocatePage(source).IsValid()) failures++;
+		}
+		auto allocateTime = GetBenchmarkTime() - start;
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		PrintBenchmark(WString(L"AllocatePage in a new ") + modeNames[m] + L" file", pageCount, allocateTime);
+		TEST_ASSERT(failures == 0);
+	}
+
+	{
+		// growing the file without use masks and group commits
+		auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+		volatile vuint64_t totalUsedPages = 0;
+		FileMapping fileMapping(4 KB, fd, &totalUsedPages, nullptr);
+		fileMapping.InitializeEmptySource();
+
+		vint failures = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i++)
+		{
+			auto page = fileMapping.AppendPage();
+			if (!page.IsValid() || !fileMapping.UnmapPage(page)) failures++;
+		}
+		auto appendTime = GetBenchmarkTime() - start;
+		fileMapping.UnmapAllPages();
+		fileMapping.TruncateFile();
+		CloseFileForFileSource(fd);
+
+		PrintBenchmark(L"FileMapping::AppendPage", pageCount, appendTime);
+		TEST_ASSERT(failures == 0);
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_SegmentMapping)
+{
+	// random pages of a 128MB file are mapped and unmapped, keeping a window of mapped pages
+	const vint pageCount = 32768;
+	const vint windowSize = 256;
+	const vint accessCount = 200000;
+	auto fd = CreateNewFileForFileSource(TEMP_DIR L"db.bin");
+	volatile vuint64_t totalUsedPages = 0;
+	FileMapping fileMapping(4 KB, fd, &totalUsedPages, nullptr);
+	fileMapping.InitializeEmptySource();
+	for (vint i = 3; i < pageCount; i++)
+	{
+		fileMapping.UnmapPage(fileMapping.AppendPage());
+	}
+	fileMapping.UnmapAllPages();
+
+	Array<BufferPage> window(windowSize);
+
+	BenchmarkRandom random(1);
+	vint failures = 0;
+	vuint64_t checksum = 0;
+	auto start = GetBenchmarkTime();
+	for (vint i = 0; i < accessCount; i++)
+	{
+		auto& slot = window[i % windowSize];
+		if (slot.IsValid() && !fileMapping.UnmapPage(slot)) failures++;
+		slot = BufferPage();
+
+		BufferPage page{(vuint64_t)(random.Next() % pageCount)};
+		if (fileMapping.GetMappedPageDesc(page)) continue;
+		if (auto pageDesc = fileMapping.MapPage(page))
+		{
+			checksum += *(volatile vuint64_t*)pageDesc->address;
+			slot = page;
+		}
+		else
+		{
+			failures++;
+		}
+	}
+	auto stop = GetBenchmarkTime();
+
+	BufferMetrics metrics;
+	fileMapping.GetCounters().Collect(metrics);
+	fileMapping.UnmapAllPages();
+	fileMapping.TruncateFile();
+	CloseFileForFileSource(fd);
+
+	PrintBenchmark(L"Map and unmap random pages of a MemoryMapped file", accessCount, stop - start);
+	console::Console::WriteLine(L"    <BENCHMARK> Segments mapped: " + u64tow(metrics.Get(BufferCounter::SegmentMaps)));
+	TEST_ASSERT(failures == 0);
+	TEST_ASSERT(checksum == 0);
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_UseMasks)
+{
+	{
+		// with a small cache, pages evicted for random reads include the use mask page
+		const vint pageCount = 4096;
+		const vint accessCount = 20000;
+		BufferManager bm(4 KB, 64);
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		Array<BufferPage> pages(pageCount);
+		for (vint i = 0; i < pageCount; i++)
+		{
+			pages[i] = bm.AllocatePage(source);
+		}
+
+		BufferMetrics before;
+		bm.GetMetrics(before);
+		BenchmarkRandom random(1);
+		vint failures = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < accessCount; i++)
+		{
+			auto page = pages[random.Next() % pageCount];
+			auto address = bm.LockPageShared(source, page);
+			if (!address || !bm.UnlockPage(source, page, address, PersistanceType::NoChanging)) failures++;
+		}
+		auto stop = GetBenchmarkTime();
+		BufferMetrics after;
+		bm.GetMetrics(after);
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		PrintBenchmark(L"Random read with a small cache", accessCount, stop - start);
+		console::Console::WriteLine(L"    <BENCHMARK> Page misses: " + u64tow(after.Get(BufferCounter::PageMisses) - before.Get(BufferCounter::PageMisses)));
+		TEST_ASSERT(failures == 0);
+	}
+
+	{
+		// a bitmap of 64M pages, with free pages only at the end
+		const vint itemCount = 1024 * 1024;
+		const vint scanCount = 20;
+		Array<vuint64_t> items(itemCount);
+		for (vint i = 0; i < itemCount; i++)
+		{
+			items[i] = ~(vuint64_t)0;
+		}
+		items[itemCount - 1] = 0;
+
+		const wchar_t* kernelNames[] = {L"portable", L"accelerated"};
+		for (vint k = 0; k < 2; k++)
+		{
+			if (k == 1 && !IsBitmapScanAccelerated()) break;
+			vuint64_t count = 0;
+			auto start = GetBenchmarkTime();
+			for (vint i = 0; i < scanCount; i++)
+			{
+				count += k == 0 ? CountBitsPortable(&items[0], itemCount) : CountBits(&items[0], itemCount);
+			}
+			auto countTime = GetBenchmarkTime() - start;
+			TEST_ASSERT(count == scanCount * (vuint64_t)(itemCount - 1) * 64);
+
+			vuint64_t found = 0;
+			start = GetBenchmarkTime();
+			for (vint i = 0; i < scanCount; i++)
+			{
+				found = k == 0 ? FindZeroBitsPortable(&items[0], 0, itemCount * 64, 16) : FindZeroBits(&items[0], 0, itemCount * 64, 16);
+			}
+			auto findTime = GetBenchmarkTime() - start;
+			TEST_ASSERT(found == (vuint64_t)(itemCount - 1) * 64);
+
+			PrintBenchmark(WString(L"Count used pages in 8MB of use masks, ") + kernelNames[k], scanCount, countTime);
+			PrintBenchmark(WString(L"Find 16 free pages in 8MB of use masks, ") + kernelNames[k], scanCount, findTime);
+		}
+	}
+}
+
+TEST_CASE(Utility_Buffer_Benchmark_FreeExtents)
+{
+	const vint pageCount = 16384;
+	const vint runLength = 16;
+	BufferManager bm(4 KB, pageCount * 2);
+	Array<BufferPage> pages(pageCount);
+	{
+		// allocating runs of pages for a bulk load
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		vint failures = 0;
+		auto start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i += runLength)
+		{
+			for (vint j = 0; j < runLength; j++)
+			{
+				pages[i + j] = bm.AllocatePage(source);
+				if (!pages[i + j].IsValid()) failures++;
+			}
+		}
+		auto singleTime = GetBenchmarkTime() - start;
+
+		start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i += runLength)
+		{
+			if (!bm.AllocatePages(source, runLength, true, &pages[i])) failures++;
+		}
+		auto batchTime = GetBenchmarkTime() - start;
+
+		// free every other run, the file is left with pageCount / runLength / 2 holes
+		start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i += runLength * 2)
+		{
+			if (!bm.FreePages(source, &pages[i], runLength)) failures++;
+		}
+		auto freeTime = GetBenchmarkTime() - start;
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		PrintBenchmark(L"AllocatePage for runs of 16 pages", pageCount, singleTime);
+		PrintBenchmark(L"AllocatePages for runs of 16 pages", pageCount, batchTime);
+		PrintBenchmark(L"FreePages for runs of 16 pages", pageCount / 2, freeTime);
+		TEST_ASSERT(failures == 0);
+	}
+	{
+		// holes are found again from use masks when the file is opened
+		auto start = GetBenchmarkTime();
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, FileSourceMode::PooledFrames);
+		auto loadTime = GetBenchmarkTime() - start;
+		TEST_ASSERT(source.IsValid());
+
+		vint failures = 0;
+		start = GetBenchmarkTime();
+		for (vint i = 0; i < pageCount; i += runLength * 2)
+		{
+			if (!bm.AllocatePages(source, runLength, true, &pages[i])) failures++;
+		}
+		auto reuseTime = GetBenchmarkTime() - start;
+		TEST_ASSERT(bm.UnloadSource(source));
+
+		PrintBenchmark(L"Open a file with 512 free extents", 1, loadTime);
+		PrintBenchmark(L"AllocatePages reusing free extents", pageCount / 2, reuseTime);
+		TEST_ASSERT(failures == 0);
+	}
+}
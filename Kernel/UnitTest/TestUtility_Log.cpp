@@ -378,6 +378,79 @@ TEST_CASE(Utility_Log_LongItem)
 	TEST_ASSERT(reader->NextItem() == false);
 }
 
+TEST_CASE(Utility_Log_ReadWithAccessStrategy)
+{
+	BufferManager bm(4 KB, 64);
+	vuint64_t message[8192], messageCopy[8192];
+	for (vint i = 0; i < sizeof(message)/sizeof(*message); i++)
+	{
+		message[i] = i;
+	}
+
+	BufferTransaction trans;
+	{
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true);
+		LogManager log(&bm, source, true);
+		trans = log.OpenTransaction();
+		auto writer = log.OpenLogItem(trans);
+		TEST_ASSERT(writer->GetStream().Write(message, sizeof(message)) == sizeof(message));
+		TEST_ASSERT(writer->Close());
+		TEST_ASSERT(log.CloseTransaction(trans));
+		TEST_ASSERT(bm.UnloadSource(source));
+	}
+
+	// pages of the item are not in memory after reloading the log, they are read through a ring of 4 pages
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false);
+	LogManager log(&bm, source, false);
+	auto cachedPageCount = bm.GetSourceCachedPageCount(source);
+	BufferAccessStrategy strategy(4);
+	auto reader = log.EnumInactiveLogItem(trans, &strategy);
+	TEST_ASSERT(reader->NextItem() == true);
+	TEST_ASSERT(reader->GetStream().Size() == sizeof(message));
+	TEST_ASSERT(reader->GetStream().Read(messageCopy, sizeof(messageCopy)) == sizeof(messageCopy));
+	TEST_ASSERT(memcmp(message, messageCopy, sizeof(message)) == 0);
+	TEST_ASSERT(reader->NextItem() == false);
+	TEST_ASSERT(strategy.GetRecycledPageCount() > 0);
+	TEST_ASSERT(bm.GetSourceCachedPageCount(source) <= cachedPageCount + strategy.GetRingSize());
+}
+
+TEST_CASE(Utility_Log_PageChecksums)
+{
+	BufferPoolOptions options;
+	options.pageChecksums = true;
+	BufferManager bm(4 KB, 16, BufferReplacement::Clock, options);
+	vuint64_t message[8192], messageCopy[8192];
+	for (vint i = 0; i < sizeof(message)/sizeof(*message); i++)
+	{
+		message[i] = i;
+	}
+
+	// log pages are filled up to the checksum trailer, and verified when they are read again
+	BufferTransaction trans;
+	{
+		auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", true, FileSourceMode::PooledFrames);
+		LogManager log(&bm, source, true);
+		trans = log.OpenTransaction();
+		auto writer = log.OpenLogItem(trans);
+		TEST_ASSERT(writer->GetStream().Write(message, sizeof(message)) == sizeof(message));
+		TEST_ASSERT(writer->Close());
+		TEST_ASSERT(log.CloseTransaction(trans));
+		TEST_ASSERT(bm.UnloadSource(source));
+	}
+
+	auto source = bm.LoadFileSource(TEMP_DIR L"db.bin", false, FileSourceMode::PooledFrames);
+	LogManager log(&bm, source, false);
+	auto reader = log.EnumInactiveLogItem(trans);
+	TEST_ASSERT(reader->NextItem() == true);
+	TEST_ASSERT(reader->GetStream().Read(messageCopy, sizeof(messageCopy)) == sizeof(messageCopy));
+	TEST_ASSERT(memcmp(message, messageCopy, sizeof(message)) == 0);
+
+	BufferMetrics metrics;
+	bm.GetMetrics(metrics);
+	TEST_ASSERT(metrics.Get(BufferCounter::PageMisses) > 16);
+	TEST_ASSERT(metrics.Get(BufferCounter::ChecksumFailures) == 0);
+}
+
 TEST_CASE(Utility_Log_LogTransactionItem)
 {
 	{
@@ -390,7 +463,9 @@ TEST_CASE(Utility_Log_LogTransactionItem)
 		{
 			BufferTransaction transaction{(vuint64_t)i};
 			BufferPointer address{(vuint64_t)i};
-			TEST_ASSERT(logAddressItem.WriteAddressItem(transaction, address) == true);
+			BufferTicket ticket;
+			TEST_ASSERT(logAddressItem.WriteAddressItem(transaction, address, ticket) == true);
+			TEST_ASSERT(bm.WaitForPersistance(source, ticket) == true);
 		}
 
 		for (vint i = 0; i < 1024; i++)